@@ -145,18 +145,37 @@ extern "C" {
   * getGameHighScores
 */
 
+struct telebot_linear_allocator_chunk;
+struct telebot_linear_allocator_block;
+
+/**
+ * @brief Arena made of linked chunks, new chunks are added when it runs full.
+ */
 typedef struct telebot_linear_allocator {
-    void* data_ptr;
-    size_t current_offset;
-    size_t capacity;
+    struct telebot_linear_allocator_chunk *head; /**< First chunk */
+    struct telebot_linear_allocator_chunk *current; /**< Chunk in use */
+    size_t chunk_size; /**< Capacity of new chunks */
+    size_t used; /**< Bytes handed out, alignment padding included */
+    size_t high_water; /**< Largest number of bytes in use at once */
+    struct telebot_linear_allocator_block *blocks; /**< Adopted blocks */
 } telebot_linear_allocator_t;
 
+/**
+ * @brief Position in an arena, see telebot_linear_allocator_mark().
+ */
+typedef struct telebot_linear_allocator_mark {
+    struct telebot_linear_allocator_chunk *chunk;
+    size_t offset;
+    size_t used;
+    struct telebot_linear_allocator_block *blocks;
+} telebot_linear_allocator_mark_t;
+
 /**
  * @brief This object represents a Telegram user or bot.
  */
 typedef struct telebot_user {
     /** Unique identifier for this user or bot */
-    int id;
+    long long id;
 
     /** True, if this user is a bot */
     bool is_bot;
@@ -179,23 +198,22 @@ typedef struct telebot_user {
  */
 typedef struct telebot_chat {
     /** Unique identifier for this chat, not exceeding 1e13 by absolute value */
-    // NOTE(erick): Should we use an int64 here?
-    int id;
+    long long id;
 
     /** Type of chat, can be either "private", or "group", or "channel" */
-    char type[TELEBOT_CHAT_TYPE_SIZE];
+    char *type;
 
     /** Optional. Title, for channels and group chats */
-    char title[TELEBOT_CHAT_TITLE_SIZE];
+    char *title;
 
     /** Optional. Username, for private chats and channels if available */
-    char username[TELEBOT_USER_NAME_SIZE];
+    char *username;
 
     /** Optional. First name of the other party in a private chat */
-    char first_name[TELEBOT_FIRST_NAME_SIZE];
+    char *first_name;
 
     /** Optional. Last name of the other party in a private chat */
-    char last_name[TELEBOT_LAST_NAME_SIZE];
+    char *last_name;
 } telebot_chat_t;
 
 /**
@@ -204,7 +222,7 @@ typedef struct telebot_chat {
  */
 typedef struct telebot_photo {
     /** Unique identifier for this file */
-    char file_id[TELEBOT_FILE_ID_SIZE];
+    char *file_id;
 
     /** Photo width */
     int width;
@@ -222,19 +240,19 @@ typedef struct telebot_photo {
  */
 typedef struct telebot_audio {
     /** Unique identifier for this file */
-    char file_id[TELEBOT_FILE_ID_SIZE];
+    char *file_id;
 
     /** Duration of the audio in seconds as defined by sender */
     int duration;
 
     /** Optional. Performer of the audio as defined by sender or by audio tags */
-    char performer[TELEBOT_AUDIO_PERFORMER_SIZE];
+    char *performer;
 
     /** Optional. Title of the audio as defined by sender or by audio tags */
-    char title[TELEBOT_AUDIO_TITLE_SIZE];
+    char *title;
 
     /** Optional. MIME type of the file as defined by sender */
-    char mime_type[TELEBOT_AUDIO_MIME_TYPE_SIZE];
+    char *mime_type;
 
     /** Optional. File size */
     int file_size;
@@ -246,16 +264,16 @@ typedef struct telebot_audio {
  */
 typedef struct telebot_document {
     /** Unique file identifier. */
-    char file_id[TELEBOT_FILE_ID_SIZE];
+    char *file_id;
 
     /** Optional. Document thumbnail as defined by sender. */
-    telebot_photo_t thumb;
+    telebot_photo_t *thumb;
 
     /** Optional. Original filename as defined by sender. */
-    char file_name[TELEBOT_FILE_NAME_SIZE];
+    char *file_name;
 
     /** Optional. MIME type of the file as defined by sender. */
-    char mime_type[TELEBOT_DOCUMENT_MIME_TYPE_SIZE];
+    char *mime_type;
 
     /** Optional. File size. */
     int file_size;
@@ -267,7 +285,7 @@ typedef struct telebot_document {
 // TODO(erick): This type needs to be revised.
 typedef struct telebot_sticker {
     /** Unique identifier for this file */
-    char file_id[TELEBOT_FILE_ID_SIZE];
+    char *file_id;
 
     /** Sticker width */
     int width;
@@ -276,7 +294,7 @@ typedef struct telebot_sticker {
     int height;
 
     /** Optional. Sticker thumbnail in .webp or .jpg format */
-    telebot_photo_t thumb;
+    telebot_photo_t *thumb;
 
     /** Optional. File size */
     int file_size;
@@ -287,7 +305,7 @@ typedef struct telebot_sticker {
  */
 typedef struct telebot_video {
     /** Unique identifier for this file */
-    char file_id[TELEBOT_FILE_ID_SIZE];
+    char *file_id;
 
     /** Video width as defined by sender */
     int width;
@@ -299,10 +317,10 @@ typedef struct telebot_video {
     int duration;
 
     /** Optional. Video thumbnail */
-    telebot_photo_t thumb;
+    telebot_photo_t *thumb;
 
     /** Optional. Mime type of a file as defined by sender */
-    char mime_type[TELEBOT_VIDEO_MIME_TYPE_SIZE];
+    char *mime_type;
 
     /** Optional. File size */
     int file_size;
@@ -313,13 +331,13 @@ typedef struct telebot_video {
  */
 typedef struct telebot_voice {
     /** Unique identifier for this file */
-    char file_id[TELEBOT_FILE_ID_SIZE];
+    char *file_id;
 
     /** Duration of the audio in seconds as defined by sender */
     int duration;
 
     /** Optional. MIME type of the file as defined by sender */
-    char mime_type[TELEBOT_VOICE_MIME_TYPE_SIZE];
+    char *mime_type;
 
     /** Optional. File size */
     int file_size;
@@ -330,16 +348,16 @@ typedef struct telebot_voice {
  */
 typedef struct telebot_contact {
     /** Contact's phone number */
-    char phone_number[TELEBOT_PHONE_NUMBER_SIZE];
+    char *phone_number;
 
     /** Contact's first name */
-    char first_name[TELEBOT_FIRST_NAME_SIZE];
+    char *first_name;
 
     /** Optional. Contact's last name */
-    char last_name[TELEBOT_LAST_NAME_SIZE];
+    char *last_name;
 
     /** Optional. Contact's user identifier in Telegram */
-    int user_id;
+    long long user_id;
 } telebot_contact_t;
 
 /**
@@ -377,13 +395,16 @@ typedef struct telebot_file {
 
 /**
  * @brief This object represents a message.
+ *
+ * Only fields present in the update take memory: strings, optional objects
+ * and photo arrays live in the arena of the batch and absent ones are NULL.
  */
 typedef struct telebot_message {
     /** Unique message identifier */
     int message_id;
 
-    /** Optional. Sender, can be empty for messages sent to channels */
-    telebot_user_t from;
+    /** Optional. Sender, NULL for messages sent to channels */
+    telebot_user_t *from;
 
     /** Date the message was sent in Unix time */
     long date;
@@ -392,7 +413,7 @@ typedef struct telebot_message {
     telebot_chat_t chat;
 
     /** Optional. For forwarded messages, sender of the original message */
-    telebot_user_t forward_from;
+    telebot_user_t *forward_from;
 
     /**
      * Optional. For forwarded messages, date the original message was sent
@@ -408,53 +429,58 @@ typedef struct telebot_message {
     struct telebot_message  *reply_to_message;
 
     /** Optional. For text messages, the actual UTF-8 text of the message */
-    // TODO(erick): A message length should not be hardcoded.
-    char text[TELEBOT_MESSAGE_TEXT_SIZE];
+    char *text;
 
     /** Optional. Message is an audio file, information about the file */
-    telebot_audio_t audio;
+    telebot_audio_t *audio;
 
     /** Optional. Message is a general file, information about the file */
-    telebot_document_t document;
+    telebot_document_t *document;
 
     /** Optional. Message is a photo, available sizes of the photo */
-    telebot_photo_t photo[TELEBOT_MESSAGE_PHOTO_SIZE];
+    telebot_photo_t *photo;
+
+    /** Number of sizes in photo */
+    int photo_count;
 
     /** Optional. Message is a sticker, information about the sticker */
-    telebot_sticker_t sticker;
+    telebot_sticker_t *sticker;
 
     /** Optional. Message is a video, information about the video */
-    telebot_video_t video;
+    telebot_video_t *video;
 
     /** Optional. Message is a voice message, information about the file */
-    telebot_voice_t voice;
+    telebot_voice_t *voice;
 
     /** Optional. Caption for the photo or video */
-    char caption[TELEBOT_MESSAGE_CAPTION_SIZE];
+    char *caption;
 
     /** Optional. Message is a shared contact, information about the contact */
-    telebot_contact_t contact;
+    telebot_contact_t *contact;
 
     /** Optional. Message is a shared location, information about the location */
-    telebot_location_t location;
+    telebot_location_t *location;
 
     /**
      * Optional. A new member was added to the group, information about them
      * (this member may be bot itself)
      */
-    telebot_user_t new_chat_participant;
+    telebot_user_t *new_chat_participant;
 
     /**
      * Optional. A member was removed from the group, information about them
      * (this member may be bot itself)
      */
-    telebot_user_t left_chat_participant;
+    telebot_user_t *left_chat_participant;
 
     /** Optional. A chat title was changed to this value */
-    char new_chat_title[TELEBOT_CHAT_TITLE_SIZE];
+    char *new_chat_title;
 
     /** Optional. A chat photo was change to this value */
-    telebot_photo_t new_chat_photo[TELEBOT_MESSAGE_NEW_CHAT_PHOTO_SIZE];
+    telebot_photo_t *new_chat_photo;
+
+    /** Number of sizes in new_chat_photo */
+    int new_chat_photo_count;
 
     /** Optional. Informs that the chat photo was deleted */
     bool delete_chat_photo;
@@ -472,20 +498,20 @@ typedef struct telebot_message {
      * Optional. The group has been migrated to a supergroup with the specified
      * identifier, not exceeding 1e13 by absolute value
      */
-    int migrate_to_chat_id;
+    long long migrate_to_chat_id;
 
     /**
      * Optional. The supergroup has been migrated from a group with the
      * specified identifier, not exceeding 1e13 by absolute value
      */
-    int migrate_from_chat_id;
+    long long migrate_from_chat_id;
 
 } telebot_message_t;
 
 typedef struct telebot_callback_query {
     char *id;
     telebot_user_t from;
-    telebot_message_t message;
+    telebot_message_t *message;
     char *inline_message_id;
     char *chat_instance;
     char *data;
@@ -552,31 +578,163 @@ typedef struct {
     json_object* current_row;
 } telebot_keyboard;
 
+/**
+ * @brief Counters describing how updates are fetched by the polling thread.
+ */
+typedef struct telebot_update_stats {
+    int limit; /**< Batch limit of the next getUpdates call */
+    int last_count; /**< Updates received by the last call */
+    int backlog; /**< Updates drained since the server queue was last empty */
+    int max_backlog; /**< Highest backlog observed */
+    unsigned long batches; /**< getUpdates calls that succeeded */
+    unsigned long failed_batches; /**< getUpdates calls that failed */
+    unsigned long full_batches; /**< Calls that returned a full batch */
+    unsigned long updates; /**< Updates received in total */
+    size_t arena_used; /**< Arena bytes the last batch needed */
+    size_t arena_high_water; /**< Most arena bytes a batch needed */
+} telebot_update_stats_t;
+
+/**
+ * @brief Counters describing how updates are handed to the update callback.
+ */
+typedef struct telebot_dispatch_stats {
+    int workers; /**< Worker threads, 0 if updates are handled inline */
+    int queue_depth; /**< Updates dispatched and not handled yet */
+    int max_queue_depth; /**< Highest depth observed on a worker queue */
+    unsigned long dispatched; /**< Updates dispatched */
+    unsigned long handled; /**< Updates the callback returned from */
+    unsigned long handler_time_total_us; /**< Time spent in the callback */
+    unsigned long handler_time_max_us; /**< Slowest callback invocation */
+    unsigned long queue_wait_max_us; /**< Longest wait in a worker queue */
+} telebot_dispatch_stats_t;
+
+/**
+ * @brief Counters describing how sent messages are spaced out to stay within
+ * the Telegram rate limits.
+ */
+typedef struct telebot_send_stats {
+    int waiting; /**< Messages waiting for their slot */
+    int chats; /**< Chats with a pending rate limit state */
+    unsigned long queued; /**< Messages given a slot */
+    unsigned long sent; /**< Messages sent once their slot came */
+    unsigned long dropped; /**< Messages dropped, their wait was too long */
+    unsigned long rate_limited; /**< Sends Telegram answered with 429 */
+    unsigned long queue_wait_total_us; /**< Time spent waiting for slots */
+    unsigned long queue_wait_max_us; /**< Longest wait for a slot */
+} telebot_send_stats_t;
+
+/**
+ * @brief This object represents a bot. It owns the connection to Telegram, the
+ * polling thread and the memory of received updates, so any number of bots
+ * can run in one process.
+ */
+typedef struct telebot_handler telebot_h;
+
 /**
  * @brief This function type defines callback for receiving updates.
+ * @param bot The bot that received the update.
+ * @param update The update, only valid until the callback returns.
+ * @param user_data The pointer given to telebot_start().
+ */
+typedef void (*telebot_update_cb_f)(telebot_h *bot,
+        const telebot_update_t *update, void *user_data);
+
+/**
+ * @brief This function type defines callback for the outcome of a message
+ * sent with telebot_send_message_async(). It is called from an internal thread
+ * of the bot, so it should return quickly and MUST NOT destroy the bot.
+ * @param bot The bot that sent the message.
+ * @param ret TELEBOT_ERROR_NONE if the message was sent,
+ * TELEBOT_ERROR_RATE_LIMITED if it was dropped or refused with 429, another
+ * error otherwise.
+ * @param user_data The pointer given to telebot_send_message_async().
  */
-typedef void (*telebot_update_cb_f)(const telebot_update_t *update);
+typedef void (*telebot_send_cb_f)(telebot_h *bot, telebot_error_e ret,
+        void *user_data);
 
+/**
+ * @brief Allocate zeroed memory from an arena, aligned for any object type.
+ */
 void *telebot_linear_allocator_alloc(telebot_linear_allocator_t *allocator, size_t size);
 
+/**
+ * @brief Allocate zeroed memory from an arena with the given alignment, which
+ * must be a power of two not larger than a page (1 for strings).
+ */
+void *telebot_linear_allocator_alloc_aligned(telebot_linear_allocator_t *allocator,
+        size_t size, size_t alignment);
+
+/**
+ * @brief Get the current position of an arena.
+ */
+telebot_linear_allocator_mark_t telebot_linear_allocator_mark(
+        telebot_linear_allocator_t *allocator);
+
+/**
+ * @brief Release everything allocated since mark was taken. The memory is
+ * cleared, so it is handed out zeroed again.
+ */
+void telebot_linear_allocator_rewind(telebot_linear_allocator_t *allocator,
+        telebot_linear_allocator_mark_t mark);
+
+/**
+ * @brief Tie a malloc'd block to the arena, it is freed along with what is
+ * allocated from now on. Used to keep a response alive while parsed updates
+ * point into it.
+ * @return on Success, TELEBOT_ERROR_NONE is returned, on failure the block is
+ * not adopted and still belongs to the caller.
+ */
+telebot_error_e telebot_linear_allocator_adopt(
+        telebot_linear_allocator_t *allocator, void *block);
+
 /**
  * @brief Initial function to use telebot APIs.
  *
- * This function must be used first to call, and it creates handler. This call
+ * This function must be used first to call, and it creates a bot. This call
  * MUST have corresponding call to telebot_destroy() when operation is complete.
+ * @param bot Pointer to put the new bot.
+ * @param token Telegram Bot token to use.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_create(telebot_h **bot, char *token);
+
+/**
+ * @brief Same as telebot_create(), but the new bot uses the connection pool
+ * and the transport thread of share instead of opening its own. They are
+ * released along with the last bot using them.
+ * @param bot Pointer to put the new bot.
  * @param token Telegram Bot token to use.
+ * @param share A bot created with telebot_create().
  * @return On success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_create(char *token);
+telebot_error_e telebot_create_shared(telebot_h **bot, char *token,
+        telebot_h *share);
+
+struct telebot_core_options;
+
+/**
+ * @brief Same as telebot_create(), with transport options for the core
+ * handler of the bot, e.g. the base URL of the Bot API server to talk to.
+ * @param bot Pointer to put the new bot.
+ * @param token Telegram Bot token to use.
+ * @param options Transport options from telebot-core-api.h, or NULL for the
+ * defaults.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_create_with_options(telebot_h **bot, char *token,
+        const struct telebot_core_options *options);
 
 /**
  * @brief Final function to use telebo APIs
  *
- * This function must be the last function to call for a telebot use.
- * It is the opposite of the telebot_create() function.
+ * This function must be the last function to call for a bot. It is the
+ * opposite of the telebot_create() function. A bot still receiving updates
+ * is stopped first, see telebot_stop(). It MUST NOT be called from an update
+ * callback.
+ * @param bot The bot created with telebot_create().
  * @return On success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_destroy();
+telebot_error_e telebot_destroy(telebot_h *bot);
 
 /**
  * @brief This function is used start to receiving Telegram bot updates.
@@ -584,41 +742,317 @@ telebot_error_e telebot_destroy();
  *
  * This call MUST have corresponding call to telebot_stop() when receiving
  * update is needed to terminate.
+ * @param bot The bot created with telebot_create().
  * @param update_cb Callback function to receive latest telegram update.
+ * @param user_data Passed to every call of update_cb.
  * @return On success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_start(telebot_update_cb_f update_cb, bool should_deatach_thread, pthread_t* thread_id);
+telebot_error_e telebot_start(telebot_h *bot, telebot_update_cb_f update_cb,
+        void *user_data, bool should_deatach_thread, pthread_t* thread_id);
 
 
 /**
  * @brief This function stops receiving updates by stopping internal thread.
  *
- * It is the opposite of the telebot_start() function.
+ * It is the opposite of the telebot_start() and telebot_start_webhook()
+ * functions. A long poll in flight is abandoned within a second, a batch
+ * already received is still handed to the update callback. It returns once
+ * the polling thread no longer uses the bot, so the bot can be destroyed
+ * right away; the thread itself may still be joined. Called from an update
+ * callback, it only requests the stop and returns at once; a webhook stopped
+ * that way is released by telebot_destroy(), or by calling telebot_stop()
+ * again from outside the callbacks before starting anew.
+ * @param bot The bot created with telebot_create().
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_stop(telebot_h *bot);
+
+/**
+ * @brief This function starts receiving updates through an embedded webhook
+ * server instead of polling for them.
+ *
+ * The server speaks plain HTTP/1.1 with keep-alive on the given port of every
+ * interface, from a single epoll thread. Telegram only posts to HTTPS urls,
+ * so it is meant to sit behind a TLS terminating proxy; register the public
+ * url with telebot_core_set_web_hook(). Every update is handed to update_cb
+ * through the same dispatcher as polled updates, see telebot_set_workers(),
+ * and the POST carrying it is only answered once it was handled, so Telegram
+ * delivers it again if the process dies meanwhile.
+ *
+ * This call MUST have a corresponding call to telebot_stop(), and cannot be
+ * combined with telebot_start().
+ * @param bot The bot created with telebot_create().
+ * @param port Port to listen on, 0 to pick a free one.
+ * @param path Target the updates are posted to, like "/bot-secret", other
+ * targets are answered with 404. NULL accepts any target.
+ * @param update_cb Callback function to receive the updates.
+ * @param user_data Passed to every call of update_cb.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_start_webhook(telebot_h *bot, int port,
+        const char *path, telebot_update_cb_f update_cb, void *user_data);
+
+/**
+ * @brief This function gets the port the webhook server of a bot listens on,
+ * useful when telebot_start_webhook() picked it.
+ * @param bot The bot created with telebot_create().
+ * @param port Pointer to put the port.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_get_webhook_port(telebot_h *bot, int *port);
+
+/**
+ * @brief This function sets how the internal thread started with
+ * telebot_start() polls for updates.
+ *
+ * With a positive timeout, the thread uses long polling: each getUpdates call
+ * is held by the server until an update arrives or the timeout expires, and
+ * the next call is issued right away. Updates are delivered as soon as they
+ * are available and an idle bot sends one request per timeout period. With 0,
+ * the thread falls back to short polling once per second, re-polling at once
+ * only when a full batch was received. Defaults to 30 seconds. The timeout
+ * does not delay telebot_stop(), which abandons a pending long poll.
+ * @param bot The bot created with telebot_create().
+ * @param timeout Long polling timeout in seconds, 0 for short polling.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_set_polling_timeout(telebot_h *bot, int timeout);
+
+/**
+ * @brief This function sets how many updates are requested per getUpdates
+ * call.
+ *
+ * In adaptive mode the limit starts at min_limit, doubles every time a batch
+ * comes back full and halves when a batch is less than a quarter full, staying
+ * within [min_limit, max_limit]. Otherwise max_limit is always used. Defaults
+ * to adaptive between 10 and 100.
+ * @param bot The bot created with telebot_create().
+ * @param min_limit Smallest limit, at least 1.
+ * @param max_limit Largest limit, at most 100.
+ * @param adaptive Whether to adapt the limit to the incoming traffic.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_set_update_limit(telebot_h *bot, int min_limit,
+        int max_limit, bool adaptive);
+
+/**
+ * @brief This function gets batch statistics of the polling thread.
+ *
+ * The server does not report how many updates are queued, so the backlog is
+ * estimated from consecutive full batches: it is the number of updates
+ * received since a batch last came back less than full.
+ * @param bot The bot created with telebot_create().
+ * @param stats Pointer to the statistics to fill.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_get_update_stats(telebot_h *bot,
+        telebot_update_stats_t *stats);
+
+/**
+ * @brief This function sets how many worker threads run the update callback.
+ *
+ * Updates are sharded by chat: all updates of a chat go to the same worker
+ * and are handled in order, while different chats are handled in parallel.
+ * The callback must then be thread-safe; the telebot send functions are. With
+ * 0 workers, the default, the callback runs on the polling thread. It MUST be
+ * called before telebot_start().
+ * @param bot The bot created with telebot_create().
+ * @param workers Number of worker threads, at most 64.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_set_workers(telebot_h *bot, int workers);
+
+/**
+ * @brief This function gets queue depth and handler latency statistics of the
+ * update dispatch.
+ * @param bot The bot created with telebot_create().
+ * @param stats Pointer to the statistics to fill.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_get_dispatch_stats(telebot_h *bot,
+        telebot_dispatch_stats_t *stats);
+
+/**
+ * @brief This function sets the rate limits messages of the bot are held to.
+ *
+ * Telegram allows a bot about 30 messages per second overall, one per second
+ * to a private chat and 20 per minute to a group. Beyond that it answers with
+ * 429 errors. The functions sending a message into a chat (send, forward,
+ * photo, audio, document, sticker, video, voice and location) therefore take
+ * the next free slot of a global limit and of a limit of their chat, and
+ * block the calling thread until it comes, which for a busy chat may be many
+ * seconds. From update callbacks this stalls the other chats of the worker,
+ * telebot_send_message_async() queues the message instead and returns right
+ * away. Slots are handed out in call order and evenly spaced,
+ * so a broadcast goes out at the highest rate allowed, and messages to one
+ * chat keep their order. Slots run 5% under the limits, so that network
+ * jitter does not push requests over them. Negative chat ids and \@usernames are held to the
+ * group limit. Defaults to 30, 60 and 20 with no maximum wait.
+ * @param bot The bot created with telebot_create().
+ * @param global_rate Messages per second over all chats, 0 for no limit.
+ * @param chat_rate Messages per minute to one private chat, 0 for no limit.
+ * @param group_rate Messages per minute to one group or channel, 0 for no
+ * limit.
+ * @param max_wait Seconds a message may wait for its slot. Messages that would
+ * wait longer are dropped and TELEBOT_ERROR_RATE_LIMITED is returned for them.
+ * With 0 messages wait as long as it takes.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_set_rate_limit(telebot_h *bot, int global_rate,
+        int chat_rate, int group_rate, int max_wait);
+
+/**
+ * @brief This function gets queue wait, drop and 429 statistics of the
+ * messages sent by the bot, see telebot_set_rate_limit().
+ * @param bot The bot created with telebot_create().
+ * @param stats Pointer to the statistics to fill.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_get_send_stats(telebot_h *bot,
+        telebot_send_stats_t *stats);
+
+struct telebot_core_stats;
+
+/**
+ * @brief This function copies the per-method request counters and latency
+ * histograms of the bot, see telebot_core_stats_snapshot(). It takes no lock
+ * and is cheap enough to be called every second.
+ * @param bot The bot created with telebot_create().
+ * @param stats Statistics from telebot-core-api.h to fill, best allocated
+ * once as they are large.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_stats_snapshot(telebot_h *bot,
+        struct telebot_core_stats *stats);
+
+/**
+ * @brief This function starts serving the statistics of the bot as an
+ * OpenMetrics text page, for Prometheus to scrape, on port of the loopback
+ * interface. It runs on its own thread, and every buffer it needs is
+ * allocated here so that scrapes allocate nothing. The page has poll cycles,
+ * updates and the update arena from the polling thread, the dispatch and send
+ * statistics, and per Bot API method request, failure and retry counters and
+ * latency histograms. It is stopped by telebot_stop_metrics() or along with
+ * the bot.
+ * @param bot The bot created with telebot_create().
+ * @param port Port to listen on, 0 picks a free one.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_start_metrics(telebot_h *bot, int port);
+
+/**
+ * @brief This function gets the port the metrics page of a bot is served on,
+ * useful when telebot_start_metrics() picked it.
+ * @param bot The bot created with telebot_create().
+ * @param port Pointer to put the port.
+ * @return On success, TELEBOT_ERROR_NONE is returned, otherwise
+ * TELEBOT_ERROR_NOT_SUPPORTED if the page is not served.
+ */
+telebot_error_e telebot_get_metrics_port(telebot_h *bot, int *port);
+
+/**
+ * @brief This function stops serving the metrics page of a bot.
+ * @param bot The bot created with telebot_create().
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_stop_metrics(telebot_h *bot);
+
+/**
+ * @brief This object polls updates for many bots from a single event loop.
+ *
+ * The long polls of all its bots are requests of one curl multi loop, over
+ * one shared connection pool, instead of a polling thread and a prefetch
+ * thread per bot. Received batches are handed to a few worker threads that
+ * run the update callbacks, the batches of one bot in order.
+ */
+typedef struct telebot_mux telebot_mux_t;
+
+/**
+ * @brief This function creates a multiplexer. This call MUST have a
+ * corresponding call to telebot_mux_destroy().
+ * @param mux Pointer to put the new multiplexer.
+ * @param workers Number of threads running update callbacks, 1 to 64.
+ * @param options Transport options from telebot-core-api.h, shared by all bots
+ * of the multiplexer, or NULL for the defaults. The share member is ignored.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_mux_create(telebot_mux_t **mux, int workers,
+        const struct telebot_core_options *options);
+
+/**
+ * @brief This function creates a bot polled by a multiplexer. Its updates are
+ * received as soon as the multiplexer is started, or right away if it already
+ * is.
+ *
+ * The bot is owned by the multiplexer: it MUST NOT be passed to
+ * telebot_start(), telebot_stop() or telebot_destroy(), and is destroyed along
+ * with it. Other functions, like the polling timeout and update limit
+ * settings, apply as for any bot. Update callbacks may run on any worker of
+ * the multiplexer.
+ * @param mux The multiplexer created with telebot_mux_create().
+ * @param token Telegram Bot token to use.
+ * @param update_cb Callback function to receive the updates of the bot.
+ * @param user_data Passed to every call of update_cb.
+ * @param bot Pointer to put the new bot.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_mux_add(telebot_mux_t *mux, char *token,
+        telebot_update_cb_f update_cb, void *user_data, telebot_h **bot);
+
+/**
+ * @brief This function starts polling updates for every bot of a multiplexer.
+ * @param mux The multiplexer created with telebot_mux_create().
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_mux_start(telebot_mux_t *mux);
+
+/**
+ * @brief This function stops a multiplexer and destroys it with all its bots.
+ *
+ * Pending polls are aborted. Batches received but not handled yet are not
+ * confirmed to Telegram, so they are delivered again on the next start.
+ * @param mux The multiplexer created with telebot_mux_create().
  * @return On success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_stop();
+telebot_error_e telebot_mux_destroy(telebot_mux_t *mux);
 
 /**
  * @brief This function is used to get information about telegram bot itself.
  *
- * @param me Pointer to the telegram user object address. This pointer MUST be
- * freed after use.
+ * @param bot The bot created with telebot_create().
+ * @param me Pointer to the telegram user object. Its strings are owned by the
+ * caller and MUST be freed with telebot_put_me() after use.
  * @return On success, TELEBOT_ERROR_NONE is returned, and user object is
  * stored in input parameter.
  */
-telebot_error_e telebot_get_me(telebot_user_t *me);
+telebot_error_e telebot_get_me(telebot_h *bot, telebot_user_t *me);
+
+/**
+ * @brief This function frees the strings of a user object returned by
+ * telebot_get_me().
+ * @param me The user object filled by telebot_get_me().
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_put_me(telebot_user_t *me);
 
 /**
  * @brief This function is used to get latest updates. It is alternative for
  * telebot_start() function, if you want to poll updates.
- * @param updates Pointer to the updates object address. It MUST be freed.
+ * @param bot The bot created with telebot_create().
+ * @param updates Pointer to the updates object address. The updates belong to
+ * the bot and stay valid until the next call or telebot_destroy(), they MUST
+ * NOT be freed.
  * @param count Pointer to put number of updates received.
- * @return on Success, TELEBOT_ERROR_NONE is returned.
+ * @return on Success, TELEBOT_ERROR_NONE is returned, otherwise
+ * TELEBOT_ERROR_NOT_SUPPORTED while the bot is receiving updates through
+ * telebot_start(), a webhook or a mux.
  */
-telebot_error_e telebot_get_updates(telebot_update_t **updates, int *count);
+telebot_error_e telebot_get_updates(telebot_h *bot, telebot_update_t **updates,
+        int *count);
 
 /**
  * @brief This function is used to get user profile pictures object
+ * @param bot The bot created with telebot_create().
  * @param user_id Unique identifier of the target user.
  * @param offset Sequential number of the first photo to be returned.
  * By default, up to 10 photos are returned.
@@ -627,19 +1061,21 @@ telebot_error_e telebot_get_updates(telebot_update_t **updates, int *count);
  * @param count Pointer to the number of photos object.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_get_user_profile_photos(int user_id, int offset,
-        telebot_photo_t **photos, int *count);
+telebot_error_e telebot_get_user_profile_photos(telebot_h *bot,
+        long long user_id, int offset, telebot_photo_t **photos, int *count);
 
 /**
  * @brief This function is used to download file.
+ * @param bot The bot created with telebot_create().
  * @param file_id File identifier to get info about.
  * @param path A path where the file is downloaded
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_download_file(char *file_id, char *path);
+telebot_error_e telebot_download_file(telebot_h *bot, char *file_id, char *path);
 
 /**
  * @brief This function is used to send text messages.
+ * @param bot The bot created with telebot_create().
  * @param chat_id Unique identifier for the target chat or username of the
  * target channel (in the format \@channelusername).
  * @param text Text of the message to be sent.
@@ -651,22 +1087,51 @@ telebot_error_e telebot_download_file(char *file_id, char *path);
  * reply keyboard, instructions to hide keyboard or to force a reply from the user.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_send_message(int chat_id, char *text, char *parse_mode,
-        bool disable_web_page_preview, int reply_to_message_id, const char *reply_markup);
+telebot_error_e telebot_send_message(telebot_h *bot, long long chat_id,
+        char *text,
+        char *parse_mode, bool disable_web_page_preview,
+        int reply_to_message_id, const char *reply_markup);
+
+/**
+ * @brief This function queues a text message and returns without waiting for
+ * its rate limit slot, see telebot_set_rate_limit(). The message is sent over
+ * the asynchronous transport once its slot comes. Messages still queued when
+ * the bot is destroyed are given up with TELEBOT_ERROR_OPERATION_FAILED.
+ * @param bot The bot created with telebot_create().
+ * @param chat_id Unique identifier for the target chat.
+ * @param text Text of the message to be sent. Like every string argument, it
+ * is copied.
+ * @param parse_mode Send Markdown, if you want Telegram apps to show bold,
+ * italic and inline URLs in your bot's message.
+ * @param disable_web_page_preview Disables link previews for links in this message.
+ * @param reply_to_message_id If the message is a reply, ID of the original message.
+ * @param reply_markup Additional interface options, see telebot_send_message().
+ * @param cb Called with the outcome of the message, or NULL.
+ * @param user_data Pointer passed to cb.
+ * @return on Success, TELEBOT_ERROR_NONE is returned and cb is called exactly
+ * once later on. Otherwise the message was not queued and cb is never called.
+ */
+telebot_error_e telebot_send_message_async(telebot_h *bot, long long chat_id,
+        const char *text, const char *parse_mode,
+        bool disable_web_page_preview, int reply_to_message_id,
+        const char *reply_markup, telebot_send_cb_f cb, void *user_data);
 
 /**
  * @brief This function is used to delete messages.
+ * @param bot The bot created with telebot_create().
  * @param chat_id Unique identifier for the target chat or username of the
  * target channel (in the format \@channelusername).
  * @param message_id Identifier of the message to delete
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_delete_message(int chat_id, int message_id);
+telebot_error_e telebot_delete_message(telebot_h *bot, long long chat_id,
+        int message_id);
 
 /**
  * @brief Use this method to send answers to callback queries sent from
  * inline keyboards. The answer will be displayed to the user as a notification
  * at the top of the chat screen or as an alert.
+ * @param bot The bot created with telebot_create().
  * @param callback_query_id Unique identifier for the query to be answered.
  * @param text Optional (i.e. can be NULL). Text of the notification. If not
  * specified, nothing will be shown to the user, 0-200 characters.
@@ -681,11 +1146,12 @@ telebot_error_e telebot_delete_message(int chat_id, int message_id);
  * Telegram apps will support caching starting in version 3.14.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_answer_callback_query(const char *callback_query_id, char *text,
-                                              bool show_alert, char *url,
-                                              int cache_time);
+telebot_error_e telebot_answer_callback_query(telebot_h *bot,
+        const char *callback_query_id, char *text, bool show_alert, char *url,
+        int cache_time);
 /**
  * @brief This function is used to forward messages of any kind.
+ * @param bot The bot created with telebot_create().
  * @param chat_id Unique identifier for the target chat or username of the
  * target channel (in the format \@channelusername).
  * @param from_chat_id Unique identifier for the chat where the original
@@ -693,11 +1159,12 @@ telebot_error_e telebot_answer_callback_query(const char *callback_query_id, cha
  * @param message_id Unique message identifier.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_forward_message(char *chat_id, char *from_chat_id,
-        int message_id);
+telebot_error_e telebot_forward_message(telebot_h *bot, char *chat_id,
+        char *from_chat_id, int message_id);
 
 /**
  * @brief This functionis used to send photos.
+ * @param bot The bot created with telebot_create().
  * @param chat_id Unique identifier for the target chat or username of the
  * target channel (in the format \@channelusername).
  * @param photo Photo to send. It is either file_id as String to resend a photo
@@ -710,8 +1177,9 @@ telebot_error_e telebot_forward_message(char *chat_id, char *from_chat_id,
  * the user.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_send_photo(char *chat_id, char *photo, bool is_file,
-        char *caption, int reply_to_message_id, char *reply_markup);
+telebot_error_e telebot_send_photo(telebot_h *bot, char *chat_id, char *photo,
+        bool is_file, char *caption, int reply_to_message_id,
+        char *reply_markup);
 /**
  * @brief This function is used to to send audio files. if you want Telegram
  * clients to display them in the music player. Your audio must be in the .mp3
@@ -720,6 +1188,7 @@ telebot_error_e telebot_send_photo(char *chat_id, char *photo, bool is_file,
  * mime-type of the file to be sent is not audio/mpeg, the file will be sent as
  * a playable voice message. For this to work, the audio must be in an .ogg
  * file encoded with OPUS.
+ * @param bot The bot created with telebot_create().
  * @param chat_id Unique identifier for the target chat or username of the
  * target channel (in the format \@channelusername).
  * @param audio Audio file to send. It is either a file_id as String to resend an
@@ -733,12 +1202,13 @@ telebot_error_e telebot_send_photo(char *chat_id, char *photo, bool is_file,
  * keyboard, instructions to hide keyboard or to force a reply from the user.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_send_audio(char *chat_id, char *audio, bool is_file,
-        int duration, char *performer, char *title, int reply_to_message_id,
-        char *reply_markup);
+telebot_error_e telebot_send_audio(telebot_h *bot, char *chat_id, char *audio,
+        bool is_file, int duration, char *performer, char *title,
+        int reply_to_message_id, char *reply_markup);
 
 /**
  * @brief This function is used to send general files.
+ * @param bot The bot created with telebot_create().
  * @param chat_id Unique identifier for the target chat or username of the
  * target channel (in the format \@channelusername).
  * @param document Document file to send. It is either a file_id as String to
@@ -749,11 +1219,13 @@ telebot_error_e telebot_send_audio(char *chat_id, char *audio, bool is_file,
  * keyboard, instructions to hide keyboard or to force a reply from the user.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_send_document(char *chat_id, char *document,
-        bool is_file, int reply_to_message_id, char *reply_markup);
+telebot_error_e telebot_send_document(telebot_h *bot, char *chat_id,
+        char *document, bool is_file, int reply_to_message_id,
+        char *reply_markup);
 
 /**
  * @brief This function is used to to send .webp stickers.
+ * @param bot The bot created with telebot_create().
  * @param chat_id Unique identifier for the target chat or username of the
  * target channel (in the format \@channelusername)
  * @param sticker Sticker file to send. It is either a file_id as String to
@@ -764,12 +1236,14 @@ telebot_error_e telebot_send_document(char *chat_id, char *document,
  * keyboard, instructions to hide keyboard or to force a reply from the user.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_send_sticker(char *chat_id, char *sticker, bool is_file,
-        int reply_to_message_id, char *reply_markup);
+telebot_error_e telebot_send_sticker(telebot_h *bot, char *chat_id,
+        char *sticker, bool is_file, int reply_to_message_id,
+        char *reply_markup);
 
 /**
  * @brief This function is used to send video files, Telegram clients support
  * mp4 videos (other formats may be sent as Document).
+ * @param bot The bot created with telebot_create().
  * @param chat_id Unique identifier for the target chat or username of the
  * target channel (in the format \@channelusername).
  * @param video Video file to send. It is either a file_id as String to resend
@@ -782,8 +1256,9 @@ telebot_error_e telebot_send_sticker(char *chat_id, char *sticker, bool is_file,
  * keyboard, instructions to hide keyboard or to force a reply from the user.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_send_video(char *chat_id, char *video, bool is_file,
-        int duration, char *caption, int reply_to_message_id, char *reply_markup);
+telebot_error_e telebot_send_video(telebot_h *bot, char *chat_id, char *video,
+        bool is_file, int duration, char *caption, int reply_to_message_id,
+        char *reply_markup);
 
 /**
  * @brief This function is used to send audio files, if you want Telegram
@@ -791,6 +1266,7 @@ telebot_error_e telebot_send_video(char *chat_id, char *video, bool is_file,
  * your audio must be in an .ogg file encoded with OPUS (other formats may be
  * sent as Audio or Document). Bots can currently send voice messages of up to
  * 50 MB in size.
+ * @param bot The bot created with telebot_create().
  * @param chat_id Unique identifier for the target chat or username of the
  * target channel (in the format \@channelusername).
  * @param voice Audio file to send. It is either a file_id as String to resend
@@ -802,11 +1278,12 @@ telebot_error_e telebot_send_video(char *chat_id, char *video, bool is_file,
  * keyboard, instructions to hide keyboard or to force a reply from the user.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_send_voice(char *chat_id, char *voice, bool is_file,
-        int duration, int reply_to_message_id, char *reply_markup);
+telebot_error_e telebot_send_voice(telebot_h *bot, char *chat_id, char *voice,
+        bool is_file, int duration, int reply_to_message_id, char *reply_markup);
 
 /**
  * @brief This function is used to send point on the map.
+ * @param bot The bot created with telebot_create().
  * @param chat_id Unique identifier for the target chat or username of the
  * target channel (in the format \@channelusername).
  * @param latitude Latitude of location.
@@ -816,8 +1293,9 @@ telebot_error_e telebot_send_voice(char *chat_id, char *voice, bool is_file,
  * keyboard, instructions to hide keyboard or to force a reply from the user.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_send_location(char *chat_id, float latitude,
-        float longitude, int reply_to_message_id, char *reply_markup);
+telebot_error_e telebot_send_location(telebot_h *bot, char *chat_id,
+        float latitude, float longitude, int reply_to_message_id,
+        char *reply_markup);
 
 /**
  * @brief This function is used to tell the user that something is happening on
@@ -829,6 +1307,7 @@ telebot_error_e telebot_send_location(char *chat_id, float latitude,
  * The user will see a "sending photo" status for the bot.
  * It is only recommended to use when a response from the bot will take a
  * noticeable amount of time to arrive.
+ * @param bot The bot created with telebot_create().
  * @param chat_id Unique identifier for the target chat or username of the
  * target channel (in the format \@channelusername)
  * @param action Type of action to broadcast. Choose one, depending on what the
@@ -838,7 +1317,8 @@ telebot_error_e telebot_send_location(char *chat_id, float latitude,
  * data.
  * @return on Success, TELEBOT_ERROR_NONE is returned.
  */
-telebot_error_e telebot_send_chat_action(char *chat_id, char *action);
+telebot_error_e telebot_send_chat_action(telebot_h *bot, char *chat_id,
+        char *action);
 
 
 /**
@@ -43,14 +43,158 @@ extern "C" {
 
 /**
  * @brief This object represents a core telebot handler.
+ *
+ * The handler holds no per-request state, so requests may be issued on the
+ * same handler from several threads at once.
  */
 typedef struct telebot_core_handler {
     char *token; /**< Telegam bot token */
     int  offset; /**< Telegam last update id */
-    char *resp_data; /**< Telegam response object */
-    size_t resp_size; /**< Telegam response size */
+    char *api_url; /**< Bot API server base URL */
+    struct telebot_core_transport *transport; /**< Connection pool (private) */
 } telebot_core_h;
 
+/**
+ * @brief This object receives the response of a blocking core request.
+ *
+ * It is owned by the caller and MUST be zero-initialized before its first
+ * use. It may be passed to any number of requests, one at a time, and keeps
+ * its buffer from one to the next. Release it with
+ * telebot_core_response_free().
+ */
+typedef struct telebot_core_response {
+    char *data; /**< Telegam response, NUL terminated */
+    size_t size; /**< Telegam response size */
+    size_t capacity; /**< Allocated size of data */
+} telebot_core_response_t;
+
+/**
+ * @brief Counters describing how the connection pool of a core handler is
+ * being used.
+ */
+typedef struct telebot_core_connection_stats {
+    unsigned long requests; /**< Requests performed through the pool */
+    unsigned long reused; /**< Requests served over an already open connection */
+    unsigned long connected; /**< Requests that had to open a new connection */
+    unsigned long reaped; /**< Idle connections closed by reaping */
+    unsigned long reconnects; /**< Forced reconnects requested */
+} telebot_core_connection_stats_t;
+
+/**
+ * @brief Counters describing how requests of a core handler were retried.
+ */
+typedef struct telebot_core_retry_stats {
+    unsigned long requests; /**< Requests completed, retries included */
+    unsigned long retries; /**< Attempts repeated after a failure */
+    unsigned long rate_limited; /**< Attempts answered with 429 */
+    unsigned long server_errors; /**< Attempts answered with 5xx */
+    unsigned long transport_errors; /**< Attempts failed without an answer */
+    unsigned long failed; /**< Requests that failed after their last attempt */
+    unsigned long long retry_wait_total_us; /**< Time spent waiting to retry */
+    unsigned long long latency_total_us; /**< Time from start to completion */
+    unsigned long latency_max_us; /**< Longest request, retries included */
+} telebot_core_retry_stats_t;
+
+#define TELEBOT_CORE_STATS_METHODS 19 /**< Bot API methods, downloads, others */
+#define TELEBOT_CORE_HISTOGRAM_BUCKETS 464 /**< Up to 2^32 microseconds */
+
+/**
+ * @brief Phases of a request, see telebot_core_method_stats_t.
+ */
+typedef enum telebot_core_phase {
+    TELEBOT_CORE_PHASE_DNS = 0, /**< Name resolution */
+    TELEBOT_CORE_PHASE_CONNECT, /**< TCP connection setup */
+    TELEBOT_CORE_PHASE_TLS, /**< TLS handshake */
+    TELEBOT_CORE_PHASE_TTFB, /**< From the request sent to its first byte */
+    TELEBOT_CORE_PHASE_TOTAL, /**< Whole attempt */
+    TELEBOT_CORE_PHASES,
+} telebot_core_phase_e;
+
+/**
+ * @brief Latency histogram in microseconds with a precision of 1/16: bucket
+ * i counts values below telebot_core_histogram_limit(i) and at least the
+ * limit of bucket i - 1.
+ */
+typedef struct telebot_core_histogram {
+    unsigned long count; /**< Values recorded */
+    unsigned long long sum_us; /**< Sum of the values */
+    unsigned long max_us; /**< Largest value */
+    unsigned long buckets[TELEBOT_CORE_HISTOGRAM_BUCKETS]; /**< Values per bucket */
+} telebot_core_histogram_t;
+
+/**
+ * @brief Counters and latencies of the requests of one Bot API method.
+ *
+ * Every attempt is counted, so a retried request is counted once per
+ * attempt. DNS, connect and TLS are only recorded for attempts that opened a
+ * new connection.
+ */
+typedef struct telebot_core_method_stats {
+    const char *method; /**< Method name, "download" or "other" */
+    unsigned long requests; /**< Attempts made */
+    unsigned long failures; /**< Requests that failed after their last attempt */
+    unsigned long retries; /**< Attempts repeated after a failure */
+    /** Attempts by HTTP status class: [2] for 2xx up to [5] for 5xx, [0] for
+     * attempts that got no answer */
+    unsigned long status[6];
+    telebot_core_histogram_t latency[TELEBOT_CORE_PHASES]; /**< Per phase */
+} telebot_core_method_stats_t;
+
+/**
+ * @brief Request statistics of a connection pool, per method. At about 340
+ * KB, it is best allocated once and reused for every snapshot.
+ */
+typedef struct telebot_core_stats {
+    telebot_core_method_stats_t methods[TELEBOT_CORE_STATS_METHODS];
+} telebot_core_stats_t;
+
+/**
+ * @brief Options for telebot_core_create_ex().
+ */
+typedef struct telebot_core_options {
+    bool http2; /**< Multiplex all requests over shared HTTP/2 connections */
+    /** Bot API server base URL, e.g. a local Bot API server or a mock for
+     * load tests. NULL for the one of share, or api.telegram.org. */
+    const char *api_url;
+    const char *ca_file; /**< CA bundle to verify the server, NULL for default */
+    /** Handler whose connection pool and transport thread are used, instead
+     * of creating new ones. http2 and ca_file then come from it. */
+    struct telebot_core_handler *share;
+} telebot_core_options_t;
+
+struct json_object;
+
+/**
+ * @brief This function type defines the consumer of a streamed response
+ * body, see telebot_core_get_updates_stream().
+ * @param data The next chunk of the body, only valid during the call. It is
+ * not NUL terminated. While no data arrives, e.g. during a long poll or
+ * before a retry, the consumer is also asked whether to go on with a NULL
+ * chunk, at least once a second.
+ * @param size Size of the chunk in bytes, 0 with a NULL chunk.
+ * @param user_data The pointer given when the request was issued.
+ * @return TELEBOT_ERROR_NONE to continue receiving, any other value aborts
+ * the transfer.
+ */
+typedef telebot_error_e (*telebot_core_stream_cb_f)(const char *data,
+        size_t size, void *user_data);
+
+/**
+ * @brief This function type defines the completion callback of asynchronous
+ * core requests.
+ *
+ * Callbacks are invoked on the internal transport thread of the handler, so
+ * they should return quickly and MUST NOT call telebot_core_async_wait().
+ * @param handler The telebot handler the request was issued on.
+ * @param ret TELEBOT_ERROR_NONE if the request succeeded and Telegram
+ * answered with "ok", an error code otherwise.
+ * @param result The "result" member of the response, or NULL on failure. It
+ * is owned by the library and only valid until the callback returns.
+ * @param user_data The pointer given when the request was issued.
+ */
+typedef void (*telebot_core_async_cb_f)(telebot_core_h *handler,
+        telebot_error_e ret, struct json_object *result, void *user_data);
+
 /**
  * @brief Start function to use telebot core APIs.
  *
@@ -63,6 +207,27 @@ typedef struct telebot_core_handler {
  */
 telebot_error_e telebot_core_create(telebot_core_h *handler, char *token);
 
+/**
+ * @brief Start function to use telebot core APIs with non-default options.
+ *
+ * Same as telebot_core_create(), but allows tuning the transport. By default
+ * every in-flight request holds its own HTTP/1.1 keep-alive connection. With
+ * http2 enabled, synchronous and asynchronous requests are all issued as
+ * streams over HTTP/2 connections shared by the handler instead. An "http://"
+ * api_url is spoken to with HTTP/2 prior knowledge (h2c), an "https://" one
+ * is negotiated with ALPN.
+ *
+ * Handlers of many bots can share one transport through options->share, so
+ * that they reuse each other's connections and are driven by a single event
+ * loop. The transport is released with the last handler using it.
+ * @param handler A pointer to a handler.
+ * @param token Telegram bot token to use.
+ * @param options Transport options, or NULL for the defaults.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_core_create_ex(telebot_core_h *handler, char *token,
+        const telebot_core_options_t *options);
+
 /**
  * @brief Final function to use telebot core APIs
  *
@@ -75,14 +240,122 @@ telebot_error_e telebot_core_create(telebot_core_h *handler, char *token);
  */
 telebot_error_e telebot_core_destroy(telebot_core_h *handler);
 
+/**
+ * @brief This function releases the buffer of a response object. The object
+ * may be used again afterwards.
+ * @param response The response object to release.
+ */
+void telebot_core_response_free(telebot_core_response_t *response);
+
+/**
+ * @brief This function opens connections to the Telegram server ahead of time,
+ * so that the first requests do not pay for the TCP and TLS handshakes.
+ *
+ * Every idle pooled connection without an open socket is connected. TLS
+ * sessions are shared across the pool, so only the first handshake is a full
+ * one. Connections that are busy are left untouched.
+ * @param handler The telebot handler created with telebot_core_create().
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_core_warmup(telebot_core_h *handler);
+
+/**
+ * @brief This function closes pooled connections that have not been used for
+ * at least max_idle seconds. They are re-established on demand.
+ * @param handler The telebot handler created with telebot_core_create().
+ * @param max_idle Idle time in seconds after which a connection is closed.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_core_reap_idle_connections(telebot_core_h *handler,
+        int max_idle);
+
+/**
+ * @brief This function drops every pooled connection, e.g. after a network
+ * change. Idle connections are closed immediately, busy ones as soon as their
+ * current request completes.
+ * @param handler The telebot handler created with telebot_core_create().
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_core_reconnect(telebot_core_h *handler);
+
+/**
+ * @brief This function gets the connection pool counters of the handler.
+ * @param handler The telebot handler created with telebot_core_create().
+ * @param stats Pointer to the structure to be filled.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_core_get_connection_stats(telebot_core_h *handler,
+        telebot_core_connection_stats_t *stats);
+
+/**
+ * @brief This function sets how failed requests are retried. A 429 answer is
+ * retried for any method once its retry_after is over, unless that is longer
+ * than max_retry_after. 5xx answers and lost connections are retried with a
+ * jittered exponential backoff, for methods that are safe to repeat, or for
+ * any method when the connection could not be opened at all. Streamed
+ * requests are only retried while nothing was passed on to their consumer.
+ * The policy applies to every handler sharing the connection pool.
+ * @param handler The telebot handler created with telebot_core_create().
+ * @param max_retries Retries after the first attempt, 0 disables retrying.
+ * Default is 3.
+ * @param max_retry_after Longest retry_after in seconds that is waited for.
+ * Default is 60.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_core_set_retry(telebot_core_h *handler,
+        int max_retries, int max_retry_after);
+
+/**
+ * @brief This function gets the retry counters of the handler, shared by
+ * every handler using the same connection pool.
+ * @param handler The telebot handler created with telebot_core_create().
+ * @param stats Pointer to the structure to be filled.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_core_get_retry_stats(telebot_core_h *handler,
+        telebot_core_retry_stats_t *stats);
+
+/**
+ * @brief This function copies the per-method request statistics of the
+ * handler, shared by every handler using the same connection pool.
+ *
+ * Requests record into atomic counters, so taking a snapshot never blocks
+ * them and is cheap enough to be done every second. Counters are read one at
+ * a time, so a snapshot taken while requests complete may count an attempt
+ * in one counter and not yet in another.
+ * @param handler The telebot handler created with telebot_core_create().
+ * @param stats Pointer to the structure to be filled.
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_core_stats_snapshot(telebot_core_h *handler,
+        telebot_core_stats_t *stats);
+
+/**
+ * @brief This function gets the exclusive upper limit of a histogram bucket.
+ * @param index Bucket index, below TELEBOT_CORE_HISTOGRAM_BUCKETS.
+ * @return The limit in microseconds.
+ */
+unsigned long long telebot_core_histogram_limit(int index);
+
+/**
+ * @brief This function estimates a percentile of a histogram, within the
+ * precision of its buckets.
+ * @param histogram The histogram, e.g. of a snapshot.
+ * @param percentile Between 0 and 100.
+ * @return The value in microseconds, 0 for an empty histogram.
+ */
+unsigned long telebot_core_histogram_percentile(
+        const telebot_core_histogram_t *histogram, double percentile);
+
 /**
  * @brief This function gets basic information about the bot.
  * @param handler The telebot handler created with telebot_core_create().
+ * @param response Receives the response, or NULL to discard it.
  * @return On success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data. All core API responses are JSON objects. It MUST be freed
- * after use.
+ * response. All core API responses are JSON objects.
  */
-telebot_error_e telebot_core_get_me(telebot_core_h *handler);
+telebot_error_e telebot_core_get_me(telebot_core_h *handler,
+        telebot_core_response_t *response);
 
 /**
  * @brief This function is used to receive incoming updates (long polling).
@@ -98,12 +371,53 @@ telebot_error_e telebot_core_get_me(telebot_core_h *handler);
  * @param limit Limits the number of updates to be retrieved. Values between
  * 1—100 are accepted. Defaults to 100.
  * @param timeout Timeout in seconds for long polling. Defaults to 0, i.e. usual
- * short polling.
+ * short polling. With a positive timeout the transfer itself is aborted if it
+ * has not completed a few seconds after the server side timeout.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data. It MUST be freed after use.
+ * response.
  */
 telebot_error_e telebot_core_get_updates(telebot_core_h *handler, int offset,
-        int limit, int timeout);
+        int limit, int timeout, telebot_core_response_t *response);
+
+/**
+ * @brief Variant of telebot_core_get_updates() that hands the response body
+ * to cb as it is received, instead of collecting it in a response object.
+ * This lets the caller parse the response while the rest of it is still on
+ * the wire.
+ * @param handler The telebot handler created with telebot_core_create().
+ * @param offset See telebot_core_get_updates().
+ * @param limit See telebot_core_get_updates().
+ * @param timeout See telebot_core_get_updates().
+ * @param cb Receives the body chunk by chunk, on the calling thread or on the
+ * transport thread. Returning an error aborts the transfer.
+ * @param user_data Passed to every call of cb.
+ * @return on Success, TELEBOT_ERROR_NONE is returned. Only the body of a
+ * 200 answer is passed to cb, answers with an HTTP error status are retried
+ * like those of telebot_core_get_updates().
+ */
+telebot_error_e telebot_core_get_updates_stream(telebot_core_h *handler,
+        int offset, int limit, int timeout, telebot_core_stream_cb_f cb,
+        void *user_data);
+
+/**
+ * @brief Asynchronous variant of telebot_core_get_updates_stream(). The long
+ * poll is queued on the curl multi event loop of the handler, so the polls of
+ * many handlers sharing a transport are all driven by its single thread.
+ * @param handler The telebot handler created with telebot_core_create().
+ * @param offset See telebot_core_get_updates().
+ * @param limit See telebot_core_get_updates().
+ * @param timeout See telebot_core_get_updates().
+ * @param stream_cb Receives the body chunk by chunk, on the transport thread.
+ * Returning an error aborts the transfer.
+ * @param cb Invoked once the transfer is over, with a NULL result.
+ * @param user_data Passed to every call of stream_cb and cb.
+ * @return on Success, TELEBOT_ERROR_NONE is returned and cb will be invoked,
+ * otherwise the request was not queued.
+ */
+telebot_error_e telebot_core_get_updates_stream_async(telebot_core_h *handler,
+        int offset, int limit, int timeout, telebot_core_stream_cb_f stream_cb,
+        telebot_core_async_cb_f cb, void *user_data);
 
 /**
  * @brief This function is used to get user profile pictures object
@@ -113,21 +427,25 @@ telebot_error_e telebot_core_get_updates(telebot_core_h *handler, int offset,
  * all photos are returned.
  * @param limit Limits the number of photos to be retrieved. Values between
  * 1—100 are accepted. Defaults to 100.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data. It MUST be freed after use.
+ * response.
  */
 telebot_error_e telebot_core_get_user_profile_photos(telebot_core_h *handler,
-        int user_id, int offset, int limit);
+        long long user_id, int offset, int limit,
+        telebot_core_response_t *response);
 
 /**
  * @brief This function is used get basic info about a file and prepare it for
  * downloading. For the moment, bots can download files of up to 20MB in size.
  * @param handler The telebot handler created with telebot_core_create().
  * @param file_id File identifier to get info about.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data, which contains a File object. It MUST be freed after use.
+ * response, which contains a File object.
  */
-telebot_error_e telebot_core_get_file(telebot_core_h *handler, char *file_id);
+telebot_error_e telebot_core_get_file(telebot_core_h *handler, char *file_id,
+        telebot_core_response_t *response);
 
 /**
  * @brief This function is used download file using file_path obtained with
@@ -154,19 +472,20 @@ telebot_error_e telebot_core_download_file(telebot_core_h *handler, char *file_p
  * @param reply_to_message_id If the message is a reply, ID of the original message.
  * @param reply_markup Additional interface options. An object for a custom
  * reply keyboard, instructions to hide keyboard or to force a reply from the user.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data. It MUST be freed after use.
+ * response.
  */
-telebot_error_e telebot_core_send_message(telebot_core_h *handler, char *chat_id,
-        char *text, char *parse_mode, bool disable_web_page_preview,
-        int reply_to_message_id, const char *reply_markup);
+telebot_error_e telebot_core_send_message(telebot_core_h *handler,
+        char *chat_id, char *text, char *parse_mode,
+        bool disable_web_page_preview, int reply_to_message_id,
+        const char *reply_markup, telebot_core_response_t *response);
 
 telebot_error_e telebot_core_delete_message(telebot_core_h *handler,
-                                            int chat_id, int message_id);
-telebot_error_e telebot_core_answer_callback_query(telebot_core_h * handler,
-                                                   const char *callback_query_id,
-                                                   char *text, bool show_alert,
-                                                   char *url, int cache_time);
+        long long chat_id, int message_id, telebot_core_response_t *response);
+telebot_error_e telebot_core_answer_callback_query(telebot_core_h *handler,
+        const char *callback_query_id, char *text, bool show_alert, char *url,
+        int cache_time, telebot_core_response_t *response);
 
 /**
  * @brief This function is used to forward messages of any kind.
@@ -176,11 +495,13 @@ telebot_error_e telebot_core_answer_callback_query(telebot_core_h * handler,
  * @param from_chat_id Unique identifier for the chat where the original
  * message was sent (or channel username in the format \@channelusername).
  * @param message_id Unique message identifier.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data that contains the sent message. It MUST be freed after use.
+ * response that contains the sent message.
  */
 telebot_error_e telebot_core_forward_message(telebot_core_h *handler,
-        char *chat_id, char *from_chat_id, int message_id);
+        char *chat_id, char *from_chat_id, int message_id,
+        telebot_core_response_t *response);
 
 /**
  * @brief This functionis used to send photos.
@@ -195,12 +516,13 @@ telebot_error_e telebot_core_forward_message(telebot_core_h *handler,
  * @param reply_markup Additional interface options. An object for a custom
  * reply keyboard, instructions to hide keyboard or to force a reply from
  * the user.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data that contains the sent message. It MUST be freed after use.
+ * response that contains the sent message.
  */
 telebot_error_e telebot_core_send_photo(telebot_core_h *handler, char *chat_id,
         char *photo, bool is_file, char *caption, int reply_to_message_id,
-        char *reply_markup);
+        char *reply_markup, telebot_core_response_t *response);
 /**
  * @brief This function is used to to send audio files. if you want Telegram
  * clients to display them in the music player. Your audio must be in the .mp3
@@ -222,12 +544,14 @@ telebot_error_e telebot_core_send_photo(telebot_core_h *handler, char *chat_id,
  * @param reply_to_message_id If the message is a reply, ID of the original message.
  * @param reply_markup Additional interface options. An object for a custom reply
  * keyboard, instructions to hide keyboard or to force a reply from the user.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data that contains the sent message. It MUST be freed after use.
+ * response that contains the sent message.
  */
 telebot_error_e telebot_core_send_audio(telebot_core_h *handler, char *chat_id,
         char *audio, bool is_file, int duration, char *performer, char *title,
-    int reply_to_message_id, char *reply_markup);
+        int reply_to_message_id, char *reply_markup,
+        telebot_core_response_t *response);
 
 /**
  * @brief This function is used to send general files.
@@ -240,12 +564,13 @@ telebot_error_e telebot_core_send_audio(telebot_core_h *handler, char *chat_id,
  * @param reply_to_message_id If the message is a reply, ID of the original message.
  * @param reply_markup Additional interface options. An object for a custom reply
  * keyboard, instructions to hide keyboard or to force a reply from the user.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data that contains the sent message. It MUST be freed after use.
+ * response that contains the sent message.
  */
-telebot_error_e telebot_core_send_document(telebot_core_h *handler, char *chat_id,
-        char *document, bool is_file, int reply_to_message_id,
-        char *reply_markup);
+telebot_error_e telebot_core_send_document(telebot_core_h *handler,
+        char *chat_id, char *document, bool is_file, int reply_to_message_id,
+        char *reply_markup, telebot_core_response_t *response);
 
 /**
  * @brief This function is used to to send .webp stickers.
@@ -258,12 +583,14 @@ telebot_error_e telebot_core_send_document(telebot_core_h *handler, char *chat_i
  * @param reply_to_message_id If the message is a reply, ID of the original message.
  * @param reply_markup Additional interface options. An object for a custom reply
  * keyboard, instructions to hide keyboard or to force a reply from the user.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data that contains the sent message. It MUST be freed after use.
+ * response that contains the sent message.
  */
 
-telebot_error_e telebot_core_send_sticker(telebot_core_h *handler, char *chat_id,
-        char *sticker, bool is_file, int reply_to_message_id, char *reply_markup);
+telebot_error_e telebot_core_send_sticker(telebot_core_h *handler,
+        char *chat_id, char *sticker, bool is_file, int reply_to_message_id,
+        char *reply_markup, telebot_core_response_t *response);
 
 /**
  * @brief This function is used to send video files, Telegram clients support
@@ -279,12 +606,14 @@ telebot_error_e telebot_core_send_sticker(telebot_core_h *handler, char *chat_id
  * @param reply_to_message_id If the message is a reply, ID of the original message.
  * @param reply_markup Additional interface options. An object for a custom reply
  * keyboard, instructions to hide keyboard or to force a reply from the user.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data that contains the sent message. It MUST be freed after use.
+ * response that contains the sent message.
  */
 telebot_error_e telebot_core_send_video(telebot_core_h *handler, char *chat_id,
         char *video, bool is_file, int duration, char *caption,
-        int reply_to_message_id, char *reply_markup);
+        int reply_to_message_id, char *reply_markup,
+        telebot_core_response_t *response);
 /**
  * @brief This function is used to send audio files, if you want Telegram
  * clients to display the file as a playable voice message. For this to work,
@@ -301,13 +630,14 @@ telebot_error_e telebot_core_send_video(telebot_core_h *handler, char *chat_id,
  * @param reply_to_message_id If the message is a reply, ID of the original message.
  * @param reply_markup Additional interface options. An object for a custom reply
  * keyboard, instructions to hide keyboard or to force a reply from the user.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data that contains the sent message. It MUST be freed after use.
+ * response that contains the sent message.
  */
 
 telebot_error_e telebot_core_send_voice(telebot_core_h *handler, char *chat_id,
         char *voice, bool is_file, int duration, int reply_to_message_id,
-        char *reply_markup);
+        char *reply_markup, telebot_core_response_t *response);
 
 /**
  * @brief This function is used to send point on the map.
@@ -319,12 +649,13 @@ telebot_error_e telebot_core_send_voice(telebot_core_h *handler, char *chat_id,
  * @param reply_to_message_id If the message is a reply, ID of the original message.
  * @param reply_markup Additional interface options. An object for a custom reply
  * keyboard, instructions to hide keyboard or to force a reply from the user.
+ * @param response Receives the response, or NULL to discard it.
  * @return on Success, TELEBOT_ERROR_NONE is returned. Response is placed in
- * handler->resp_data that contains the sent message. It MUST be freed after use.
+ * response that contains the sent message.
  */
-telebot_error_e telebot_core_send_location(telebot_core_h *handler, char *chat_id,
-        float latitude, float longitude, int reply_to_message_id,
-        char *reply_markup);
+telebot_error_e telebot_core_send_location(telebot_core_h *handler,
+        char *chat_id, float latitude, float longitude, int reply_to_message_id,
+        char *reply_markup, telebot_core_response_t *response);
 
 /**
  * @brief This function is used to tell the user that something is happening on
@@ -344,9 +675,10 @@ telebot_error_e telebot_core_send_location(telebot_core_h *handler, char *chat_i
  * record_video or upload_video for videos, record_audio or upload_audio for
  * audio files, upload_document for general files, find_location for location
  * data.
+* @param response Receives the response, or NULL to discard it.
  */
 telebot_error_e telebot_core_send_chat_action(telebot_core_h *handler,
-        char *chat_id, char *action);
+        char *chat_id, char *action, telebot_core_response_t *response);
 
 /**
  * @brief This function is used to specify a url and receive incoming updates
@@ -358,9 +690,96 @@ telebot_error_e telebot_core_send_chat_action(telebot_core_h *handler,
  * @param url HTTPS url to send updates to. Use an empty string to remove webhook
  * integration
  * @param certificate A path to to a public key certificate to upload server.
+* @param response Receives the response, or NULL to discard it.
  */
 telebot_error_e telebot_core_set_web_hook(telebot_core_h *handler, char *url,
-        char *certificate);
+        char *certificate, telebot_core_response_t *response);
+
+/**
+ * @brief This function blocks until every asynchronous request issued on the
+ * handler has completed and its callback has returned. With a shared
+ * transport, this includes the requests of the other handlers sharing it.
+ * @param handler The telebot handler created with telebot_core_create().
+ * @return On success, TELEBOT_ERROR_NONE is returned.
+ */
+telebot_error_e telebot_core_async_wait(telebot_core_h *handler);
+
+/*
+ * Asynchronous variants of the send functions. They take the same arguments
+ * as their blocking counterparts, plus a completion callback and a user
+ * pointer passed back to it. The request is queued on a curl multi event
+ * loop running on a single transport thread, and the function returns as
+ * soon as it is queued. All string arguments are copied, so they can be
+ * released right after the call returns. A return value other than
+ * TELEBOT_ERROR_NONE means the request was not queued and the callback will
+ * never be invoked.
+ */
+
+/** @brief Asynchronous variant of telebot_core_send_message(). */
+telebot_error_e telebot_core_send_message_async(telebot_core_h *handler,
+        char *chat_id, char *text, char *parse_mode,
+        bool disable_web_page_preview, int reply_to_message_id,
+        const char *reply_markup, telebot_core_async_cb_f cb, void *user_data);
+
+/** @brief Asynchronous variant of telebot_core_delete_message(). */
+telebot_error_e telebot_core_delete_message_async(telebot_core_h *handler,
+        long long chat_id, int message_id, telebot_core_async_cb_f cb,
+        void *user_data);
+
+/** @brief Asynchronous variant of telebot_core_answer_callback_query(). */
+telebot_error_e telebot_core_answer_callback_query_async(
+        telebot_core_h *handler, const char *callback_query_id, char *text,
+        bool show_alert, char *url, int cache_time, telebot_core_async_cb_f cb,
+        void *user_data);
+
+/** @brief Asynchronous variant of telebot_core_forward_message(). */
+telebot_error_e telebot_core_forward_message_async(telebot_core_h *handler,
+        char *chat_id, char *from_chat_id, int message_id,
+        telebot_core_async_cb_f cb, void *user_data);
+
+/** @brief Asynchronous variant of telebot_core_send_photo(). */
+telebot_error_e telebot_core_send_photo_async(telebot_core_h *handler,
+        char *chat_id, char *photo, bool is_file, char *caption,
+        int reply_to_message_id, char *reply_markup, telebot_core_async_cb_f cb,
+        void *user_data);
+
+/** @brief Asynchronous variant of telebot_core_send_audio(). */
+telebot_error_e telebot_core_send_audio_async(telebot_core_h *handler,
+        char *chat_id, char *audio, bool is_file, int duration, char *performer,
+        char *title, int reply_to_message_id, char *reply_markup,
+        telebot_core_async_cb_f cb, void *user_data);
+
+/** @brief Asynchronous variant of telebot_core_send_document(). */
+telebot_error_e telebot_core_send_document_async(telebot_core_h *handler,
+        char *chat_id, char *document, bool is_file, int reply_to_message_id,
+        char *reply_markup, telebot_core_async_cb_f cb, void *user_data);
+
+/** @brief Asynchronous variant of telebot_core_send_sticker(). */
+telebot_error_e telebot_core_send_sticker_async(telebot_core_h *handler,
+        char *chat_id, char *sticker, bool is_file, int reply_to_message_id,
+        char *reply_markup, telebot_core_async_cb_f cb, void *user_data);
+
+/** @brief Asynchronous variant of telebot_core_send_video(). */
+telebot_error_e telebot_core_send_video_async(telebot_core_h *handler,
+        char *chat_id, char *video, bool is_file, int duration, char *caption,
+        int reply_to_message_id, char *reply_markup, telebot_core_async_cb_f cb,
+        void *user_data);
+
+/** @brief Asynchronous variant of telebot_core_send_voice(). */
+telebot_error_e telebot_core_send_voice_async(telebot_core_h *handler,
+        char *chat_id, char *voice, bool is_file, int duration,
+        int reply_to_message_id, char *reply_markup, telebot_core_async_cb_f cb,
+        void *user_data);
+
+/** @brief Asynchronous variant of telebot_core_send_location(). */
+telebot_error_e telebot_core_send_location_async(telebot_core_h *handler,
+        char *chat_id, float latitude, float longitude, int reply_to_message_id,
+        char *reply_markup, telebot_core_async_cb_f cb, void *user_data);
+
+/** @brief Asynchronous variant of telebot_core_send_chat_action(). */
+telebot_error_e telebot_core_send_chat_action_async(telebot_core_h *handler,
+        char *chat_id, char *action, telebot_core_async_cb_f cb,
+        void *user_data);
 
 /**
  * @} // end of APIs
@@ -0,0 +1,66 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TELEBOT_DISPATCHER_H__
+#define __TELEBOT_DISPATCHER_H__
+
+typedef struct telebot_dispatcher telebot_dispatcher_t;
+
+/*
+ * Updates submitted together. done is called once the last of them was
+ * handled, on the thread that handled it, e.g. to release their arena.
+ */
+typedef struct telebot_dispatch_batch {
+    atomic_int pending; /* Set by telebot_dispatcher_submit_batch() */
+    void (*done)(struct telebot_dispatch_batch *batch);
+} telebot_dispatch_batch_t;
+
+/**
+ * Create a dispatcher running update_cb of bot on workers threads. Updates of
+ * one chat always go to the same worker, so they are handled in order. With 0
+ * workers, updates are handled inline by telebot_dispatcher_submit().
+ */
+telebot_dispatcher_t *telebot_dispatcher_create(int workers, telebot_h *bot,
+        telebot_update_cb_f update_cb, void *user_data);
+
+/** Stop the workers, after they handled every submitted update. */
+void telebot_dispatcher_destroy(telebot_dispatcher_t *dispatcher);
+
+/** Queue an update, blocks while the queue of its worker is full. */
+void telebot_dispatcher_submit(telebot_dispatcher_t *dispatcher,
+        const telebot_update_t *update);
+
+/**
+ * Queue count updates as a batch, blocks while a queue is full. done may be
+ * called before this returns, right away when count is 0.
+ */
+void telebot_dispatcher_submit_batch(telebot_dispatcher_t *dispatcher,
+        const telebot_update_t *updates, int count,
+        telebot_dispatch_batch_t *batch);
+
+/** Wait until every submitted update has been handled. */
+void telebot_dispatcher_wait(telebot_dispatcher_t *dispatcher);
+
+/** Whether the calling thread is one of the workers, false without any. */
+bool telebot_dispatcher_is_worker(telebot_dispatcher_t *dispatcher);
+
+/** Get queue and handler statistics. */
+void telebot_dispatcher_get_stats(telebot_dispatcher_t *dispatcher,
+        telebot_dispatch_stats_t *stats);
+
+#endif /* __TELEBOT_DISPATCHER_H__ */
@@ -0,0 +1,67 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TELEBOT_METRICS_H__
+#define __TELEBOT_METRICS_H__
+
+typedef struct telebot_metrics telebot_metrics_t;
+
+/** Page being rendered, written to with the functions below. */
+typedef struct telebot_metrics_page telebot_metrics_page_t;
+
+/**
+ * Called on the server thread for every scrape, to write all metric families
+ * to the page. It MUST NOT allocate either, so that scrapes stay cheap.
+ */
+typedef void (*telebot_metrics_render_cb_f)(telebot_metrics_page_t *page,
+        void *user_data);
+
+/**
+ * Start serving an OpenMetrics text page on port of the loopback interface,
+ * 0 picks a free port. Every buffer is allocated up front, a scrape only
+ * renders into them. Connections are served one at a time and closed after
+ * the answer.
+ */
+telebot_metrics_t *telebot_metrics_start(int port,
+        telebot_metrics_render_cb_f render_cb, void *user_data);
+
+/** Port the server is listening on. */
+int telebot_metrics_port(telebot_metrics_t *metrics);
+
+/** Stop the server thread and close its socket. */
+void telebot_metrics_stop(telebot_metrics_t *metrics);
+
+/** Write the TYPE and HELP lines of a family, type e.g. "counter". */
+void telebot_metrics_family(telebot_metrics_page_t *page, const char *name,
+        const char *type, const char *help);
+
+/**
+ * Write a sample of family name, suffix e.g. "_total" or "" and labels e.g.
+ * "method=\"getMe\"" or NULL.
+ */
+void telebot_metrics_sample(telebot_metrics_page_t *page, const char *name,
+        const char *suffix, const char *labels, unsigned long long value);
+
+/**
+ * Write the samples of a latency histogram in seconds, with buckets of fixed
+ * bounds from 1 ms to 60 s summed up from the finer ones of histogram.
+ */
+void telebot_metrics_histogram(telebot_metrics_page_t *page, const char *name,
+        const char *labels, const telebot_core_histogram_t *histogram);
+
+#endif /* __TELEBOT_METRICS_H__ */
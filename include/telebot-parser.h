@@ -19,6 +19,18 @@
 #ifndef __TELEBOT_PARSER_H__
 #define __TELEBOT_PARSER_H__
 
+/**
+ * Create the arena parsed updates are allocated from. Its head is NULL if the
+ * first chunk could not be mapped, the arena may then only be destroyed.
+ */
+telebot_linear_allocator_t telebot_linear_allocator_create(size_t chunk_size);
+
+/** Release everything allocated from the arena, clearing its memory */
+void telebot_linear_allocator_zero_all(telebot_linear_allocator_t *allocator);
+
+/** Free the arena and its memory */
+void telebot_linear_allocator_destroy(telebot_linear_allocator_t *allocator);
+
 struct json_object *telebot_parser_str_to_obj(char *data);
 
 /** Get update from Json Object */
@@ -26,6 +38,49 @@ telebot_error_e telebot_parser_get_updates(struct json_object *obj,
                                            telebot_update_t **updates, int *count,
                                            telebot_linear_allocator_t *allocator);
 
+/**
+ * Parse a getUpdates response in a single pass, without building a json-c
+ * object first. Updates and everything they point to are allocated from the
+ * allocator, *updates is NULL when the response holds no update.
+ *
+ * With zero_copy, strings without escape sequences are NUL terminated in
+ * place and point into data, which must then outlive the updates; only
+ * escaped strings are decoded into the allocator. Otherwise data is left
+ * untouched.
+ */
+telebot_error_e telebot_parser_parse_updates(char *data, size_t size,
+        bool zero_copy, telebot_update_t **updates, int *count,
+        telebot_linear_allocator_t *allocator);
+
+/**
+ * Parse a single Update object, as posted to a webhook, the same way as
+ * telebot_parser_parse_updates().
+ */
+telebot_error_e telebot_parser_parse_update(char *data, size_t size,
+        bool zero_copy, telebot_update_t *update,
+        telebot_linear_allocator_t *allocator);
+
+typedef struct telebot_stream_parser telebot_stream_parser_t;
+
+/**
+ * Start parsing a getUpdates response that arrives in chunks. Every chunk is
+ * copied to the allocator and parsed there in place, so strings point into
+ * those copies and the response is never held in one contiguous buffer.
+ */
+telebot_stream_parser_t *telebot_parser_stream_create(
+        telebot_linear_allocator_t *allocator);
+
+/** Parse the next chunk, a token split between chunks is carried over. */
+telebot_error_e telebot_parser_stream_feed(telebot_stream_parser_t *parser,
+        const char *data, size_t size);
+
+/**
+ * Get the updates of a completely fed response and free the parser, the same
+ * as telebot_parser_parse_updates(). The parser is freed on failure too.
+ */
+telebot_error_e telebot_parser_stream_finish(telebot_stream_parser_t *parser,
+        telebot_update_t **updates, int *count);
+
 /** Parse message object */
 telebot_error_e telebot_parser_get_message(struct json_object *obj,
                                            telebot_message_t *msg,
@@ -41,43 +96,45 @@ telebot_error_e telebot_parser_get_user(struct json_object *obj,
                                         telebot_linear_allocator_t *allocator);
 /** Prase chat object */
 telebot_error_e telebot_parser_get_chat(struct json_object *obj,
-        telebot_chat_t *chat);
+        telebot_chat_t *chat, telebot_linear_allocator_t *allocator);
 
 /** Prase audio object */
 telebot_error_e telebot_parser_get_audio(struct json_object *obj,
-        telebot_audio_t *audio);
+        telebot_audio_t *audio, telebot_linear_allocator_t *allocator);
 
 /** Prase document object */
 telebot_error_e telebot_parser_get_document(struct json_object *obj,
-        telebot_document_t *document);
+        telebot_document_t *document, telebot_linear_allocator_t *allocator);
 
 /** Prase profile photos object */
 telebot_error_e telebot_parser_get_profile_photos(struct json_object *obj,
-        telebot_photo_t **photos, int *count);
+        telebot_photo_t **photos, int *count,
+        telebot_linear_allocator_t *allocator);
 
 /** Prase photo size object */
 telebot_error_e telebot_parser_get_photo(struct json_object *obj,
-        telebot_photo_t *photo);
+        telebot_photo_t *photo, telebot_linear_allocator_t *allocator);
 
 /** Prase array of photo size objects */
 telebot_error_e telebot_parser_get_photos(struct json_object *obj,
-        telebot_photo_t photo_array[], int array_size);
+        telebot_photo_t **photos, int *count,
+        telebot_linear_allocator_t *allocator);
 
 /** Prase sticker object */
 telebot_error_e telebot_parser_get_sticker(struct json_object *obj,
-        telebot_sticker_t *sticker);
+        telebot_sticker_t *sticker, telebot_linear_allocator_t *allocator);
 
 /** Prase video object */
 telebot_error_e telebot_parser_get_video(struct json_object *obj,
-        telebot_video_t *video);
+        telebot_video_t *video, telebot_linear_allocator_t *allocator);
 
 /** Prase voice object */
 telebot_error_e telebot_parser_get_voice(struct json_object *obj,
-        telebot_voice_t *voice);
+        telebot_voice_t *voice, telebot_linear_allocator_t *allocator);
 
 /** Prase contact object */
 telebot_error_e telebot_parser_get_contact(struct json_object *obj,
-        telebot_contact_t *contact);
+        telebot_contact_t *contact, telebot_linear_allocator_t *allocator);
 
 /** Prase location object */
 telebot_error_e telebot_parser_get_location(struct json_object *obj,
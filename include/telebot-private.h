@@ -22,8 +22,38 @@
 #define TELEBOT_API_URL                      "https://api.telegram.org"
 #define TELEBOT_URL_SIZE                     1024
 #define TELEBOT_UPDATE_POLLING_INTERVAL      1000000 // 1 second
+#define TELEBOT_UPDATE_POLLING_TIMEOUT       30 // seconds, long polling
+#define TELEBOT_UPDATE_POLLING_GRACE         10 // seconds, on top of timeout
 #define TELEBOT_UPDATE_COUNT_MAX_LIMIT       100
 #define TELEBOT_UPDATE_COUNT_PER_REQUEST     10
+#define TELEBOT_CORE_CONNECTION_POOL_SIZE    4
+#define TELEBOT_CORE_CONNECTION_MAX_AGE      118 // seconds, same as libcurl
+#define TELEBOT_CORE_RESPONSE_SIZE_MIN       (4 * 1024)
+#define TELEBOT_CORE_RESPONSE_SIZE_RETAIN    (256 * 1024) // kept between requests
+#define TELEBOT_CORE_RESPONSE_SIZE_MAX       (64 * 1024 * 1024)
+#define TELEBOT_CORE_RETRY_MAX               3 // retries of a failed request
+#define TELEBOT_CORE_RETRY_AFTER_MAX         60 // seconds, longer 429 waits fail
+#define TELEBOT_CORE_BACKOFF_MIN             250000 // microseconds, first retry
+#define TELEBOT_CORE_BACKOFF_MAX             30000000 // microseconds
+#define TELEBOT_CORE_STREAM_CHECK_INTERVAL   250000 // microseconds, retry sleeps
+#define TELEBOT_ALLOCATOR_RESIDENT_SIZE      (64 * 1024) // kept committed
+#define TELEBOT_ALLOCATOR_CHUNK_SIZE         (16 * 1024 * 1024)
+#define TELEBOT_MUX_ALLOCATOR_CHUNK_SIZE     (1024 * 1024) // per bot of a mux
+#define TELEBOT_DISPATCHER_QUEUE_SIZE        128 // updates per worker
+#define TELEBOT_DISPATCHER_WORKERS_MAX       64
+#define TELEBOT_DISPATCHER_BATCHES_MAX       (TELEBOT_DISPATCHER_QUEUE_SIZE + 2)
+#define TELEBOT_DISPATCHER_BATCHES_SPARE     2 // arenas kept between batches
+#define TELEBOT_WEBHOOK_REQUEST_SIZE_MAX     (1024 * 1024) // headers and body
+#define TELEBOT_WEBHOOK_CONNECTIONS_MAX      1024
+#define TELEBOT_WEBHOOK_EVENTS               64 // per epoll_wait
+#define TELEBOT_SCHEDULER_GLOBAL_RATE        30 // messages per second
+#define TELEBOT_SCHEDULER_CHAT_RATE          60 // messages per minute
+#define TELEBOT_SCHEDULER_GROUP_RATE         20 // messages per minute
+#define TELEBOT_SCHEDULER_HEADROOM           0.95 // of the rates, for jitter
+#define TELEBOT_SCHEDULER_CHATS_MIN          64 // initial chat map size
+#define TELEBOT_SCHEDULER_QUEUE_MIN          64 // initial queue size
+#define TELEBOT_PARSER_DEPTH_MAX             16 // nested objects and arrays
+#define TELEBOT_PARSER_ARRAYS_MAX            4 // nested arrays
 
 #define TELEBOT_METHOD_GET_ME                "getMe"
 #define TELEBOT_METHOD_GET_UPDATES           "getUpdates"
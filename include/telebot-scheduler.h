@@ -0,0 +1,86 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TELEBOT_SCHEDULER_H__
+#define __TELEBOT_SCHEDULER_H__
+
+typedef struct telebot_scheduler telebot_scheduler_t;
+
+/**
+ * Called from the scheduler thread when a submitted message may be sent, with
+ * TELEBOT_ERROR_NONE, or was dropped, with an error. It must not block.
+ */
+typedef void (*telebot_scheduler_release_f)(telebot_error_e ret, void *data);
+
+/**
+ * Create a scheduler spacing out the messages of a bot, with the default
+ * Telegram limits.
+ */
+telebot_scheduler_t *telebot_scheduler_create(void);
+
+/** Destroy a scheduler, after closing it. No acquire may be waiting. */
+void telebot_scheduler_destroy(telebot_scheduler_t *scheduler);
+
+/**
+ * Set the global rate per second, the rate per minute of private chats and
+ * of groups and channels, 0 lifting a limit. Messages that would wait longer
+ * than max_wait seconds are dropped, 0 waits as long as it takes.
+ */
+void telebot_scheduler_set_rate(telebot_scheduler_t *scheduler,
+        int global_rate, int chat_rate, int group_rate, int max_wait);
+
+/**
+ * Take the next free slot of the global and chat limits for a message to
+ * chat_id, and block the calling thread until it comes. Returns
+ * TELEBOT_ERROR_RATE_LIMITED if the message was dropped instead. Every
+ * successful call MUST be followed by telebot_scheduler_done() once the
+ * message was sent.
+ */
+telebot_error_e telebot_scheduler_acquire(telebot_scheduler_t *scheduler,
+        const char *chat_id);
+
+/** Account for the outcome of a message released by acquire. */
+void telebot_scheduler_done(telebot_scheduler_t *scheduler,
+        telebot_error_e ret);
+
+/**
+ * Queue a message to chat_id without blocking. Its chat slot is taken right
+ * away, and release is called from the scheduler thread once the slot and
+ * the next global slot have come. A message released with TELEBOT_ERROR_NONE
+ * MUST be followed by telebot_scheduler_complete() once it was sent. On
+ * failure release is never called.
+ */
+telebot_error_e telebot_scheduler_submit(telebot_scheduler_t *scheduler,
+        const char *chat_id, telebot_scheduler_release_f release, void *data);
+
+/** Account for the outcome of a message released by the queue. */
+void telebot_scheduler_complete(telebot_scheduler_t *scheduler,
+        telebot_error_e ret);
+
+/**
+ * Refuse new messages, release the queued ones with
+ * TELEBOT_ERROR_OPERATION_FAILED and wait until every released message was
+ * completed. MUST NOT be called from a release function.
+ */
+void telebot_scheduler_close(telebot_scheduler_t *scheduler);
+
+/** Get queue and rate limit statistics. */
+void telebot_scheduler_get_stats(telebot_scheduler_t *scheduler,
+        telebot_send_stats_t *stats);
+
+#endif /* __TELEBOT_SCHEDULER_H__ */
@@ -0,0 +1,50 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TELEBOT_STATS_H__
+#define __TELEBOT_STATS_H__
+
+#define TELEBOT_STATS_DOWNLOAD "download"
+
+typedef struct telebot_stats telebot_stats_t;
+
+/** Create empty per-method request statistics. */
+telebot_stats_t *telebot_stats_create(void);
+
+/** Destroy request statistics, no request may be recording into them. */
+void telebot_stats_destroy(telebot_stats_t *stats);
+
+/**
+ * Record one attempt of method performed on curl_h, with its outcome and the
+ * phase timings curl measured for it.
+ */
+void telebot_stats_attempt(telebot_stats_t *stats, const char *method,
+        CURL *curl_h, CURLcode res, long resp_code);
+
+/** Record that a failed attempt of method is going to be repeated. */
+void telebot_stats_retry(telebot_stats_t *stats, const char *method);
+
+/** Record the outcome of a request of method, after its last attempt. */
+void telebot_stats_done(telebot_stats_t *stats, const char *method,
+        bool failed);
+
+/** Copy the statistics, while requests keep recording into them. */
+void telebot_stats_read(telebot_stats_t *stats,
+        telebot_core_stats_t *snapshot);
+
+#endif /* __TELEBOT_STATS_H__ */
@@ -0,0 +1,59 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TELEBOT_WEBHOOK_H__
+#define __TELEBOT_WEBHOOK_H__
+
+typedef struct telebot_webhook telebot_webhook_t;
+
+/**
+ * Called for every POST body received, returns the HTTP status to answer
+ * with. The body may be modified and stays valid until the round callback
+ * returned.
+ */
+typedef int (*telebot_webhook_request_cb_f)(char *body, size_t size,
+        void *user_data);
+
+/**
+ * Called once the requests received in one round of the event loop were
+ * passed to the request callback, before any of them is answered.
+ */
+typedef void (*telebot_webhook_round_cb_f)(void *user_data);
+
+/**
+ * Start an HTTP/1.1 server on port of every interface, 0 picks a free port.
+ * Connections are kept alive and served by a single epoll thread. With a
+ * path, POSTs to any other target are answered with 404.
+ */
+telebot_webhook_t *telebot_webhook_start(int port, const char *path,
+        telebot_webhook_request_cb_f request_cb,
+        telebot_webhook_round_cb_f round_cb, void *user_data);
+
+/** Port the server is listening on. */
+int telebot_webhook_port(telebot_webhook_t *webhook);
+
+/** Ask the server thread to leave its loop, without waiting for it. */
+void telebot_webhook_signal(telebot_webhook_t *webhook);
+
+/** Whether the calling thread is the server thread. */
+bool telebot_webhook_is_thread(telebot_webhook_t *webhook);
+
+/** Stop the server thread and close every connection. */
+void telebot_webhook_stop(telebot_webhook_t *webhook);
+
+#endif /* __TELEBOT_WEBHOOK_H__ */
@@ -19,10 +19,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
 #include <errno.h>
+#include <sys/mman.h>
 #include <json.h>
 #include <json_object.h>
 #include <telebot-private.h>
@@ -30,245 +35,1952 @@
 #include <telebot-core-api.h>
 #include <telebot-api.h>
 #include <telebot-parser.h>
+#include <telebot-dispatcher.h>
+#include <telebot-webhook.h>
+#include <telebot-scheduler.h>
+#include <telebot-metrics.h>
 #include <assert.h>
 
 
-// TODO(erick): Since theses values are not thread local we can't
-// spawn more than one thread to handle updates.
-static telebot_update_cb_f g_update_cb;
-static telebot_core_h *g_handler;
-static bool g_run_telebot;
+/* Long poll of a bot driven by a multiplexer, under the lock of the mux */
+struct telebot_mux_poll {
+    telebot_stream_parser_t *parser;
+    int arena; /* Arena the poll in flight is parsed into */
+    int limit;
+    telebot_error_e ret;
+    telebot_update_t *updates;
+    int count;
+    bool busy; /* A batch is being handled */
+    bool completed; /* The next poll completed while busy */
+    unsigned long due_us; /* When a delayed poll is issued */
+    struct telebot_handler *next; /* Ready or delayed list */
+};
+
+/*
+ * Everything a bot needs lives in its handle, so any number of bots can run
+ * in one process, each with its own polling thread.
+ */
+struct telebot_handler {
+    telebot_core_h core;
+    telebot_update_cb_f update_cb;
+    void *user_data;
+    atomic_bool running;
+    int polling_timeout;
+    pthread_mutex_t update_lock;
+    bool polling; /* The polling thread still uses the bot */
+    pthread_t polling_thread;
+    pthread_cond_t polling_cond; /* Signaled once it let go of the bot */
+    struct telebot_fetch *fetch; /* Of the polling thread, to wake it */
+    int update_min_limit;
+    int update_max_limit;
+    bool update_adaptive;
+    telebot_update_stats_t update_stats;
+    int workers;
+    telebot_dispatcher_t *dispatcher;
+    telebot_dispatch_stats_t dispatch_stats;
+    telebot_scheduler_t *scheduler; /* Spaces out sent messages */
+    // Two arenas of a mux poll: the batch being handled and the one being
+    // prefetched. The first one also serves the webhook.
+    telebot_linear_allocator_t update_allocator[2];
+    // Result of the last telebot_get_updates(), reset by the next call.
+    telebot_linear_allocator_t get_updates_allocator;
+    // Arenas of the polling thread, one per batch until it was handled.
+    struct telebot_batch *batches_free;
+    int batches_free_count;
+    int batches_count;
+    pthread_cond_t batches_cond; /* Signaled when one is put back */
+    telebot_webhook_t *webhook; /* Receiving instead of polling */
+    telebot_mux_t *mux; /* Polled by a mux instead of its own thread */
+    struct telebot_handler *mux_next;
+    telebot_metrics_t *metrics; /* Serving the metrics page */
+    telebot_core_stats_t *metrics_stats; /* Snapshot of each scrape */
+    struct telebot_mux_poll poll;
+};
+
+/* Arena of a polled batch, put back by the worker handling its last update */
+struct telebot_batch {
+    telebot_dispatch_batch_t dispatch;
+    telebot_h *bot;
+    telebot_linear_allocator_t allocator;
+    struct telebot_batch *next_free;
+};
+
+/*
+ * A mux drives the long polls of all its bots as asynchronous requests on the
+ * curl multi loop of one shared transport. Completed batches are queued for a
+ * few worker threads running the update callbacks, the next poll of a bot is
+ * issued before its batch is handled.
+ */
+struct telebot_mux {
+    telebot_core_h core; /* Only holds the transport the bots share */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;
+    int workers;
+    pthread_t *threads;
+    int threads_count;
+    telebot_h *bots;
+    telebot_h *ready_head;
+    telebot_h *ready_tail;
+    telebot_h *delayed;
+};
+
 static void *telebot_polling_thread(void *data);
-static telebot_linear_allocator_t update_allocator;
+static void telebot_fetch_wake(struct telebot_fetch *fetch);
+static telebot_error_e telebot_get_updates_timeout(telebot_h *bot,
+        telebot_update_t **updates, int *count, int limit, int timeout,
+        telebot_linear_allocator_t *allocator, const atomic_bool *running);
 
 // TODO(erick): All occurencies of ids should match the API types.
 
-telebot_linear_allocator_t telebot_linear_allocator_create(size_t total_capacity)
+/*
+ * Chunks only reserve address space: pages are committed by the kernel when
+ * first touched, so RSS follows what the batches actually use. Memory handed
+ * out is zeroed, either fresh from the kernel or cleared by zero_all/rewind.
+ */
+struct telebot_linear_allocator_chunk {
+    struct telebot_linear_allocator_chunk *next;
+    size_t capacity; /* Bytes in data */
+    size_t offset; /* Bytes handed out */
+    size_t dirty; /* Bytes handed out since last cleared */
+    char *data;
+};
+
+/* Adopted malloc blocks, the list itself lives in the arena */
+struct telebot_linear_allocator_block {
+    struct telebot_linear_allocator_block *next;
+    void *data;
+};
+
+#define TELEBOT_ALLOCATOR_ALIGNMENT _Alignof(max_align_t)
+#define TELEBOT_ALLOCATOR_HEADER_SIZE \
+    ((sizeof(struct telebot_linear_allocator_chunk) + \
+      TELEBOT_ALLOCATOR_ALIGNMENT - 1) & ~(TELEBOT_ALLOCATOR_ALIGNMENT - 1))
+
+static struct telebot_linear_allocator_chunk *telebot_linear_allocator_chunk_create(
+        size_t capacity)
+{
+    size_t size = TELEBOT_ALLOCATOR_HEADER_SIZE + capacity;
+    struct telebot_linear_allocator_chunk *chunk = mmap(NULL, size,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+            -1, 0);
+    if (chunk == MAP_FAILED) {
+        ERR("Failed to map %zu bytes, error: %d", size, errno);
+        return NULL;
+    }
+
+    chunk->capacity = capacity;
+    chunk->data = (char *)chunk + TELEBOT_ALLOCATOR_HEADER_SIZE;
+
+    return chunk;
+}
+
+/*
+ * Clear chunk->data[start, chunk->dirty). Up to keep bytes are memset and
+ * stay committed, whole pages beyond are given back to the kernel, which
+ * hands out zero pages again on the next touch.
+ */
+static void telebot_linear_allocator_chunk_clear(
+        struct telebot_linear_allocator_chunk *chunk, size_t start, size_t keep)
+{
+    if (chunk->dirty <= start)
+        return;
+
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t from = (uintptr_t)(chunk->data + start);
+    uintptr_t to = (uintptr_t)(chunk->data + chunk->dirty);
+    uintptr_t release = (from + keep + page - 1) & ~(page - 1);
+
+    if (release >= to) {
+        memset((void *)from, 0, to - from);
+    }
+    else {
+        memset((void *)from, 0, release - from);
+        to = (to + page - 1) & ~(page - 1);
+        if (madvise((void *)release, to - release, MADV_DONTNEED) != 0)
+            memset((void *)release, 0, chunk->data + chunk->dirty -
+                    (char *)release);
+    }
+    chunk->dirty = start;
+}
+
+telebot_linear_allocator_t telebot_linear_allocator_create(size_t chunk_size)
 {
     telebot_linear_allocator_t result;
-    result.data_ptr = malloc(total_capacity);
-    assert(result.data_ptr);
+    result.chunk_size = chunk_size;
+    result.head = telebot_linear_allocator_chunk_create(chunk_size);
 
-    result.current_offset = 0;
-    result.capacity = total_capacity;
+    result.current = result.head;
+    result.used = 0;
+    result.high_water = 0;
+    result.blocks = NULL;
 
     return result;
 }
 
+/* Free the blocks adopted after stop, before their list nodes are cleared */
+static void telebot_linear_allocator_release(
+        telebot_linear_allocator_t *allocator,
+        struct telebot_linear_allocator_block *stop)
+{
+    while (allocator->blocks != stop) {
+        free(allocator->blocks->data);
+        allocator->blocks = allocator->blocks->next;
+    }
+}
+
 void telebot_linear_allocator_zero_all(telebot_linear_allocator_t *allocator)
 {
-    memset(allocator->data_ptr, 0, allocator->capacity);
+    struct telebot_linear_allocator_chunk *chunk;
+    size_t keep = TELEBOT_ALLOCATOR_RESIDENT_SIZE;
+    for (chunk = allocator->head; chunk != NULL; chunk = chunk->next) {
+        telebot_linear_allocator_chunk_clear(chunk, 0, keep);
+        keep = 0;
+    }
 }
 
 void telebot_linear_allocator_free_all(telebot_linear_allocator_t *allocator)
 {
-    allocator->current_offset = 0;
+    telebot_linear_allocator_release(allocator, NULL);
+
+    struct telebot_linear_allocator_chunk *chunk;
+    for (chunk = allocator->head; chunk != NULL; chunk = chunk->next)
+        chunk->offset = 0;
+
+    allocator->current = allocator->head;
+    allocator->used = 0;
 }
 
-// TODO(erick): We probably want to use mmap for this.
-void *telebot_linear_allocator_alloc(telebot_linear_allocator_t *allocator, size_t size)
+void *telebot_linear_allocator_alloc_aligned(telebot_linear_allocator_t *allocator,
+        size_t size, size_t alignment)
 {
-    if(allocator->current_offset + size >= allocator->capacity) {
+    if ((alignment == 0) || ((alignment & (alignment - 1)) != 0) ||
+            (alignment > (size_t)sysconf(_SC_PAGESIZE)))
         return NULL;
+
+    struct telebot_linear_allocator_chunk *chunk = allocator->current;
+    size_t pad;
+    while (true) {
+        uintptr_t address = (uintptr_t)(chunk->data + chunk->offset);
+        pad = (alignment - (address & (alignment - 1))) & (alignment - 1);
+        if ((chunk->capacity - chunk->offset >= pad) &&
+                (chunk->capacity - chunk->offset - pad >= size))
+            break;
+
+        // Chunks left behind by a reset are reused before growing.
+        if (chunk->next == NULL) {
+            size_t capacity = allocator->chunk_size;
+            if (capacity < size + alignment)
+                capacity = size + alignment;
+            chunk->next = telebot_linear_allocator_chunk_create(capacity);
+            if (chunk->next == NULL)
+                return NULL;
+        }
+        chunk = chunk->next;
     }
 
-    void* result = allocator->data_ptr + allocator->current_offset;
-    allocator->current_offset += size;
+    void *result = chunk->data + chunk->offset + pad;
+    chunk->offset += pad + size;
+    if (chunk->offset > chunk->dirty)
+        chunk->dirty = chunk->offset;
+
+    allocator->current = chunk;
+    allocator->used += pad + size;
+    if (allocator->used > allocator->high_water)
+        allocator->high_water = allocator->used;
+
     return result;
 }
 
-void telebot_linear_allocator_destroy(telebot_linear_allocator_t *allocator)
-{
-    free(allocator->data_ptr);
+void *telebot_linear_allocator_alloc(telebot_linear_allocator_t *allocator, size_t size)
+{
+    return telebot_linear_allocator_alloc_aligned(allocator, size,
+            TELEBOT_ALLOCATOR_ALIGNMENT);
+}
+
+telebot_linear_allocator_mark_t telebot_linear_allocator_mark(
+        telebot_linear_allocator_t *allocator)
+{
+    telebot_linear_allocator_mark_t mark;
+    mark.chunk = allocator->current;
+    mark.offset = allocator->current->offset;
+    mark.used = allocator->used;
+    mark.blocks = allocator->blocks;
+
+    return mark;
+}
+
+void telebot_linear_allocator_rewind(telebot_linear_allocator_t *allocator,
+        telebot_linear_allocator_mark_t mark)
+{
+    telebot_linear_allocator_release(allocator, mark.blocks);
+
+    struct telebot_linear_allocator_chunk *chunk;
+    size_t start = mark.offset;
+    for (chunk = mark.chunk; chunk != NULL; chunk = chunk->next) {
+        telebot_linear_allocator_chunk_clear(chunk, start, 0);
+        chunk->offset = start;
+        start = 0;
+    }
+
+    allocator->current = mark.chunk;
+    allocator->used = mark.used;
+}
+
+telebot_error_e telebot_linear_allocator_adopt(
+        telebot_linear_allocator_t *allocator, void *block)
+{
+    struct telebot_linear_allocator_block *node =
+        telebot_linear_allocator_alloc(allocator,
+                sizeof(struct telebot_linear_allocator_block));
+    if (node == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+
+    node->data = block;
+    node->next = allocator->blocks;
+    allocator->blocks = node;
+
+    return TELEBOT_ERROR_NONE;
+}
+
+void telebot_linear_allocator_destroy(telebot_linear_allocator_t *allocator)
+{
+    telebot_linear_allocator_release(allocator, NULL);
+
+    struct telebot_linear_allocator_chunk *chunk = allocator->head;
+    while (chunk != NULL) {
+        struct telebot_linear_allocator_chunk *next = chunk->next;
+        munmap(chunk, TELEBOT_ALLOCATOR_HEADER_SIZE + chunk->capacity);
+        chunk = next;
+    }
+
+    allocator->head = allocator->current = NULL;
+}
+
+static pthread_key_t g_call_key;
+static pthread_once_t g_call_once = PTHREAD_ONCE_INIT;
+
+static void telebot_call_response_free(void *data)
+{
+    telebot_core_response_free(data);
+    free(data);
+}
+
+static void telebot_call_key_create(void)
+{
+    pthread_key_create(&g_call_key, telebot_call_response_free);
+}
+
+/*
+ * The wrappers below may be called from several update workers at once, all
+ * on the core handler of the bot. The wrappers that read the response get it
+ * in a response object of the calling thread, which is kept so that its
+ * buffer is reused by the next call; the others let the core drop the body.
+ */
+static telebot_core_response_t *telebot_call_response(void)
+{
+    pthread_once(&g_call_once, telebot_call_key_create);
+
+    telebot_core_response_t *response = pthread_getspecific(g_call_key);
+    if (response == NULL) {
+        response = calloc(1, sizeof(telebot_core_response_t));
+        if (response == NULL) {
+            ERR("Failed to allocate memory");
+            return NULL;
+        }
+        if (pthread_setspecific(g_call_key, response) != 0) {
+            free(response);
+            return NULL;
+        }
+    }
+
+    return response;
+}
+
+static void telebot_free(telebot_h *bot);
+
+static telebot_error_e telebot_create_ex(telebot_h **bot, char *token,
+        const telebot_core_options_t *options, size_t chunk_size)
+{
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    *bot = NULL;
+
+    telebot_h *handle = calloc(1, sizeof(telebot_h));
+    if (handle == NULL) {
+        ERR("Failed to allocate memory");
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+    }
+
+    telebot_error_e ret = telebot_core_create_ex(&(handle->core), token,
+            options);
+    if (ret != TELEBOT_ERROR_NONE) {
+        free(handle);
+        return ret;
+    }
+
+    handle->scheduler = telebot_scheduler_create();
+    if (handle->scheduler == NULL) {
+        telebot_core_destroy(&(handle->core));
+        free(handle);
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+    }
+
+    pthread_mutex_init(&(handle->update_lock), NULL);
+    pthread_cond_init(&(handle->polling_cond), NULL);
+    pthread_cond_init(&(handle->batches_cond), NULL);
+    handle->polling_timeout = TELEBOT_UPDATE_POLLING_TIMEOUT;
+    handle->update_min_limit = TELEBOT_UPDATE_COUNT_PER_REQUEST;
+    handle->update_max_limit = TELEBOT_UPDATE_COUNT_MAX_LIMIT;
+    handle->update_adaptive = true;
+    handle->update_stats.limit = TELEBOT_UPDATE_COUNT_PER_REQUEST;
+
+    handle->update_allocator[0] = telebot_linear_allocator_create(chunk_size);
+    handle->update_allocator[1] = telebot_linear_allocator_create(chunk_size);
+    handle->get_updates_allocator = telebot_linear_allocator_create(
+            chunk_size);
+    if ((handle->update_allocator[0].head == NULL) ||
+            (handle->update_allocator[1].head == NULL) ||
+            (handle->get_updates_allocator.head == NULL)) {
+        telebot_core_destroy(&(handle->core));
+        telebot_free(handle);
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+    }
+
+    *bot = handle;
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_create(telebot_h **bot, char *token)
+{
+    return telebot_create_ex(bot, token, NULL, TELEBOT_ALLOCATOR_CHUNK_SIZE);
+}
+
+telebot_error_e telebot_create_with_options(telebot_h **bot, char *token,
+        const telebot_core_options_t *options)
+{
+    return telebot_create_ex(bot, token, options,
+            TELEBOT_ALLOCATOR_CHUNK_SIZE);
+}
+
+telebot_error_e telebot_create_shared(telebot_h **bot, char *token,
+        telebot_h *share)
+{
+    if (share == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_options_t options = { .share = &(share->core) };
+
+    return telebot_create_ex(bot, token, &options,
+            TELEBOT_ALLOCATOR_CHUNK_SIZE);
+}
+
+/* The core handler MUST have been destroyed already */
+static void telebot_free(telebot_h *bot)
+{
+    telebot_linear_allocator_destroy(&(bot->update_allocator[0]));
+    telebot_linear_allocator_destroy(&(bot->update_allocator[1]));
+    telebot_linear_allocator_destroy(&(bot->get_updates_allocator));
+    while (bot->batches_free != NULL) {
+        struct telebot_batch *batch = bot->batches_free;
+        bot->batches_free = batch->next_free;
+        telebot_linear_allocator_destroy(&(batch->allocator));
+        free(batch);
+    }
+    pthread_mutex_destroy(&(bot->update_lock));
+    pthread_cond_destroy(&(bot->polling_cond));
+    pthread_cond_destroy(&(bot->batches_cond));
+    telebot_scheduler_destroy(bot->scheduler);
+    free(bot);
+}
+
+telebot_error_e telebot_destroy(telebot_h *bot)
+{
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    if (bot->mux != NULL)
+        return TELEBOT_ERROR_NOT_SUPPORTED;
+
+    telebot_stop(bot);
+    telebot_stop_metrics(bot);
+    telebot_scheduler_close(bot->scheduler);
+    telebot_core_destroy(&(bot->core));
+    telebot_free(bot);
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_start(telebot_h *bot, telebot_update_cb_f update_cb,
+        void *user_data, bool should_deatach_thread, pthread_t* thread_id)
+{
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    if (update_cb == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    if ((bot->mux != NULL) || (bot->webhook != NULL))
+        return TELEBOT_ERROR_NOT_SUPPORTED;
+
+    pthread_t t_id;
+    pthread_attr_t attr;
+
+    if(thread_id == NULL) {
+        thread_id = &t_id;
+    }
+
+    int ret = pthread_attr_init(&attr);
+    if (ret != 0) {
+        ERR("Failed to init pthread attributes, error: %d", errno);
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    }
+
+    if(should_deatach_thread) {
+        ret = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (ret != 0) {
+            ERR("Failed to set pthread detatched attribute, error: %d", errno);
+            return TELEBOT_ERROR_OPERATION_FAILED;
+        }
+    }
+
+    telebot_dispatcher_t *dispatcher = telebot_dispatcher_create(bot->workers,
+            bot, update_cb, user_data);
+    if (dispatcher == NULL)
+        return TELEBOT_ERROR_OPERATION_FAILED;
+
+    pthread_mutex_lock(&(bot->update_lock));
+    if (bot->polling) {
+        // Stopped from an update callback, the thread is still winding down.
+        pthread_mutex_unlock(&(bot->update_lock));
+        telebot_dispatcher_destroy(dispatcher);
+        return TELEBOT_ERROR_NOT_SUPPORTED;
+    }
+    bot->dispatcher = dispatcher;
+
+    bot->update_cb = update_cb;
+    bot->user_data = user_data;
+    bot->running = true;
+
+    // The thread waits for the lock, so its id is known before it runs.
+    ret = pthread_create(thread_id, &attr, telebot_polling_thread, bot);
+    if (ret != 0) {
+        ERR("Failed to create thread, error: %d", errno);
+        bot->update_cb = NULL;
+        bot->running = false;
+        bot->dispatcher = NULL;
+        pthread_mutex_unlock(&(bot->update_lock));
+        telebot_dispatcher_destroy(dispatcher);
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    }
+    bot->polling = true;
+    bot->polling_thread = *thread_id;
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_stop(telebot_h *bot)
+{
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    if (bot->mux != NULL)
+        return TELEBOT_ERROR_NOT_SUPPORTED;
+
+    // Like the polling thread, the webhook thread and the workers it feeds
+    // only ask it to stop; it is joined by the next telebot_stop() from
+    // outside, or by telebot_destroy().
+    pthread_mutex_lock(&(bot->update_lock));
+    telebot_webhook_t *webhook = bot->webhook;
+    if ((webhook != NULL) && (telebot_webhook_is_thread(webhook) ||
+                telebot_dispatcher_is_worker(bot->dispatcher))) {
+        bot->running = false;
+        pthread_mutex_unlock(&(bot->update_lock));
+        telebot_webhook_signal(webhook);
+        return TELEBOT_ERROR_NONE;
+    }
+    bot->webhook = NULL;
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    if (webhook != NULL) {
+        telebot_webhook_stop(webhook);
+
+        pthread_mutex_lock(&(bot->update_lock));
+        telebot_dispatcher_t *dispatcher = bot->dispatcher;
+        telebot_dispatcher_get_stats(dispatcher, &(bot->dispatch_stats));
+        bot->dispatcher = NULL;
+        pthread_mutex_unlock(&(bot->update_lock));
+        telebot_dispatcher_destroy(dispatcher);
+    }
+
+    bot->running = false;
+
+    // Wake the polling thread out of its wait between polls, a long poll in
+    // flight notices the stop within a second, and wait until the thread is
+    // done with the bot. The callbacks run on it or on the workers it owns,
+    // from there the stop is only requested.
+    pthread_mutex_lock(&(bot->update_lock));
+    if (bot->fetch != NULL)
+        telebot_fetch_wake(bot->fetch);
+    if (bot->polling &&
+            !pthread_equal(bot->polling_thread, pthread_self()) &&
+            !telebot_dispatcher_is_worker(bot->dispatcher)) {
+        while (bot->polling)
+            pthread_cond_wait(&(bot->polling_cond), &(bot->update_lock));
+    }
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    bot->update_cb = NULL;
+
+    return TELEBOT_ERROR_NONE;
+}
+
+/*
+ * Every POST carries one update. The updates of a round of the event loop are
+ * parsed into the first arena, strings pointing into the request buffers, and
+ * go through the dispatcher as a batch before the requests are answered.
+ */
+static int telebot_webhook_update(char *body, size_t size, void *user_data)
+{
+    telebot_h *bot = user_data;
+    telebot_linear_allocator_t *allocator = &(bot->update_allocator[0]);
+
+    telebot_update_t *update = telebot_linear_allocator_alloc(allocator,
+            sizeof(telebot_update_t));
+    if (update == NULL)
+        return 500;
+
+    if (telebot_parser_parse_update(body, size, true, update, allocator) !=
+            TELEBOT_ERROR_NONE)
+        return 400;
+
+    telebot_dispatcher_submit(bot->dispatcher, update);
+
+    return 200;
+}
+
+static void telebot_webhook_round(void *user_data)
+{
+    telebot_h *bot = user_data;
+
+    telebot_dispatcher_wait(bot->dispatcher);
+    telebot_linear_allocator_free_all(&(bot->update_allocator[0]));
+    telebot_linear_allocator_zero_all(&(bot->update_allocator[0]));
+}
+
+telebot_error_e telebot_start_webhook(telebot_h *bot, int port,
+        const char *path, telebot_update_cb_f update_cb, void *user_data)
+{
+    if ((bot == NULL) || (update_cb == NULL) || (port < 0) || (port > 65535))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    if ((bot->mux != NULL) || (bot->webhook != NULL) || bot->running)
+        return TELEBOT_ERROR_NOT_SUPPORTED;
+
+    telebot_dispatcher_t *dispatcher = telebot_dispatcher_create(bot->workers,
+            bot, update_cb, user_data);
+    if (dispatcher == NULL)
+        return TELEBOT_ERROR_OPERATION_FAILED;
+
+    pthread_mutex_lock(&(bot->update_lock));
+    bot->dispatcher = dispatcher;
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    bot->update_cb = update_cb;
+    bot->user_data = user_data;
+    bot->running = true;
+
+    // A callback stopping the bot waits for the lock until it is published.
+    pthread_mutex_lock(&(bot->update_lock));
+    bot->webhook = telebot_webhook_start(port, path, telebot_webhook_update,
+            telebot_webhook_round, bot);
+    if (bot->webhook == NULL) {
+        bot->update_cb = NULL;
+        bot->running = false;
+        bot->dispatcher = NULL;
+        pthread_mutex_unlock(&(bot->update_lock));
+        telebot_dispatcher_destroy(dispatcher);
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    }
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_get_webhook_port(telebot_h *bot, int *port)
+{
+    if ((bot == NULL) || (port == NULL))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    if (bot->webhook == NULL)
+        return TELEBOT_ERROR_NOT_SUPPORTED;
+
+    *port = telebot_webhook_port(bot->webhook);
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_set_polling_timeout(telebot_h *bot, int timeout)
+{
+    if ((bot == NULL) || (timeout < 0))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    bot->polling_timeout = timeout;
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_set_update_limit(telebot_h *bot, int min_limit,
+        int max_limit, bool adaptive)
+{
+    if ((bot == NULL) || (min_limit < 1) || (max_limit > TELEBOT_UPDATE_COUNT_MAX_LIMIT) ||
+            (min_limit > max_limit))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&(bot->update_lock));
+    bot->update_min_limit = min_limit;
+    bot->update_max_limit = max_limit;
+    bot->update_adaptive = adaptive;
+    if (!adaptive)
+        bot->update_stats.limit = max_limit;
+    else if (bot->update_stats.limit < min_limit)
+        bot->update_stats.limit = min_limit;
+    else if (bot->update_stats.limit > max_limit)
+        bot->update_stats.limit = max_limit;
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_get_update_stats(telebot_h *bot,
+        telebot_update_stats_t *stats)
+{
+    if ((bot == NULL) || (stats == NULL))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&(bot->update_lock));
+    *stats = bot->update_stats;
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_set_workers(telebot_h *bot, int workers)
+{
+    if ((bot == NULL) || (workers < 0) ||
+            (workers > TELEBOT_DISPATCHER_WORKERS_MAX))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    if (bot->running)
+        return TELEBOT_ERROR_NOT_SUPPORTED;
+
+    bot->workers = workers;
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_get_dispatch_stats(telebot_h *bot,
+        telebot_dispatch_stats_t *stats)
+{
+    if ((bot == NULL) || (stats == NULL))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&(bot->update_lock));
+    if (bot->dispatcher != NULL)
+        telebot_dispatcher_get_stats(bot->dispatcher, stats);
+    else
+        *stats = bot->dispatch_stats;
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_set_rate_limit(telebot_h *bot, int global_rate,
+        int chat_rate, int group_rate, int max_wait)
+{
+    if ((bot == NULL) || (global_rate < 0) || (chat_rate < 0) ||
+            (group_rate < 0) || (max_wait < 0))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_scheduler_set_rate(bot->scheduler, global_rate, chat_rate,
+            group_rate, max_wait);
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_get_send_stats(telebot_h *bot,
+        telebot_send_stats_t *stats)
+{
+    if ((bot == NULL) || (stats == NULL))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_scheduler_get_stats(bot->scheduler, stats);
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_stats_snapshot(telebot_h *bot,
+        struct telebot_core_stats *stats)
+{
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    return telebot_core_stats_snapshot(&(bot->core), stats);
+}
+
+static const char *telebot_metrics_phases[TELEBOT_CORE_PHASES] = {
+    "dns", "connect", "tls", "ttfb", "total",
+};
+
+/* One family of a per-method counter, for the methods used so far */
+static void telebot_metrics_methods(telebot_metrics_page_t *page,
+        const telebot_core_stats_t *stats, const char *name, const char *help,
+        size_t offset)
+{
+    char labels[64];
+    int index;
+
+    telebot_metrics_family(page, name, "counter", help);
+    for (index = 0; index < TELEBOT_CORE_STATS_METHODS; index++) {
+        const telebot_core_method_stats_t *method = &(stats->methods[index]);
+        if (method->requests == 0)
+            continue;
+
+        snprintf(labels, sizeof(labels), "method=\"%s\"", method->method);
+        telebot_metrics_sample(page, name, "_total", labels,
+                *(const unsigned long *)((const char *)method + offset));
+    }
+}
+
+/* Runs on the metrics thread, the snapshot buffer is the only one needed */
+static void telebot_metrics_render(telebot_metrics_page_t *page,
+        void *user_data)
+{
+    telebot_h *bot = user_data;
+    telebot_update_stats_t updates;
+    telebot_dispatch_stats_t dispatch;
+    telebot_send_stats_t send;
+    telebot_core_stats_t *stats = bot->metrics_stats;
+    char labels[96];
+    int index, phase;
+
+    telebot_get_update_stats(bot, &updates);
+    telebot_get_dispatch_stats(bot, &dispatch);
+    telebot_get_send_stats(bot, &send);
+    telebot_core_stats_snapshot(&(bot->core), stats);
+
+    telebot_metrics_family(page, "telebot_polls", "counter",
+            "getUpdates calls of the polling thread.");
+    telebot_metrics_sample(page, "telebot_polls", "_total", "outcome=\"ok\"",
+            updates.batches);
+    telebot_metrics_sample(page, "telebot_polls", "_total",
+            "outcome=\"failed\"", updates.failed_batches);
+    telebot_metrics_family(page, "telebot_full_polls", "counter",
+            "getUpdates calls that returned a full batch.");
+    telebot_metrics_sample(page, "telebot_full_polls", "_total", NULL,
+            updates.full_batches);
+    telebot_metrics_family(page, "telebot_updates_received", "counter",
+            "Updates received by polling.");
+    telebot_metrics_sample(page, "telebot_updates_received", "_total", NULL,
+            updates.updates);
+    telebot_metrics_family(page, "telebot_update_limit", "gauge",
+            "Batch limit of the next getUpdates call.");
+    telebot_metrics_sample(page, "telebot_update_limit", "", NULL,
+            updates.limit);
+    telebot_metrics_family(page, "telebot_update_backlog", "gauge",
+            "Updates drained since the server queue was last empty.");
+    telebot_metrics_sample(page, "telebot_update_backlog", "", NULL,
+            updates.backlog);
+    telebot_metrics_family(page, "telebot_update_arena_bytes", "gauge",
+            "Update arena bytes the last batch needed.");
+    telebot_metrics_sample(page, "telebot_update_arena_bytes", "", NULL,
+            updates.arena_used);
+    telebot_metrics_family(page, "telebot_update_arena_max_bytes", "gauge",
+            "Most update arena bytes a batch needed.");
+    telebot_metrics_sample(page, "telebot_update_arena_max_bytes", "", NULL,
+            updates.arena_high_water);
+
+    telebot_metrics_family(page, "telebot_updates_dispatched", "counter",
+            "Updates handed to the update callback.");
+    telebot_metrics_sample(page, "telebot_updates_dispatched", "_total", NULL,
+            dispatch.dispatched);
+    telebot_metrics_family(page, "telebot_updates_handled", "counter",
+            "Updates the update callback returned from.");
+    telebot_metrics_sample(page, "telebot_updates_handled", "_total", NULL,
+            dispatch.handled);
+    telebot_metrics_family(page, "telebot_update_queue_depth", "gauge",
+            "Updates dispatched and not handled yet.");
+    telebot_metrics_sample(page, "telebot_update_queue_depth", "", NULL,
+            dispatch.queue_depth);
+
+    telebot_metrics_family(page, "telebot_messages", "counter",
+            "Messages by their fate under the send rate limits.");
+    telebot_metrics_sample(page, "telebot_messages", "_total",
+            "state=\"queued\"", send.queued);
+    telebot_metrics_sample(page, "telebot_messages", "_total",
+            "state=\"sent\"", send.sent);
+    telebot_metrics_sample(page, "telebot_messages", "_total",
+            "state=\"dropped\"", send.dropped);
+    telebot_metrics_family(page, "telebot_messages_waiting", "gauge",
+            "Messages waiting for their send slot.");
+    telebot_metrics_sample(page, "telebot_messages_waiting", "", NULL,
+            send.waiting);
+
+    telebot_metrics_methods(page, stats, "telebot_requests",
+            "Bot API request attempts.",
+            offsetof(telebot_core_method_stats_t, requests));
+    telebot_metrics_methods(page, stats, "telebot_request_failures",
+            "Bot API requests that failed after their last attempt.",
+            offsetof(telebot_core_method_stats_t, failures));
+    telebot_metrics_methods(page, stats, "telebot_request_retries",
+            "Bot API request attempts repeated after a failure.",
+            offsetof(telebot_core_method_stats_t, retries));
+
+    telebot_metrics_family(page, "telebot_responses", "counter",
+            "Bot API request attempts by HTTP status class, none without "
+            "an answer.");
+    for (index = 0; index < TELEBOT_CORE_STATS_METHODS; index++) {
+        const telebot_core_method_stats_t *method = &(stats->methods[index]);
+        int class;
+        for (class = 0; class < 6; class++) {
+            if ((method->requests == 0) || (class == 1))
+                continue;
+            if (class == 0)
+                snprintf(labels, sizeof(labels),
+                        "method=\"%s\",class=\"none\"", method->method);
+            else
+                snprintf(labels, sizeof(labels),
+                        "method=\"%s\",class=\"%dxx\"", method->method,
+                        class);
+            telebot_metrics_sample(page, "telebot_responses", "_total",
+                    labels, method->status[class]);
+        }
+    }
+
+    telebot_metrics_family(page, "telebot_request_duration_seconds",
+            "histogram", "Bot API request attempts by phase, connection setup "
+            "phases only for new connections.");
+    for (index = 0; index < TELEBOT_CORE_STATS_METHODS; index++) {
+        const telebot_core_method_stats_t *method = &(stats->methods[index]);
+        for (phase = 0; phase < TELEBOT_CORE_PHASES; phase++) {
+            if (method->latency[phase].count == 0)
+                continue;
+            snprintf(labels, sizeof(labels), "method=\"%s\",phase=\"%s\"",
+                    method->method, telebot_metrics_phases[phase]);
+            telebot_metrics_histogram(page,
+                    "telebot_request_duration_seconds", labels,
+                    &(method->latency[phase]));
+        }
+    }
+}
+
+telebot_error_e telebot_start_metrics(telebot_h *bot, int port)
+{
+    if ((bot == NULL) || (port < 0) || (port > 65535))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    if (bot->metrics != NULL)
+        return TELEBOT_ERROR_NOT_SUPPORTED;
+
+    bot->metrics_stats = malloc(sizeof(telebot_core_stats_t));
+    if (bot->metrics_stats == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+
+    bot->metrics = telebot_metrics_start(port, telebot_metrics_render, bot);
+    if (bot->metrics == NULL) {
+        free(bot->metrics_stats);
+        bot->metrics_stats = NULL;
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    }
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_get_metrics_port(telebot_h *bot, int *port)
+{
+    if ((bot == NULL) || (port == NULL))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    if (bot->metrics == NULL)
+        return TELEBOT_ERROR_NOT_SUPPORTED;
+
+    *port = telebot_metrics_port(bot->metrics);
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_stop_metrics(telebot_h *bot)
+{
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    if (bot->metrics == NULL)
+        return TELEBOT_ERROR_NONE;
+
+    telebot_metrics_stop(bot->metrics);
+    bot->metrics = NULL;
+    free(bot->metrics_stats);
+    bot->metrics_stats = NULL;
+
+    return TELEBOT_ERROR_NONE;
+}
+
+static int telebot_update_limit(telebot_h *bot)
+{
+    pthread_mutex_lock(&(bot->update_lock));
+    int limit = bot->update_stats.limit;
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    return limit;
+}
+
+/*
+ * Accounts for a batch received by the polling thread and picks the limit of
+ * the next call: a full batch doubles it, a batch under a quarter full halves
+ * it, so spikes are drained in few round trips and quiet periods go back to
+ * small responses. The arena is only read here, by the thread that filled it.
+ */
+static void telebot_update_batch_done(telebot_h *bot, int count, int limit,
+        const telebot_linear_allocator_t *allocator)
+{
+    telebot_update_stats_t *stats = &(bot->update_stats);
+
+    pthread_mutex_lock(&(bot->update_lock));
+    stats->batches++;
+    stats->updates += count;
+    stats->last_count = count;
+    stats->arena_used = allocator->used;
+    if (stats->arena_used > stats->arena_high_water)
+        stats->arena_high_water = stats->arena_used;
+
+    if (count >= limit) {
+        stats->full_batches++;
+        stats->backlog += count;
+    }
+    else {
+        stats->backlog = 0;
+    }
+    if (stats->backlog > stats->max_backlog)
+        stats->max_backlog = stats->backlog;
+
+    if (bot->update_adaptive) {
+        if ((count >= limit) && (stats->limit < bot->update_max_limit))
+            stats->limit = (stats->limit * 2 < bot->update_max_limit) ?
+                stats->limit * 2 : bot->update_max_limit;
+        else if ((count < limit / 4) && (stats->limit > bot->update_min_limit))
+            stats->limit = (stats->limit / 2 > bot->update_min_limit) ?
+                stats->limit / 2 : bot->update_min_limit;
+    }
+    pthread_mutex_unlock(&(bot->update_lock));
+}
+
+static void telebot_update_batch_failed(telebot_h *bot)
+{
+    pthread_mutex_lock(&(bot->update_lock));
+    bot->update_stats.failed_batches++;
+    pthread_mutex_unlock(&(bot->update_lock));
+}
+
+/*
+ * The next getUpdates call runs on a fetcher thread while the callbacks of the
+ * current batch run, so that network and handler time overlap. Each batch is
+ * parsed into its own arena, which is put back once its callbacks are done.
+ */
+struct telebot_fetch {
+    telebot_h *bot;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;
+    bool requested;
+    bool done;
+    telebot_linear_allocator_t *allocator;
+    int limit;
+    int timeout;
+    useconds_t delay;
+    telebot_update_t *updates;
+    int count;
+    telebot_error_e ret;
+};
+
+static void *telebot_fetch_thread(void *data)
+{
+    struct telebot_fetch *fetch = data;
+
+    pthread_mutex_lock(&(fetch->lock));
+    while (true) {
+        while (fetch->running && !fetch->requested)
+            pthread_cond_wait(&(fetch->cond), &(fetch->lock));
+        if (!fetch->running)
+            break;
+        fetch->requested = false;
+
+        // The delay is cut short when the bot is stopped.
+        if (fetch->delay > 0) {
+            struct timespec due;
+            clock_gettime(CLOCK_MONOTONIC, &due);
+            due.tv_sec += fetch->delay / 1000000;
+            due.tv_nsec += (fetch->delay % 1000000) * 1000;
+            if (due.tv_nsec >= 1000000000) {
+                due.tv_sec++;
+                due.tv_nsec -= 1000000000;
+            }
+            while (fetch->running && fetch->bot->running &&
+                    (pthread_cond_timedwait(&(fetch->cond), &(fetch->lock),
+                        &due) != ETIMEDOUT));
+        }
+        pthread_mutex_unlock(&(fetch->lock));
+
+        telebot_update_t *updates = NULL;
+        int count = 0;
+        telebot_error_e ret = TELEBOT_ERROR_OPERATION_FAILED;
+        if (fetch->bot->running) {
+            telebot_linear_allocator_zero_all(fetch->allocator);
+            ret = telebot_get_updates_timeout(fetch->bot, &updates, &count,
+                    fetch->limit, fetch->timeout, fetch->allocator,
+                    &(fetch->bot->running));
+        }
+
+        pthread_mutex_lock(&(fetch->lock));
+        fetch->updates = updates;
+        fetch->count = count;
+        fetch->ret = ret;
+        fetch->done = true;
+        pthread_cond_broadcast(&(fetch->cond));
+    }
+    pthread_mutex_unlock(&(fetch->lock));
+
+    return NULL;
+}
+
+static void telebot_fetch_wake(struct telebot_fetch *fetch)
+{
+    pthread_mutex_lock(&(fetch->lock));
+    pthread_cond_broadcast(&(fetch->cond));
+    pthread_mutex_unlock(&(fetch->lock));
+}
+
+static void telebot_fetch_start(struct telebot_fetch *fetch,
+        telebot_linear_allocator_t *allocator, int limit, int timeout,
+        useconds_t delay)
+{
+    pthread_mutex_lock(&(fetch->lock));
+    fetch->allocator = allocator;
+    fetch->limit = limit;
+    fetch->timeout = timeout;
+    fetch->delay = delay;
+    fetch->done = false;
+    fetch->requested = true;
+    pthread_cond_broadcast(&(fetch->cond));
+    pthread_mutex_unlock(&(fetch->lock));
+}
+
+static telebot_error_e telebot_fetch_wait(struct telebot_fetch *fetch,
+        telebot_update_t **updates, int *count)
+{
+    pthread_mutex_lock(&(fetch->lock));
+    while (!fetch->done)
+        pthread_cond_wait(&(fetch->cond), &(fetch->lock));
+    *updates = fetch->updates;
+    *count = fetch->count;
+    telebot_error_e ret = fetch->ret;
+    pthread_mutex_unlock(&(fetch->lock));
+
+    return ret;
+}
+
+/* Runs on the thread that handled the last update of the batch */
+static void telebot_batch_done(telebot_dispatch_batch_t *dispatch)
+{
+    struct telebot_batch *batch = (struct telebot_batch *)dispatch;
+    telebot_h *bot = batch->bot;
+
+    telebot_linear_allocator_free_all(&(batch->allocator));
+
+    // Arenas piled up behind a slow callback are given back afterwards.
+    pthread_mutex_lock(&(bot->update_lock));
+    if (bot->batches_free_count >= TELEBOT_DISPATCHER_BATCHES_SPARE) {
+        bot->batches_count--;
+    }
+    else {
+        batch->next_free = bot->batches_free;
+        bot->batches_free = batch;
+        bot->batches_free_count++;
+        batch = NULL;
+    }
+    pthread_cond_signal(&(bot->batches_cond));
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    if (batch != NULL) {
+        telebot_linear_allocator_destroy(&(batch->allocator));
+        free(batch);
+    }
+}
+
+/*
+ * Takes an arena for the next batch, adding one while batches are held by a
+ * slow callback. Every held batch has an update queued for that worker, so
+ * its full queue blocks the poll before the limit is reached. NULL only if
+ * none could be allocated.
+ */
+static struct telebot_batch *telebot_batch_get(telebot_h *bot)
+{
+    struct telebot_batch *batch = NULL;
+
+    pthread_mutex_lock(&(bot->update_lock));
+    while (bot->batches_free == NULL) {
+        if (bot->batches_count < TELEBOT_DISPATCHER_BATCHES_MAX) {
+            batch = calloc(1, sizeof(struct telebot_batch));
+            if (batch != NULL) {
+                batch->allocator = telebot_linear_allocator_create(
+                        bot->update_allocator[0].chunk_size);
+                if (batch->allocator.head == NULL) {
+                    free(batch);
+                    batch = NULL;
+                }
+            }
+            if (batch != NULL) {
+                batch->bot = bot;
+                batch->dispatch.done = telebot_batch_done;
+                bot->batches_count++;
+                break;
+            }
+            ERR("Failed to allocate memory");
+            if (bot->batches_count == 0)
+                break;
+        }
+        pthread_cond_wait(&(bot->batches_cond), &(bot->update_lock));
+    }
+    if ((batch == NULL) && (bot->batches_free != NULL)) {
+        batch = bot->batches_free;
+        bot->batches_free = batch->next_free;
+        bot->batches_free_count--;
+    }
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    return batch;
+}
+
+static void *telebot_polling_thread(void *data)
+{
+    telebot_h *bot = data;
+    struct telebot_fetch fetch;
+    int limit = telebot_update_limit(bot);
+    int count = 0;
+    telebot_update_t *updates = NULL;
+    telebot_error_e ret = TELEBOT_ERROR_OPERATION_FAILED;
+
+    memset(&fetch, 0, sizeof(fetch));
+    fetch.bot = bot;
+    pthread_mutex_init(&(fetch.lock), NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(fetch.cond), &attr);
+    pthread_condattr_destroy(&attr);
+    fetch.running = true;
+
+    pthread_mutex_lock(&(bot->update_lock));
+    telebot_dispatcher_t *dispatcher = bot->dispatcher;
+    bot->fetch = &fetch;
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    struct telebot_batch *batch = telebot_batch_get(bot);
+    if (batch == NULL) {
+        fetch.running = false;
+        bot->running = false;
+    }
+    else if (pthread_create(&(fetch.thread), NULL, telebot_fetch_thread,
+                &fetch) != 0) {
+        ERR("Failed to create thread, error: %d", errno);
+        telebot_batch_done(&(batch->dispatch));
+        fetch.running = false;
+        bot->running = false;
+    }
+    else {
+        telebot_fetch_start(&fetch, &(batch->allocator), limit,
+                bot->polling_timeout, 0);
+    }
+
+    while (bot->running) {
+        ret = telebot_fetch_wait(&fetch, &updates, &count);
+        if (ret != TELEBOT_ERROR_NONE) {
+            // Do not hammer the server while it (or the network) is failing.
+            telebot_update_batch_failed(bot);
+            telebot_fetch_start(&fetch, &(batch->allocator), limit,
+                    bot->polling_timeout, TELEBOT_UPDATE_POLLING_INTERVAL);
+            continue;
+        }
+        telebot_update_batch_done(bot, count, limit, &(batch->allocator));
+
+        // With long polling the server holds the request until an update
+        // arrives, and a full batch means more are already waiting.
+        int timeout = bot->polling_timeout;
+        useconds_t delay = TELEBOT_UPDATE_POLLING_INTERVAL;
+        if ((timeout > 0) || (count >= limit))
+            delay = 0;
+
+        // The offset is already past this batch, fetch the next one into
+        // another arena while the workers handle this one. Its arena is put
+        // back once they are done with it, nothing waits for them here.
+        struct telebot_batch *next = telebot_batch_get(bot);
+        limit = telebot_update_limit(bot);
+        telebot_fetch_start(&fetch, &(next->allocator), limit, timeout,
+                delay);
+
+        telebot_dispatcher_submit_batch(dispatcher, updates, count,
+                &(batch->dispatch));
+        batch = next;
+    }
+
+    if (fetch.running) {
+        // The offset already moved past a prefetched batch, hand it out
+        // before leaving or it would be lost.
+        ret = telebot_fetch_wait(&fetch, &updates, &count);
+        if (ret != TELEBOT_ERROR_NONE)
+            count = 0;
+        telebot_dispatcher_submit_batch(dispatcher, updates, count,
+                &(batch->dispatch));
+
+        pthread_mutex_lock(&(fetch.lock));
+        fetch.running = false;
+        pthread_cond_broadcast(&(fetch.cond));
+        pthread_mutex_unlock(&(fetch.lock));
+        pthread_join(fetch.thread, NULL);
+    }
+
+    pthread_mutex_lock(&(bot->update_lock));
+    bot->fetch = NULL;
+    telebot_dispatcher_get_stats(dispatcher, &(bot->dispatch_stats));
+    bot->dispatcher = NULL;
+    pthread_mutex_unlock(&(bot->update_lock));
+    telebot_dispatcher_destroy(dispatcher);
+    pthread_mutex_destroy(&(fetch.lock));
+    pthread_cond_destroy(&(fetch.cond));
+
+    // The bot may be freed as soon as this is signaled.
+    pthread_mutex_lock(&(bot->update_lock));
+    bot->polling = false;
+    pthread_cond_broadcast(&(bot->polling_cond));
+    pthread_mutex_unlock(&(bot->update_lock));
+
+    pthread_exit(NULL);
+
+    return NULL;
+}
+
+static char *telebot_strdup_opt(const char *str)
+{
+    if (str == NULL)
+        return NULL;
+
+    return strdup(str);
+}
+
+telebot_error_e telebot_get_me(telebot_h *bot, telebot_user_t *me)
+{
+    if ((bot == NULL) || (me == NULL))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_h *handler = &(bot->core);
+    telebot_core_response_t *response = telebot_call_response();
+    if (response == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+
+    telebot_error_e ret = telebot_core_get_me(handler, response);
+    if (ret != TELEBOT_ERROR_NONE)
+        return ret;
+
+    struct json_object *obj = telebot_parser_str_to_obj(response->data);
+
+    if (obj == NULL)
+        return TELEBOT_ERROR_OPERATION_FAILED;
+
+    struct json_object *ok;
+    if (!json_object_object_get_ex(obj, "ok", &ok)) {
+        json_object_put(obj);
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    }
+
+    if (!json_object_get_boolean(ok)) {
+        json_object_put(obj);
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    }
+
+    struct json_object *result;
+    if (!json_object_object_get_ex(obj, "result", &result)){
+        json_object_put(obj);
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    }
+
+    // The arenas of the bot are filled and cleared by the polling, webhook
+    // and mux threads, so the user is parsed into a scratch one and its
+    // strings are handed to the caller.
+    telebot_linear_allocator_t allocator = telebot_linear_allocator_create(
+            TELEBOT_CORE_RESPONSE_SIZE_MIN);
+    if (allocator.head == NULL) {
+        json_object_put(obj);
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+    }
+    telebot_user_t user;
+    ret = telebot_parser_get_user(result, &user, &allocator);
+    json_object_put(obj);
+
+    if (ret != TELEBOT_ERROR_NONE) {
+        telebot_linear_allocator_destroy(&allocator);
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    }
+
+    *me = user;
+    me->first_name = telebot_strdup_opt(user.first_name);
+    me->last_name = telebot_strdup_opt(user.last_name);
+    me->username = telebot_strdup_opt(user.username);
+    me->language_code = telebot_strdup_opt(user.language_code);
+    telebot_linear_allocator_destroy(&allocator);
+
+    if (((user.first_name != NULL) && (me->first_name == NULL)) ||
+            ((user.last_name != NULL) && (me->last_name == NULL)) ||
+            ((user.username != NULL) && (me->username == NULL)) ||
+            ((user.language_code != NULL) && (me->language_code == NULL))) {
+        telebot_put_me(me);
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+    }
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_put_me(telebot_user_t *me)
+{
+    if (me == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    free(me->first_name);
+    free(me->last_name);
+    free(me->username);
+    free(me->language_code);
+    memset(me, 0, sizeof(telebot_user_t));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_get_updates(telebot_h *bot, telebot_update_t **updates,
+        int *count)
+{
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    // The offset and the arenas belong to the receiving threads meanwhile.
+    pthread_mutex_lock(&(bot->update_lock));
+    bool receiving = bot->running || bot->polling || (bot->mux != NULL) ||
+        (bot->webhook != NULL);
+    pthread_mutex_unlock(&(bot->update_lock));
+    if (receiving)
+        return TELEBOT_ERROR_NOT_SUPPORTED;
+
+    telebot_linear_allocator_t *allocator = &(bot->get_updates_allocator);
+    telebot_linear_allocator_free_all(allocator);
+    telebot_linear_allocator_zero_all(allocator);
+
+    return telebot_get_updates_timeout(bot, updates, count,
+            telebot_update_limit(bot), 0, allocator, NULL);
+}
+
+/* Moves the offset past a batch, so that the next call confirms it */
+static void telebot_update_offset(telebot_h *bot,
+        const telebot_update_t *updates, int count)
+{
+    int index;
+    for (index = 0;index < count; index++) {
+        if (updates[index].update_id >= bot->core.offset)
+            bot->core.offset = updates[index].update_id + 1;
+    }
+}
+
+struct telebot_updates_stream {
+    telebot_stream_parser_t *parser;
+    const atomic_bool *running; /* Gives up once cleared, may be NULL */
+};
+
+static telebot_error_e telebot_updates_feed(const char *data, size_t size,
+        void *user_data)
+{
+    struct telebot_updates_stream *stream = user_data;
+
+    if ((stream->running != NULL) && !*(stream->running))
+        return TELEBOT_ERROR_OPERATION_FAILED;
+
+    if (size == 0)
+        return TELEBOT_ERROR_NONE;
+
+    return telebot_parser_stream_feed(stream->parser, data, size);
+}
+
+static telebot_error_e telebot_get_updates_timeout(telebot_h *bot,
+        telebot_update_t **updates, int *count, int limit, int timeout,
+        telebot_linear_allocator_t *allocator, const atomic_bool *running)
+{
+    if (count == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    if (updates == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    *updates = NULL;
+    *count = 0;
+
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    // The response is parsed while it is received, chunks are copied to the
+    // arena of the batch and the strings of the updates point into them.
+    telebot_stream_parser_t *parser = telebot_parser_stream_create(allocator);
+    if (parser == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+
+    struct telebot_updates_stream stream = { parser, running };
+    telebot_error_e ret = telebot_core_get_updates_stream(&(bot->core),
+            bot->core.offset, limit, timeout, telebot_updates_feed, &stream);
+    telebot_error_e parsed = telebot_parser_stream_finish(parser, updates,
+            count);
+    if (ret == TELEBOT_ERROR_NONE)
+        ret = parsed;
+    if (ret != TELEBOT_ERROR_NONE) {
+        *updates = NULL;
+        *count = 0;
+        return ret;
+    }
+
+    telebot_update_offset(bot, *updates, *count);
+
+    return TELEBOT_ERROR_NONE;
+}
+
+static unsigned long telebot_mux_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/* Both take the lock of the mux */
+static void telebot_mux_ready(telebot_mux_t *mux, telebot_h *bot)
+{
+    bot->poll.next = NULL;
+    if (mux->ready_tail != NULL)
+        mux->ready_tail->poll.next = bot;
+    else
+        mux->ready_head = bot;
+    mux->ready_tail = bot;
+    pthread_cond_signal(&(mux->cond));
+}
+
+static void telebot_mux_delay(telebot_mux_t *mux, telebot_h *bot,
+        useconds_t delay)
+{
+    bot->poll.due_us = telebot_mux_now() + delay;
+    bot->poll.next = mux->delayed;
+    mux->delayed = bot;
+    pthread_cond_broadcast(&(mux->cond));
+}
+
+static telebot_error_e telebot_mux_feed(const char *data, size_t size,
+        void *user_data)
+{
+    telebot_h *bot = user_data;
+
+    if (size == 0)
+        return TELEBOT_ERROR_NONE;
+
+    return telebot_parser_stream_feed(bot->poll.parser, data, size);
+}
+
+/* Runs on the transport thread, the batch is handled by a worker */
+static void telebot_mux_polled(telebot_core_h *handler, telebot_error_e ret,
+        struct json_object *result, void *user_data)
+{
+    telebot_h *bot = user_data;
+    telebot_mux_t *mux = bot->mux;
+    telebot_update_t *updates;
+    int count;
+
+    telebot_error_e parsed = telebot_parser_stream_finish(bot->poll.parser,
+            &updates, &count);
+    if (ret == TELEBOT_ERROR_NONE)
+        ret = parsed;
+    if (ret != TELEBOT_ERROR_NONE) {
+        updates = NULL;
+        count = 0;
+    }
+
+    pthread_mutex_lock(&(mux->lock));
+    bot->poll.parser = NULL;
+    bot->poll.ret = ret;
+    bot->poll.updates = updates;
+    bot->poll.count = count;
+    if (mux->running) {
+        if (bot->poll.busy)
+            bot->poll.completed = true;
+        else
+            telebot_mux_ready(mux, bot);
+    }
+    pthread_mutex_unlock(&(mux->lock));
+}
+
+/* Issues the next long poll of bot, parsed into its poll.arena */
+static void telebot_mux_poll(telebot_mux_t *mux, telebot_h *bot)
+{
+    telebot_linear_allocator_t *allocator =
+        &(bot->update_allocator[bot->poll.arena]);
+    telebot_error_e ret = TELEBOT_ERROR_OUT_OF_MEMORY;
+
+    telebot_linear_allocator_zero_all(allocator);
+    bot->poll.limit = telebot_update_limit(bot);
+    bot->poll.parser = telebot_parser_stream_create(allocator);
+    if (bot->poll.parser != NULL)
+        ret = telebot_core_get_updates_stream_async(&(bot->core),
+                bot->core.offset, bot->poll.limit, bot->polling_timeout,
+                telebot_mux_feed, telebot_mux_polled, bot);
+    if (ret == TELEBOT_ERROR_NONE)
+        return;
+
+    if (bot->poll.parser != NULL) {
+        telebot_update_t *updates;
+        int count;
+        telebot_parser_stream_finish(bot->poll.parser, &updates, &count);
+        bot->poll.parser = NULL;
+    }
+    telebot_linear_allocator_free_all(allocator);
+
+    pthread_mutex_lock(&(mux->lock));
+    telebot_mux_delay(mux, bot, TELEBOT_UPDATE_POLLING_INTERVAL);
+    pthread_mutex_unlock(&(mux->lock));
+}
+
+/*
+ * Same flow as the polling thread: the offset moves past the batch, the next
+ * poll goes out into the other arena and only then the callbacks run.
+ */
+static void telebot_mux_handle(telebot_mux_t *mux, telebot_h *bot)
+{
+    int current = bot->poll.arena;
+    telebot_update_t *updates = bot->poll.updates;
+    int count = bot->poll.count;
+    int limit = bot->poll.limit;
+
+    if (bot->poll.ret != TELEBOT_ERROR_NONE) {
+        // Do not hammer the server while it (or the network) is failing.
+        telebot_update_batch_failed(bot);
+        telebot_linear_allocator_free_all(&(bot->update_allocator[current]));
+        pthread_mutex_lock(&(mux->lock));
+        bot->poll.busy = false;
+        telebot_mux_delay(mux, bot, TELEBOT_UPDATE_POLLING_INTERVAL);
+        pthread_mutex_unlock(&(mux->lock));
+        return;
+    }
+
+    telebot_update_offset(bot, updates, count);
+    telebot_update_batch_done(bot, count, limit,
+            &(bot->update_allocator[current]));
+
+    bot->poll.arena = !current;
+    if ((bot->polling_timeout > 0) || (count >= limit)) {
+        telebot_mux_poll(mux, bot);
+    }
+    else {
+        pthread_mutex_lock(&(mux->lock));
+        telebot_mux_delay(mux, bot, TELEBOT_UPDATE_POLLING_INTERVAL);
+        pthread_mutex_unlock(&(mux->lock));
+    }
+
+    int index;
+    for (index = 0; index < count; index++)
+        bot->update_cb(bot, &(updates[index]), bot->user_data);
+    telebot_linear_allocator_free_all(&(bot->update_allocator[current]));
+
+    pthread_mutex_lock(&(mux->lock));
+    bot->poll.busy = false;
+    if (bot->poll.completed) {
+        bot->poll.completed = false;
+        if (mux->running)
+            telebot_mux_ready(mux, bot);
+    }
+    pthread_mutex_unlock(&(mux->lock));
+}
+
+/* Takes the bot whose delayed poll is due first out of the list */
+static telebot_h *telebot_mux_due(telebot_mux_t *mux, unsigned long *due_us)
+{
+    telebot_h **link, **first = NULL;
+    for (link = &(mux->delayed); *link != NULL; link = &((*link)->poll.next)) {
+        if ((first == NULL) || ((*link)->poll.due_us < (*first)->poll.due_us))
+            first = link;
+    }
+    if (first == NULL)
+        return NULL;
+
+    telebot_h *bot = *first;
+    *due_us = bot->poll.due_us;
+    if (bot->poll.due_us > telebot_mux_now())
+        return NULL;
+
+    *first = bot->poll.next;
+    bot->poll.next = NULL;
+
+    return bot;
+}
+
+static void *telebot_mux_thread(void *data)
+{
+    telebot_mux_t *mux = data;
+
+    pthread_mutex_lock(&(mux->lock));
+    while (mux->running) {
+        telebot_h *bot = mux->ready_head;
+        if (bot != NULL) {
+            mux->ready_head = bot->poll.next;
+            if (mux->ready_head == NULL)
+                mux->ready_tail = NULL;
+            bot->poll.next = NULL;
+            bot->poll.busy = true;
+            pthread_mutex_unlock(&(mux->lock));
+
+            telebot_mux_handle(mux, bot);
+
+            pthread_mutex_lock(&(mux->lock));
+            continue;
+        }
+
+        unsigned long due_us = 0;
+        bot = telebot_mux_due(mux, &due_us);
+        if (bot != NULL) {
+            pthread_mutex_unlock(&(mux->lock));
+            telebot_mux_poll(mux, bot);
+            pthread_mutex_lock(&(mux->lock));
+            continue;
+        }
+
+        if (due_us == 0) {
+            pthread_cond_wait(&(mux->cond), &(mux->lock));
+        }
+        else {
+            struct timespec ts;
+            ts.tv_sec = due_us / 1000000UL;
+            ts.tv_nsec = (due_us % 1000000UL) * 1000;
+            pthread_cond_timedwait(&(mux->cond), &(mux->lock), &ts);
+        }
+    }
+    pthread_mutex_unlock(&(mux->lock));
+
+    return NULL;
 }
 
-telebot_error_e telebot_create(char *token)
+telebot_error_e telebot_mux_create(telebot_mux_t **mux, int workers,
+        const telebot_core_options_t *options)
 {
-    g_handler = (telebot_core_h *)malloc(sizeof(telebot_core_h));
-    if (g_handler == NULL) {
+    if (mux == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    *mux = NULL;
+
+    if ((workers < 1) || (workers > TELEBOT_DISPATCHER_WORKERS_MAX))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_mux_t *handle = calloc(1, sizeof(telebot_mux_t));
+    if (handle == NULL) {
         ERR("Failed to allocate memory");
         return TELEBOT_ERROR_OUT_OF_MEMORY;
     }
 
-    telebot_error_e ret = telebot_core_create(g_handler, token);
+    telebot_core_options_t core_options = {0};
+    if (options != NULL)
+        core_options = *options;
+    core_options.share = NULL;
+    telebot_error_e ret = telebot_core_create_ex(&(handle->core), "",
+            &core_options);
     if (ret != TELEBOT_ERROR_NONE) {
-        free(g_handler);
+        free(handle);
         return ret;
     }
 
-    update_allocator = telebot_linear_allocator_create(512 * 1024 * 1024); // 500MB
+    handle->threads = calloc(workers, sizeof(pthread_t));
+    if (handle->threads == NULL) {
+        ERR("Failed to allocate memory");
+        telebot_core_destroy(&(handle->core));
+        free(handle);
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&(handle->lock), NULL);
+    pthread_cond_init(&(handle->cond), &attr);
+    pthread_condattr_destroy(&attr);
+    handle->workers = workers;
+
+    *mux = handle;
 
     return TELEBOT_ERROR_NONE;
 }
 
-telebot_error_e telebot_destroy()
+telebot_error_e telebot_mux_add(telebot_mux_t *mux, char *token,
+        telebot_update_cb_f update_cb, void *user_data, telebot_h **bot)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if ((mux == NULL) || (update_cb == NULL) || (bot == NULL))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_core_destroy(g_handler);
-    if (g_handler != NULL)
-        free(g_handler);
+    telebot_core_options_t options = {
+        .api_url = mux->core.api_url,
+        .share = &(mux->core),
+    };
+    telebot_error_e ret = telebot_create_ex(bot, token, &options,
+            TELEBOT_MUX_ALLOCATOR_CHUNK_SIZE);
+    if (ret != TELEBOT_ERROR_NONE)
+        return ret;
 
-    g_handler = NULL;
+    telebot_h *handle = *bot;
+    handle->mux = mux;
+    handle->update_cb = update_cb;
+    handle->user_data = user_data;
+    handle->running = true;
 
-    telebot_linear_allocator_destroy(&update_allocator);
+    pthread_mutex_lock(&(mux->lock));
+    handle->mux_next = mux->bots;
+    mux->bots = handle;
+    if (mux->running)
+        telebot_mux_delay(mux, handle, 0);
+    pthread_mutex_unlock(&(mux->lock));
 
     return TELEBOT_ERROR_NONE;
 }
 
-telebot_error_e telebot_start(telebot_update_cb_f update_cb,
-                              bool should_deatach_thread, pthread_t* thread_id)
+telebot_error_e telebot_mux_start(telebot_mux_t *mux)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
-
-    if (update_cb == NULL)
+    if (mux == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    pthread_t t_id;
-    pthread_attr_t attr;
-
-    if(thread_id == NULL) {
-        thread_id = &t_id;
-    }
-
-    int ret = pthread_attr_init(&attr);
-    if (ret != 0) {
-        ERR("Failed to init pthread attributes, error: %d", errno);
-        return TELEBOT_ERROR_OPERATION_FAILED;
+    pthread_mutex_lock(&(mux->lock));
+    if (mux->running) {
+        pthread_mutex_unlock(&(mux->lock));
+        return TELEBOT_ERROR_NOT_SUPPORTED;
     }
-
-    if(should_deatach_thread) {
-        ret = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-        if (ret != 0) {
-            ERR("Failed to set pthread detatched attribute, error: %d", errno);
-            return TELEBOT_ERROR_OPERATION_FAILED;
+    mux->running = true;
+
+    // Workers issue the first poll of every bot
+    telebot_h *bot;
+    for (bot = mux->bots; bot != NULL; bot = bot->mux_next)
+        telebot_mux_delay(mux, bot, 0);
+
+    while (mux->threads_count < mux->workers) {
+        if (pthread_create(&(mux->threads[mux->threads_count]), NULL,
+                    telebot_mux_thread, mux) != 0) {
+            ERR("Failed to create thread, error: %d", errno);
+            break;
         }
+        mux->threads_count++;
     }
+    pthread_mutex_unlock(&(mux->lock));
 
-    g_update_cb = update_cb;
-    g_run_telebot = true;
-
-    ret = pthread_create(thread_id, &attr, telebot_polling_thread, NULL);
-    if (ret != 0) {
-        ERR("Failed to create thread, error: %d", errno);
-        g_update_cb = NULL;
-        g_run_telebot = false;
+    if (mux->threads_count == 0)
         return TELEBOT_ERROR_OPERATION_FAILED;
-    }
 
     return TELEBOT_ERROR_NONE;
 }
 
-telebot_error_e telebot_stop()
+telebot_error_e telebot_mux_destroy(telebot_mux_t *mux)
 {
-    g_run_telebot = false;
-    g_update_cb = NULL;
+    if (mux == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    return TELEBOT_ERROR_NONE;
-}
+    pthread_mutex_lock(&(mux->lock));
+    mux->running = false;
+    pthread_cond_broadcast(&(mux->cond));
+    pthread_mutex_unlock(&(mux->lock));
 
-static void *telebot_polling_thread(void *data)
-{
     int index;
-    telebot_error_e ret;
-
-    while (g_run_telebot) {
-        int count;
-        telebot_update_t *updates;
-        telebot_linear_allocator_zero_all(&update_allocator);
-
-        ret = telebot_get_updates(&updates, &count);
-        if (ret != TELEBOT_ERROR_NONE)
-            continue;
-
-        for (index = 0;index < count; index++) {
-            g_update_cb(&(updates[index]));
-
-        }
-
-        telebot_linear_allocator_free_all(&update_allocator);
+    for (index = 0; index < mux->threads_count; index++)
+        pthread_join(mux->threads[index], NULL);
+
+    // The transport goes with the last handler, aborting the polls still in
+    // flight. Their completions touch the bots, which are freed afterwards.
+    telebot_h *bot;
+    for (bot = mux->bots; bot != NULL; bot = bot->mux_next) {
+        telebot_stop_metrics(bot);
+        telebot_scheduler_close(bot->scheduler);
+        telebot_core_destroy(&(bot->core));
+    }
+    telebot_core_destroy(&(mux->core));
 
-        usleep(TELEBOT_UPDATE_POLLING_INTERVAL);
+    while (mux->bots != NULL) {
+        bot = mux->bots;
+        mux->bots = bot->mux_next;
+        telebot_free(bot);
     }
 
-    pthread_exit(NULL);
+    pthread_mutex_destroy(&(mux->lock));
+    pthread_cond_destroy(&(mux->cond));
+    free(mux->threads);
+    free(mux);
 
-    return NULL;
+    return TELEBOT_ERROR_NONE;
 }
 
-telebot_error_e telebot_get_me(telebot_user_t *me)
+/*
+ * Profile photos outlive any update batch: they are parsed into a scratch
+ * arena and packed with their file ids into one block, released by free().
+ */
+static telebot_photo_t *telebot_photos_pack(const telebot_photo_t *photos,
+        int count)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
-
-    telebot_error_e ret = telebot_core_get_me(g_handler);
-    if (ret != TELEBOT_ERROR_NONE)
-        return ret;
-
-    struct json_object *obj = telebot_parser_str_to_obj(g_handler->resp_data);
-    free(g_handler->resp_data);
-    g_handler->resp_data = NULL;
-    g_handler->resp_size = 0;
-
-    if (obj == NULL)
-        return TELEBOT_ERROR_OPERATION_FAILED;
-
-    struct json_object *ok;
-    if (!json_object_object_get_ex(obj, "ok", &ok)) {
-        json_object_put(obj);
-        return TELEBOT_ERROR_OPERATION_FAILED;
-    }
-
-    if (!json_object_get_boolean(ok)) {
-        json_object_put(ok);
-        json_object_put(obj);
-        return TELEBOT_ERROR_OPERATION_FAILED;
-    }
-    json_object_put(ok);
-
-    struct json_object *result;
-    if (!json_object_object_get_ex(obj, "result", &result)){
-        json_object_put(obj);
-        return TELEBOT_ERROR_OPERATION_FAILED;
-    }
+    size_t size = count * sizeof(telebot_photo_t);
+    int index;
+    for (index = 0; index < count; index++)
+        size += strlen(photos[index].file_id) + 1;
 
-    // TODO(erick): getMe should not be using the update allocator.
-    ret = telebot_parser_get_user(result, me, &update_allocator);
-    json_object_put(result);
-    json_object_put(obj);
+    telebot_photo_t *result = malloc(size);
+    if (result == NULL)
+        return NULL;
 
-    if (ret != TELEBOT_ERROR_NONE) {
-        return TELEBOT_ERROR_OPERATION_FAILED;
+    char *strings = (char *)(result + count);
+    for (index = 0; index < count; index++) {
+        size_t len = strlen(photos[index].file_id) + 1;
+        result[index] = photos[index];
+        result[index].file_id = memcpy(strings, photos[index].file_id, len);
+        strings += len;
     }
 
-    return TELEBOT_ERROR_NONE;
+    return result;
 }
 
-telebot_error_e telebot_get_updates(telebot_update_t **updates, int *count)
+telebot_error_e telebot_get_user_profile_photos(telebot_h *bot,
+        long long user_id, int offset, telebot_photo_t **photos, int *count)
 {
-    if (count == NULL)
+    if (photos == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    if (updates == NULL)
+    if (count == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    *updates = NULL;
+    *photos = NULL;
     *count = 0;
 
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_get_updates(g_handler, g_handler->offset,
-            TELEBOT_UPDATE_COUNT_PER_REQUEST, 0);
+    telebot_core_h *handler = &(bot->core);
+    telebot_core_response_t *response = telebot_call_response();
+    if (response == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+
+    telebot_error_e ret = telebot_core_get_user_profile_photos(handler,
+            user_id, offset, TELEBOT_USER_PHOTOS_MAX_LIMIT, response);
     if (ret != TELEBOT_ERROR_NONE)
         return ret;
 
-    struct json_object *obj = telebot_parser_str_to_obj(g_handler->resp_data);
-    free(g_handler->resp_data);
-    g_handler->resp_data = NULL;
-    g_handler->resp_size = 0;
+    struct json_object *obj = telebot_parser_str_to_obj(response->data);
 
     if (obj == NULL)
         return TELEBOT_ERROR_OPERATION_FAILED;
@@ -280,11 +1992,9 @@ telebot_error_e telebot_get_updates(telebot_update_t **updates, int *count)
     }
 
     if (!json_object_get_boolean(ok)) {
-        json_object_put(ok);
         json_object_put(obj);
         return TELEBOT_ERROR_OPERATION_FAILED;
     }
-    json_object_put(ok);
 
     struct json_object *result;
     if (!json_object_object_get_ex(obj, "result", &result)){
@@ -292,187 +2002,241 @@ telebot_error_e telebot_get_updates(telebot_update_t **updates, int *count)
         return TELEBOT_ERROR_OPERATION_FAILED;
     }
 
-    ret = telebot_parser_get_updates(result, updates, count, &update_allocator);
-    json_object_put(result);
+    telebot_linear_allocator_t allocator =
+        telebot_linear_allocator_create(TELEBOT_ALLOCATOR_RESIDENT_SIZE);
+    if (allocator.head == NULL) {
+        json_object_put(obj);
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+    }
+    telebot_photo_t *parsed;
+    ret = telebot_parser_get_profile_photos(result, &parsed, count,
+            &allocator);
     json_object_put(obj);
 
-    if (ret != TELEBOT_ERROR_NONE)
-        return ret;
-
-
-    int index, cnt = *count;
-    telebot_update_t *ups = *updates;
-    for (index = 0;index < cnt; index++) {
-        if (ups[index].update_id >= g_handler->offset)
-            g_handler->offset = ups[index].update_id + 1;
+    if ((ret == TELEBOT_ERROR_NONE) && (*count > 0)) {
+        *photos = telebot_photos_pack(parsed, *count);
+        if (*photos == NULL) {
+            *count = 0;
+            ret = TELEBOT_ERROR_OUT_OF_MEMORY;
+        }
     }
+    telebot_linear_allocator_destroy(&allocator);
 
-
-    return TELEBOT_ERROR_NONE;
+    return ret;
 }
 
-telebot_error_e telebot_get_user_profile_photos(int user_id, int offset,
-        telebot_photo_t **photos, int *count)
+telebot_error_e telebot_download_file(telebot_h *bot, char *file_id, char *path)
 {
-    if (photos == NULL)
-        return TELEBOT_ERROR_INVALID_PARAMETER;
-
-    if (count == NULL)
+    if (bot == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    *photos = NULL;
-    *count = 0;
+    telebot_core_h *handler = &(bot->core);
+    telebot_core_response_t *response = telebot_call_response();
+    if (response == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
 
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (file_id == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_get_user_profile_photos(g_handler,
-            user_id, offset, TELEBOT_USER_PHOTOS_MAX_LIMIT);
+    telebot_error_e ret = telebot_core_get_file(handler, file_id, response);
     if (ret != TELEBOT_ERROR_NONE)
         return ret;
 
-    struct json_object *obj = telebot_parser_str_to_obj(g_handler->resp_data);
-    free(g_handler->resp_data);
-    g_handler->resp_data = NULL;
-    g_handler->resp_size = 0;
+    struct json_object *obj = telebot_parser_str_to_obj(response->data);
 
     if (obj == NULL)
         return TELEBOT_ERROR_OPERATION_FAILED;
 
-    struct json_object *ok;
-    if (!json_object_object_get_ex(obj, "ok", &ok)) {
-        json_object_put(obj);
-        return TELEBOT_ERROR_OPERATION_FAILED;
-    }
-
-    if (!json_object_get_boolean(ok)) {
-        json_object_put(ok);
-        json_object_put(obj);
-        return TELEBOT_ERROR_OPERATION_FAILED;
-    }
-    json_object_put(ok);
-
     struct json_object *result;
     if (!json_object_object_get_ex(obj, "result", &result)){
         json_object_put(obj);
         return TELEBOT_ERROR_OPERATION_FAILED;
     }
 
-    ret = telebot_parser_get_profile_photos(result, photos, count);
-    json_object_put(result);
+    char *file_path = NULL;
+    ret = telebot_parser_get_file_path(result, &file_path);
     json_object_put(obj);
 
+    if (file_path == NULL)
+        return TELEBOT_ERROR_OPERATION_FAILED;
+
+    ret = telebot_core_download_file(handler, file_path, path);
+    free(file_path);
+
     return ret;
 }
 
-telebot_error_e telebot_download_file(char *file_id, char *path)
+telebot_error_e telebot_send_message(telebot_h *bot, long long chat_id,
+        char *text,
+        char *parse_mode, bool disable_web_page_preview,
+        int reply_to_message_id, const char *reply_markup)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    if (file_id == NULL)
+    telebot_core_h *handler = &(bot->core);
+
+    if (text == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_get_file(g_handler, file_id);
+    char chat_id_str[32];
+    sprintf(chat_id_str, "%lld", chat_id);
+
+    telebot_error_e ret = telebot_scheduler_acquire(bot->scheduler,
+            chat_id_str);
     if (ret != TELEBOT_ERROR_NONE)
         return ret;
 
-    struct json_object *obj = telebot_parser_str_to_obj(g_handler->resp_data);
-    free(g_handler->resp_data);
-    g_handler->resp_data = NULL;
-    g_handler->resp_size = 0;
+    ret = telebot_core_send_message(handler, chat_id_str, text,
+            parse_mode, disable_web_page_preview, reply_to_message_id,
+            reply_markup, NULL);
+    telebot_scheduler_done(bot->scheduler, ret);
 
-    if (obj == NULL)
-        return TELEBOT_ERROR_OPERATION_FAILED;
+    return ret;
+}
 
-    char *file_path;
-    ret = telebot_parser_get_file_path(obj, &file_path);
-    json_object_put(obj);
+/* A message of telebot_send_message_async(), until it was sent */
+struct telebot_queued_message {
+    telebot_h *bot;
+    char chat_id[32];
+    char *text;
+    char *parse_mode;
+    char *reply_markup;
+    bool disable_web_page_preview;
+    int reply_to_message_id;
+    telebot_send_cb_f cb;
+    void *user_data;
+};
+
+static void telebot_queued_message_free(struct telebot_queued_message *message)
+{
+    free(message->text);
+    free(message->parse_mode);
+    free(message->reply_markup);
+    free(message);
+}
 
-    if (file_path == NULL)
-        return TELEBOT_ERROR_OPERATION_FAILED;
+static void telebot_queued_message_finish(struct telebot_queued_message *message,
+        telebot_error_e ret)
+{
+    if (message->cb != NULL)
+        message->cb(message->bot, ret, message->user_data);
+    telebot_queued_message_free(message);
+}
 
-    ret = telebot_core_download_file(g_handler, file_path, path);
-    free(file_path);
-    if (g_handler->resp_data != NULL) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+static void telebot_queued_message_sent(telebot_core_h *handler,
+        telebot_error_e ret, struct json_object *result, void *user_data)
+{
+    struct telebot_queued_message *message = user_data;
+    telebot_scheduler_t *scheduler = message->bot->scheduler;
 
-    return ret;
+    telebot_queued_message_finish(message, ret);
+    telebot_scheduler_complete(scheduler, ret);
 }
 
-telebot_error_e telebot_send_message(int chat_id, char *text, char *parse_mode,
-        bool disable_web_page_preview, int reply_to_message_id, const char *reply_markup)
+/* Runs on the scheduler thread, the transport copies the message */
+static void telebot_queued_message_release(telebot_error_e ret, void *data)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    struct telebot_queued_message *message = data;
+    telebot_h *bot = message->bot;
 
-    if (text == NULL)
+    if (ret != TELEBOT_ERROR_NONE) {
+        telebot_queued_message_finish(message, ret);
+        return;
+    }
+
+    ret = telebot_core_send_message_async(&(bot->core), message->chat_id,
+            message->text, message->parse_mode,
+            message->disable_web_page_preview, message->reply_to_message_id,
+            message->reply_markup, telebot_queued_message_sent, message);
+    if (ret != TELEBOT_ERROR_NONE) {
+        telebot_queued_message_finish(message, ret);
+        telebot_scheduler_complete(bot->scheduler, ret);
+    }
+}
+
+telebot_error_e telebot_send_message_async(telebot_h *bot, long long chat_id,
+        const char *text, const char *parse_mode,
+        bool disable_web_page_preview, int reply_to_message_id,
+        const char *reply_markup, telebot_send_cb_f cb, void *user_data)
+{
+    if ((bot == NULL) || (text == NULL))
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    char chat_id_str[32];
-    sprintf(chat_id_str, "%d", chat_id);
-    telebot_error_e ret = telebot_core_send_message(g_handler, chat_id_str, text,
-            parse_mode, disable_web_page_preview, reply_to_message_id,
-            reply_markup);
+    struct telebot_queued_message *message = calloc(1,
+            sizeof(struct telebot_queued_message));
+    if (message == NULL) {
+        ERR("Failed to allocate memory");
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+    }
 
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
+    message->bot = bot;
+    snprintf(message->chat_id, sizeof(message->chat_id), "%lld", chat_id);
+    message->text = strdup(text);
+    message->parse_mode = telebot_strdup_opt(parse_mode);
+    message->reply_markup = telebot_strdup_opt(reply_markup);
+    message->disable_web_page_preview = disable_web_page_preview;
+    message->reply_to_message_id = reply_to_message_id;
+    message->cb = cb;
+    message->user_data = user_data;
+    if ((message->text == NULL) ||
+            ((parse_mode != NULL) && (message->parse_mode == NULL)) ||
+            ((reply_markup != NULL) && (message->reply_markup == NULL))) {
+        ERR("Failed to allocate memory");
+        telebot_queued_message_free(message);
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
     }
 
+    telebot_error_e ret = telebot_scheduler_submit(bot->scheduler,
+            message->chat_id, telebot_queued_message_release, message);
+    if (ret != TELEBOT_ERROR_NONE)
+        telebot_queued_message_free(message);
+
     return ret;
 }
 
-telebot_error_e telebot_delete_message(int chat_id, int message_id)
+telebot_error_e telebot_delete_message(telebot_h *bot, long long chat_id,
+        int message_id)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_delete_message(g_handler, chat_id, message_id);
+    telebot_core_h *handler = &(bot->core);
 
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+    telebot_error_e ret = telebot_core_delete_message(handler, chat_id,
+            message_id, NULL);
 
     return ret;
 }
 
-telebot_error_e telebot_answer_callback_query(const char *callback_query_id, char *text,
-                                              bool show_alert, char *url,
-                                              int cache_time)
+telebot_error_e telebot_answer_callback_query(telebot_h *bot,
+        const char *callback_query_id, char *text, bool show_alert, char *url,
+        int cache_time)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_h *handler = &(bot->core);
 
     if (callback_query_id == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_answer_callback_query(g_handler,
+    telebot_error_e ret = telebot_core_answer_callback_query(handler,
                                                              callback_query_id, text,
                                                              show_alert, url,
-                                                             cache_time);
-
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+                                                             cache_time, NULL);
 
     return ret;
 }
 
 
-telebot_error_e telebot_forward_message(char *chat_id, char *from_chat_id,
-        int message_id)
+telebot_error_e telebot_forward_message(telebot_h *bot, char *chat_id,
+        char *from_chat_id, int message_id)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_h *handler = &(bot->core);
 
     if (chat_id == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -480,23 +2244,25 @@ telebot_error_e telebot_forward_message(char *chat_id, char *from_chat_id,
     if (message_id <= 0)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_forward_message(g_handler, chat_id,
-            from_chat_id, message_id);
+    telebot_error_e ret = telebot_scheduler_acquire(bot->scheduler, chat_id);
+    if (ret != TELEBOT_ERROR_NONE)
+        return ret;
 
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+    ret = telebot_core_forward_message(handler, chat_id,
+            from_chat_id, message_id, NULL);
+    telebot_scheduler_done(bot->scheduler, ret);
 
     return ret;
 }
 
-telebot_error_e telebot_send_photo(char *chat_id, char *photo, bool is_file,
-        char *caption, int reply_to_message_id, char *reply_markup)
+telebot_error_e telebot_send_photo(telebot_h *bot, char *chat_id, char *photo,
+        bool is_file, char *caption, int reply_to_message_id,
+        char *reply_markup)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_h *handler = &(bot->core);
 
     if (chat_id == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -504,24 +2270,25 @@ telebot_error_e telebot_send_photo(char *chat_id, char *photo, bool is_file,
     if (photo == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_send_photo(g_handler, chat_id, photo,
-            is_file, caption, reply_to_message_id, reply_markup);
+    telebot_error_e ret = telebot_scheduler_acquire(bot->scheduler, chat_id);
+    if (ret != TELEBOT_ERROR_NONE)
+        return ret;
 
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+    ret = telebot_core_send_photo(handler, chat_id, photo,
+            is_file, caption, reply_to_message_id, reply_markup, NULL);
+    telebot_scheduler_done(bot->scheduler, ret);
 
     return ret;
 }
 
-telebot_error_e telebot_send_audio(char *chat_id, char *audio, bool is_file,
-        int duration, char *performer, char *title, int reply_to_message_id,
-        char *reply_markup)
+telebot_error_e telebot_send_audio(telebot_h *bot, char *chat_id, char *audio,
+        bool is_file, int duration, char *performer, char *title,
+        int reply_to_message_id, char *reply_markup)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_h *handler = &(bot->core);
 
     if (chat_id == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -529,24 +2296,26 @@ telebot_error_e telebot_send_audio(char *chat_id, char *audio, bool is_file,
     if (audio == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_send_audio(g_handler, chat_id, audio,
-            is_file, duration, performer, title, reply_to_message_id,
-            reply_markup);
+    telebot_error_e ret = telebot_scheduler_acquire(bot->scheduler, chat_id);
+    if (ret != TELEBOT_ERROR_NONE)
+        return ret;
 
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+    ret = telebot_core_send_audio(handler, chat_id, audio,
+            is_file, duration, performer, title, reply_to_message_id,
+            reply_markup, NULL);
+    telebot_scheduler_done(bot->scheduler, ret);
 
     return ret;
 }
 
-telebot_error_e telebot_send_document(char *chat_id, char *document,
-        bool is_file, int reply_to_message_id, char *reply_markup)
+telebot_error_e telebot_send_document(telebot_h *bot, char *chat_id,
+        char *document, bool is_file, int reply_to_message_id,
+        char *reply_markup)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_h *handler = &(bot->core);
 
     if (chat_id == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -554,23 +2323,25 @@ telebot_error_e telebot_send_document(char *chat_id, char *document,
     if (document == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_send_document(g_handler, chat_id,
-            document, is_file, reply_to_message_id, reply_markup);
+    telebot_error_e ret = telebot_scheduler_acquire(bot->scheduler, chat_id);
+    if (ret != TELEBOT_ERROR_NONE)
+        return ret;
 
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+    ret = telebot_core_send_document(handler, chat_id,
+            document, is_file, reply_to_message_id, reply_markup, NULL);
+    telebot_scheduler_done(bot->scheduler, ret);
 
     return ret;
 }
 
-telebot_error_e telebot_send_sticker(char *chat_id, char *sticker,
-        bool is_file, int reply_to_message_id, char *reply_markup)
+telebot_error_e telebot_send_sticker(telebot_h *bot, char *chat_id,
+        char *sticker, bool is_file, int reply_to_message_id,
+        char *reply_markup)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_h *handler = &(bot->core);
 
     if (chat_id == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -578,23 +2349,25 @@ telebot_error_e telebot_send_sticker(char *chat_id, char *sticker,
     if (sticker == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_send_sticker(g_handler, chat_id, sticker,
-            is_file, reply_to_message_id, reply_markup);
+    telebot_error_e ret = telebot_scheduler_acquire(bot->scheduler, chat_id);
+    if (ret != TELEBOT_ERROR_NONE)
+        return ret;
 
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+    ret = telebot_core_send_sticker(handler, chat_id, sticker,
+            is_file, reply_to_message_id, reply_markup, NULL);
+    telebot_scheduler_done(bot->scheduler, ret);
 
     return ret;
 }
 
-telebot_error_e telebot_send_video(char *chat_id, char *video, bool is_file,
-        int duration, char *caption, int reply_to_message_id, char *reply_markup)
+telebot_error_e telebot_send_video(telebot_h *bot, char *chat_id, char *video,
+        bool is_file, int duration, char *caption, int reply_to_message_id,
+        char *reply_markup)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_h *handler = &(bot->core);
 
     if (chat_id == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -602,23 +2375,25 @@ telebot_error_e telebot_send_video(char *chat_id, char *video, bool is_file,
     if (video == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_send_video(g_handler, chat_id, video,
-            is_file, duration, caption, reply_to_message_id, reply_markup);
+    telebot_error_e ret = telebot_scheduler_acquire(bot->scheduler, chat_id);
+    if (ret != TELEBOT_ERROR_NONE)
+        return ret;
 
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+    ret = telebot_core_send_video(handler, chat_id, video,
+            is_file, duration, caption, reply_to_message_id, reply_markup,
+            NULL);
+    telebot_scheduler_done(bot->scheduler, ret);
 
     return ret;
 }
 
-telebot_error_e telebot_send_voice(char *chat_id, char *voice, bool is_file,
-        int duration, int reply_to_message_id, char *reply_markup)
+telebot_error_e telebot_send_voice(telebot_h *bot, char *chat_id, char *voice,
+        bool is_file, int duration, int reply_to_message_id, char *reply_markup)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_h *handler = &(bot->core);
 
     if (chat_id == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -626,55 +2401,53 @@ telebot_error_e telebot_send_voice(char *chat_id, char *voice, bool is_file,
     if (voice == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_send_voice(g_handler, chat_id, voice,
-            is_file, duration, reply_to_message_id, reply_markup);
+    telebot_error_e ret = telebot_scheduler_acquire(bot->scheduler, chat_id);
+    if (ret != TELEBOT_ERROR_NONE)
+        return ret;
 
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+    ret = telebot_core_send_voice(handler, chat_id, voice,
+            is_file, duration, reply_to_message_id, reply_markup, NULL);
+    telebot_scheduler_done(bot->scheduler, ret);
 
     return ret;
 }
 
-telebot_error_e telebot_send_location(char *chat_id, float latitude,
-        float longitude, int reply_to_message_id, char *reply_markup)
+telebot_error_e telebot_send_location(telebot_h *bot, char *chat_id,
+        float latitude, float longitude, int reply_to_message_id,
+        char *reply_markup)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_h *handler = &(bot->core);
 
     if (chat_id == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_send_location(g_handler, chat_id,
-            latitude, longitude, reply_to_message_id, reply_markup);
+    telebot_error_e ret = telebot_scheduler_acquire(bot->scheduler, chat_id);
+    if (ret != TELEBOT_ERROR_NONE)
+        return ret;
 
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+    ret = telebot_core_send_location(handler, chat_id,
+            latitude, longitude, reply_to_message_id, reply_markup, NULL);
+    telebot_scheduler_done(bot->scheduler, ret);
 
     return ret;
 }
 
-telebot_error_e telebot_send_chat_action(char *chat_id, char *action)
+telebot_error_e telebot_send_chat_action(telebot_h *bot, char *chat_id,
+        char *action)
 {
-    if (g_handler == NULL)
-        return TELEBOT_ERROR_NOT_SUPPORTED;
+    if (bot == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_core_h *handler = &(bot->core);
 
     if (chat_id == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    telebot_error_e ret = telebot_core_send_chat_action(g_handler, chat_id,
-            action);
-
-    if (g_handler->resp_data) {
-        free(g_handler->resp_data);
-        g_handler->resp_data = NULL;
-        g_handler->resp_size = 0;
-    }
+    telebot_error_e ret = telebot_core_send_chat_action(handler, chat_id,
+            action, NULL);
 
     return ret;
 }
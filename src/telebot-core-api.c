@@ -21,90 +21,1308 @@
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/random.h>
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include <json.h>
+#include <json_object.h>
 #include <telebot-private.h>
 #include <telebot-common.h>
 #include <telebot-core-api.h>
+#include <telebot-api.h>
+#include <telebot-parser.h>
+#include <telebot-stats.h>
+
+/*
+ * Every core handler owns a small pool of long-lived curl easy handles. An
+ * easy handle keeps its connections alive between transfers, so reusing it
+ * avoids a TCP and TLS handshake per request. TLS sessions and DNS results
+ * are shared across the pool, so even a freshly opened connection resumes
+ * the TLS session instead of doing a full handshake.
+ */
+struct telebot_core_connection {
+    CURL *curl_h;
+    bool in_use;
+    bool stale;
+    time_t last_used;
+};
+
+/*
+ * Asynchronous requests are driven by a single curl multi handle, owned by a
+ * dedicated thread. Submitters only append to the pending list and wake the
+ * thread up; everything touching the multi handle happens on that thread.
+ */
+struct telebot_core_waiter {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+    CURLcode res;
+    long resp_code;
+};
+
+/*
+ * Consumer of a response body that is handed over instead of collected. Only
+ * the body of a 200 answer is passed on, any other one is collected in error
+ * for the retry policy, so that a request nothing was passed on for yet can
+ * be repeated.
+ */
+struct telebot_core_stream {
+    telebot_core_stream_cb_f cb;
+    void *user_data;
+    CURL *curl_h; /* Transfer the body comes from */
+    telebot_core_response_t *error; /* Body of other answers, may be NULL */
+    size_t fed; /* Bytes passed on to cb */
+};
+
+struct telebot_core_request {
+    telebot_core_h *handler;
+    /* Outlives the handler, which may be gone when the engine aborts */
+    struct telebot_core_transport *transport;
+    struct telebot_core_waiter *waiter;
+    CURL *curl_h;
+    struct curl_httppost *post;
+    telebot_core_response_t resp;
+    telebot_core_async_cb_f cb;
+    void *user_data;
+    struct telebot_core_stream stream; /* Body consumer, cb NULL to collect */
+    const char *method;
+    int attempts; /* Failed attempts so far */
+    unsigned long start_us;
+    unsigned long due_us; /* Next attempt, while delayed */
+    struct telebot_core_request *prev;
+    struct telebot_core_request *next;
+};
+
+struct telebot_core_engine {
+    CURLM *multi;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t idle_cond;
+    bool running;
+    int outstanding;
+    struct telebot_core_request *pending_head;
+    struct telebot_core_request *pending_tail;
+    struct telebot_core_request *active;
+    struct telebot_core_request *delayed; /* By due time, engine thread only */
+};
+
+struct telebot_core_transport {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    CURLSH *share;
+    pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+    struct telebot_core_connection conns[TELEBOT_CORE_CONNECTION_POOL_SIZE];
+    telebot_core_connection_stats_t stats;
+    telebot_core_retry_stats_t retry_stats;
+    telebot_stats_t *method_stats; /* Lock free */
+    int max_retries;
+    int max_retry_after;
+    struct telebot_core_engine *engine;
+    long http_version;
+    char *ca_file;
+    int refs; /* Handlers using the transport, under lock */
+};
+
+static void telebot_core_engine_destroy(struct telebot_core_engine *engine);
+
+static time_t telebot_core_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static unsigned long telebot_core_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void telebot_core_sleep_us(unsigned long us)
+{
+    struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+    while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR));
+}
+
+static void telebot_core_share_lock(CURL *handle, curl_lock_data data,
+        curl_lock_access access, void *userptr)
+{
+    struct telebot_core_transport *transport = userptr;
+    pthread_mutex_lock(&(transport->share_locks[data]));
+}
+
+static void telebot_core_share_unlock(CURL *handle, curl_lock_data data,
+        void *userptr)
+{
+    struct telebot_core_transport *transport = userptr;
+    pthread_mutex_unlock(&(transport->share_locks[data]));
+}
+
+static struct telebot_core_transport *telebot_core_transport_create(
+        const char *api_url, const telebot_core_options_t *options)
+{
+    struct telebot_core_transport *transport = calloc(1,
+            sizeof(struct telebot_core_transport));
+    if (transport == NULL) {
+        ERR("Failed to allocate memory");
+        return NULL;
+    }
+
+    transport->method_stats = telebot_stats_create();
+    if (transport->method_stats == NULL) {
+        free(transport);
+        return NULL;
+    }
+
+    transport->share = curl_share_init();
+    if (transport->share == NULL) {
+        ERR("Failed to init curl share");
+        telebot_stats_destroy(transport->method_stats);
+        free(transport);
+        return NULL;
+    }
+
+    int index;
+    for (index = 0; index < CURL_LOCK_DATA_LAST; index++)
+        pthread_mutex_init(&(transport->share_locks[index]), NULL);
+    pthread_mutex_init(&(transport->lock), NULL);
+    pthread_cond_init(&(transport->cond), NULL);
+    transport->refs = 1;
+    transport->max_retries = TELEBOT_CORE_RETRY_MAX;
+    transport->max_retry_after = TELEBOT_CORE_RETRY_AFTER_MAX;
+
+    curl_share_setopt(transport->share, CURLSHOPT_LOCKFUNC,
+            telebot_core_share_lock);
+    curl_share_setopt(transport->share, CURLSHOPT_UNLOCKFUNC,
+            telebot_core_share_unlock);
+    curl_share_setopt(transport->share, CURLSHOPT_USERDATA, transport);
+    curl_share_setopt(transport->share, CURLSHOPT_SHARE,
+            CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(transport->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+
+    /*
+     * Without HTTP/2 stay on HTTP/1.1 keep-alive rather than letting ALPN
+     * pick a protocol per connection. Plain-text endpoints (local stand-in
+     * servers) speak h2c with prior knowledge.
+     */
+    transport->http_version = CURL_HTTP_VERSION_1_1;
+    if (options == NULL)
+        return transport;
+
+    if (options->http2 && (strncmp(api_url, "https://", 8) == 0))
+        transport->http_version = CURL_HTTP_VERSION_2TLS;
+    else if (options->http2)
+        transport->http_version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+
+    if (options->ca_file != NULL)
+        transport->ca_file = strdup(options->ca_file);
+
+    return transport;
+}
+
+static bool telebot_core_multiplexed(struct telebot_core_transport *transport)
+{
+    return transport->http_version != CURL_HTTP_VERSION_1_1;
+}
+
+static struct telebot_core_transport *telebot_core_transport_ref(
+        struct telebot_core_transport *transport)
+{
+    pthread_mutex_lock(&(transport->lock));
+    transport->refs++;
+    pthread_mutex_unlock(&(transport->lock));
+
+    return transport;
+}
+
+static void telebot_core_transport_destroy(struct telebot_core_transport *transport)
+{
+    pthread_mutex_lock(&(transport->lock));
+    int refs = --transport->refs;
+    pthread_mutex_unlock(&(transport->lock));
+    if (refs > 0)
+        return;
+
+    if (transport->engine != NULL)
+        telebot_core_engine_destroy(transport->engine);
+
+    int index;
+    for (index = 0; index < TELEBOT_CORE_CONNECTION_POOL_SIZE; index++) {
+        if (transport->conns[index].curl_h != NULL)
+            curl_easy_cleanup(transport->conns[index].curl_h);
+    }
+
+    curl_share_cleanup(transport->share);
+
+    for (index = 0; index < CURL_LOCK_DATA_LAST; index++)
+        pthread_mutex_destroy(&(transport->share_locks[index]));
+    pthread_mutex_destroy(&(transport->lock));
+    pthread_cond_destroy(&(transport->cond));
+
+    if (transport->ca_file != NULL)
+        free(transport->ca_file);
+    telebot_stats_destroy(transport->method_stats);
+    free(transport);
+}
+
+static void telebot_core_connection_setup(struct telebot_core_transport *transport,
+        struct telebot_core_connection *conn)
+{
+    curl_easy_setopt(conn->curl_h, CURLOPT_SHARE, transport->share);
+    curl_easy_setopt(conn->curl_h, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(conn->curl_h, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(conn->curl_h, CURLOPT_MAXAGE_CONN,
+            (long)TELEBOT_CORE_CONNECTION_MAX_AGE);
+    curl_easy_setopt(conn->curl_h, CURLOPT_HTTP_VERSION,
+            transport->http_version);
+    if (transport->ca_file != NULL)
+        curl_easy_setopt(conn->curl_h, CURLOPT_CAINFO, transport->ca_file);
+}
+
+/*
+ * Takes a free connection from the pool, waiting for one if all of them are
+ * busy. The most recently used one is preferred, as it is the most likely to
+ * still have a live socket.
+ */
+static struct telebot_core_connection *telebot_core_connection_acquire(
+        struct telebot_core_transport *transport)
+{
+    struct telebot_core_connection *conn = NULL;
+
+    pthread_mutex_lock(&(transport->lock));
+    while (conn == NULL) {
+        int index;
+        for (index = 0; index < TELEBOT_CORE_CONNECTION_POOL_SIZE; index++) {
+            struct telebot_core_connection *c = &(transport->conns[index]);
+            if (c->in_use)
+                continue;
+            if ((conn == NULL) || ((conn->curl_h == NULL) && (c->curl_h != NULL)) ||
+                    ((c->curl_h != NULL) && (c->last_used > conn->last_used)))
+                conn = c;
+        }
+
+        if (conn == NULL)
+            pthread_cond_wait(&(transport->cond), &(transport->lock));
+    }
+    conn->in_use = true;
+    pthread_mutex_unlock(&(transport->lock));
+
+    if (conn->curl_h == NULL) {
+        conn->curl_h = curl_easy_init();
+        if (conn->curl_h == NULL) {
+            ERR("Failed to init curl");
+            pthread_mutex_lock(&(transport->lock));
+            conn->in_use = false;
+            pthread_cond_signal(&(transport->cond));
+            pthread_mutex_unlock(&(transport->lock));
+            return NULL;
+        }
+    }
+    else {
+        /* Keeps live connections and caches, drops the previous options */
+        curl_easy_reset(conn->curl_h);
+    }
+
+    telebot_core_connection_setup(transport, conn);
+
+    return conn;
+}
+
+static void telebot_core_connection_release(struct telebot_core_transport *transport,
+        struct telebot_core_connection *conn, bool performed)
+{
+    long new_connects = 0L;
+    if (performed)
+        curl_easy_getinfo(conn->curl_h, CURLINFO_NUM_CONNECTS, &new_connects);
+
+    pthread_mutex_lock(&(transport->lock));
+    if (performed) {
+        transport->stats.requests++;
+        if (new_connects > 0)
+            transport->stats.connected++;
+        else
+            transport->stats.reused++;
+    }
+
+    if (conn->stale) {
+        curl_easy_cleanup(conn->curl_h);
+        conn->curl_h = NULL;
+        conn->stale = false;
+    }
+    conn->in_use = false;
+    conn->last_used = telebot_core_now();
+    pthread_cond_signal(&(transport->cond));
+    pthread_mutex_unlock(&(transport->lock));
+}
+
+static size_t discard_data_cb(void *contents, size_t size, size_t nmemb,
+        void *userp)
+{
+    return size * nmemb;
+}
+
+/*
+ * Makes room for size more bytes and the NUL terminator. The capacity
+ * doubles, so a response costs a few reallocs rather than one per chunk.
+ */
+static bool telebot_core_buffer_reserve(char **data, size_t *capacity,
+        size_t used, size_t size)
+{
+    size_t needed = used + size + 1;
+    if (needed <= *capacity)
+        return true;
+
+    if (needed > TELEBOT_CORE_RESPONSE_SIZE_MAX) {
+        ERR("Response larger than %d bytes", TELEBOT_CORE_RESPONSE_SIZE_MAX);
+        return false;
+    }
+
+    size_t new_capacity = (*capacity > 0) ? *capacity :
+        TELEBOT_CORE_RESPONSE_SIZE_MIN;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+    if (new_capacity > TELEBOT_CORE_RESPONSE_SIZE_MAX)
+        new_capacity = TELEBOT_CORE_RESPONSE_SIZE_MAX;
+
+    char *new_data = realloc(*data, new_capacity);
+    if (new_data == NULL) {
+        ERR("Failed to allocate memory, size:%lu", (unsigned long)new_capacity);
+        return false;
+    }
+
+    *data = new_data;
+    *capacity = new_capacity;
+
+    return true;
+}
+
+/*
+ * The response buffer is kept from one request to the next. A buffer that
+ * grew past the retain size for an outlier response is released instead, so
+ * that one large reply does not stay pinned for as long as the caller keeps
+ * the response object.
+ */
+static void telebot_core_response_reset(telebot_core_response_t *response)
+{
+    if (response->capacity > TELEBOT_CORE_RESPONSE_SIZE_RETAIN) {
+        free(response->data);
+        response->data = NULL;
+        response->capacity = 0;
+    }
+
+    response->size = 0;
+    if (response->data != NULL)
+        response->data[0] = '\0';
+}
 
 static size_t write_data_cb(void *contents, size_t size, size_t nmemb,
         void *userp)
 {
-    telebot_core_h *handler = (telebot_core_h *) userp;
+    telebot_core_response_t *response = userp;
     size_t r_size = size * nmemb;
 
-    handler->resp_data = realloc(handler->resp_data, handler->resp_size +
-            r_size + 1);
-    if (handler->resp_data == NULL) {
-        ERR("Failed to allocate memory, size:%u", (unsigned int)r_size);
-        return 0;
+    if (!telebot_core_buffer_reserve(&(response->data),
+                &(response->capacity), response->size, r_size))
+        return 0;
+
+    memcpy((response->data + response->size), contents, r_size);
+    response->size += r_size;
+    response->data[response->size] = 0;
+
+    return r_size;
+}
+
+static size_t write_stream_cb(void *contents, size_t size, size_t nmemb,
+        void *userp)
+{
+    struct telebot_core_stream *stream = userp;
+    size_t r_size = size * nmemb;
+
+    long resp_code = 0L;
+    curl_easy_getinfo(stream->curl_h, CURLINFO_RESPONSE_CODE, &resp_code);
+    if (resp_code != 200L) {
+        if (stream->error == NULL)
+            return r_size;
+        return write_data_cb(contents, size, nmemb, stream->error);
+    }
+
+    /* A short count makes curl abort the transfer with CURLE_WRITE_ERROR */
+    if (stream->cb(contents, r_size, stream->user_data) != TELEBOT_ERROR_NONE)
+        return 0;
+    stream->fed += r_size;
+
+    return r_size;
+}
+
+/* Asks the consumer whether to go on, also while no data arrives */
+static int stream_progress_cb(void *clientp, curl_off_t dltotal,
+        curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    struct telebot_core_stream *stream = clientp;
+
+    if (stream->cb(NULL, 0, stream->user_data) != TELEBOT_ERROR_NONE)
+        return 1;
+
+    return 0;
+}
+
+static void telebot_core_stream_setup(CURL *curl_h,
+        struct telebot_core_stream *stream)
+{
+    stream->curl_h = curl_h;
+    curl_easy_setopt(curl_h, CURLOPT_WRITEFUNCTION, write_stream_cb);
+    curl_easy_setopt(curl_h, CURLOPT_WRITEDATA, stream);
+    curl_easy_setopt(curl_h, CURLOPT_XFERINFOFUNCTION, stream_progress_cb);
+    curl_easy_setopt(curl_h, CURLOPT_XFERINFODATA, stream);
+    curl_easy_setopt(curl_h, CURLOPT_NOPROGRESS, 0L);
+}
+
+/* Sleeps before a retry, false if the consumer of the stream gave up */
+static bool telebot_core_retry_sleep(struct telebot_core_stream *stream,
+        unsigned long us)
+{
+    while (us > 0) {
+        if ((stream != NULL) &&
+                (stream->cb(NULL, 0, stream->user_data) != TELEBOT_ERROR_NONE))
+            return false;
+
+        unsigned long slice = us;
+        if ((stream != NULL) && (slice > TELEBOT_CORE_STREAM_CHECK_INTERVAL))
+            slice = TELEBOT_CORE_STREAM_CHECK_INTERVAL;
+        telebot_core_sleep_us(slice);
+        us -= slice;
+    }
+
+    return true;
+}
+
+/* Telegram answers 429 when the bot sends faster than it allows */
+static telebot_error_e telebot_core_http_error(long resp_code)
+{
+    if (resp_code == 429L)
+        return TELEBOT_ERROR_RATE_LIMITED;
+
+    return TELEBOT_ERROR_OPERATION_FAILED;
+}
+
+/* Methods that can be repeated without a visible effect, even when the failed
+ * attempt might have reached Telegram */
+static const char *telebot_core_idempotent_methods[] = {
+    TELEBOT_METHOD_GET_ME,
+    TELEBOT_METHOD_GET_UPDATES,
+    TELEBOT_METHOD_GET_USERPHOTOS,
+    TELEBOT_METHOD_GET_FILE,
+    TELEBOT_METHOD_SET_WEBHOOK,
+    TELEBOT_METHOD_SEND_CHATACTION,
+    NULL
+};
+
+static bool telebot_core_idempotent(const char *method)
+{
+    int index;
+    for (index = 0; telebot_core_idempotent_methods[index] != NULL; index++) {
+        if (strcmp(method, telebot_core_idempotent_methods[index]) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/* Failures that happen before anything was sent, any method can be retried */
+static bool telebot_core_unsent(CURLcode res)
+{
+    switch (res) {
+    case CURLE_COULDNT_RESOLVE_PROXY:
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_SSL_CONNECT_ERROR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Failures of our own making, that another attempt would not fix */
+static bool telebot_core_local_error(CURLcode res)
+{
+    switch (res) {
+    case CURLE_FAILED_INIT:
+    case CURLE_URL_MALFORMAT:
+    case CURLE_OUT_OF_MEMORY:
+    case CURLE_WRITE_ERROR:
+    case CURLE_READ_ERROR:
+    case CURLE_ABORTED_BY_CALLBACK:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* The "parameters.retry_after" of an error answer in seconds, 0 without one */
+static long telebot_core_retry_after(const telebot_core_response_t *response)
+{
+    if ((response == NULL) || (response->data == NULL) ||
+            (response->size == 0))
+        return 0;
+
+    struct json_object *obj = telebot_parser_str_to_obj(response->data);
+    if (obj == NULL)
+        return 0;
+
+    long seconds = 0;
+    struct json_object *parameters, *retry_after;
+    if (json_object_object_get_ex(obj, "parameters", &parameters) &&
+            json_object_object_get_ex(parameters, "retry_after", &retry_after))
+        seconds = json_object_get_int(retry_after);
+    json_object_put(obj);
+
+    return seconds;
+}
+
+/*
+ * Each retrying thread draws from a generator of its own, seeded on first use,
+ * so that bots and threads do not share one unseeded sequence.
+ */
+static double telebot_core_jitter(void)
+{
+    static __thread unsigned short seed[3];
+    static __thread bool seeded;
+
+    if (!seeded) {
+        if (getrandom(seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed)) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            unsigned long mix = (unsigned long)now.tv_nsec ^
+                (unsigned long)now.tv_sec ^ (unsigned long)pthread_self();
+            seed[0] = (unsigned short)mix;
+            seed[1] = (unsigned short)(mix >> 16);
+            seed[2] = (unsigned short)(mix >> 32);
+        }
+        seeded = true;
+    }
+
+    return erand48(seed);
+}
+
+/*
+ * Full jitter: a random delay up to the exponential ceiling, so that requests
+ * which failed together do not come back together.
+ */
+static unsigned long telebot_core_backoff(int attempt)
+{
+    unsigned long ceiling = TELEBOT_CORE_BACKOFF_MAX;
+    if (attempt < 16)
+        ceiling = (unsigned long)TELEBOT_CORE_BACKOFF_MIN << attempt;
+    if (ceiling > TELEBOT_CORE_BACKOFF_MAX)
+        ceiling = TELEBOT_CORE_BACKOFF_MAX;
+
+    return (unsigned long)(ceiling * telebot_core_jitter());
+}
+
+/*
+ * Counts a failed attempt and decides whether it is repeated. Returns the
+ * delay before the next attempt in microseconds, or -1 to give up.
+ */
+static long telebot_core_retry_delay(struct telebot_core_transport *transport,
+        const char *method, int attempt, CURLcode res, long resp_code,
+        const telebot_core_response_t *response)
+{
+    if ((res == CURLE_OK) && (resp_code == 200L))
+        return -1;
+
+    pthread_mutex_lock(&(transport->lock));
+    if (res != CURLE_OK)
+        transport->retry_stats.transport_errors++;
+    else if (resp_code == 429L)
+        transport->retry_stats.rate_limited++;
+    else if (resp_code >= 500L)
+        transport->retry_stats.server_errors++;
+    int max_retries = transport->max_retries;
+    long max_retry_after = transport->max_retry_after;
+    pthread_mutex_unlock(&(transport->lock));
+
+    if (attempt >= max_retries)
+        return -1;
+
+    long delay;
+    if ((res == CURLE_OK) && (resp_code == 429L)) {
+        /* The request was turned down as a whole, any method can repeat it */
+        long seconds = telebot_core_retry_after(response);
+        if (seconds > max_retry_after) {
+            ERR("Retry after %ld seconds is too long", seconds);
+            return -1;
+        }
+        delay = (seconds > 0) ? seconds * 1000000L :
+            (long)telebot_core_backoff(attempt);
+    }
+    else if ((res == CURLE_OK) && (resp_code >= 500L) &&
+            telebot_core_idempotent(method)) {
+        delay = telebot_core_backoff(attempt);
+    }
+    else if ((res != CURLE_OK) && (telebot_core_unsent(res) ||
+                (!telebot_core_local_error(res) &&
+                 telebot_core_idempotent(method)))) {
+        delay = telebot_core_backoff(attempt);
+    }
+    else {
+        return -1;
+    }
+
+    DBG("Retrying %s in %ld us, attempt: %d", method, delay, attempt + 1);
+    pthread_mutex_lock(&(transport->lock));
+    transport->retry_stats.retries++;
+    transport->retry_stats.retry_wait_total_us += delay;
+    pthread_mutex_unlock(&(transport->lock));
+    telebot_stats_retry(transport->method_stats, method);
+
+    return delay;
+}
+
+static void telebot_core_retry_done(struct telebot_core_transport *transport,
+        const char *method, unsigned long start_us, telebot_error_e ret)
+{
+    unsigned long latency = telebot_core_now_us() - start_us;
+    telebot_stats_done(transport->method_stats, method,
+            ret != TELEBOT_ERROR_NONE);
+
+    pthread_mutex_lock(&(transport->lock));
+    transport->retry_stats.requests++;
+    if (ret != TELEBOT_ERROR_NONE)
+        transport->retry_stats.failed++;
+    transport->retry_stats.latency_total_us += latency;
+    if (latency > transport->retry_stats.latency_max_us)
+        transport->retry_stats.latency_max_us = latency;
+    pthread_mutex_unlock(&(transport->lock));
+}
+
+static void telebot_core_request_free(struct telebot_core_request *req)
+{
+    if (req->post != NULL)
+        curl_formfree(req->post);
+    if (req->curl_h != NULL)
+        curl_easy_cleanup(req->curl_h);
+    if (req->resp.data != NULL)
+        free(req->resp.data);
+    free(req);
+}
+
+/*
+ * Checks the transfer outcome, parses the response and hands the "result"
+ * member to the user callback. The parsed object only lives for the duration
+ * of the callback.
+ */
+static void telebot_core_request_complete(struct telebot_core_request *req,
+        CURLcode res)
+{
+    telebot_error_e ret = TELEBOT_ERROR_NONE;
+    struct json_object *obj = NULL;
+    struct json_object *result = NULL;
+    long resp_code = 0L;
+
+    if (req->waiter != NULL) {
+        struct telebot_core_waiter *waiter = req->waiter;
+        pthread_mutex_lock(&(waiter->lock));
+        if (res == CURLE_OK)
+            curl_easy_getinfo(req->curl_h, CURLINFO_RESPONSE_CODE,
+                    &(waiter->resp_code));
+        waiter->res = res;
+        waiter->done = true;
+        pthread_cond_signal(&(waiter->cond));
+        pthread_mutex_unlock(&(waiter->lock));
+
+        telebot_core_request_free(req);
+        return;
+    }
+
+    if (res != CURLE_OK) {
+        ERR("Asynchronous request failed\nError: %s (%d)",
+                curl_easy_strerror(res), res);
+        ret = TELEBOT_ERROR_OPERATION_FAILED;
+    }
+    else {
+        curl_easy_getinfo(req->curl_h, CURLINFO_RESPONSE_CODE, &resp_code);
+        if (resp_code != 200L) {
+            ERR("Wrong HTTP response received, response: %ld", resp_code);
+            ret = telebot_core_http_error(resp_code);
+        }
+    }
+
+    /* A streamed body was already handed over, its consumer judges it */
+    if ((ret == TELEBOT_ERROR_NONE) && (req->stream.cb != NULL)) {
+        result = NULL;
+    }
+    else if ((ret == TELEBOT_ERROR_NONE) && (req->resp.data != NULL)) {
+        DBG("Response: %s", req->resp.data);
+        obj = telebot_parser_str_to_obj(req->resp.data);
+
+        struct json_object *ok;
+        if ((obj == NULL) || !json_object_object_get_ex(obj, "ok", &ok) ||
+                !json_object_get_boolean(ok) ||
+                !json_object_object_get_ex(obj, "result", &result)) {
+            result = NULL;
+            ret = TELEBOT_ERROR_OPERATION_FAILED;
+        }
+    }
+    else if (ret == TELEBOT_ERROR_NONE) {
+        ret = TELEBOT_ERROR_OPERATION_FAILED;
+    }
+
+    telebot_core_retry_done(req->transport, req->method,
+            req->start_us, ret);
+    if (req->cb != NULL)
+        req->cb(req->handler, ret, result, req->user_data);
+
+    if (obj != NULL)
+        json_object_put(obj);
+
+    telebot_core_request_free(req);
+}
+
+static void telebot_core_engine_done(struct telebot_core_engine *engine)
+{
+    pthread_mutex_lock(&(engine->lock));
+    engine->outstanding--;
+    if (engine->outstanding == 0)
+        pthread_cond_broadcast(&(engine->idle_cond));
+    pthread_mutex_unlock(&(engine->lock));
+}
+
+static void telebot_core_engine_unlink(struct telebot_core_engine *engine,
+        struct telebot_core_request *req)
+{
+    if (req->prev != NULL)
+        req->prev->next = req->next;
+    else
+        engine->active = req->next;
+    if (req->next != NULL)
+        req->next->prev = req->prev;
+    req->prev = req->next = NULL;
+}
+
+static void telebot_core_engine_activate(struct telebot_core_engine *engine,
+        struct telebot_core_request *req)
+{
+    req->prev = NULL;
+    req->next = engine->active;
+    if (engine->active != NULL)
+        engine->active->prev = req;
+    engine->active = req;
+    curl_multi_add_handle(engine->multi, req->curl_h);
+}
+
+/* Every attempt is recorded here, whoever retries or completes it */
+static void telebot_core_engine_record(struct telebot_core_request *req,
+        CURLcode res)
+{
+    long resp_code = 0L;
+    if (res == CURLE_OK)
+        curl_easy_getinfo(req->curl_h, CURLINFO_RESPONSE_CODE, &resp_code);
+    telebot_stats_attempt(req->transport->method_stats, req->method,
+            req->curl_h, res, resp_code);
+}
+
+/*
+ * Asynchronous requests are retried by the engine itself: a failed one is put
+ * aside until its delay is over and then added to the multi handle again.
+ * Blocking requests are retried by their caller, streamed ones as long as
+ * nothing was passed on to their consumer.
+ */
+static bool telebot_core_engine_retry(struct telebot_core_engine *engine,
+        struct telebot_core_request *req, CURLcode res)
+{
+    if ((req->waiter != NULL) ||
+            ((req->stream.cb != NULL) && (req->stream.fed > 0)))
+        return false;
+
+    long resp_code = 0L;
+    if (res == CURLE_OK)
+        curl_easy_getinfo(req->curl_h, CURLINFO_RESPONSE_CODE, &resp_code);
+
+    long delay = telebot_core_retry_delay(req->transport,
+            req->method, req->attempts, res, resp_code, &(req->resp));
+    if (delay < 0)
+        return false;
+
+    req->attempts++;
+    telebot_core_response_reset(&(req->resp));
+    req->due_us = telebot_core_now_us() + delay;
+
+    struct telebot_core_request **link = &(engine->delayed);
+    while ((*link != NULL) && ((*link)->due_us <= req->due_us))
+        link = &((*link)->next);
+    req->prev = NULL;
+    req->next = *link;
+    *link = req;
+
+    return true;
+}
+
+static void *telebot_core_engine_thread(void *data)
+{
+    struct telebot_core_engine *engine = data;
+    int still_running;
+
+    while (true) {
+        pthread_mutex_lock(&(engine->lock));
+        if (!engine->running) {
+            pthread_mutex_unlock(&(engine->lock));
+            break;
+        }
+        struct telebot_core_request *pending = engine->pending_head;
+        engine->pending_head = engine->pending_tail = NULL;
+        pthread_mutex_unlock(&(engine->lock));
+
+        while (pending != NULL) {
+            struct telebot_core_request *req = pending;
+            pending = pending->next;
+            telebot_core_engine_activate(engine, req);
+        }
+
+        unsigned long now = telebot_core_now_us();
+        while ((engine->delayed != NULL) && (engine->delayed->due_us <= now)) {
+            struct telebot_core_request *req = engine->delayed;
+            engine->delayed = req->next;
+            telebot_core_engine_activate(engine, req);
+        }
+
+        curl_multi_perform(engine->multi, &still_running);
+
+        CURLMsg *msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(engine->multi, &msgs_left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            struct telebot_core_request *req = NULL;
+            CURLcode res = msg->data.result;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&req);
+            curl_multi_remove_handle(engine->multi, req->curl_h);
+            telebot_core_engine_unlink(engine, req);
+            telebot_core_engine_record(req, res);
+            if (telebot_core_engine_retry(engine, req, res))
+                continue;
+            telebot_core_request_complete(req, res);
+            telebot_core_engine_done(engine);
+        }
+
+        /* Wake up in time for the first delayed request */
+        int timeout_ms = 1000;
+        if (engine->delayed != NULL) {
+            now = telebot_core_now_us();
+            unsigned long due = engine->delayed->due_us;
+            if (due <= now)
+                timeout_ms = 0;
+            else if (due - now < 1000000UL)
+                timeout_ms = (due - now + 999) / 1000;
+        }
+        curl_multi_poll(engine->multi, NULL, 0, timeout_ms, NULL);
+    }
+
+    return NULL;
+}
+
+static struct telebot_core_engine *telebot_core_engine_create(
+        struct telebot_core_transport *transport)
+{
+    struct telebot_core_engine *engine = calloc(1,
+            sizeof(struct telebot_core_engine));
+    if (engine == NULL) {
+        ERR("Failed to allocate memory");
+        return NULL;
+    }
+
+    engine->multi = curl_multi_init();
+    if (engine->multi == NULL) {
+        ERR("Failed to init curl multi");
+        free(engine);
+        return NULL;
+    }
+
+    curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING,
+            telebot_core_multiplexed(transport) ? (long)CURLPIPE_MULTIPLEX :
+            (long)CURLPIPE_NOTHING);
+
+    pthread_mutex_init(&(engine->lock), NULL);
+    pthread_cond_init(&(engine->idle_cond), NULL);
+    engine->running = true;
+
+    if (pthread_create(&(engine->thread), NULL, telebot_core_engine_thread,
+                engine) != 0) {
+        ERR("Failed to create thread, error: %d", errno);
+        curl_multi_cleanup(engine->multi);
+        pthread_mutex_destroy(&(engine->lock));
+        pthread_cond_destroy(&(engine->idle_cond));
+        free(engine);
+        return NULL;
+    }
+
+    return engine;
+}
+
+/*
+ * Stops the engine thread and fails every request that is still queued or in
+ * flight, so that no callback is silently lost.
+ */
+static void telebot_core_engine_destroy(struct telebot_core_engine *engine)
+{
+    pthread_mutex_lock(&(engine->lock));
+    engine->running = false;
+    pthread_mutex_unlock(&(engine->lock));
+    curl_multi_wakeup(engine->multi);
+    pthread_join(engine->thread, NULL);
+
+    while (engine->active != NULL) {
+        struct telebot_core_request *req = engine->active;
+        curl_multi_remove_handle(engine->multi, req->curl_h);
+        telebot_core_engine_unlink(engine, req);
+        telebot_core_request_complete(req, CURLE_ABORTED_BY_CALLBACK);
+    }
+
+    while (engine->pending_head != NULL) {
+        struct telebot_core_request *req = engine->pending_head;
+        engine->pending_head = req->next;
+        telebot_core_request_complete(req, CURLE_ABORTED_BY_CALLBACK);
+    }
+
+    while (engine->delayed != NULL) {
+        struct telebot_core_request *req = engine->delayed;
+        engine->delayed = req->next;
+        telebot_core_request_complete(req, CURLE_ABORTED_BY_CALLBACK);
+    }
+
+    curl_multi_cleanup(engine->multi);
+    pthread_mutex_destroy(&(engine->lock));
+    pthread_cond_destroy(&(engine->idle_cond));
+    free(engine);
+}
+
+static struct telebot_core_engine *telebot_core_engine_get(
+        struct telebot_core_transport *transport)
+{
+    pthread_mutex_lock(&(transport->lock));
+    if (transport->engine == NULL)
+        transport->engine = telebot_core_engine_create(transport);
+    struct telebot_core_engine *engine = transport->engine;
+    pthread_mutex_unlock(&(transport->lock));
+
+    return engine;
+}
+
+static struct telebot_core_request *telebot_core_request_create(
+        telebot_core_h *handler, const char *method, struct curl_httppost *post)
+{
+    struct telebot_core_transport *transport = handler->transport;
+    struct telebot_core_request *req;
+
+    req = calloc(1, sizeof(struct telebot_core_request));
+    if (req == NULL) {
+        ERR("Failed to allocate memory");
+        if (post != NULL)
+            curl_formfree(post);
+        return NULL;
+    }
+
+    req->handler = handler;
+    req->transport = transport;
+    req->post = post;
+    req->method = method;
+    req->start_us = telebot_core_now_us();
+    req->curl_h = curl_easy_init();
+    if (req->curl_h == NULL) {
+        ERR("Failed to init curl");
+        telebot_core_request_free(req);
+        return NULL;
+    }
+
+    char URL[TELEBOT_URL_SIZE];
+    snprintf(URL, TELEBOT_URL_SIZE, "%s/bot%s/%s", handler->api_url,
+            handler->token, method);
+    curl_easy_setopt(req->curl_h, CURLOPT_URL, URL);
+    curl_easy_setopt(req->curl_h, CURLOPT_WRITEFUNCTION, write_data_cb);
+    curl_easy_setopt(req->curl_h, CURLOPT_WRITEDATA, &(req->resp));
+    curl_easy_setopt(req->curl_h, CURLOPT_PRIVATE, req);
+    curl_easy_setopt(req->curl_h, CURLOPT_SHARE, transport->share);
+    curl_easy_setopt(req->curl_h, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(req->curl_h, CURLOPT_TCP_KEEPALIVE, 1L);
+    if (transport->ca_file != NULL)
+        curl_easy_setopt(req->curl_h, CURLOPT_CAINFO, transport->ca_file);
+
+    /* Wait for the existing connection to multiplex instead of opening a new
+     * one for every concurrent request */
+    curl_easy_setopt(req->curl_h, CURLOPT_HTTP_VERSION, transport->http_version);
+    if (telebot_core_multiplexed(transport))
+        curl_easy_setopt(req->curl_h, CURLOPT_PIPEWAIT, 1L);
+
+    if (post != NULL)
+        curl_easy_setopt(req->curl_h, CURLOPT_HTTPPOST, post);
+
+    return req;
+}
+
+static void telebot_core_engine_submit(struct telebot_core_engine *engine,
+        struct telebot_core_request *req)
+{
+    pthread_mutex_lock(&(engine->lock));
+    if (engine->pending_tail != NULL)
+        engine->pending_tail->next = req;
+    else
+        engine->pending_head = req;
+    engine->pending_tail = req;
+    engine->outstanding++;
+    pthread_mutex_unlock(&(engine->lock));
+
+    curl_multi_wakeup(engine->multi);
+}
+
+/*
+ * A positive timeout (in seconds) bounds the whole transfer. With a stream the
+ * body is passed on chunk by chunk on the transport thread and cb gets a NULL
+ * result.
+ */
+static telebot_error_e telebot_core_async_perform_ex(telebot_core_h *handler,
+        const char *method, struct curl_httppost *post, long timeout,
+        const struct telebot_core_stream *stream, telebot_core_async_cb_f cb,
+        void *user_data)
+{
+    struct telebot_core_engine *engine;
+    struct telebot_core_request *req;
+
+    engine = telebot_core_engine_get(handler->transport);
+    if (engine == NULL) {
+        if (post != NULL)
+            curl_formfree(post);
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    }
+
+    req = telebot_core_request_create(handler, method, post);
+    if (req == NULL)
+        return TELEBOT_ERROR_OPERATION_FAILED;
+
+    if (timeout > 0)
+        curl_easy_setopt(req->curl_h, CURLOPT_TIMEOUT, timeout);
+    if (stream != NULL) {
+        req->stream = *stream;
+        req->stream.error = &(req->resp);
+        telebot_core_stream_setup(req->curl_h, &(req->stream));
     }
 
-    memcpy((handler->resp_data  + handler->resp_size), contents, r_size);
-    handler->resp_size += r_size;
-    handler->resp_data[handler->resp_size] = 0;
+    req->cb = cb;
+    req->user_data = user_data;
+    telebot_core_engine_submit(engine, req);
 
-    return r_size;
+    return TELEBOT_ERROR_NONE;
 }
 
-static telebot_error_e telebot_core_curl_perform(telebot_core_h *handler,
-        const char *method, struct curl_httppost *post)
+static telebot_error_e telebot_core_async_perform(telebot_core_h *handler,
+        const char *method, struct curl_httppost *post,
+        telebot_core_async_cb_f cb, void *user_data)
 {
-    CURL *curl_h;
-    CURLcode res;
-    long resp_code = 0L;
+    return telebot_core_async_perform_ex(handler, method, post, 0, NULL, cb,
+            user_data);
+}
 
-    handler->resp_data = (char *)malloc(1);
-    handler->resp_size = 0;
+/*
+ * Blocking request over the shared multi handle, used in HTTP/2 mode so that
+ * concurrent callers end up as streams of one connection rather than each
+ * holding a pooled connection of its own.
+ */
+static CURLcode telebot_core_multiplexed_perform(telebot_core_h *handler,
+        const char *method, struct curl_httppost *post, long timeout,
+        struct telebot_core_stream *stream, telebot_core_response_t *response,
+        long *resp_code)
+{
+    struct telebot_core_engine *engine;
+    struct telebot_core_request *req;
+    struct telebot_core_waiter waiter;
 
-    curl_h = curl_easy_init();
+    engine = telebot_core_engine_get(handler->transport);
+    if (engine == NULL)
+        return CURLE_FAILED_INIT;
 
-    if (curl_h == NULL) {
-        ERR("Failed to init curl");
-        return TELEBOT_ERROR_OPERATION_FAILED;
+    /* The form stays with the caller, which may need it for a retry */
+    req = telebot_core_request_create(handler, method, NULL);
+    if (req == NULL)
+        return CURLE_OUT_OF_MEMORY;
+
+    if (post != NULL)
+        curl_easy_setopt(req->curl_h, CURLOPT_HTTPPOST, post);
+    if (timeout > 0)
+        curl_easy_setopt(req->curl_h, CURLOPT_TIMEOUT, timeout);
+
+    /* The caller blocks until completion, so the response can go straight
+     * to its buffer or stream */
+    if (stream != NULL) {
+        telebot_core_stream_setup(req->curl_h, stream);
+    }
+    else if (response != NULL) {
+        curl_easy_setopt(req->curl_h, CURLOPT_WRITEDATA, response);
+    }
+    else {
+        curl_easy_setopt(req->curl_h, CURLOPT_WRITEFUNCTION, discard_data_cb);
     }
 
+    memset(&waiter, 0, sizeof(waiter));
+    pthread_mutex_init(&(waiter.lock), NULL);
+    pthread_cond_init(&(waiter.cond), NULL);
+    req->waiter = &waiter;
+    telebot_core_engine_submit(engine, req);
+
+    pthread_mutex_lock(&(waiter.lock));
+    while (!waiter.done)
+        pthread_cond_wait(&(waiter.cond), &(waiter.lock));
+    pthread_mutex_unlock(&(waiter.lock));
+    pthread_mutex_destroy(&(waiter.lock));
+    pthread_cond_destroy(&(waiter.cond));
+
+    *resp_code = waiter.resp_code;
+
+    return waiter.res;
+}
+
+/* One attempt of a blocking request, the form is left to the caller */
+static CURLcode telebot_core_transfer(telebot_core_h *handler,
+        const char *method, struct curl_httppost *post, long timeout,
+        struct telebot_core_stream *stream, telebot_core_response_t *response,
+        long *resp_code)
+{
+    struct telebot_core_connection *conn = NULL;
+    CURLcode res;
+
+    if (telebot_core_multiplexed(handler->transport))
+        return telebot_core_multiplexed_perform(handler, method, post,
+                timeout, stream, response, resp_code);
+
+    conn = telebot_core_connection_acquire(handler->transport);
+    if (conn == NULL)
+        return CURLE_FAILED_INIT;
+
     char URL[TELEBOT_URL_SIZE];
-    snprintf(URL, TELEBOT_URL_SIZE, "%s/bot%s/%s", TELEBOT_API_URL,
+    snprintf(URL, TELEBOT_URL_SIZE, "%s/bot%s/%s", handler->api_url,
             handler->token, method);
-    curl_easy_setopt(curl_h, CURLOPT_URL, URL);
-    curl_easy_setopt(curl_h, CURLOPT_WRITEFUNCTION, write_data_cb);
-    curl_easy_setopt(curl_h, CURLOPT_WRITEDATA, handler);
+    curl_easy_setopt(conn->curl_h, CURLOPT_URL, URL);
+    if (stream != NULL) {
+        telebot_core_stream_setup(conn->curl_h, stream);
+    }
+    else if (response != NULL) {
+        curl_easy_setopt(conn->curl_h, CURLOPT_WRITEFUNCTION, write_data_cb);
+        curl_easy_setopt(conn->curl_h, CURLOPT_WRITEDATA, response);
+    }
+    else {
+        curl_easy_setopt(conn->curl_h, CURLOPT_WRITEFUNCTION, discard_data_cb);
+    }
+    if (timeout > 0)
+        curl_easy_setopt(conn->curl_h, CURLOPT_TIMEOUT, timeout);
+
+    if (post != NULL)
+        curl_easy_setopt(conn->curl_h, CURLOPT_HTTPPOST, post);
+
+    res = curl_easy_perform(conn->curl_h);
+    if (res == CURLE_OK)
+        curl_easy_getinfo(conn->curl_h, CURLINFO_RESPONSE_CODE, resp_code);
+    if (stream != NULL)
+        curl_easy_setopt(conn->curl_h, CURLOPT_NOPROGRESS, 1L);
+    telebot_stats_attempt(handler->transport->method_stats, method,
+            conn->curl_h, res, *resp_code);
+    telebot_core_connection_release(handler->transport, conn, true);
+
+    return res;
+}
+
+/*
+ * A positive timeout (in seconds) bounds each attempt, so that a long poll on
+ * a silently dropped connection does not block forever. With a stream the
+ * body is passed on chunk by chunk, otherwise it is collected in the response
+ * of the caller, or dropped without one. Failed attempts are repeated as the
+ * retry policy allows, sleeping in the calling thread. Nothing is written to
+ * the handler, so that any number of threads can perform requests on it.
+ */
+static telebot_error_e telebot_core_curl_perform_timeout(
+        telebot_core_h *handler, const char *method, struct curl_httppost *post,
+        long timeout, struct telebot_core_stream *stream,
+        telebot_core_response_t *response)
+{
+    telebot_error_e ret = TELEBOT_ERROR_NONE;
+    telebot_core_response_t scratch = {0};
+    unsigned long start_us = telebot_core_now_us();
+    CURLcode res;
+    long resp_code;
+    int attempt;
+
+    /* The retry_after of a 429 comes in the body, which is kept even when
+     * the caller has no use for it or streams a 200 one */
+    telebot_core_response_t *body = response;
+    if (body == NULL)
+        body = &scratch;
+    if (stream != NULL)
+        stream->error = body;
+
+    for (attempt = 0; ; attempt++) {
+        resp_code = 0L;
+        telebot_core_response_reset(body);
+
+        res = telebot_core_transfer(handler, method, post, timeout, stream,
+                body, &resp_code);
+
+        /* A streamed body was already partly consumed, it cannot be redone */
+        if ((stream != NULL) && (stream->fed > 0))
+            break;
+
+        long delay = telebot_core_retry_delay(handler->transport, method,
+                attempt, res, resp_code, body);
+        if (delay < 0)
+            break;
+        if (!telebot_core_retry_sleep(stream, delay))
+            break;
+    }
 
     if (post != NULL)
-        curl_easy_setopt(curl_h, CURLOPT_HTTPPOST, post);
+        curl_formfree(post);
 
-    res = curl_easy_perform(curl_h);
     if (res != CURLE_OK) {
         ERR("Failed to curl_easy_perform\nError: %s (%d)",
                 curl_easy_strerror(res), res);
-        if (handler->resp_data != NULL)
-            free(handler->resp_data);
-        handler->resp_data= NULL;
-        handler->resp_size = 0;
-        curl_easy_cleanup(curl_h);
-        return TELEBOT_ERROR_OPERATION_FAILED;
+        ret = TELEBOT_ERROR_OPERATION_FAILED;
     }
-
-    curl_easy_getinfo(curl_h, CURLINFO_RESPONSE_CODE, &resp_code);
-    if (resp_code != 200L) {
+    else if (resp_code != 200L) {
         ERR("Wrong HTTP response received, response: %ld", resp_code);
-        if (handler->resp_data != NULL)
-            free(handler->resp_data);
-        handler->resp_data = NULL;
-        handler->resp_size = 0;
-        curl_easy_cleanup(curl_h);
-        return TELEBOT_ERROR_OPERATION_FAILED;
+        ret = telebot_core_http_error(resp_code);
+    }
+    else if ((response != NULL) && !telebot_core_buffer_reserve(
+                &(response->data), &(response->capacity), response->size, 0)) {
+        /* An empty body still leaves an empty string behind */
+        ret = TELEBOT_ERROR_OUT_OF_MEMORY;
+    }
+    else if (response != NULL) {
+        DBG("Response: %s", response->data);
     }
 
-    DBG("Response: %s", handler->resp_data);
+    if ((ret != TELEBOT_ERROR_NONE) && (response != NULL))
+        telebot_core_response_reset(response);
+    telebot_core_response_free(&scratch);
+    telebot_core_retry_done(handler->transport, method, start_us, ret);
 
-    curl_easy_cleanup(curl_h);
+    return ret;
+}
 
-    return TELEBOT_ERROR_NONE;
+static telebot_error_e telebot_core_curl_perform(telebot_core_h *handler,
+        const char *method, struct curl_httppost *post,
+        telebot_core_response_t *response)
+{
+    return telebot_core_curl_perform_timeout(handler, method, post, 0, NULL,
+            response);
 }
 
 telebot_error_e telebot_core_create(telebot_core_h *handler, char *token)
+{
+    return telebot_core_create_ex(handler, token, NULL);
+}
+
+telebot_error_e telebot_core_create_ex(telebot_core_h *handler, char *token,
+        const telebot_core_options_t *options)
 {
     if ((token == NULL) || (handler == NULL)) {
         ERR("Token(0x%p) or handler(0x%p) is NULL",
@@ -112,54 +1330,280 @@ telebot_error_e telebot_core_create(telebot_core_h *handler, char *token)
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
-    handler->token = strdup(token);
-    handler->offset = 0;
-    handler->resp_data = NULL;
-    handler->resp_size = 0;
+    const char *api_url = TELEBOT_API_URL;
+    if ((options != NULL) && (options->api_url != NULL))
+        api_url = options->api_url;
+    else if ((options != NULL) && (options->share != NULL))
+        api_url = options->share->api_url;
 
     curl_global_init(CURL_GLOBAL_DEFAULT);
 
+    if ((options != NULL) && (options->share != NULL) &&
+            (options->share->transport != NULL))
+        handler->transport = telebot_core_transport_ref(
+                options->share->transport);
+    else
+        handler->transport = telebot_core_transport_create(api_url, options);
+    if (handler->transport == NULL) {
+        curl_global_cleanup();
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+    }
+
+    handler->api_url = strdup(api_url);
+    handler->token = strdup(token);
+    handler->offset = 0;
+
     return TELEBOT_ERROR_NONE;
 }
 
 telebot_error_e telebot_core_destroy(telebot_core_h *handler)
 {
-    curl_global_cleanup();
-
     if (handler == NULL) {
         ERR("Handler is NULL");
+        curl_global_cleanup();
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    if (handler->transport != NULL) {
+        telebot_core_transport_destroy(handler->transport);
+        handler->transport = NULL;
+    }
+
     if (handler->token != NULL) {
         memset(handler->token, 'X', strlen(handler->token));
         free(handler->token);
         handler->token = NULL;
     }
 
-    if (handler->resp_data != NULL)
-        free(handler->resp_data);
+    if (handler->api_url != NULL) {
+        free(handler->api_url);
+        handler->api_url = NULL;
+    }
+
+    curl_global_cleanup();
 
     return TELEBOT_ERROR_NONE;
 }
 
-telebot_error_e telebot_core_get_me(telebot_core_h *handler)
+void telebot_core_response_free(telebot_core_response_t *response)
 {
-    if (handler == NULL) {
+    if (response == NULL)
+        return;
+
+    free(response->data);
+    response->data = NULL;
+    response->size = 0;
+    response->capacity = 0;
+}
+
+telebot_error_e telebot_core_warmup(telebot_core_h *handler)
+{
+    if ((handler == NULL) || (handler->transport == NULL)) {
         ERR("Handler is NULL");
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
-    if (handler->token == NULL) {
-        ERR("Token is NULL");
+    struct telebot_core_transport *transport = handler->transport;
+    struct telebot_core_connection *idle[TELEBOT_CORE_CONNECTION_POOL_SIZE];
+    int index, count = 0;
+
+    pthread_mutex_lock(&(transport->lock));
+    for (index = 0; index < TELEBOT_CORE_CONNECTION_POOL_SIZE; index++) {
+        struct telebot_core_connection *conn = &(transport->conns[index]);
+        if (conn->in_use)
+            continue;
+        conn->in_use = true;
+        idle[count++] = conn;
+    }
+    pthread_mutex_unlock(&(transport->lock));
+
+    telebot_error_e ret = TELEBOT_ERROR_NONE;
+    for (index = 0; index < count; index++) {
+        struct telebot_core_connection *conn = idle[index];
+        if (conn->curl_h == NULL)
+            conn->curl_h = curl_easy_init();
+        else
+            curl_easy_reset(conn->curl_h);
+
+        if (conn->curl_h == NULL) {
+            ERR("Failed to init curl");
+            ret = TELEBOT_ERROR_OPERATION_FAILED;
+            telebot_core_connection_release(transport, conn, false);
+            continue;
+        }
+
+        /* A HEAD request to the API root leaves a live connection behind */
+        telebot_core_connection_setup(transport, conn);
+        curl_easy_setopt(conn->curl_h, CURLOPT_URL, handler->api_url);
+        curl_easy_setopt(conn->curl_h, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(conn->curl_h, CURLOPT_WRITEFUNCTION, discard_data_cb);
+
+        CURLcode res = curl_easy_perform(conn->curl_h);
+        if (res != CURLE_OK) {
+            ERR("Failed to warm up connection\nError: %s (%d)",
+                    curl_easy_strerror(res), res);
+            ret = TELEBOT_ERROR_NO_CONNECTION;
+        }
+        telebot_core_connection_release(transport, conn, res == CURLE_OK);
+    }
+
+    return ret;
+}
+
+telebot_error_e telebot_core_reap_idle_connections(telebot_core_h *handler,
+        int max_idle)
+{
+    if ((handler == NULL) || (handler->transport == NULL)) {
+        ERR("Handler is NULL");
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_GET_ME, NULL);
+    if (max_idle < 0)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    struct telebot_core_transport *transport = handler->transport;
+    time_t now = telebot_core_now();
+    int index;
+
+    pthread_mutex_lock(&(transport->lock));
+    for (index = 0; index < TELEBOT_CORE_CONNECTION_POOL_SIZE; index++) {
+        struct telebot_core_connection *conn = &(transport->conns[index]);
+        if (conn->in_use || (conn->curl_h == NULL))
+            continue;
+        if ((now - conn->last_used) < max_idle)
+            continue;
+
+        curl_easy_cleanup(conn->curl_h);
+        conn->curl_h = NULL;
+        transport->stats.reaped++;
+    }
+    pthread_mutex_unlock(&(transport->lock));
+
+    return TELEBOT_ERROR_NONE;
 }
 
-telebot_error_e telebot_core_get_updates(telebot_core_h *handler, int offset,
-        int limit, int timeout)
+telebot_error_e telebot_core_reconnect(telebot_core_h *handler)
+{
+    if ((handler == NULL) || (handler->transport == NULL)) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct telebot_core_transport *transport = handler->transport;
+    int index;
+
+    pthread_mutex_lock(&(transport->lock));
+    for (index = 0; index < TELEBOT_CORE_CONNECTION_POOL_SIZE; index++) {
+        struct telebot_core_connection *conn = &(transport->conns[index]);
+        if (conn->in_use) {
+            conn->stale = true;
+        }
+        else if (conn->curl_h != NULL) {
+            curl_easy_cleanup(conn->curl_h);
+            conn->curl_h = NULL;
+        }
+    }
+    transport->stats.reconnects++;
+    pthread_mutex_unlock(&(transport->lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_core_get_connection_stats(telebot_core_h *handler,
+        telebot_core_connection_stats_t *stats)
+{
+    if ((handler == NULL) || (handler->transport == NULL)) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (stats == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&(handler->transport->lock));
+    *stats = handler->transport->stats;
+    pthread_mutex_unlock(&(handler->transport->lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_core_set_retry(telebot_core_h *handler,
+        int max_retries, int max_retry_after)
+{
+    if ((handler == NULL) || (handler->transport == NULL)) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if ((max_retries < 0) || (max_retry_after < 0))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&(handler->transport->lock));
+    handler->transport->max_retries = max_retries;
+    handler->transport->max_retry_after = max_retry_after;
+    pthread_mutex_unlock(&(handler->transport->lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_core_get_retry_stats(telebot_core_h *handler,
+        telebot_core_retry_stats_t *stats)
+{
+    if ((handler == NULL) || (handler->transport == NULL)) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (stats == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&(handler->transport->lock));
+    *stats = handler->transport->retry_stats;
+    pthread_mutex_unlock(&(handler->transport->lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_core_stats_snapshot(telebot_core_h *handler,
+        telebot_core_stats_t *stats)
+{
+    if ((handler == NULL) || (handler->transport == NULL)) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (stats == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_stats_read(handler->transport->method_stats, stats);
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_core_async_wait(telebot_core_h *handler)
+{
+    if ((handler == NULL) || (handler->transport == NULL)) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    pthread_mutex_lock(&(handler->transport->lock));
+    struct telebot_core_engine *engine = handler->transport->engine;
+    pthread_mutex_unlock(&(handler->transport->lock));
+
+    if (engine == NULL)
+        return TELEBOT_ERROR_NONE;
+
+    pthread_mutex_lock(&(engine->lock));
+    while (engine->outstanding > 0)
+        pthread_cond_wait(&(engine->idle_cond), &(engine->lock));
+    pthread_mutex_unlock(&(engine->lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_core_get_me(telebot_core_h *handler,
+        telebot_core_response_t *response)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -171,6 +1615,13 @@ telebot_error_e telebot_core_get_updates(telebot_core_h *handler, int offset,
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_GET_ME, NULL,
+            response);
+}
+
+static struct curl_httppost *telebot_core_get_updates_form(int offset,
+        int limit, int timeout)
+{
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -189,11 +1640,92 @@ telebot_error_e telebot_core_get_updates(telebot_core_h *handler, int offset,
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "timeout",
             CURLFORM_COPYCONTENTS, timeout_str, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_GET_UPDATES, post);
+    return post;
+}
+
+/* The transfer may take the whole long polling timeout, and a bit more */
+static long telebot_core_get_updates_timeout(int timeout)
+{
+    if (timeout > 0)
+        return timeout + TELEBOT_UPDATE_POLLING_GRACE;
+
+    return 0;
+}
+
+static telebot_error_e telebot_core_get_updates_perform(
+        telebot_core_h *handler, int offset, int limit, int timeout,
+        struct telebot_core_stream *stream, telebot_core_response_t *response)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_get_updates_form(offset, limit,
+            timeout);
+
+    return telebot_core_curl_perform_timeout(handler, TELEBOT_METHOD_GET_UPDATES,
+            post, telebot_core_get_updates_timeout(timeout), stream, response);
+}
+
+telebot_error_e telebot_core_get_updates(telebot_core_h *handler, int offset,
+        int limit, int timeout, telebot_core_response_t *response)
+{
+    return telebot_core_get_updates_perform(handler, offset, limit, timeout,
+            NULL, response);
+}
+
+telebot_error_e telebot_core_get_updates_stream(telebot_core_h *handler,
+        int offset, int limit, int timeout, telebot_core_stream_cb_f cb,
+        void *user_data)
+{
+    if (cb == NULL) {
+        ERR("Stream callback is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct telebot_core_stream stream = { cb, user_data };
+
+    return telebot_core_get_updates_perform(handler, offset, limit, timeout,
+            &stream, NULL);
+}
+
+telebot_error_e telebot_core_get_updates_stream_async(telebot_core_h *handler,
+        int offset, int limit, int timeout, telebot_core_stream_cb_f stream_cb,
+        telebot_core_async_cb_f cb, void *user_data)
+{
+    if ((handler == NULL) || (handler->transport == NULL)) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (stream_cb == NULL) {
+        ERR("Stream callback is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_get_updates_form(offset, limit,
+            timeout);
+    struct telebot_core_stream stream = { stream_cb, user_data };
+
+    return telebot_core_async_perform_ex(handler, TELEBOT_METHOD_GET_UPDATES,
+            post, telebot_core_get_updates_timeout(timeout), &stream, cb,
+            user_data);
 }
 
 telebot_error_e telebot_core_get_user_profile_photos(telebot_core_h *handler,
-        int user_id, int offset, int limit)
+        long long user_id, int offset, int limit,
+        telebot_core_response_t *response)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -208,8 +1740,8 @@ telebot_error_e telebot_core_get_user_profile_photos(telebot_core_h *handler,
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
-    char offset_str[16], limit_str[16], user_id_str[16];
-    snprintf(user_id_str, sizeof(user_id_str), "%d", user_id);
+    char offset_str[16], limit_str[16], user_id_str[32];
+    snprintf(user_id_str, sizeof(user_id_str), "%lld", user_id);
     snprintf(offset_str, sizeof(offset_str), "%d", offset);
     snprintf(limit_str, sizeof(limit_str), "%d", limit);
 
@@ -220,10 +1752,12 @@ telebot_error_e telebot_core_get_user_profile_photos(telebot_core_h *handler,
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "limit",
             CURLFORM_COPYCONTENTS, limit_str, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_GET_USERPHOTOS, post);
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_GET_USERPHOTOS,
+            post, response);
 }
 
-telebot_error_e telebot_core_get_file(telebot_core_h *handler, char *file_id)
+telebot_error_e telebot_core_get_file(telebot_core_h *handler, char *file_id,
+        telebot_core_response_t *response)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -244,23 +1778,14 @@ telebot_error_e telebot_core_get_file(telebot_core_h *handler, char *file_id)
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "file_id",
             CURLFORM_COPYCONTENTS, file_id, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_GET_FILE, post);
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_GET_FILE, post,
+            response);
 }
 
-telebot_error_e telebot_core_send_message(telebot_core_h *handler, char *chat_id,
+static struct curl_httppost *telebot_core_send_message_form(char *chat_id,
         char *text, char *parse_mode, bool disable_web_page_preview,
         int reply_to_message_id, const char *reply_markup)
 {
-    if (handler == NULL) {
-        ERR("Handler is NULL");
-        return TELEBOT_ERROR_INVALID_PARAMETER;
-    }
-
-    if (handler->token == NULL) {
-        ERR("Token is NULL");
-        return TELEBOT_ERROR_INVALID_PARAMETER;
-    }
-
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -282,11 +1807,76 @@ telebot_error_e telebot_core_send_message(telebot_core_h *handler, char *chat_id
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "reply_markup",
             CURLFORM_COPYCONTENTS, reply_markup, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_MESSAGE, post);
+    return post;
+}
+
+telebot_error_e telebot_core_send_message(telebot_core_h *handler,
+        char *chat_id, char *text, char *parse_mode,
+        bool disable_web_page_preview, int reply_to_message_id,
+        const char *reply_markup, telebot_core_response_t *response)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_send_message_form(chat_id, text,
+            parse_mode, disable_web_page_preview, reply_to_message_id,
+            reply_markup);
+
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_MESSAGE, post,
+            response);
+}
+
+telebot_error_e telebot_core_send_message_async(telebot_core_h *handler,
+        char *chat_id, char *text, char *parse_mode,
+        bool disable_web_page_preview, int reply_to_message_id,
+        const char *reply_markup, telebot_core_async_cb_f cb, void *user_data)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_send_message_form(chat_id, text,
+            parse_mode, disable_web_page_preview, reply_to_message_id,
+            reply_markup);
+
+    return telebot_core_async_perform(handler, TELEBOT_METHOD_SEND_MESSAGE, post,
+            cb, user_data);
+}
+
+static struct curl_httppost *telebot_core_delete_message_form(
+        long long chat_id, int message_id)
+{
+    struct curl_httppost *post = NULL;
+    struct curl_httppost *last = NULL;
+
+    char chat_id_str[32];
+    snprintf(chat_id_str, sizeof(chat_id_str), "%lld", chat_id);
+    char message_id_str[16];
+    snprintf(message_id_str, sizeof(message_id_str), "%d", message_id);
+
+    curl_formadd (&post, &last, CURLFORM_COPYNAME, "chat_id",
+                  CURLFORM_COPYCONTENTS, chat_id_str, CURLFORM_END);
+    curl_formadd (&post, &last, CURLFORM_COPYNAME, "message_id",
+                  CURLFORM_COPYCONTENTS, message_id_str, CURLFORM_END);
+
+    return post;
 }
 
 telebot_error_e telebot_core_delete_message(telebot_core_h *handler,
-                                            int chat_id, int message_id)
+        long long chat_id, int message_id, telebot_core_response_t *response)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -298,26 +1888,16 @@ telebot_error_e telebot_core_delete_message(telebot_core_h *handler,
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
-    struct curl_httppost *post = NULL;
-    struct curl_httppost *last = NULL;
-
-    char chat_id_str[16];
-    snprintf(chat_id_str, sizeof(chat_id_str), "%d", chat_id);
-    char message_id_str[16];
-    snprintf(message_id_str, sizeof(message_id_str), "%d", message_id);
-
-    curl_formadd (&post, &last, CURLFORM_COPYNAME, "chat_id",
-                  CURLFORM_COPYCONTENTS, chat_id_str, CURLFORM_END);
-    curl_formadd (&post, &last, CURLFORM_COPYNAME, "message_id",
-                  CURLFORM_COPYCONTENTS, message_id_str, CURLFORM_END);
+    struct curl_httppost *post = telebot_core_delete_message_form(chat_id,
+            message_id);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_DELETE_MESSAGE, post);
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_DELETE_MESSAGE,
+            post, response);
 }
 
-telebot_error_e telebot_core_answer_callback_query(telebot_core_h * handler,
-                                                   const char *callback_query_id,
-                                                   char *text, bool show_alert,
-                                                   char *url, int cache_time)
+telebot_error_e telebot_core_delete_message_async(telebot_core_h *handler,
+        long long chat_id, int message_id, telebot_core_async_cb_f cb,
+        void *user_data)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -329,6 +1909,17 @@ telebot_error_e telebot_core_answer_callback_query(telebot_core_h * handler,
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    struct curl_httppost *post = telebot_core_delete_message_form(chat_id,
+            message_id);
+
+    return telebot_core_async_perform(handler, TELEBOT_METHOD_DELETE_MESSAGE, post,
+            cb, user_data);
+}
+
+static struct curl_httppost *telebot_core_answer_callback_query_form(
+        const char *callback_query_id, char *text, bool show_alert, char *url,
+        int cache_time)
+{
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -357,13 +1948,34 @@ telebot_error_e telebot_core_answer_callback_query(telebot_core_h * handler,
                       CURLFORM_COPYCONTENTS, cache_time_str, CURLFORM_END);
     }
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_ANSWER_CALLBACK_QUERY,
-                                     post);
+    return post;
 }
 
+telebot_error_e telebot_core_answer_callback_query(telebot_core_h *handler,
+        const char *callback_query_id, char *text, bool show_alert, char *url,
+        int cache_time, telebot_core_response_t *response)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
 
-telebot_error_e telebot_core_forward_message(telebot_core_h *handler,
-        char *chat_id, char *from_chat_id, int message_id)
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_answer_callback_query_form(
+            callback_query_id, text, show_alert, url, cache_time);
+
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_ANSWER_CALLBACK_QUERY,
+                                     post, response);
+}
+
+telebot_error_e telebot_core_answer_callback_query_async(
+        telebot_core_h *handler, const char *callback_query_id, char *text,
+        bool show_alert, char *url, int cache_time, telebot_core_async_cb_f cb,
+        void *user_data)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -375,6 +1987,17 @@ telebot_error_e telebot_core_forward_message(telebot_core_h *handler,
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    struct curl_httppost *post = telebot_core_answer_callback_query_form(
+            callback_query_id, text, show_alert, url, cache_time);
+
+    return telebot_core_async_perform(handler,
+            TELEBOT_METHOD_ANSWER_CALLBACK_QUERY, post, cb, user_data);
+}
+
+
+static struct curl_httppost *telebot_core_forward_message_form(char *chat_id,
+        char *from_chat_id, int message_id)
+{
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -388,12 +2011,33 @@ telebot_error_e telebot_core_forward_message(telebot_core_h *handler,
     curl_formadd (&post, &last, CURLFORM_COPYNAME, "message_id",
             CURLFORM_COPYCONTENTS, message_id_str, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_FORWARD_MESSAGE, post);
+    return post;
 }
 
-telebot_error_e telebot_core_send_photo(telebot_core_h *handler, char *chat_id,
-        char *photo, bool is_file, char *caption, int reply_to_message_id,
-        char *reply_markup)
+telebot_error_e telebot_core_forward_message(telebot_core_h *handler,
+        char *chat_id, char *from_chat_id, int message_id,
+        telebot_core_response_t *response)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_forward_message_form(chat_id,
+            from_chat_id, message_id);
+
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_FORWARD_MESSAGE,
+            post, response);
+}
+
+telebot_error_e telebot_core_forward_message_async(telebot_core_h *handler,
+        char *chat_id, char *from_chat_id, int message_id,
+        telebot_core_async_cb_f cb, void *user_data)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -405,6 +2049,17 @@ telebot_error_e telebot_core_send_photo(telebot_core_h *handler, char *chat_id,
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    struct curl_httppost *post = telebot_core_forward_message_form(chat_id,
+            from_chat_id, message_id);
+
+    return telebot_core_async_perform(handler, TELEBOT_METHOD_FORWARD_MESSAGE, post,
+            cb, user_data);
+}
+
+static struct curl_httppost *telebot_core_send_photo_form(char *chat_id,
+        char *photo, bool is_file, char *caption, int reply_to_message_id,
+        char *reply_markup)
+{
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -428,12 +2083,34 @@ telebot_error_e telebot_core_send_photo(telebot_core_h *handler, char *chat_id,
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "reply_markup",
             CURLFORM_COPYCONTENTS, reply_markup, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_PHOTO, post);
+    return post;
 }
 
-telebot_error_e telebot_core_send_audio(telebot_core_h *handler, char *chat_id,
-        char *audio, bool is_file, int duration, char *performer, char *title,
-        int reply_to_message_id, char *reply_markup)
+telebot_error_e telebot_core_send_photo(telebot_core_h *handler, char *chat_id,
+        char *photo, bool is_file, char *caption, int reply_to_message_id,
+        char *reply_markup, telebot_core_response_t *response)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_send_photo_form(chat_id, photo,
+            is_file, caption, reply_to_message_id, reply_markup);
+
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_PHOTO, post,
+            response);
+}
+
+telebot_error_e telebot_core_send_photo_async(telebot_core_h *handler,
+        char *chat_id, char *photo, bool is_file, char *caption,
+        int reply_to_message_id, char *reply_markup, telebot_core_async_cb_f cb,
+        void *user_data)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -445,6 +2122,17 @@ telebot_error_e telebot_core_send_audio(telebot_core_h *handler, char *chat_id,
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    struct curl_httppost *post = telebot_core_send_photo_form(chat_id, photo,
+            is_file, caption, reply_to_message_id, reply_markup);
+
+    return telebot_core_async_perform(handler, TELEBOT_METHOD_SEND_PHOTO, post,
+            cb, user_data);
+}
+
+static struct curl_httppost *telebot_core_send_audio_form(char *chat_id,
+        char *audio, bool is_file, int duration, char *performer, char *title,
+        int reply_to_message_id, char *reply_markup)
+{
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -474,11 +2162,36 @@ telebot_error_e telebot_core_send_audio(telebot_core_h *handler, char *chat_id,
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "reply_markup",
             CURLFORM_COPYCONTENTS, reply_markup, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_AUDIO, post);
+    return post;
+}
+
+telebot_error_e telebot_core_send_audio(telebot_core_h *handler, char *chat_id,
+        char *audio, bool is_file, int duration, char *performer, char *title,
+        int reply_to_message_id, char *reply_markup,
+        telebot_core_response_t *response)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_send_audio_form(chat_id, audio,
+            is_file, duration, performer, title, reply_to_message_id,
+            reply_markup);
+
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_AUDIO, post,
+            response);
 }
 
-telebot_error_e telebot_core_send_document(telebot_core_h *handler, char *chat_id,
-        char *document, bool is_file, int reply_to_message_id, char *reply_markup)
+telebot_error_e telebot_core_send_audio_async(telebot_core_h *handler,
+        char *chat_id, char *audio, bool is_file, int duration, char *performer,
+        char *title, int reply_to_message_id, char *reply_markup,
+        telebot_core_async_cb_f cb, void *user_data)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -490,6 +2203,18 @@ telebot_error_e telebot_core_send_document(telebot_core_h *handler, char *chat_i
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    struct curl_httppost *post = telebot_core_send_audio_form(chat_id, audio,
+            is_file, duration, performer, title, reply_to_message_id,
+            reply_markup);
+
+    return telebot_core_async_perform(handler, TELEBOT_METHOD_SEND_AUDIO, post,
+            cb, user_data);
+}
+
+static struct curl_httppost *telebot_core_send_document_form(char *chat_id,
+        char *document, bool is_file, int reply_to_message_id,
+        char *reply_markup)
+{
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -512,11 +2237,33 @@ telebot_error_e telebot_core_send_document(telebot_core_h *handler, char *chat_i
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "reply_markup",
             CURLFORM_COPYCONTENTS, reply_markup, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_PHOTO, post);
+    return post;
+}
+
+telebot_error_e telebot_core_send_document(telebot_core_h *handler,
+        char *chat_id, char *document, bool is_file, int reply_to_message_id,
+        char *reply_markup, telebot_core_response_t *response)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_send_document_form(chat_id,
+            document, is_file, reply_to_message_id, reply_markup);
+
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_DOCUMENT,
+            post, response);
 }
 
-telebot_error_e telebot_core_send_sticker(telebot_core_h *handler, char *chat_id,
-        char *sticker, bool is_file, int reply_to_message_id, char *reply_markup)
+telebot_error_e telebot_core_send_document_async(telebot_core_h *handler,
+        char *chat_id, char *document, bool is_file, int reply_to_message_id,
+        char *reply_markup, telebot_core_async_cb_f cb, void *user_data)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -528,6 +2275,17 @@ telebot_error_e telebot_core_send_sticker(telebot_core_h *handler, char *chat_id
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    struct curl_httppost *post = telebot_core_send_document_form(chat_id,
+            document, is_file, reply_to_message_id, reply_markup);
+
+    return telebot_core_async_perform(handler, TELEBOT_METHOD_SEND_DOCUMENT, post,
+            cb, user_data);
+}
+
+static struct curl_httppost *telebot_core_send_sticker_form(char *chat_id,
+        char *sticker, bool is_file, int reply_to_message_id,
+        char *reply_markup)
+{
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -550,12 +2308,12 @@ telebot_error_e telebot_core_send_sticker(telebot_core_h *handler, char *chat_id
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "reply_markup",
             CURLFORM_COPYCONTENTS, reply_markup, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_STICKER, post);
+    return post;
 }
 
-telebot_error_e telebot_core_send_video(telebot_core_h *handler, char *chat_id,
-        char *video, bool is_file, int duration, char *caption,
-        int reply_to_message_id, char *reply_markup)
+telebot_error_e telebot_core_send_sticker(telebot_core_h *handler,
+        char *chat_id, char *sticker, bool is_file, int reply_to_message_id,
+        char *reply_markup, telebot_core_response_t *response)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -567,6 +2325,38 @@ telebot_error_e telebot_core_send_video(telebot_core_h *handler, char *chat_id,
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    struct curl_httppost *post = telebot_core_send_sticker_form(chat_id,
+            sticker, is_file, reply_to_message_id, reply_markup);
+
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_STICKER, post,
+            response);
+}
+
+telebot_error_e telebot_core_send_sticker_async(telebot_core_h *handler,
+        char *chat_id, char *sticker, bool is_file, int reply_to_message_id,
+        char *reply_markup, telebot_core_async_cb_f cb, void *user_data)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_send_sticker_form(chat_id,
+            sticker, is_file, reply_to_message_id, reply_markup);
+
+    return telebot_core_async_perform(handler, TELEBOT_METHOD_SEND_STICKER, post,
+            cb, user_data);
+}
+
+static struct curl_httppost *telebot_core_send_video_form(char *chat_id,
+        char *video, bool is_file, int duration, char *caption,
+        int reply_to_message_id, char *reply_markup)
+{
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -594,12 +2384,35 @@ telebot_error_e telebot_core_send_video(telebot_core_h *handler, char *chat_id,
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "reply_markup",
             CURLFORM_COPYCONTENTS, reply_markup, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_VIDEO, post);
+    return post;
 }
 
-telebot_error_e telebot_core_send_voice(telebot_core_h *handler, char *chat_id,
-        char *voice, bool is_file, int duration, int reply_to_message_id,
-        char *reply_markup)
+telebot_error_e telebot_core_send_video(telebot_core_h *handler, char *chat_id,
+        char *video, bool is_file, int duration, char *caption,
+        int reply_to_message_id, char *reply_markup,
+        telebot_core_response_t *response)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_send_video_form(chat_id, video,
+            is_file, duration, caption, reply_to_message_id, reply_markup);
+
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_VIDEO, post,
+            response);
+}
+
+telebot_error_e telebot_core_send_video_async(telebot_core_h *handler,
+        char *chat_id, char *video, bool is_file, int duration, char *caption,
+        int reply_to_message_id, char *reply_markup, telebot_core_async_cb_f cb,
+        void *user_data)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -611,6 +2424,17 @@ telebot_error_e telebot_core_send_voice(telebot_core_h *handler, char *chat_id,
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    struct curl_httppost *post = telebot_core_send_video_form(chat_id, video,
+            is_file, duration, caption, reply_to_message_id, reply_markup);
+
+    return telebot_core_async_perform(handler, TELEBOT_METHOD_SEND_VIDEO, post,
+            cb, user_data);
+}
+
+static struct curl_httppost *telebot_core_send_voice_form(char *chat_id,
+        char *voice, bool is_file, int duration, int reply_to_message_id,
+        char *reply_markup)
+{
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -636,12 +2460,34 @@ telebot_error_e telebot_core_send_voice(telebot_core_h *handler, char *chat_id,
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "reply_markup",
             CURLFORM_COPYCONTENTS, reply_markup, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_VOICE, post);
+    return post;
 }
 
-telebot_error_e telebot_core_send_location(telebot_core_h *handler,
-        char *chat_id, float latitude, float longitude, int reply_to_message_id,
-        char *reply_markup)
+telebot_error_e telebot_core_send_voice(telebot_core_h *handler, char *chat_id,
+        char *voice, bool is_file, int duration, int reply_to_message_id,
+        char *reply_markup, telebot_core_response_t *response)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_send_voice_form(chat_id, voice,
+            is_file, duration, reply_to_message_id, reply_markup);
+
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_VOICE, post,
+            response);
+}
+
+telebot_error_e telebot_core_send_voice_async(telebot_core_h *handler,
+        char *chat_id, char *voice, bool is_file, int duration,
+        int reply_to_message_id, char *reply_markup, telebot_core_async_cb_f cb,
+        void *user_data)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -653,6 +2499,17 @@ telebot_error_e telebot_core_send_location(telebot_core_h *handler,
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    struct curl_httppost *post = telebot_core_send_voice_form(chat_id, voice,
+            is_file, duration, reply_to_message_id, reply_markup);
+
+    return telebot_core_async_perform(handler, TELEBOT_METHOD_SEND_VOICE, post,
+            cb, user_data);
+}
+
+static struct curl_httppost *telebot_core_send_location_form(char *chat_id,
+        float latitude, float longitude, int reply_to_message_id,
+        char *reply_markup)
+{
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -674,11 +2531,33 @@ telebot_error_e telebot_core_send_location(telebot_core_h *handler,
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "reply_markup",
             CURLFORM_COPYCONTENTS, reply_markup, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_LOCATION, post);
+    return post;
 }
 
-telebot_error_e telebot_core_send_chat_action(telebot_core_h *handler,
-        char *chat_id, char *action)
+telebot_error_e telebot_core_send_location(telebot_core_h *handler,
+        char *chat_id, float latitude, float longitude, int reply_to_message_id,
+        char *reply_markup, telebot_core_response_t *response)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_send_location_form(chat_id,
+            latitude, longitude, reply_to_message_id, reply_markup);
+
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_LOCATION,
+            post, response);
+}
+
+telebot_error_e telebot_core_send_location_async(telebot_core_h *handler,
+        char *chat_id, float latitude, float longitude, int reply_to_message_id,
+        char *reply_markup, telebot_core_async_cb_f cb, void *user_data)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -690,6 +2569,16 @@ telebot_error_e telebot_core_send_chat_action(telebot_core_h *handler,
         return TELEBOT_ERROR_INVALID_PARAMETER;
     }
 
+    struct curl_httppost *post = telebot_core_send_location_form(chat_id,
+            latitude, longitude, reply_to_message_id, reply_markup);
+
+    return telebot_core_async_perform(handler, TELEBOT_METHOD_SEND_LOCATION, post,
+            cb, user_data);
+}
+
+static struct curl_httppost *telebot_core_send_chat_action_form(char *chat_id,
+        char *action)
+{
     struct curl_httppost *post = NULL;
     struct curl_httppost *last = NULL;
 
@@ -698,11 +2587,52 @@ telebot_error_e telebot_core_send_chat_action(telebot_core_h *handler,
     curl_formadd(&post, &last, CURLFORM_COPYNAME, "action",
             CURLFORM_COPYCONTENTS, action, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_CHATACTION, post);
+    return post;
+}
+
+telebot_error_e telebot_core_send_chat_action(telebot_core_h *handler,
+        char *chat_id, char *action, telebot_core_response_t *response)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_send_chat_action_form(chat_id,
+            action);
+
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SEND_CHATACTION,
+            post, response);
+}
+
+telebot_error_e telebot_core_send_chat_action_async(telebot_core_h *handler,
+        char *chat_id, char *action, telebot_core_async_cb_f cb,
+        void *user_data)
+{
+    if (handler == NULL) {
+        ERR("Handler is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    if (handler->token == NULL) {
+        ERR("Token is NULL");
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+    }
+
+    struct curl_httppost *post = telebot_core_send_chat_action_form(chat_id,
+            action);
+
+    return telebot_core_async_perform(handler, TELEBOT_METHOD_SEND_CHATACTION, post,
+            cb, user_data);
 }
 
 telebot_error_e telebot_core_set_web_hook(telebot_core_h *handler, char *url,
-        char *certificate_file)
+        char *certificate_file, telebot_core_response_t *response)
 {
     if (handler == NULL) {
         ERR("Handler is NULL");
@@ -724,7 +2654,8 @@ telebot_error_e telebot_core_set_web_hook(telebot_core_h *handler, char *url,
         curl_formadd(&post, &last, CURLFORM_COPYNAME, "certificate",
                 CURLFORM_FILE, certificate_file, CURLFORM_END);
 
-    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SET_WEBHOOK, post);
+    return telebot_core_curl_perform(handler, TELEBOT_METHOD_SET_WEBHOOK, post,
+            response);
 }
 
 static size_t write_file_cb(void *contents, size_t size, size_t nmemb,
@@ -740,7 +2671,7 @@ telebot_error_e telebot_core_download_file(telebot_core_h *handler,
     if ((handler == NULL) || (handler->token == NULL))
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    CURL *curl_h;
+    struct telebot_core_connection *conn;
     CURLcode res;
     long resp_code = 0L;
 
@@ -748,35 +2679,36 @@ telebot_error_e telebot_core_download_file(telebot_core_h *handler,
     if (fp == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    curl_h = curl_easy_init();
-    if (curl_h == NULL)
+    conn = telebot_core_connection_acquire(handler->transport);
+    if (conn == NULL) {
+        fclose(fp);
         return TELEBOT_ERROR_OPERATION_FAILED;
+    }
 
     char URL[TELEBOT_URL_SIZE];
-    snprintf(URL, TELEBOT_URL_SIZE, "%s/file/bot%s/%s", TELEBOT_API_URL,
+    snprintf(URL, TELEBOT_URL_SIZE, "%s/file/bot%s/%s", handler->api_url,
             handler->token, file_path);
 
-    curl_easy_setopt(curl_h, CURLOPT_URL, URL);
-    curl_easy_setopt(curl_h, CURLOPT_WRITEFUNCTION, write_file_cb);
-    curl_easy_setopt(curl_h, CURLOPT_WRITEDATA, fp);
+    curl_easy_setopt(conn->curl_h, CURLOPT_URL, URL);
+    curl_easy_setopt(conn->curl_h, CURLOPT_WRITEFUNCTION, write_file_cb);
+    curl_easy_setopt(conn->curl_h, CURLOPT_WRITEDATA, fp);
 
-    res = curl_easy_perform(curl_h);
-    if (res != CURLE_OK) {
-        curl_easy_cleanup(curl_h);
-        return TELEBOT_ERROR_OPERATION_FAILED;
-    }
+    res = curl_easy_perform(conn->curl_h);
+    if (res == CURLE_OK)
+        curl_easy_getinfo(conn->curl_h, CURLINFO_RESPONSE_CODE, &resp_code);
+    telebot_stats_attempt(handler->transport->method_stats,
+            TELEBOT_STATS_DOWNLOAD, conn->curl_h, res, resp_code);
+    telebot_core_connection_release(handler->transport, conn, true);
+    telebot_stats_done(handler->transport->method_stats,
+            TELEBOT_STATS_DOWNLOAD, (res != CURLE_OK) || (resp_code != 200L));
 
-    curl_easy_getinfo(curl_h, CURLINFO_RESPONSE_CODE, &resp_code);
-    if (resp_code != 200L) {
+    if ((res != CURLE_OK) || (resp_code != 200L)) {
         fclose(fp);
         unlink(out_file);
-        curl_easy_cleanup(curl_h);
         return TELEBOT_ERROR_OPERATION_FAILED;
     }
 
     fclose(fp);
 
-    curl_easy_cleanup(curl_h);
-
     return TELEBOT_ERROR_NONE;
 }
@@ -0,0 +1,318 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <telebot-private.h>
+#include <telebot-common.h>
+#include <telebot-api.h>
+#include <telebot-dispatcher.h>
+
+struct telebot_dispatch_entry {
+    const telebot_update_t *update;
+    telebot_dispatch_batch_t *batch; /* NULL when submitted alone */
+    unsigned long queued_us;
+};
+
+struct telebot_worker {
+    struct telebot_dispatcher *dispatcher;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct telebot_dispatch_entry queue[TELEBOT_DISPATCHER_QUEUE_SIZE];
+    int head;
+    int count;
+    bool running;
+};
+
+struct telebot_dispatcher {
+    telebot_h *bot;
+    telebot_update_cb_f update_cb;
+    void *user_data;
+    int count;
+    struct telebot_worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t idle_cond;
+    int pending;
+    telebot_dispatch_stats_t stats;
+};
+
+static unsigned long telebot_dispatcher_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/* Updates without a chat are keyed by their sender */
+static long long telebot_dispatcher_id(const telebot_update_t *update)
+{
+    switch (update->update_type) {
+    case UPDATE_TYPE_MESSAGE:
+        return update->message.chat.id;
+    case UPDATE_TYPE_CALLBACK_QUERY:
+        if (update->callback_query.message != NULL)
+            return update->callback_query.message->chat.id;
+        return update->callback_query.from.id;
+    default:
+        return update->update_id;
+    }
+}
+
+/*
+ * The whole 64-bit id is mixed (murmur3 finalizer), so that supergroup ids
+ * (-100xxxxxxxxxx) spread over the workers as evenly as small ones.
+ */
+static unsigned long long telebot_dispatcher_key(const telebot_update_t *update)
+{
+    unsigned long long key = telebot_dispatcher_id(update);
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+
+    return key;
+}
+
+static void telebot_dispatcher_release(telebot_dispatch_batch_t *batch)
+{
+    if (atomic_fetch_sub(&(batch->pending), 1) == 1)
+        batch->done(batch);
+}
+
+static void telebot_dispatcher_handle(struct telebot_dispatcher *dispatcher,
+        const telebot_update_t *update, telebot_dispatch_batch_t *batch,
+        unsigned long queued_us)
+{
+    unsigned long start = telebot_dispatcher_now();
+    dispatcher->update_cb(dispatcher->bot, update, dispatcher->user_data);
+    unsigned long end = telebot_dispatcher_now();
+
+    pthread_mutex_lock(&(dispatcher->lock));
+    telebot_dispatch_stats_t *stats = &(dispatcher->stats);
+    stats->handled++;
+    stats->handler_time_total_us += end - start;
+    if (end - start > stats->handler_time_max_us)
+        stats->handler_time_max_us = end - start;
+    if (start - queued_us > stats->queue_wait_max_us)
+        stats->queue_wait_max_us = start - queued_us;
+    stats->queue_depth--;
+    dispatcher->pending--;
+    if (dispatcher->pending == 0)
+        pthread_cond_broadcast(&(dispatcher->idle_cond));
+    pthread_mutex_unlock(&(dispatcher->lock));
+
+    if (batch != NULL)
+        telebot_dispatcher_release(batch);
+}
+
+static void *telebot_worker_thread(void *data)
+{
+    struct telebot_worker *worker = data;
+
+    pthread_mutex_lock(&(worker->lock));
+    while (true) {
+        while (worker->running && (worker->count == 0))
+            pthread_cond_wait(&(worker->not_empty), &(worker->lock));
+        if (worker->count == 0)
+            break;
+
+        struct telebot_dispatch_entry entry = worker->queue[worker->head];
+        worker->head = (worker->head + 1) % TELEBOT_DISPATCHER_QUEUE_SIZE;
+        worker->count--;
+        pthread_cond_signal(&(worker->not_full));
+        pthread_mutex_unlock(&(worker->lock));
+
+        telebot_dispatcher_handle(worker->dispatcher, entry.update,
+                entry.batch, entry.queued_us);
+
+        pthread_mutex_lock(&(worker->lock));
+    }
+    pthread_mutex_unlock(&(worker->lock));
+
+    return NULL;
+}
+
+telebot_dispatcher_t *telebot_dispatcher_create(int workers, telebot_h *bot,
+        telebot_update_cb_f update_cb, void *user_data)
+{
+    struct telebot_dispatcher *dispatcher = calloc(1,
+            sizeof(struct telebot_dispatcher));
+    if (dispatcher == NULL) {
+        ERR("Failed to allocate memory");
+        return NULL;
+    }
+
+    dispatcher->bot = bot;
+    dispatcher->update_cb = update_cb;
+    dispatcher->user_data = user_data;
+    pthread_mutex_init(&(dispatcher->lock), NULL);
+    pthread_cond_init(&(dispatcher->idle_cond), NULL);
+    if (workers == 0)
+        return dispatcher;
+
+    dispatcher->workers = calloc(workers, sizeof(struct telebot_worker));
+    if (dispatcher->workers == NULL) {
+        ERR("Failed to allocate memory");
+        telebot_dispatcher_destroy(dispatcher);
+        return NULL;
+    }
+
+    int index;
+    for (index = 0; index < workers; index++) {
+        struct telebot_worker *worker = &(dispatcher->workers[index]);
+        worker->dispatcher = dispatcher;
+        worker->running = true;
+        pthread_mutex_init(&(worker->lock), NULL);
+        pthread_cond_init(&(worker->not_empty), NULL);
+        pthread_cond_init(&(worker->not_full), NULL);
+
+        if (pthread_create(&(worker->thread), NULL, telebot_worker_thread,
+                    worker) != 0) {
+            ERR("Failed to create worker thread");
+            pthread_mutex_destroy(&(worker->lock));
+            pthread_cond_destroy(&(worker->not_empty));
+            pthread_cond_destroy(&(worker->not_full));
+            telebot_dispatcher_destroy(dispatcher);
+            return NULL;
+        }
+        dispatcher->count++;
+    }
+    dispatcher->stats.workers = workers;
+
+    return dispatcher;
+}
+
+void telebot_dispatcher_destroy(telebot_dispatcher_t *dispatcher)
+{
+    int index;
+    for (index = 0; index < dispatcher->count; index++) {
+        struct telebot_worker *worker = &(dispatcher->workers[index]);
+        pthread_mutex_lock(&(worker->lock));
+        worker->running = false;
+        pthread_cond_signal(&(worker->not_empty));
+        pthread_mutex_unlock(&(worker->lock));
+    }
+
+    for (index = 0; index < dispatcher->count; index++) {
+        struct telebot_worker *worker = &(dispatcher->workers[index]);
+        pthread_join(worker->thread, NULL);
+        pthread_mutex_destroy(&(worker->lock));
+        pthread_cond_destroy(&(worker->not_empty));
+        pthread_cond_destroy(&(worker->not_full));
+    }
+
+    pthread_mutex_destroy(&(dispatcher->lock));
+    pthread_cond_destroy(&(dispatcher->idle_cond));
+    free(dispatcher->workers);
+    free(dispatcher);
+}
+
+static void telebot_dispatcher_queue(telebot_dispatcher_t *dispatcher,
+        const telebot_update_t *update, telebot_dispatch_batch_t *batch)
+{
+    unsigned long now = telebot_dispatcher_now();
+
+    pthread_mutex_lock(&(dispatcher->lock));
+    dispatcher->pending++;
+    dispatcher->stats.dispatched++;
+    dispatcher->stats.queue_depth++;
+    pthread_mutex_unlock(&(dispatcher->lock));
+
+    if (dispatcher->count == 0) {
+        telebot_dispatcher_handle(dispatcher, update, batch, now);
+        return;
+    }
+
+    unsigned long long key = telebot_dispatcher_key(update);
+    struct telebot_worker *worker =
+        &(dispatcher->workers[key % dispatcher->count]);
+
+    pthread_mutex_lock(&(worker->lock));
+    while (worker->count == TELEBOT_DISPATCHER_QUEUE_SIZE)
+        pthread_cond_wait(&(worker->not_full), &(worker->lock));
+
+    int tail = (worker->head + worker->count) % TELEBOT_DISPATCHER_QUEUE_SIZE;
+    worker->queue[tail].update = update;
+    worker->queue[tail].batch = batch;
+    worker->queue[tail].queued_us = now;
+    worker->count++;
+    int depth = worker->count;
+    pthread_cond_signal(&(worker->not_empty));
+    pthread_mutex_unlock(&(worker->lock));
+
+    pthread_mutex_lock(&(dispatcher->lock));
+    if (depth > dispatcher->stats.max_queue_depth)
+        dispatcher->stats.max_queue_depth = depth;
+    pthread_mutex_unlock(&(dispatcher->lock));
+}
+
+void telebot_dispatcher_submit(telebot_dispatcher_t *dispatcher,
+        const telebot_update_t *update)
+{
+    telebot_dispatcher_queue(dispatcher, update, NULL);
+}
+
+/* The batch holds one extra reference until every update is queued */
+void telebot_dispatcher_submit_batch(telebot_dispatcher_t *dispatcher,
+        const telebot_update_t *updates, int count,
+        telebot_dispatch_batch_t *batch)
+{
+    atomic_store(&(batch->pending), count + 1);
+
+    int index;
+    for (index = 0; index < count; index++)
+        telebot_dispatcher_queue(dispatcher, &(updates[index]), batch);
+
+    telebot_dispatcher_release(batch);
+}
+
+void telebot_dispatcher_wait(telebot_dispatcher_t *dispatcher)
+{
+    pthread_mutex_lock(&(dispatcher->lock));
+    while (dispatcher->pending > 0)
+        pthread_cond_wait(&(dispatcher->idle_cond), &(dispatcher->lock));
+    pthread_mutex_unlock(&(dispatcher->lock));
+}
+
+bool telebot_dispatcher_is_worker(telebot_dispatcher_t *dispatcher)
+{
+    if (dispatcher == NULL)
+        return false;
+
+    int index;
+    for (index = 0; index < dispatcher->count; index++) {
+        if (pthread_equal(dispatcher->workers[index].thread, pthread_self()))
+            return true;
+    }
+
+    return false;
+}
+
+void telebot_dispatcher_get_stats(telebot_dispatcher_t *dispatcher,
+        telebot_dispatch_stats_t *stats)
+{
+    pthread_mutex_lock(&(dispatcher->lock));
+    *stats = dispatcher->stats;
+    pthread_mutex_unlock(&(dispatcher->lock));
+}
@@ -0,0 +1,366 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <telebot-private.h>
+#include <telebot-common.h>
+#include <telebot-core-api.h>
+#include <telebot-metrics.h>
+
+#define TELEBOT_METRICS_PAGE_SIZE (512 * 1024)
+#define TELEBOT_METRICS_REQUEST_SIZE 4096
+#define TELEBOT_METRICS_HEADER_SIZE 256
+#define TELEBOT_METRICS_TIMEOUT 2 /* Seconds a scraper may stall for */
+
+#define TELEBOT_METRICS_CONTENT_TYPE \
+    "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+struct telebot_metrics_page {
+    char *data;
+    size_t size;
+    size_t capacity;
+    bool overflow; /* Something did not fit, the page is not served */
+};
+
+struct telebot_metrics {
+    int listen_fd;
+    int event_fd;
+    int port;
+    pthread_t thread;
+    telebot_metrics_render_cb_f render_cb;
+    void *user_data;
+    struct telebot_metrics_page page;
+    char request[TELEBOT_METRICS_REQUEST_SIZE];
+    char header[TELEBOT_METRICS_HEADER_SIZE];
+};
+
+/* Fixed bucket bounds, as scrapers aggregate over them */
+static const struct {
+    unsigned long long us;
+    const char *le;
+} telebot_metrics_bounds[] = {
+    { 1000, "0.001" },
+    { 2500, "0.0025" },
+    { 5000, "0.005" },
+    { 10000, "0.01" },
+    { 25000, "0.025" },
+    { 50000, "0.05" },
+    { 100000, "0.1" },
+    { 250000, "0.25" },
+    { 500000, "0.5" },
+    { 1000000, "1.0" },
+    { 2500000, "2.5" },
+    { 5000000, "5.0" },
+    { 10000000, "10.0" },
+    { 30000000, "30.0" },
+    { 60000000, "60.0" },
+};
+
+/* Only integer conversions are used, which vsnprintf does without malloc */
+static void telebot_metrics_printf(telebot_metrics_page_t *page,
+        const char *format, ...)
+{
+    if (page->overflow)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(page->data + page->size, page->capacity - page->size,
+            format, args);
+    va_end(args);
+
+    if ((len < 0) || ((size_t)len >= page->capacity - page->size))
+        page->overflow = true;
+    else
+        page->size += len;
+}
+
+void telebot_metrics_family(telebot_metrics_page_t *page, const char *name,
+        const char *type, const char *help)
+{
+    telebot_metrics_printf(page, "# TYPE %s %s\n# HELP %s %s\n", name, type,
+            name, help);
+}
+
+void telebot_metrics_sample(telebot_metrics_page_t *page, const char *name,
+        const char *suffix, const char *labels, unsigned long long value)
+{
+    if (labels != NULL)
+        telebot_metrics_printf(page, "%s%s{%s} %llu\n", name, suffix, labels,
+                value);
+    else
+        telebot_metrics_printf(page, "%s%s %llu\n", name, suffix, value);
+}
+
+void telebot_metrics_histogram(telebot_metrics_page_t *page, const char *name,
+        const char *labels, const telebot_core_histogram_t *histogram)
+{
+    const char *comma = (labels != NULL) ? "," : "";
+    if (labels == NULL)
+        labels = "";
+
+    /*
+     * A fine bucket goes into the first bound its highest value is within.
+     * The counts are summed from the buckets alone, so that they stay
+     * consistent while requests record into the histogram.
+     */
+    unsigned long long total = 0;
+    int index = 0, bound;
+    for (bound = 0; bound < sizeof(telebot_metrics_bounds) /
+            sizeof(telebot_metrics_bounds[0]); bound++) {
+        while ((index < TELEBOT_CORE_HISTOGRAM_BUCKETS) &&
+                (telebot_core_histogram_limit(index) <=
+                 telebot_metrics_bounds[bound].us + 1))
+            total += histogram->buckets[index++];
+        telebot_metrics_printf(page, "%s_bucket{%s%sle=\"%s\"} %llu\n", name,
+                labels, comma, telebot_metrics_bounds[bound].le, total);
+    }
+    while (index < TELEBOT_CORE_HISTOGRAM_BUCKETS)
+        total += histogram->buckets[index++];
+
+    telebot_metrics_printf(page, "%s_bucket{%s%sle=\"+Inf\"} %llu\n"
+            "%s_count{%s} %llu\n%s_sum{%s} %llu.%06llu\n", name, labels,
+            comma, total, name, labels, total, name, labels,
+            histogram->sum_us / 1000000, histogram->sum_us % 1000000);
+}
+
+static bool telebot_metrics_send(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+/* Reads the request head, false if the client went away or stalled */
+static bool telebot_metrics_read(telebot_metrics_t *metrics, int fd)
+{
+    size_t size = 0;
+    metrics->request[0] = '\0';
+
+    while (strstr(metrics->request, "\r\n\r\n") == NULL) {
+        if (size + 1 >= TELEBOT_METRICS_REQUEST_SIZE)
+            return false;
+
+        ssize_t received = recv(fd, metrics->request + size,
+                TELEBOT_METRICS_REQUEST_SIZE - size - 1, 0);
+        if ((received < 0) && (errno == EINTR))
+            continue;
+        if (received <= 0)
+            return false;
+        size += received;
+        metrics->request[size] = '\0';
+    }
+
+    return true;
+}
+
+static void telebot_metrics_serve(telebot_metrics_t *metrics, int fd)
+{
+    struct telebot_metrics_page *page = &(metrics->page);
+    int status = 200;
+    const char *reason = "OK";
+
+    if (!telebot_metrics_read(metrics, fd))
+        return;
+
+    /* The page is served on /metrics and /, with or without a query */
+    bool head = (strncmp(metrics->request, "HEAD ", 5) == 0);
+    const char *target = strchr(metrics->request, ' ');
+    size_t len = (target != NULL) ? strcspn(target + 1, " ?") : 0;
+    if (!head && (strncmp(metrics->request, "GET ", 4) != 0)) {
+        status = 405;
+        reason = "Method Not Allowed";
+    }
+    else if (!(((len == 1) && (target[1] == '/')) || ((len == 8) &&
+                    (strncmp(target + 1, "/metrics", 8) == 0)))) {
+        status = 404;
+        reason = "Not Found";
+    }
+
+    page->size = 0;
+    page->overflow = false;
+    if (status == 200) {
+        metrics->render_cb(page, metrics->user_data);
+        telebot_metrics_printf(page, "# EOF\n");
+        if (page->overflow) {
+            ERR("Metrics page does not fit in %d bytes",
+                    TELEBOT_METRICS_PAGE_SIZE);
+            status = 500;
+            reason = "Internal Server Error";
+            page->size = 0;
+        }
+    }
+
+    int header_len = snprintf(metrics->header, TELEBOT_METRICS_HEADER_SIZE,
+            "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+            "Connection: close\r\n\r\n", status, reason,
+            (status == 200) ? TELEBOT_METRICS_CONTENT_TYPE : "text/plain",
+            page->size);
+    if (telebot_metrics_send(fd, metrics->header, header_len) && !head)
+        telebot_metrics_send(fd, page->data, page->size);
+}
+
+static void *telebot_metrics_thread(void *data)
+{
+    telebot_metrics_t *metrics = data;
+
+    while (true) {
+        struct pollfd fds[2] = {
+            { .fd = metrics->listen_fd, .events = POLLIN },
+            { .fd = metrics->event_fd, .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            ERR("Failed to poll metrics server, error: %d", errno);
+            break;
+        }
+        if (fds[1].revents != 0)
+            break;
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        int fd = accept4(metrics->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if ((errno != EINTR) && (errno != EAGAIN) &&
+                    (errno != EWOULDBLOCK))
+                ERR("Failed to accept connection, error: %d", errno);
+            continue;
+        }
+
+        /* A stalled scraper must not hold the thread up for long */
+        struct timeval timeout = { .tv_sec = TELEBOT_METRICS_TIMEOUT };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        telebot_metrics_serve(metrics, fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+telebot_metrics_t *telebot_metrics_start(int port,
+        telebot_metrics_render_cb_f render_cb, void *user_data)
+{
+    telebot_metrics_t *metrics = calloc(1, sizeof(telebot_metrics_t));
+    if (metrics == NULL) {
+        ERR("Failed to allocate memory");
+        return NULL;
+    }
+
+    metrics->listen_fd = metrics->event_fd = -1;
+    metrics->render_cb = render_cb;
+    metrics->user_data = user_data;
+    metrics->page.capacity = TELEBOT_METRICS_PAGE_SIZE;
+    metrics->page.data = malloc(metrics->page.capacity);
+    if (metrics->page.data == NULL) {
+        ERR("Failed to allocate memory");
+        goto error;
+    }
+
+    metrics->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK |
+            SOCK_CLOEXEC, 0);
+    if (metrics->listen_fd < 0) {
+        ERR("Failed to create socket, error: %d", errno);
+        goto error;
+    }
+
+    int one = 1;
+    setsockopt(metrics->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if ((bind(metrics->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+            (listen(metrics->listen_fd, SOMAXCONN) != 0) ||
+            (getsockname(metrics->listen_fd, (struct sockaddr *)&addr,
+                         &addr_len) != 0)) {
+        ERR("Failed to listen on port %d, error: %d", port, errno);
+        goto error;
+    }
+    metrics->port = ntohs(addr.sin_port);
+
+    metrics->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (metrics->event_fd < 0) {
+        ERR("Failed to create event fd, error: %d", errno);
+        goto error;
+    }
+
+    if (pthread_create(&(metrics->thread), NULL, telebot_metrics_thread,
+                metrics) != 0) {
+        ERR("Failed to create thread, error: %d", errno);
+        goto error;
+    }
+
+    return metrics;
+
+error:
+    if (metrics->event_fd >= 0)
+        close(metrics->event_fd);
+    if (metrics->listen_fd >= 0)
+        close(metrics->listen_fd);
+    free(metrics->page.data);
+    free(metrics);
+
+    return NULL;
+}
+
+int telebot_metrics_port(telebot_metrics_t *metrics)
+{
+    return metrics->port;
+}
+
+void telebot_metrics_stop(telebot_metrics_t *metrics)
+{
+    uint64_t value = 1;
+    if (write(metrics->event_fd, &value, sizeof(value)) < 0)
+        ERR("Failed to wake up metrics thread, error: %d", errno);
+    pthread_join(metrics->thread, NULL);
+
+    close(metrics->event_fd);
+    close(metrics->listen_fd);
+    free(metrics->page.data);
+    free(metrics);
+}
@@ -32,6 +32,24 @@ struct json_object *telebot_parser_str_to_obj(char *data)
     return json_tokener_parse(data);
 }
 
+/* Arena memory is zeroed, so the copy is always NUL terminated */
+static char *telebot_parser_strdup(struct json_object *obj,
+        telebot_linear_allocator_t *allocator)
+{
+    int len = json_object_get_string_len(obj);
+    char *str = telebot_linear_allocator_alloc_aligned(allocator, len + 1, 1);
+    if (str != NULL)
+        memcpy(str, json_object_get_string(obj), len);
+
+    return str;
+}
+
+static void *telebot_parser_new(telebot_linear_allocator_t *allocator,
+        size_t size)
+{
+    return telebot_linear_allocator_alloc(allocator, size);
+}
+
 telebot_error_e telebot_parser_get_updates(struct json_object *obj,
                                            telebot_update_t **updates, int *count,
                                            telebot_linear_allocator_t *allocator)
@@ -63,7 +81,6 @@ telebot_error_e telebot_parser_get_updates(struct json_object *obj,
         struct json_object *update_id;
         if (json_object_object_get_ex(item, "update_id", &update_id)) {
             result[index].update_id = json_object_get_int(update_id);
-            json_object_put(update_id);
         }
 
         struct json_object *message;
@@ -74,7 +91,6 @@ telebot_error_e telebot_parser_get_updates(struct json_object *obj,
                 ERR("Failed to parse message of bot update");
 
             result[index].update_type = UPDATE_TYPE_MESSAGE;
-            json_object_put(message);
         }
 
         struct json_object *callback_query;
@@ -86,10 +102,8 @@ telebot_error_e telebot_parser_get_updates(struct json_object *obj,
                 ERR("Failed to parse callback query of bot update");
 
             result[index].update_type = UPDATE_TYPE_CALLBACK_QUERY;
-            json_object_put(callback_query);
         }
 
-        json_object_put(item);
     }
 
     return TELEBOT_ERROR_NONE;
@@ -114,11 +128,11 @@ telebot_error_e telebot_parser_get_callback_query(struct json_object *obj,
     }
     int id_len = json_object_get_string_len(id);
 
-    cb_query->id = (char*) telebot_linear_allocator_alloc(allocator, id_len + 1);
+    cb_query->id = (char*) telebot_linear_allocator_alloc_aligned(allocator,
+            id_len + 1, 1);
 
     const char* tmp_id = json_object_get_string(id);
     strncpy(cb_query->id, tmp_id, id_len + 1);
-    json_object_put(id);
 
 
     struct json_object *from;
@@ -127,7 +141,6 @@ telebot_error_e telebot_parser_get_callback_query(struct json_object *obj,
         return TELEBOT_ERROR_OPERATION_FAILED;
     }
     ret = telebot_parser_get_user(from , &(cb_query->from), allocator);
-    json_object_put(from);
 
     if (ret != TELEBOT_ERROR_NONE) {
         ERR("Failed to get <from> from callback_query object");
@@ -137,11 +150,14 @@ telebot_error_e telebot_parser_get_callback_query(struct json_object *obj,
 
     struct json_object *message;
     if (json_object_object_get_ex(obj, "message", &message)) {
-        ret = telebot_parser_get_message(message, &(cb_query->message), allocator);
+        cb_query->message = telebot_parser_new(allocator,
+                sizeof(telebot_message_t));
+        if (cb_query->message == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_message(message, cb_query->message, allocator);
         if (ret != TELEBOT_ERROR_NONE) {
             ERR("Failed to get <message> from callback_query object");
         }
-        json_object_put(message);
     }
 
 
@@ -150,12 +166,12 @@ telebot_error_e telebot_parser_get_callback_query(struct json_object *obj,
         int inline_message_id_len = json_object_get_string_len(inline_message_id);
 
         cb_query->inline_message_id = (char*)
-            telebot_linear_allocator_alloc(allocator, inline_message_id_len + 1);
+            telebot_linear_allocator_alloc_aligned(allocator,
+                inline_message_id_len + 1, 1);
 
         const char* tmp_inline_message_id = json_object_get_string(inline_message_id);
         strncpy(cb_query->inline_message_id, tmp_inline_message_id,
                 inline_message_id_len + 1);
-        json_object_put(inline_message_id);
     }
 
 
@@ -164,11 +180,11 @@ telebot_error_e telebot_parser_get_callback_query(struct json_object *obj,
         int chat_instance_len = json_object_get_string_len(chat_instance);
 
         cb_query->chat_instance = (char*)
-            telebot_linear_allocator_alloc(allocator, chat_instance_len + 1);
+            telebot_linear_allocator_alloc_aligned(allocator,
+                chat_instance_len + 1, 1);
 
         const char* tmp_chat_instance = json_object_get_string(chat_instance);
         strncpy(cb_query->chat_instance, tmp_chat_instance, chat_instance_len + 1);
-        json_object_put(chat_instance);
     }
 
 
@@ -177,11 +193,11 @@ telebot_error_e telebot_parser_get_callback_query(struct json_object *obj,
         int data_len = json_object_get_string_len(data);
 
 
-        cb_query->data = (char*) telebot_linear_allocator_alloc(allocator, data_len + 1);
+        cb_query->data = (char*) telebot_linear_allocator_alloc_aligned(allocator,
+            data_len + 1, 1);
 
         const char* tmp_data = json_object_get_string(data);
         strncpy(cb_query->data, tmp_data, data_len + 1);
-        json_object_put(data);
     }
 
 
@@ -190,11 +206,11 @@ telebot_error_e telebot_parser_get_callback_query(struct json_object *obj,
         int game_short_name_len = json_object_get_string_len(game_short_name);
 
         cb_query->game_short_name = (char*)
-            telebot_linear_allocator_alloc(allocator, game_short_name_len + 1);
+            telebot_linear_allocator_alloc_aligned(allocator,
+                game_short_name_len + 1, 1);
 
         const char* tmp_game_short_name = json_object_get_string(game_short_name);
         strncpy(cb_query->game_short_name, tmp_game_short_name, game_short_name_len + 1);
-        json_object_put(game_short_name);
     }
 
     return TELEBOT_ERROR_NONE;
@@ -216,194 +232,215 @@ telebot_error_e telebot_parser_get_message(struct json_object *obj,
         return TELEBOT_ERROR_OPERATION_FAILED;
     }
     msg->message_id = json_object_get_int(message_id);
-    json_object_put(message_id);
 
     int ret;
     struct json_object *from;
     if (json_object_object_get_ex(obj, "from", &from)) {
-        ret = telebot_parser_get_user(from , &(msg->from), allocator);
+        msg->from = telebot_parser_new(allocator, sizeof(telebot_user_t));
+        if (msg->from == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_user(from , msg->from, allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <from user> from message object");
-        json_object_put(from);
     }
 
     struct json_object *date;
     if (json_object_object_get_ex(obj, "date", &date)) {
         msg->date = json_object_get_int(date);
-        json_object_put(date);
     }
 
     struct json_object *chat;
     if (json_object_object_get_ex(obj, "chat", &chat)) {
-        ret = telebot_parser_get_chat(chat , &(msg->chat));
+        ret = telebot_parser_get_chat(chat , &(msg->chat), allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <chat> from message object");
-        json_object_put(chat);
     }
 
     struct json_object *forward_from;
     if (json_object_object_get_ex(obj, "forward_from", &forward_from)) {
-        ret = telebot_parser_get_user(forward_from , &(msg->forward_from), allocator);
+        msg->forward_from = telebot_parser_new(allocator,
+                sizeof(telebot_user_t));
+        if (msg->forward_from == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_user(forward_from , msg->forward_from,
+                allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <forward from> from message object");
-        json_object_put(forward_from);
     }
 
     struct json_object *forward_date;
     if (json_object_object_get_ex(obj, "forward_date", &forward_date)) {
         msg->forward_date = json_object_get_int(forward_date);
-        json_object_put(forward_date);
     }
 
-/* FIXME: allocating memory with alloca(), it is really wrong. */
-/*
     struct json_object *reply_to_message;
     if (json_object_object_get_ex(obj, "reply_to_message", &reply_to_message)) {
-        telebot_message_t *reply = alloca(sizeof(telebot_message_t));
-        ret = telebot_parser_get_message(reply_to_message , reply);
+        msg->reply_to_message = telebot_parser_new(allocator,
+                sizeof(telebot_message_t));
+        if (msg->reply_to_message == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_message(reply_to_message,
+                msg->reply_to_message, allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <reply_to_message> from message object");
-        msg->reply_to_message = reply;
     }
-*/
 
     struct json_object *text;
     if (json_object_object_get_ex(obj, "text", &text)) {
-        snprintf(msg->text, TELEBOT_MESSAGE_TEXT_SIZE, "%s",
-                json_object_get_string(text));
-        json_object_put(text);
+        msg->text = telebot_parser_strdup(text, allocator);
     }
 
     struct json_object *audio;
     if (json_object_object_get_ex(obj, "audio", &audio)) {
-        ret = telebot_parser_get_audio(audio , &(msg->audio));
+        msg->audio = telebot_parser_new(allocator, sizeof(telebot_audio_t));
+        if (msg->audio == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_audio(audio , msg->audio, allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <audio> from message object");
-        json_object_put(audio);
     }
 
     struct json_object *document;
     if (json_object_object_get_ex(obj, "document", &document)) {
-        ret = telebot_parser_get_document(document , &(msg->document));
+        msg->document = telebot_parser_new(allocator,
+                sizeof(telebot_document_t));
+        if (msg->document == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_document(document , msg->document, allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <document> from message object");
-        json_object_put(document);
     }
 
     struct json_object *photo;
     if (json_object_object_get_ex(obj, "photo", &photo)) {
-        ret = telebot_parser_get_photos(photo , msg->photo,
-                TELEBOT_MESSAGE_PHOTO_SIZE);
+        ret = telebot_parser_get_photos(photo , &(msg->photo),
+                &(msg->photo_count), allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <photo> from message object");
-        json_object_put(photo);
+    }
+
+    struct json_object *sticker;
+    if (json_object_object_get_ex(obj, "sticker", &sticker)) {
+        msg->sticker = telebot_parser_new(allocator, sizeof(telebot_sticker_t));
+        if (msg->sticker == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_sticker(sticker, msg->sticker, allocator);
+        if (ret != TELEBOT_ERROR_NONE)
+            ERR("Failed to get <sticker> from message object");
     }
 
     struct json_object *video;
     if (json_object_object_get_ex(obj, "video", &video)) {
-        ret = telebot_parser_get_video(video , &(msg->video));
+        msg->video = telebot_parser_new(allocator, sizeof(telebot_video_t));
+        if (msg->video == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_video(video , msg->video, allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <video> from message object");
-        json_object_put(video);
     }
 
     struct json_object *voice;
     if (json_object_object_get_ex(obj, "voice", &voice)) {
-        ret = telebot_parser_get_voice(voice , &(msg->voice));
+        msg->voice = telebot_parser_new(allocator, sizeof(telebot_voice_t));
+        if (msg->voice == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_voice(voice , msg->voice, allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <voice> from message object");
-        json_object_put(voice);
     }
 
     struct json_object *caption;
     if (json_object_object_get_ex(obj, "caption", &caption)) {
-        snprintf(msg->caption, TELEBOT_MESSAGE_CAPTION_SIZE, "%s",
-                json_object_get_string(caption));
-        json_object_put(caption);
+        msg->caption = telebot_parser_strdup(caption, allocator);
     }
 
     struct json_object *contact;
     if (json_object_object_get_ex(obj, "contact", &contact)) {
-        ret = telebot_parser_get_contact(contact , &(msg->contact));
+        msg->contact = telebot_parser_new(allocator, sizeof(telebot_contact_t));
+        if (msg->contact == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_contact(contact , msg->contact, allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <contact> from message object");
-        json_object_put(contact);
     }
 
     struct json_object *location;
     if (json_object_object_get_ex(obj, "location", &location)) {
-        ret = telebot_parser_get_location(location , &(msg->location));
+        msg->location = telebot_parser_new(allocator,
+                sizeof(telebot_location_t));
+        if (msg->location == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_location(location , msg->location);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <location> from message object");
-        json_object_put(location);
     }
 
     struct json_object *ncp;
     if (json_object_object_get_ex(obj, "new_chat_participant", &ncp)) {
-        ret = telebot_parser_get_user(ncp , &(msg->new_chat_participant), allocator);
+        msg->new_chat_participant = telebot_parser_new(allocator,
+                sizeof(telebot_user_t));
+        if (msg->new_chat_participant == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_user(ncp , msg->new_chat_participant,
+                allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <new_chat_participant> from message object");
-        json_object_put(ncp);
     }
 
     struct json_object *lcp;
     if (json_object_object_get_ex(obj, "left_chat_participant", &lcp)) {
-        ret = telebot_parser_get_user(lcp , &(msg->left_chat_participant), allocator);
+        msg->left_chat_participant = telebot_parser_new(allocator,
+                sizeof(telebot_user_t));
+        if (msg->left_chat_participant == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        ret = telebot_parser_get_user(lcp , msg->left_chat_participant,
+                allocator);
         if (ret != TELEBOT_ERROR_NONE)
             ERR("Failed to get <left_chat_participant> from message object");
-        json_object_put(lcp);
     }
 
     struct json_object *nct;
     if (json_object_object_get_ex(obj, "new_chat_title", &nct)) {
-        snprintf(msg->new_chat_title, TELEBOT_CHAT_TITLE_SIZE, "%s",
-                json_object_get_string(nct));
-        json_object_put(nct);
+        msg->new_chat_title = telebot_parser_strdup(nct, allocator);
     }
 
     struct json_object *new_chat_photo;
     if (json_object_object_get_ex(obj, "new_chat_photo", &new_chat_photo)) {
-        ret = telebot_parser_get_photos(new_chat_photo , msg->new_chat_photo,
-                TELEBOT_MESSAGE_NEW_CHAT_PHOTO_SIZE);
+        ret = telebot_parser_get_photos(new_chat_photo ,
+                &(msg->new_chat_photo), &(msg->new_chat_photo_count),
+                allocator);
         if (ret != TELEBOT_ERROR_NONE)
-            ERR("Failed to get <left_chat_participant> from message object");
-        json_object_put(new_chat_photo);
+            ERR("Failed to get <new_chat_photo> from message object");
     }
 
     struct json_object *del_chat_photo;
     if (json_object_object_get_ex(obj, "delete_chat_photo", &del_chat_photo)) {
         msg->delete_chat_photo = json_object_get_boolean(del_chat_photo);
-        json_object_put(del_chat_photo);
     }
 
     struct json_object *gcc;
     if (json_object_object_get_ex(obj, "group_chat_created", &gcc)) {
         msg->group_chat_created = json_object_get_boolean(gcc);
-        json_object_put(gcc);
     }
 
     struct json_object *sgcc;
     if (json_object_object_get_ex(obj, "supergroup_chat_created", &sgcc)) {
         msg->supergroup_chat_created = json_object_get_boolean(sgcc);
-        json_object_put(sgcc);
     }
 
     struct json_object *cacc;
     if (json_object_object_get_ex(obj, "channel_chat_created", &cacc)) {
         msg->channel_chat_created = json_object_get_boolean(cacc);
-        json_object_put(cacc);
     }
 
     struct json_object *mtci;
     if (json_object_object_get_ex(obj, "migrate_to_chat_id", &mtci)) {
-        msg->migrate_to_chat_id = json_object_get_int(mtci);
-        json_object_put(mtci);
+        msg->migrate_to_chat_id = json_object_get_int64(mtci);
     }
 
     struct json_object *mftci;
     if (json_object_object_get_ex(obj, "migrate_from_chat_id", &mftci)) {
-        msg->migrate_from_chat_id = json_object_get_int(mftci);
-        json_object_put(mftci);
+        msg->migrate_from_chat_id = json_object_get_int64(mftci);
     }
 
     return TELEBOT_ERROR_NONE;
@@ -427,8 +464,7 @@ telebot_error_e telebot_parser_get_user(struct json_object *obj,
         ERR("Object is not json user type, id not found");
         return TELEBOT_ERROR_OPERATION_FAILED;
     }
-    user->id = json_object_get_int(id);
-    json_object_put(id);
+    user->id = json_object_get_int64(id);
 
     struct json_object *first_name;
     if (!json_object_object_get_ex(obj, "first_name", &first_name)) {
@@ -437,11 +473,11 @@ telebot_error_e telebot_parser_get_user(struct json_object *obj,
     }
 
     int first_name_len = json_object_get_string_len(first_name);
-    user->first_name = telebot_linear_allocator_alloc(allocator, first_name_len + 1);
+    user->first_name = telebot_linear_allocator_alloc_aligned(allocator,
+            first_name_len + 1, 1);
     if(!user->first_name) { return TELEBOT_ERROR_OUT_OF_MEMORY; }
 
     strncpy(user->first_name, json_object_get_string(first_name), first_name_len);
-    json_object_put(first_name);
 
 
     struct json_object *is_bot;
@@ -451,44 +487,43 @@ telebot_error_e telebot_parser_get_user(struct json_object *obj,
     }
 
     user->is_bot = json_object_get_boolean(is_bot);
-    json_object_put(is_bot);
 
     struct json_object *last_name;
     if (json_object_object_get_ex(obj, "last_name", &last_name)) {
         int last_name_len = json_object_get_string_len(last_name);
-        user->last_name = telebot_linear_allocator_alloc(allocator, last_name_len + 1);
+        user->last_name = telebot_linear_allocator_alloc_aligned(allocator,
+            last_name_len + 1, 1);
         if(!user->last_name) { return TELEBOT_ERROR_OUT_OF_MEMORY; }
 
         strncpy(user->last_name, json_object_get_string(last_name), last_name_len);
-        json_object_put(last_name);
     }
 
     struct json_object *username;
     if (json_object_object_get_ex(obj, "username", &username)) {
         int username_len = json_object_get_string_len(username);
-        user->username = telebot_linear_allocator_alloc(allocator, username_len + 1);
+        user->username = telebot_linear_allocator_alloc_aligned(allocator,
+            username_len + 1, 1);
         if(!user->username) { return TELEBOT_ERROR_OUT_OF_MEMORY; }
 
         strncpy(user->username, json_object_get_string(username), username_len);
-        json_object_put(username);
     }
 
     struct json_object *language_code;
     if (json_object_object_get_ex(obj, "language_code", &language_code)) {
         int language_code_len = json_object_get_string_len(language_code);
         user->language_code =
-            telebot_linear_allocator_alloc(allocator, language_code_len + 1);
+            telebot_linear_allocator_alloc_aligned(allocator,
+                language_code_len + 1, 1);
         if(!user->language_code) { return TELEBOT_ERROR_OUT_OF_MEMORY; }
 
         strncpy(user->language_code, json_object_get_string(language_code),
                 language_code_len);
-        json_object_put(language_code);
     }
     return TELEBOT_ERROR_NONE;
 }
 
 telebot_error_e telebot_parser_get_chat(struct json_object *obj,
-        telebot_chat_t *chat)
+        telebot_chat_t *chat, telebot_linear_allocator_t *allocator)
 {
     if (obj == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -499,8 +534,7 @@ telebot_error_e telebot_parser_get_chat(struct json_object *obj,
 
     struct json_object *id;
     if (json_object_object_get_ex(obj, "id", &id)) {
-        chat->id = json_object_get_int(id);
-        json_object_put(id);
+        chat->id = json_object_get_int64(id);
     }
     else {
         ERR("Object is not chat type, id not found");
@@ -509,9 +543,7 @@ telebot_error_e telebot_parser_get_chat(struct json_object *obj,
 
     struct json_object *type;
     if (json_object_object_get_ex(obj, "type", &type)){
-        snprintf(chat->type, TELEBOT_CHAT_TYPE_SIZE, "%s",
-                json_object_get_string(type));
-        json_object_put(type);
+        chat->type = telebot_parser_strdup(type, allocator);
     }
     else {
         ERR("Object is not chat type, type not found");
@@ -520,37 +552,29 @@ telebot_error_e telebot_parser_get_chat(struct json_object *obj,
 
     struct json_object *title;
     if (json_object_object_get_ex(obj, "title", &title)) {
-        snprintf(chat->title, TELEBOT_CHAT_TITLE_SIZE, "%s",
-                json_object_get_string(title));
-        json_object_put(title);
+        chat->title = telebot_parser_strdup(title, allocator);
     }
 
     struct json_object *username;
     if (json_object_object_get_ex(obj, "username", &username)) {
-        snprintf(chat->username, TELEBOT_USER_NAME_SIZE, "%s",
-                json_object_get_string(username));
-        json_object_put(username);
+        chat->username = telebot_parser_strdup(username, allocator);
     }
 
     struct json_object *first_name;
     if (json_object_object_get_ex(obj, "first_name", &first_name)) {
-        snprintf(chat->first_name, TELEBOT_FIRST_NAME_SIZE, "%s",
-                json_object_get_string(first_name));
-        json_object_put(first_name);
+        chat->first_name = telebot_parser_strdup(first_name, allocator);
     }
 
     struct json_object *last_name;
     if (json_object_object_get_ex(obj, "last_name", &last_name)) {
-        snprintf(chat->last_name, TELEBOT_LAST_NAME_SIZE, "%s",
-                json_object_get_string(last_name));
-        json_object_put(last_name);
+        chat->last_name = telebot_parser_strdup(last_name, allocator);
     }
 
     return TELEBOT_ERROR_NONE;
 }
 
 telebot_error_e telebot_parser_get_audio(struct json_object *obj,
-        telebot_audio_t *audio)
+        telebot_audio_t *audio, telebot_linear_allocator_t *allocator)
 {
     if (obj == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -561,9 +585,7 @@ telebot_error_e telebot_parser_get_audio(struct json_object *obj,
 
     struct json_object *file_id;
     if (json_object_object_get_ex(obj, "file_id", &file_id)) {
-        snprintf(audio->file_id, TELEBOT_FILE_ID_SIZE, "%s",
-                json_object_get_string(file_id));
-        json_object_put(file_id);
+        audio->file_id = telebot_parser_strdup(file_id, allocator);
     }
     else {
         ERR("Object is not audio type, file_id not found");
@@ -573,7 +595,6 @@ telebot_error_e telebot_parser_get_audio(struct json_object *obj,
     struct json_object *duration;
     if (json_object_object_get_ex(obj, "duration", &duration)){
         audio->duration = json_object_get_int(duration);
-        json_object_put(duration);
     }
     else {
         ERR("Object is not audio type, duration not found");
@@ -582,36 +603,29 @@ telebot_error_e telebot_parser_get_audio(struct json_object *obj,
 
     struct json_object *performer;
     if (json_object_object_get_ex(obj, "performer", &performer)) {
-        snprintf(audio->performer, TELEBOT_AUDIO_PERFORMER_SIZE, "%s",
-                json_object_get_string(performer));
-        json_object_put(performer);
+        audio->performer = telebot_parser_strdup(performer, allocator);
     }
 
     struct json_object *title;
     if (json_object_object_get_ex(obj, "title", &title)) {
-        snprintf(audio->title, TELEBOT_AUDIO_TITLE_SIZE, "%s",
-                json_object_get_string(title));
-        json_object_put(title);
+        audio->title = telebot_parser_strdup(title, allocator);
     }
 
     struct json_object *mime_type;
     if (json_object_object_get_ex(obj, "mime_type", &mime_type)) {
-        snprintf(audio->mime_type, TELEBOT_AUDIO_MIME_TYPE_SIZE, "%s",
-                json_object_get_string(mime_type));
-        json_object_put(mime_type);
+        audio->mime_type = telebot_parser_strdup(mime_type, allocator);
     }
 
     struct json_object *file_size;
     if (json_object_object_get_ex(obj, "file_size", &file_size)) {
         audio->file_size = json_object_get_int(file_size);
-        json_object_put(file_size);
     }
 
     return TELEBOT_ERROR_NONE;
 }
 
 telebot_error_e telebot_parser_get_document(struct json_object *obj,
-        telebot_document_t *document)
+        telebot_document_t *document, telebot_linear_allocator_t *allocator)
 {
     if (obj == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -622,9 +636,7 @@ telebot_error_e telebot_parser_get_document(struct json_object *obj,
 
     struct json_object *file_id;
     if (json_object_object_get_ex(obj, "file_id", &file_id)) {
-        snprintf(document->file_id, TELEBOT_FILE_ID_SIZE, "%s",
-                json_object_get_string(file_id));
-        json_object_put(file_id);
+        document->file_id = telebot_parser_strdup(file_id, allocator);
     }
     else {
         ERR("Object is not audio type, file_id not found");
@@ -633,62 +645,44 @@ telebot_error_e telebot_parser_get_document(struct json_object *obj,
 
     struct json_object *thumb;
     if (json_object_object_get_ex(obj, "thumb", &thumb)) {
-        if (telebot_parser_get_photo(thumb, &(document->thumb)) !=
+        document->thumb = telebot_parser_new(allocator, sizeof(telebot_photo_t));
+        if (document->thumb == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        if (telebot_parser_get_photo(thumb, document->thumb, allocator) !=
                 TELEBOT_ERROR_NONE)
             ERR("Failed to get <thumb> from document object");
-        json_object_put(thumb);
     }
 
     struct json_object *file_name;
     if (json_object_object_get_ex(obj, "file_name", &file_name)) {
-        snprintf(document->file_name, TELEBOT_FILE_NAME_SIZE, "%s",
-                json_object_get_string(file_name));
-        json_object_put(file_name);
+        document->file_name = telebot_parser_strdup(file_name, allocator);
     }
 
     struct json_object *mime_type;
     if (json_object_object_get_ex(obj, "mime_type", &mime_type)) {
-        snprintf(document->mime_type, TELEBOT_DOCUMENT_MIME_TYPE_SIZE, "%s",
-                json_object_get_string(mime_type));
-        json_object_put(file_name);
+        document->mime_type = telebot_parser_strdup(mime_type, allocator);
     }
 
     struct json_object *file_size;
     if (json_object_object_get_ex(obj, "file_size", &file_size)) {
         document->file_size = json_object_get_int(file_size);
-        json_object_put(file_name);
     }
 
     return TELEBOT_ERROR_NONE;
 }
 
 telebot_error_e telebot_parser_get_profile_photos(struct json_object *obj,
-        telebot_photo_t **photos, int *count)
+        telebot_photo_t **photos, int *count,
+        telebot_linear_allocator_t *allocator)
 {
     if (obj == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    if (photos == NULL)
+    if ((photos == NULL) || (count == NULL))
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    int total_count;
-    struct json_object *total_count_obj;
-    if (json_object_object_get_ex(obj, "total_count", &total_count_obj)) {
-        total_count = json_object_get_int(total_count_obj);
-        json_object_put(total_count_obj);
-    }
-    else {
-        ERR("Object is not user profile photo type, total_count not found");
-        return TELEBOT_ERROR_OPERATION_FAILED;
-    }
-
-    if (total_count == 0)
-        return TELEBOT_ERROR_NONE;
-
-
-    telebot_photo_t *tmp = calloc(total_count, sizeof(telebot_photo_t));
-    *photos = tmp;
-    *count = total_count;
+    *photos = NULL;
+    *count = 0;
 
     struct json_object *array;
     if (!json_object_object_get_ex(obj, "photos", &array)) {
@@ -696,34 +690,40 @@ telebot_error_e telebot_parser_get_profile_photos(struct json_object *obj,
         return TELEBOT_ERROR_OPERATION_FAILED;
     }
 
-    int i, j, k = 0, n, m;
+    /* Every profile photo comes in several sizes, all of them are returned */
+    int i, j, k = 0, n, m, total = 0;
     n = json_object_array_length(array);
-    telebot_error_e ret = TELEBOT_ERROR_NONE;
+    for (i=0;i<n;i++)
+        total += json_object_array_length(json_object_array_get_idx(array, i));
+
+    if (total == 0)
+        return TELEBOT_ERROR_NONE;
+
+    telebot_photo_t *tmp = telebot_linear_allocator_alloc(allocator,
+            total * sizeof(telebot_photo_t));
+    if (tmp == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+
     for (i=0;i<n;i++) {
         struct json_object *item = json_object_array_get_idx(array, i);
         m = json_object_array_length(item);
         for(j=0;j<m;j++) {
             struct json_object *photo = json_object_array_get_idx(item, j);
-            ret |= telebot_parser_get_photo(photo, &(tmp[k]));
-            json_object_put(photo);
+            if (telebot_parser_get_photo(photo, &(tmp[k]), allocator) !=
+                    TELEBOT_ERROR_NONE)
+                return TELEBOT_ERROR_OPERATION_FAILED;
             k++;
         }
-        json_object_put(item);
     }
-    json_object_put(array);
 
-    if (ret != TELEBOT_ERROR_NONE) {
-        return TELEBOT_ERROR_OPERATION_FAILED;
-        *photos = NULL;
-        *count = 0;
-        free(tmp);
-    }
+    *photos = tmp;
+    *count = k;
 
     return TELEBOT_ERROR_NONE;
 }
 
 telebot_error_e telebot_parser_get_photo(struct json_object *obj,
-        telebot_photo_t *photo)
+        telebot_photo_t *photo, telebot_linear_allocator_t *allocator)
 {
     if (obj == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -734,9 +734,9 @@ telebot_error_e telebot_parser_get_photo(struct json_object *obj,
 
     struct json_object *file_id;
     if (json_object_object_get_ex(obj, "file_id", &file_id)) {
-        snprintf(photo->file_id, TELEBOT_FILE_ID_SIZE, "%s",
-                json_object_get_string(file_id));
-        json_object_put(file_id);
+        photo->file_id = telebot_parser_strdup(file_id, allocator);
+        if (photo->file_id == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
     }
     else {
         ERR("Object is not photo size type, file_id not found");
@@ -746,7 +746,6 @@ telebot_error_e telebot_parser_get_photo(struct json_object *obj,
     struct json_object *width;
     if (json_object_object_get_ex(obj, "width", &width)){
         photo->width = json_object_get_int(width);
-        json_object_put(width);
     }
     else {
         ERR("Object is not photo size type, width not found");
@@ -756,7 +755,6 @@ telebot_error_e telebot_parser_get_photo(struct json_object *obj,
     struct json_object *height;
     if (json_object_object_get_ex(obj, "height", &height)){
         photo->height = json_object_get_int(height);
-        json_object_put(height);
     }
     else {
         ERR("Object is not photo size type, height not found");
@@ -766,19 +764,19 @@ telebot_error_e telebot_parser_get_photo(struct json_object *obj,
     struct json_object *file_size;
     if (json_object_object_get_ex(obj, "file_size", &file_size)) {
         photo->file_size = json_object_get_int(file_size);
-        json_object_put(file_size);
     }
 
     return TELEBOT_ERROR_NONE;
 }
 
 telebot_error_e telebot_parser_get_photos(struct json_object *obj,
-        telebot_photo_t photo_array[], int array_size)
+        telebot_photo_t **photos, int *count,
+        telebot_linear_allocator_t *allocator)
 {
     if (obj == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
-    if (photo_array == NULL)
+    if ((photos == NULL) || (count == NULL))
         return TELEBOT_ERROR_INVALID_PARAMETER;
 
     struct json_object *array = obj;
@@ -786,25 +784,31 @@ telebot_error_e telebot_parser_get_photos(struct json_object *obj,
     if (!array_len)
         return TELEBOT_ERROR_OPERATION_FAILED;
 
-    /* FIXME: why we don't have enough memory? */
-    if (array_len > array_size)
-        array_len = array_size;
+    telebot_photo_t *result = telebot_linear_allocator_alloc(allocator,
+            array_len * sizeof(telebot_photo_t));
+    if (result == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
 
-    int index;
+    int index, parsed = 0;
     for (index=0;index<array_len;index++) {
         struct json_object *item = json_object_array_get_idx(array, index);
 
-        if (telebot_parser_get_photo(item, &(photo_array[index])) !=
-                TELEBOT_ERROR_NONE)
+        if (telebot_parser_get_photo(item, &(result[parsed]), allocator) !=
+                TELEBOT_ERROR_NONE) {
             ERR("Failed to parse photo object");
-        json_object_put(item);
+            continue;
+        }
+        parsed++;
     }
 
+    *photos = result;
+    *count = parsed;
+
     return TELEBOT_ERROR_NONE;
 }
 
 telebot_error_e telebot_parser_get_sticker(struct json_object *obj,
-        telebot_sticker_t *sticker)
+        telebot_sticker_t *sticker, telebot_linear_allocator_t *allocator)
 {
     if (obj == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -815,9 +819,7 @@ telebot_error_e telebot_parser_get_sticker(struct json_object *obj,
 
     struct json_object *file_id;
     if (json_object_object_get_ex(obj, "file_id", &file_id)) {
-        snprintf(sticker->file_id, TELEBOT_FILE_ID_SIZE, "%s",
-                json_object_get_string(file_id));
-        json_object_put(file_id);
+        sticker->file_id = telebot_parser_strdup(file_id, allocator);
     }
     else {
         ERR("Object is not sticker type, file_id not found");
@@ -827,7 +829,6 @@ telebot_error_e telebot_parser_get_sticker(struct json_object *obj,
     struct json_object *width;
     if (json_object_object_get_ex(obj, "width", &width)){
         sticker->width = json_object_get_int(width);
-        json_object_put(width);
     }
     else {
         ERR("Object is not sticker type, width not found");
@@ -837,7 +838,6 @@ telebot_error_e telebot_parser_get_sticker(struct json_object *obj,
     struct json_object *height;
     if (json_object_object_get_ex(obj, "height", &height)){
         sticker->height = json_object_get_int(height);
-        json_object_put(height);
     }
     else {
         ERR("Object is not sticker type, height not found");
@@ -846,23 +846,24 @@ telebot_error_e telebot_parser_get_sticker(struct json_object *obj,
 
     struct json_object *thumb;
     if (json_object_object_get_ex(obj, "thumb", &thumb)) {
-        if (telebot_parser_get_photo(thumb, &(sticker->thumb)) !=
+        sticker->thumb = telebot_parser_new(allocator, sizeof(telebot_photo_t));
+        if (sticker->thumb == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        if (telebot_parser_get_photo(thumb, sticker->thumb, allocator) !=
                 TELEBOT_ERROR_NONE)
             ERR("Failed to get <thumb> from sticker object");
-        json_object_put(thumb);
     }
 
     struct json_object *file_size;
     if (json_object_object_get_ex(obj, "file_size", &file_size)) {
         sticker->file_size = json_object_get_int(file_size);
-        json_object_put(file_size);
     }
 
     return TELEBOT_ERROR_NONE;
 }
 
 telebot_error_e telebot_parser_get_video(struct json_object *obj,
-        telebot_video_t *video)
+        telebot_video_t *video, telebot_linear_allocator_t *allocator)
 {
     if (obj == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -873,9 +874,7 @@ telebot_error_e telebot_parser_get_video(struct json_object *obj,
 
     struct json_object *file_id;
     if (json_object_object_get_ex(obj, "file_id", &file_id)) {
-        snprintf(video->file_id, TELEBOT_FILE_ID_SIZE, "%s",
-                json_object_get_string(file_id));
-        json_object_put(file_id);
+        video->file_id = telebot_parser_strdup(file_id, allocator);
     }
     else {
         ERR("Object is not video type, file_id not found");
@@ -885,7 +884,6 @@ telebot_error_e telebot_parser_get_video(struct json_object *obj,
     struct json_object *width;
     if (json_object_object_get_ex(obj, "width", &width)){
         video->width = json_object_get_int(width);
-        json_object_put(width);
     }
     else {
         ERR("Object is not video type, width not found");
@@ -895,7 +893,6 @@ telebot_error_e telebot_parser_get_video(struct json_object *obj,
     struct json_object *height;
     if (json_object_object_get_ex(obj, "height", &height)){
         video->height = json_object_get_int(height);
-        json_object_put(height);
     }
     else {
         ERR("Object is not video type, height not found");
@@ -905,7 +902,6 @@ telebot_error_e telebot_parser_get_video(struct json_object *obj,
     struct json_object *duration;
     if (json_object_object_get_ex(obj, "duration", &duration)){
         video->duration = json_object_get_int(duration);
-        json_object_put(duration);
     }
     else {
         ERR("Object is not video type, duration not found");
@@ -914,30 +910,29 @@ telebot_error_e telebot_parser_get_video(struct json_object *obj,
 
     struct json_object *thumb;
     if (json_object_object_get_ex(obj, "thumb", &thumb)) {
-        if (telebot_parser_get_photo(thumb, &(video->thumb)) !=
+        video->thumb = telebot_parser_new(allocator, sizeof(telebot_photo_t));
+        if (video->thumb == NULL)
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        if (telebot_parser_get_photo(thumb, video->thumb, allocator) !=
                 TELEBOT_ERROR_NONE)
             ERR("Failed to get <thumb> from video object");
-        json_object_put(thumb);
     }
 
     struct json_object *mime_type;
     if (json_object_object_get_ex(obj, "mime_type", &mime_type)) {
-        snprintf(video->mime_type, TELEBOT_VIDEO_MIME_TYPE_SIZE, "%s",
-                json_object_get_string(mime_type));
-        json_object_put(mime_type);
+        video->mime_type = telebot_parser_strdup(mime_type, allocator);
     }
 
     struct json_object *file_size;
     if (json_object_object_get_ex(obj, "file_size", &file_size)) {
         video->file_size = json_object_get_int(file_size);
-        json_object_put(file_size);
     }
 
     return TELEBOT_ERROR_NONE;
 }
 
 telebot_error_e telebot_parser_get_voice(struct json_object *obj,
-        telebot_voice_t *voice)
+        telebot_voice_t *voice, telebot_linear_allocator_t *allocator)
 {
     if (obj == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -948,9 +943,7 @@ telebot_error_e telebot_parser_get_voice(struct json_object *obj,
 
     struct json_object *file_id;
     if (json_object_object_get_ex(obj, "file_id", &file_id)) {
-        snprintf(voice->file_id, TELEBOT_FILE_ID_SIZE, "%s",
-                json_object_get_string(file_id));
-        json_object_put(file_id);
+        voice->file_id = telebot_parser_strdup(file_id, allocator);
     }
     else {
         ERR("Object is not voice type, file_id not found");
@@ -960,7 +953,6 @@ telebot_error_e telebot_parser_get_voice(struct json_object *obj,
     struct json_object *duration;
     if (json_object_object_get_ex(obj, "duration", &duration)){
         voice->duration = json_object_get_int(duration);
-        json_object_put(duration);
     }
     else {
         ERR("Object is not voice type, voice duration not found");
@@ -969,22 +961,19 @@ telebot_error_e telebot_parser_get_voice(struct json_object *obj,
 
     struct json_object *mime_type;
     if (json_object_object_get_ex(obj, "mime_type", &mime_type)) {
-        snprintf(voice->mime_type, TELEBOT_AUDIO_MIME_TYPE_SIZE, "%s",
-                json_object_get_string(mime_type));
-        json_object_put(mime_type);
+        voice->mime_type = telebot_parser_strdup(mime_type, allocator);
     }
 
     struct json_object *file_size;
     if (json_object_object_get_ex(obj, "file_size", &file_size)) {
         voice->file_size = json_object_get_int(file_size);
-        json_object_put(file_size);
     }
 
     return TELEBOT_ERROR_NONE;
 }
 
 telebot_error_e telebot_parser_get_contact(struct json_object *obj,
-        telebot_contact_t *contact)
+        telebot_contact_t *contact, telebot_linear_allocator_t *allocator)
 {
     if (obj == NULL)
         return TELEBOT_ERROR_INVALID_PARAMETER;
@@ -995,9 +984,7 @@ telebot_error_e telebot_parser_get_contact(struct json_object *obj,
 
     struct json_object *phone_number;
     if (json_object_object_get_ex(obj, "phone_number", &phone_number)) {
-        snprintf(contact->phone_number, TELEBOT_PHONE_NUMBER_SIZE, "%s",
-                json_object_get_string(phone_number));
-        json_object_put(phone_number);
+        contact->phone_number = telebot_parser_strdup(phone_number, allocator);
     }
     else {
         ERR("Object is not contact type, phone number not found");
@@ -1006,9 +993,7 @@ telebot_error_e telebot_parser_get_contact(struct json_object *obj,
 
     struct json_object *first_name;
     if (json_object_object_get_ex(obj, "first_name", &first_name)){
-        snprintf(contact->first_name, TELEBOT_FIRST_NAME_SIZE, "%s",
-                json_object_get_string(first_name));
-        json_object_put(first_name);
+        contact->first_name = telebot_parser_strdup(first_name, allocator);
     }
     else {
         ERR("Object is not contact type, first name not found");
@@ -1017,15 +1002,12 @@ telebot_error_e telebot_parser_get_contact(struct json_object *obj,
 
     struct json_object *last_name;
     if (json_object_object_get_ex(obj, "last_name", &last_name)){
-        snprintf(contact->last_name, TELEBOT_LAST_NAME_SIZE, "%s",
-                json_object_get_string(last_name));
-        json_object_put(last_name);
+        contact->last_name = telebot_parser_strdup(last_name, allocator);
     }
 
     struct json_object *user_id;
     if (json_object_object_get_ex(obj, "user_id", &user_id)) {
-        contact->user_id = json_object_get_int(user_id);
-        json_object_put(user_id);
+        contact->user_id = json_object_get_int64(user_id);
     }
 
     return TELEBOT_ERROR_NONE;
@@ -1044,7 +1026,6 @@ telebot_error_e telebot_parser_get_location(struct json_object *obj,
     struct json_object *latitude;
     if (json_object_object_get_ex (obj, "latitude", &latitude)) {
         location->latitude = json_object_get_double(latitude);
-        json_object_put (latitude);
     }
     else {
         ERR("Object is not location type, latitude not found");
@@ -1054,7 +1035,6 @@ telebot_error_e telebot_parser_get_location(struct json_object *obj,
     struct json_object *longitude;
     if (json_object_object_get_ex (obj, "longitude", &longitude)) {
         location->longitude = json_object_get_double(longitude);
-        json_object_put (longitude);
     }
     else {
         ERR("Object is not location type, latitude not found");
@@ -1076,7 +1056,6 @@ telebot_error_e telebot_parser_get_file_path(struct json_object *obj,
     struct json_object *file_path;
     if (json_object_object_get_ex (obj, "file_path", &file_path)) {
         *path = strdup(json_object_get_string(file_path));
-        json_object_put (file_path);
     }
     else {
         *path = NULL;
@@ -0,0 +1,590 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <telebot-private.h>
+#include <telebot-common.h>
+#include <telebot-api.h>
+#include <telebot-scheduler.h>
+
+/*
+ * Token buckets holding at most one token, so messages are evenly spaced at
+ * the limit and no window of any alignment sees more than the rate. Taking a
+ * token may leave the bucket negative: the message then owns a slot in the
+ * future, and the next one is scheduled after it.
+ */
+struct telebot_bucket {
+    double tokens;
+    double last_us; /* When tokens was computed, may be in the future */
+};
+
+/* Per chat bucket, in an open addressing table keyed by the chat id hash */
+struct telebot_chat_bucket {
+    uint64_t key;
+    bool used;
+    bool group;
+    struct telebot_bucket bucket;
+};
+
+/* A message of the queue, waiting for its chat slot and then a global one */
+struct telebot_queued {
+    double at; /* When its chat slot comes */
+    double since; /* When it was submitted */
+    unsigned long seq; /* Keeps submission order among equal slots */
+    telebot_scheduler_release_f release;
+    void *data;
+};
+
+struct telebot_scheduler {
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* Wakes the queue thread, on CLOCK_MONOTONIC */
+    pthread_cond_t idle_cond; /* Signaled when no released message is left */
+    double global_rate; /* Tokens per microsecond, 0 for no limit */
+    double chat_rate;
+    double group_rate;
+    unsigned long max_wait_us;
+    struct telebot_bucket global;
+    struct telebot_chat_bucket *chats;
+    int capacity; /* Slots in chats, a power of two */
+    struct telebot_queued *queue; /* Min heap on the chat slot, then seq */
+    int queue_count;
+    int queue_capacity;
+    unsigned long queue_seq;
+    int inflight; /* Released by the queue, not completed yet */
+    pthread_t thread;
+    bool thread_started;
+    bool closing;
+    telebot_send_stats_t stats;
+};
+
+static double telebot_scheduler_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Chat ids are numbers or @usernames, both are hashed with FNV-1a */
+static uint64_t telebot_scheduler_key(const char *chat_id)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *chat_id != '\0'; chat_id++) {
+        hash ^= (unsigned char)*chat_id;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/* When the bucket holds a token again, always for no limit */
+static double telebot_bucket_ready(const struct telebot_bucket *bucket,
+        double rate)
+{
+    if (rate == 0)
+        return 0;
+    if (bucket->tokens >= 1)
+        return bucket->last_us;
+
+    return bucket->last_us + (1 - bucket->tokens) / rate;
+}
+
+/*
+ * Take a token at time at, which is never before bucket->last_us. Without a
+ * limit the bucket is left alone, so that it never holds a slot in the future.
+ */
+static void telebot_bucket_take(struct telebot_bucket *bucket, double rate,
+        double at)
+{
+    if (rate == 0)
+        return;
+
+    double tokens = bucket->tokens + (at - bucket->last_us) * rate;
+    bucket->tokens = ((tokens < 1) ? tokens : 1) - 1;
+    bucket->last_us = at;
+}
+
+/* A full bucket carries no state, it is the same as a new one */
+static bool telebot_bucket_idle(const struct telebot_bucket *bucket,
+        double rate, double now)
+{
+    return (rate == 0) || (telebot_bucket_ready(bucket, rate) <= now);
+}
+
+static double telebot_chat_rate(struct telebot_scheduler *scheduler,
+        bool group)
+{
+    return group ? scheduler->group_rate : scheduler->chat_rate;
+}
+
+/*
+ * Rebuilds the table with the buckets still holding state. Idle chats are
+ * dropped on the way, so the table follows the chats currently messaged
+ * rather than every chat ever seen.
+ */
+static bool telebot_scheduler_rehash(struct telebot_scheduler *scheduler,
+        double now)
+{
+    int index, kept = 0;
+    for (index = 0; index < scheduler->capacity; index++) {
+        struct telebot_chat_bucket *chat = &(scheduler->chats[index]);
+        if (chat->used && !telebot_bucket_idle(&(chat->bucket),
+                    telebot_chat_rate(scheduler, chat->group), now))
+            kept++;
+        else
+            chat->used = false;
+    }
+
+    int capacity = TELEBOT_SCHEDULER_CHATS_MIN;
+    while ((kept + 1) * 2 > capacity)
+        capacity *= 2;
+
+    struct telebot_chat_bucket *chats = calloc(capacity,
+            sizeof(struct telebot_chat_bucket));
+    if (chats == NULL) {
+        ERR("Failed to allocate memory");
+        return false;
+    }
+
+    for (index = 0; index < scheduler->capacity; index++) {
+        struct telebot_chat_bucket *chat = &(scheduler->chats[index]);
+        if (!chat->used)
+            continue;
+        int slot = chat->key & (capacity - 1);
+        while (chats[slot].used)
+            slot = (slot + 1) & (capacity - 1);
+        chats[slot] = *chat;
+    }
+
+    free(scheduler->chats);
+    scheduler->chats = chats;
+    scheduler->capacity = capacity;
+    scheduler->stats.chats = kept;
+
+    return true;
+}
+
+static struct telebot_chat_bucket *telebot_scheduler_chat(
+        struct telebot_scheduler *scheduler, const char *chat_id, double now)
+{
+    uint64_t key = telebot_scheduler_key(chat_id);
+    int slot = key & (scheduler->capacity - 1);
+
+    while (scheduler->chats[slot].used) {
+        if (scheduler->chats[slot].key == key)
+            return &(scheduler->chats[slot]);
+        slot = (slot + 1) & (scheduler->capacity - 1);
+    }
+
+    if ((scheduler->stats.chats + 1) * 4 > scheduler->capacity * 3) {
+        if (!telebot_scheduler_rehash(scheduler, now))
+            return NULL;
+        return telebot_scheduler_chat(scheduler, chat_id, now);
+    }
+
+    struct telebot_chat_bucket *chat = &(scheduler->chats[slot]);
+    chat->used = true;
+    chat->key = key;
+    /* Negative ids are groups, @usernames are channels */
+    chat->group = (chat_id[0] == '-') || (chat_id[0] == '@');
+    chat->bucket.tokens = 1;
+    chat->bucket.last_us = now;
+    scheduler->stats.chats++;
+
+    return chat;
+}
+
+telebot_scheduler_t *telebot_scheduler_create(void)
+{
+    struct telebot_scheduler *scheduler = calloc(1,
+            sizeof(struct telebot_scheduler));
+    if (scheduler == NULL) {
+        ERR("Failed to allocate memory");
+        return NULL;
+    }
+
+    scheduler->capacity = TELEBOT_SCHEDULER_CHATS_MIN;
+    scheduler->chats = calloc(scheduler->capacity,
+            sizeof(struct telebot_chat_bucket));
+    if (scheduler->chats == NULL) {
+        ERR("Failed to allocate memory");
+        free(scheduler);
+        return NULL;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(scheduler->cond), &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&(scheduler->idle_cond), NULL);
+
+    pthread_mutex_init(&(scheduler->lock), NULL);
+    scheduler->global.tokens = 1;
+    scheduler->global.last_us = telebot_scheduler_now();
+    telebot_scheduler_set_rate(scheduler, TELEBOT_SCHEDULER_GLOBAL_RATE,
+            TELEBOT_SCHEDULER_CHAT_RATE, TELEBOT_SCHEDULER_GROUP_RATE, 0);
+
+    return scheduler;
+}
+
+void telebot_scheduler_destroy(telebot_scheduler_t *scheduler)
+{
+    telebot_scheduler_close(scheduler);
+    pthread_mutex_destroy(&(scheduler->lock));
+    pthread_cond_destroy(&(scheduler->cond));
+    pthread_cond_destroy(&(scheduler->idle_cond));
+    free(scheduler->queue);
+    free(scheduler->chats);
+    free(scheduler);
+}
+
+void telebot_scheduler_set_rate(telebot_scheduler_t *scheduler,
+        int global_rate, int chat_rate, int group_rate, int max_wait)
+{
+    /* Slots run slightly under the limits, so that requests arriving a bit
+     * closer together than they were sent are still within them */
+    double headroom = TELEBOT_SCHEDULER_HEADROOM;
+
+    pthread_mutex_lock(&(scheduler->lock));
+    scheduler->global_rate = global_rate * headroom / 1e6;
+    scheduler->chat_rate = chat_rate * headroom / 60e6;
+    scheduler->group_rate = group_rate * headroom / 60e6;
+    scheduler->max_wait_us = max_wait * 1000000UL;
+    pthread_mutex_unlock(&(scheduler->lock));
+}
+
+static void telebot_scheduler_timespec(double at, struct timespec *ts)
+{
+    ts->tv_sec = (time_t)(at / 1e6);
+    ts->tv_nsec = (long)((at - ts->tv_sec * 1e6) * 1e3);
+    if (ts->tv_nsec >= 1000000000L)
+        ts->tv_nsec = 999999999L;
+}
+
+static void telebot_scheduler_sleep_until(double at)
+{
+    struct timespec ts;
+    telebot_scheduler_timespec(at, &ts);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/* Takes the slot of the chat, the lock MUST be held */
+static telebot_error_e telebot_scheduler_chat_slot(
+        struct telebot_scheduler *scheduler, const char *chat_id, double now,
+        double *at)
+{
+    *at = now;
+    if ((scheduler->chat_rate == 0) && (scheduler->group_rate == 0))
+        return TELEBOT_ERROR_NONE;
+
+    struct telebot_chat_bucket *chat = telebot_scheduler_chat(scheduler,
+            chat_id, now);
+    if (chat == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+
+    double chat_rate = telebot_chat_rate(scheduler, chat->group);
+    double ready = telebot_bucket_ready(&(chat->bucket), chat_rate);
+    if (ready > *at)
+        *at = ready;
+    if ((scheduler->max_wait_us > 0) && (*at - now > scheduler->max_wait_us)) {
+        scheduler->stats.dropped++;
+        return TELEBOT_ERROR_RATE_LIMITED;
+    }
+    telebot_bucket_take(&(chat->bucket), chat_rate, *at);
+
+    return TELEBOT_ERROR_NONE;
+}
+
+/*
+ * A message first waits for the slot of its chat, and only then takes the
+ * next global slot. Taking both at once would reserve a global slot as far
+ * ahead as the chat slot, and every other chat would queue behind it.
+ */
+telebot_error_e telebot_scheduler_acquire(telebot_scheduler_t *scheduler,
+        const char *chat_id)
+{
+    double now = telebot_scheduler_now();
+    telebot_send_stats_t *stats = &(scheduler->stats);
+
+    pthread_mutex_lock(&(scheduler->lock));
+    double at;
+    telebot_error_e ret = telebot_scheduler_chat_slot(scheduler, chat_id, now,
+            &at);
+    if (ret != TELEBOT_ERROR_NONE) {
+        pthread_mutex_unlock(&(scheduler->lock));
+        return ret;
+    }
+    stats->waiting++;
+    pthread_mutex_unlock(&(scheduler->lock));
+
+    if (at > now)
+        telebot_scheduler_sleep_until(at);
+
+    pthread_mutex_lock(&(scheduler->lock));
+    double global_now = telebot_scheduler_now();
+    at = telebot_bucket_ready(&(scheduler->global), scheduler->global_rate);
+    if (at < global_now)
+        at = global_now;
+
+    /* A chat slot given up here is only ever a slot less, never one more */
+    unsigned long wait = at - now;
+    if ((scheduler->max_wait_us > 0) && (wait > scheduler->max_wait_us)) {
+        stats->dropped++;
+        stats->waiting--;
+        pthread_mutex_unlock(&(scheduler->lock));
+        return TELEBOT_ERROR_RATE_LIMITED;
+    }
+    telebot_bucket_take(&(scheduler->global), scheduler->global_rate, at);
+
+    stats->queued++;
+    stats->queue_wait_total_us += wait;
+    if (wait > stats->queue_wait_max_us)
+        stats->queue_wait_max_us = wait;
+    pthread_mutex_unlock(&(scheduler->lock));
+
+    if (at > global_now)
+        telebot_scheduler_sleep_until(at);
+
+    pthread_mutex_lock(&(scheduler->lock));
+    stats->waiting--;
+    pthread_mutex_unlock(&(scheduler->lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+static bool telebot_queued_before(const struct telebot_queued *a,
+        const struct telebot_queued *b)
+{
+    return (a->at < b->at) || ((a->at == b->at) && (a->seq < b->seq));
+}
+
+static void telebot_scheduler_push(struct telebot_scheduler *scheduler,
+        const struct telebot_queued *message)
+{
+    struct telebot_queued *queue = scheduler->queue;
+    int index = scheduler->queue_count++;
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!telebot_queued_before(message, &(queue[parent])))
+            break;
+        queue[index] = queue[parent];
+        index = parent;
+    }
+    queue[index] = *message;
+}
+
+static void telebot_scheduler_pop(struct telebot_scheduler *scheduler)
+{
+    struct telebot_queued *queue = scheduler->queue;
+    struct telebot_queued last = queue[--scheduler->queue_count];
+    int count = scheduler->queue_count;
+    int index = 0;
+    while (2 * index + 1 < count) {
+        int child = 2 * index + 1;
+        if ((child + 1 < count) &&
+                telebot_queued_before(&(queue[child + 1]), &(queue[child])))
+            child++;
+        if (!telebot_queued_before(&(queue[child]), &last))
+            break;
+        queue[index] = queue[child];
+        index = child;
+    }
+    if (count > 0)
+        queue[index] = last;
+}
+
+/*
+ * Releases the queue head once both its chat slot and the next global slot
+ * have come. Messages are released outside of the lock, so the release
+ * function may hand them to the asynchronous transport right away.
+ */
+static void *telebot_scheduler_thread(void *data)
+{
+    struct telebot_scheduler *scheduler = data;
+    telebot_send_stats_t *stats = &(scheduler->stats);
+
+    pthread_mutex_lock(&(scheduler->lock));
+    while (!scheduler->closing) {
+        if (scheduler->queue_count == 0) {
+            pthread_cond_wait(&(scheduler->cond), &(scheduler->lock));
+            continue;
+        }
+
+        struct telebot_queued message = scheduler->queue[0];
+        double at = telebot_bucket_ready(&(scheduler->global),
+                scheduler->global_rate);
+        if (at < message.at)
+            at = message.at;
+
+        telebot_error_e ret = TELEBOT_ERROR_NONE;
+        unsigned long wait = (at > message.since) ? at - message.since : 0;
+        if ((scheduler->max_wait_us > 0) && (wait > scheduler->max_wait_us)) {
+            stats->dropped++;
+            ret = TELEBOT_ERROR_RATE_LIMITED;
+        }
+        else {
+            double now = telebot_scheduler_now();
+            if (at > now) {
+                struct timespec ts;
+                telebot_scheduler_timespec(at, &ts);
+                pthread_cond_timedwait(&(scheduler->cond), &(scheduler->lock),
+                        &ts);
+                continue;
+            }
+            telebot_bucket_take(&(scheduler->global), scheduler->global_rate,
+                    now);
+
+            wait = now - message.since;
+            stats->queued++;
+            stats->queue_wait_total_us += wait;
+            if (wait > stats->queue_wait_max_us)
+                stats->queue_wait_max_us = wait;
+            scheduler->inflight++;
+        }
+        telebot_scheduler_pop(scheduler);
+        stats->waiting--;
+        pthread_mutex_unlock(&(scheduler->lock));
+
+        message.release(ret, message.data);
+
+        pthread_mutex_lock(&(scheduler->lock));
+    }
+    pthread_mutex_unlock(&(scheduler->lock));
+
+    return NULL;
+}
+
+telebot_error_e telebot_scheduler_submit(telebot_scheduler_t *scheduler,
+        const char *chat_id, telebot_scheduler_release_f release, void *data)
+{
+    double now = telebot_scheduler_now();
+
+    pthread_mutex_lock(&(scheduler->lock));
+    if (scheduler->closing) {
+        pthread_mutex_unlock(&(scheduler->lock));
+        return TELEBOT_ERROR_NOT_SUPPORTED;
+    }
+
+    if (scheduler->queue_count == scheduler->queue_capacity) {
+        int capacity = (scheduler->queue_capacity > 0) ?
+            scheduler->queue_capacity * 2 : TELEBOT_SCHEDULER_QUEUE_MIN;
+        struct telebot_queued *queue = realloc(scheduler->queue,
+                capacity * sizeof(struct telebot_queued));
+        if (queue == NULL) {
+            ERR("Failed to allocate memory");
+            pthread_mutex_unlock(&(scheduler->lock));
+            return TELEBOT_ERROR_OUT_OF_MEMORY;
+        }
+        scheduler->queue = queue;
+        scheduler->queue_capacity = capacity;
+    }
+
+    if (!scheduler->thread_started) {
+        if (pthread_create(&(scheduler->thread), NULL,
+                    telebot_scheduler_thread, scheduler) != 0) {
+            ERR("Failed to create the scheduler thread");
+            pthread_mutex_unlock(&(scheduler->lock));
+            return TELEBOT_ERROR_OPERATION_FAILED;
+        }
+        scheduler->thread_started = true;
+    }
+
+    struct telebot_queued message = {
+        .since = now,
+        .seq = scheduler->queue_seq++,
+        .release = release,
+        .data = data,
+    };
+    telebot_error_e ret = telebot_scheduler_chat_slot(scheduler, chat_id, now,
+            &(message.at));
+    if (ret != TELEBOT_ERROR_NONE) {
+        pthread_mutex_unlock(&(scheduler->lock));
+        return ret;
+    }
+
+    telebot_scheduler_push(scheduler, &message);
+    scheduler->stats.waiting++;
+    if (scheduler->queue[0].seq == message.seq)
+        pthread_cond_signal(&(scheduler->cond));
+    pthread_mutex_unlock(&(scheduler->lock));
+
+    return TELEBOT_ERROR_NONE;
+}
+
+void telebot_scheduler_close(telebot_scheduler_t *scheduler)
+{
+    pthread_mutex_lock(&(scheduler->lock));
+    scheduler->closing = true;
+    pthread_cond_broadcast(&(scheduler->cond));
+    bool joining = scheduler->thread_started;
+    scheduler->thread_started = false;
+    pthread_mutex_unlock(&(scheduler->lock));
+
+    if (joining)
+        pthread_join(scheduler->thread, NULL);
+
+    pthread_mutex_lock(&(scheduler->lock));
+    while (scheduler->queue_count > 0) {
+        struct telebot_queued message = scheduler->queue[0];
+        telebot_scheduler_pop(scheduler);
+        scheduler->stats.waiting--;
+        pthread_mutex_unlock(&(scheduler->lock));
+        message.release(TELEBOT_ERROR_OPERATION_FAILED, message.data);
+        pthread_mutex_lock(&(scheduler->lock));
+    }
+    while (scheduler->inflight > 0)
+        pthread_cond_wait(&(scheduler->idle_cond), &(scheduler->lock));
+    pthread_mutex_unlock(&(scheduler->lock));
+}
+
+void telebot_scheduler_done(telebot_scheduler_t *scheduler,
+        telebot_error_e ret)
+{
+    pthread_mutex_lock(&(scheduler->lock));
+    scheduler->stats.sent++;
+    if (ret == TELEBOT_ERROR_RATE_LIMITED)
+        scheduler->stats.rate_limited++;
+    pthread_mutex_unlock(&(scheduler->lock));
+}
+
+void telebot_scheduler_complete(telebot_scheduler_t *scheduler,
+        telebot_error_e ret)
+{
+    pthread_mutex_lock(&(scheduler->lock));
+    scheduler->stats.sent++;
+    if (ret == TELEBOT_ERROR_RATE_LIMITED)
+        scheduler->stats.rate_limited++;
+    if (--scheduler->inflight == 0)
+        pthread_cond_broadcast(&(scheduler->idle_cond));
+    pthread_mutex_unlock(&(scheduler->lock));
+}
+
+void telebot_scheduler_get_stats(telebot_scheduler_t *scheduler,
+        telebot_send_stats_t *stats)
+{
+    pthread_mutex_lock(&(scheduler->lock));
+    *stats = scheduler->stats;
+    pthread_mutex_unlock(&(scheduler->lock));
+}
@@ -0,0 +1,300 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <telebot-private.h>
+#include <telebot-common.h>
+#include <telebot-core-api.h>
+#include <telebot-stats.h>
+
+/*
+ * Requests record into relaxed atomic counters and never take a lock, so a
+ * snapshot costs a few tens of thousands of loads and slows no request down.
+ * Histogram buckets are log-linear as in HdrHistogram: values below 16 us
+ * get a bucket each, then every power of two is split into 16 buckets, which
+ * keeps every bucket within 1/16 of its values.
+ */
+#define TELEBOT_STATS_SUB_BUCKETS 16
+#define TELEBOT_STATS_SUB_BITS 4
+#define TELEBOT_STATS_VALUE_MAX 0xffffffffUL
+
+struct telebot_stats_histogram {
+    atomic_ulong count;
+    atomic_ullong sum_us;
+    atomic_ulong max_us;
+    atomic_ulong buckets[TELEBOT_CORE_HISTOGRAM_BUCKETS];
+};
+
+struct telebot_stats_method {
+    atomic_ulong requests;
+    atomic_ulong failures;
+    atomic_ulong retries;
+    atomic_ulong status[6];
+    struct telebot_stats_histogram latency[TELEBOT_CORE_PHASES];
+};
+
+struct telebot_stats {
+    struct telebot_stats_method methods[TELEBOT_CORE_STATS_METHODS];
+};
+
+/* In the order of the snapshot, the last one takes every other method */
+static const char *telebot_stats_methods[TELEBOT_CORE_STATS_METHODS] = {
+    TELEBOT_METHOD_GET_ME,
+    TELEBOT_METHOD_GET_UPDATES,
+    TELEBOT_METHOD_SEND_MESSAGE,
+    TELEBOT_METHOD_DELETE_MESSAGE,
+    TELEBOT_METHOD_ANSWER_CALLBACK_QUERY,
+    TELEBOT_METHOD_FORWARD_MESSAGE,
+    TELEBOT_METHOD_SEND_PHOTO,
+    TELEBOT_METHOD_SEND_AUDIO,
+    TELEBOT_METHOD_SEND_DOCUMENT,
+    TELEBOT_METHOD_SEND_VIDEO,
+    TELEBOT_METHOD_SEND_STICKER,
+    TELEBOT_METHOD_SEND_VOICE,
+    TELEBOT_METHOD_SEND_LOCATION,
+    TELEBOT_METHOD_SEND_CHATACTION,
+    TELEBOT_METHOD_GET_USERPHOTOS,
+    TELEBOT_METHOD_GET_FILE,
+    TELEBOT_METHOD_SET_WEBHOOK,
+    TELEBOT_STATS_DOWNLOAD,
+    "other",
+};
+
+static struct telebot_stats_method *telebot_stats_method(
+        telebot_stats_t *stats, const char *method)
+{
+    int index;
+    for (index = 0; index < TELEBOT_CORE_STATS_METHODS - 1; index++) {
+        if ((method != NULL) &&
+                (strcmp(method, telebot_stats_methods[index]) == 0))
+            break;
+    }
+
+    return &(stats->methods[index]);
+}
+
+static int telebot_stats_bucket(unsigned long value)
+{
+    if (value > TELEBOT_STATS_VALUE_MAX)
+        value = TELEBOT_STATS_VALUE_MAX;
+    if (value < TELEBOT_STATS_SUB_BUCKETS)
+        return (int)value;
+
+    /* Highest set bit, at least TELEBOT_STATS_SUB_BITS */
+    int exponent = 63 - __builtin_clzl(value);
+    int shift = exponent - TELEBOT_STATS_SUB_BITS;
+
+    return TELEBOT_STATS_SUB_BUCKETS * (shift + 1) +
+        (int)(value >> shift) - TELEBOT_STATS_SUB_BUCKETS;
+}
+
+static void telebot_stats_record(struct telebot_stats_histogram *histogram,
+        unsigned long value)
+{
+    atomic_fetch_add_explicit(&(histogram->count), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(histogram->sum_us), value,
+            memory_order_relaxed);
+    atomic_fetch_add_explicit(
+            &(histogram->buckets[telebot_stats_bucket(value)]), 1,
+            memory_order_relaxed);
+
+    unsigned long max = atomic_load_explicit(&(histogram->max_us),
+            memory_order_relaxed);
+    while ((value > max) && !atomic_compare_exchange_weak_explicit(
+                &(histogram->max_us), &max, value, memory_order_relaxed,
+                memory_order_relaxed));
+}
+
+/* Difference of two points in time of a transfer, 0 if they are unordered */
+static unsigned long telebot_stats_span(curl_off_t from, curl_off_t to)
+{
+    return (to > from) ? (unsigned long)(to - from) : 0UL;
+}
+
+telebot_stats_t *telebot_stats_create(void)
+{
+    telebot_stats_t *stats = calloc(1, sizeof(telebot_stats_t));
+    if (stats == NULL)
+        ERR("Failed to allocate memory");
+
+    return stats;
+}
+
+void telebot_stats_destroy(telebot_stats_t *stats)
+{
+    free(stats);
+}
+
+void telebot_stats_attempt(telebot_stats_t *stats, const char *method,
+        CURL *curl_h, CURLcode res, long resp_code)
+{
+    if (stats == NULL)
+        return;
+
+    struct telebot_stats_method *entry = telebot_stats_method(stats, method);
+    atomic_fetch_add_explicit(&(entry->requests), 1, memory_order_relaxed);
+
+    long class = (res == CURLE_OK) ? resp_code / 100 : 0L;
+    if ((class < 1) || (class > 5))
+        class = 0;
+    atomic_fetch_add_explicit(&(entry->status[class]), 1,
+            memory_order_relaxed);
+
+    /* Every point in time counts from the start of the attempt */
+    curl_off_t dns = 0, connect = 0, tls = 0, pretransfer = 0, ttfb = 0;
+    curl_off_t total = 0, uploaded = 0;
+    long connects = 0L;
+    curl_easy_getinfo(curl_h, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(curl_h, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl_h, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(curl_h, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+    curl_easy_getinfo(curl_h, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+    curl_easy_getinfo(curl_h, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(curl_h, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(curl_h, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+
+    /*
+     * curl marks the start of the transfer when a request body starts going
+     * out rather than at the first byte of the answer. Bot API answers are
+     * small, so the time to the whole answer stands in for it then.
+     */
+    if (uploaded > 0)
+        ttfb = total;
+
+    /* A reused connection has no setup phases to speak of */
+    if (connects > 0) {
+        telebot_stats_record(&(entry->latency[TELEBOT_CORE_PHASE_DNS]),
+                telebot_stats_span(0, dns));
+        if (connect > 0)
+            telebot_stats_record(
+                    &(entry->latency[TELEBOT_CORE_PHASE_CONNECT]),
+                    telebot_stats_span(dns, connect));
+        if (tls > 0)
+            telebot_stats_record(&(entry->latency[TELEBOT_CORE_PHASE_TLS]),
+                    telebot_stats_span(connect, tls));
+    }
+    if (ttfb > 0)
+        telebot_stats_record(&(entry->latency[TELEBOT_CORE_PHASE_TTFB]),
+                telebot_stats_span(pretransfer, ttfb));
+    telebot_stats_record(&(entry->latency[TELEBOT_CORE_PHASE_TOTAL]),
+            telebot_stats_span(0, total));
+}
+
+void telebot_stats_retry(telebot_stats_t *stats, const char *method)
+{
+    if (stats == NULL)
+        return;
+
+    atomic_fetch_add_explicit(&(telebot_stats_method(stats, method)->retries),
+            1, memory_order_relaxed);
+}
+
+void telebot_stats_done(telebot_stats_t *stats, const char *method,
+        bool failed)
+{
+    if ((stats == NULL) || !failed)
+        return;
+
+    atomic_fetch_add_explicit(
+            &(telebot_stats_method(stats, method)->failures), 1,
+            memory_order_relaxed);
+}
+
+void telebot_stats_read(telebot_stats_t *stats, telebot_core_stats_t *snapshot)
+{
+    int index, phase, bucket;
+
+    for (index = 0; index < TELEBOT_CORE_STATS_METHODS; index++) {
+        struct telebot_stats_method *entry = &(stats->methods[index]);
+        telebot_core_method_stats_t *out = &(snapshot->methods[index]);
+
+        out->method = telebot_stats_methods[index];
+        out->requests = atomic_load_explicit(&(entry->requests),
+                memory_order_relaxed);
+        out->failures = atomic_load_explicit(&(entry->failures),
+                memory_order_relaxed);
+        out->retries = atomic_load_explicit(&(entry->retries),
+                memory_order_relaxed);
+        for (bucket = 0; bucket < 6; bucket++)
+            out->status[bucket] = atomic_load_explicit(
+                    &(entry->status[bucket]), memory_order_relaxed);
+
+        for (phase = 0; phase < TELEBOT_CORE_PHASES; phase++) {
+            struct telebot_stats_histogram *histogram =
+                &(entry->latency[phase]);
+            telebot_core_histogram_t *copy = &(out->latency[phase]);
+
+            copy->count = atomic_load_explicit(&(histogram->count),
+                    memory_order_relaxed);
+            copy->sum_us = atomic_load_explicit(&(histogram->sum_us),
+                    memory_order_relaxed);
+            copy->max_us = atomic_load_explicit(&(histogram->max_us),
+                    memory_order_relaxed);
+            for (bucket = 0; bucket < TELEBOT_CORE_HISTOGRAM_BUCKETS;
+                    bucket++)
+                copy->buckets[bucket] = atomic_load_explicit(
+                        &(histogram->buckets[bucket]), memory_order_relaxed);
+        }
+    }
+}
+
+unsigned long long telebot_core_histogram_limit(int index)
+{
+    if (index < TELEBOT_STATS_SUB_BUCKETS)
+        return index + 1;
+
+    int shift = index / TELEBOT_STATS_SUB_BUCKETS - 1;
+    unsigned long long lower = (unsigned long long)(index %
+            TELEBOT_STATS_SUB_BUCKETS + TELEBOT_STATS_SUB_BUCKETS) << shift;
+
+    return lower + (1ULL << shift);
+}
+
+unsigned long telebot_core_histogram_percentile(
+        const telebot_core_histogram_t *histogram, double percentile)
+{
+    if ((histogram == NULL) || (histogram->count == 0))
+        return 0;
+
+    /* Rank of the value, rounded up. Buckets may be a few values ahead of
+     * count in a snapshot, and fall short of it a few values as well */
+    double exact = histogram->count * percentile / 100;
+    unsigned long rank = (unsigned long)exact;
+    if ((rank < exact) || (rank < 1))
+        rank++;
+
+    unsigned long seen = 0;
+    int index;
+    for (index = 0; index < TELEBOT_CORE_HISTOGRAM_BUCKETS; index++) {
+        seen += histogram->buckets[index];
+        if (seen >= rank)
+            break;
+    }
+    if (index == TELEBOT_CORE_HISTOGRAM_BUCKETS)
+        return histogram->max_us;
+
+    /* The highest value of the bucket, no higher than any value recorded */
+    unsigned long long value = telebot_core_histogram_limit(index) - 1;
+    return (value < histogram->max_us) ? (unsigned long)value :
+        histogram->max_us;
+}
@@ -0,0 +1,1073 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <telebot-private.h>
+#include <telebot-common.h>
+#include <telebot-api.h>
+#include <telebot-parser.h>
+
+/*
+ * Single pass parser for getUpdates responses. The input is tokenized once,
+ * keys are looked up in the field table of the object being parsed and values
+ * are stored straight into the update structs. Nothing is built in between:
+ * the nesting lives in an explicit frame stack, values of unknown keys are
+ * skipped without being decoded.
+ *
+ * All state lives in the parser, so input can also be fed in chunks as it is
+ * received: a token cut off at the end of a chunk is left unconsumed and
+ * parsed again once the next chunk is appended to it.
+ */
+
+enum telebot_stream_type {
+    STREAM_TYPE_INT,
+    STREAM_TYPE_LONG,
+    STREAM_TYPE_LLONG,
+    STREAM_TYPE_BOOL,
+    STREAM_TYPE_FLOAT,
+    STREAM_TYPE_STRING,
+    STREAM_TYPE_OBJECT,     /* Embedded struct */
+    STREAM_TYPE_POINTER,    /* Struct allocated from the arena */
+    STREAM_TYPE_ARRAY,      /* Counted array allocated from the arena */
+};
+
+enum telebot_stream_kind {
+    STREAM_KIND_RESPONSE,
+    STREAM_KIND_UPDATE,
+    STREAM_KIND_MESSAGE,
+    STREAM_KIND_CALLBACK_QUERY,
+    STREAM_KIND_USER,
+    STREAM_KIND_CHAT,
+    STREAM_KIND_PHOTO,
+    STREAM_KIND_AUDIO,
+    STREAM_KIND_DOCUMENT,
+    STREAM_KIND_STICKER,
+    STREAM_KIND_VIDEO,
+    STREAM_KIND_VOICE,
+    STREAM_KIND_CONTACT,
+    STREAM_KIND_LOCATION,
+};
+
+struct telebot_stream_field {
+    const char *name;
+    unsigned char len;
+    unsigned char type;
+    unsigned char kind;
+    unsigned short offset;
+    unsigned short count_offset;
+};
+
+#define STREAM_FIELD(str, name, type) \
+    { #name, sizeof(#name) - 1, STREAM_TYPE_##type, 0, offsetof(str, name), 0 }
+#define STREAM_OBJECT(str, name, type, kind) \
+    { #name, sizeof(#name) - 1, STREAM_TYPE_##type, STREAM_KIND_##kind, \
+        offsetof(str, name), 0 }
+#define STREAM_ARRAY(str, name, count, kind) \
+    { #name, sizeof(#name) - 1, STREAM_TYPE_ARRAY, STREAM_KIND_##kind, \
+        offsetof(str, name), offsetof(str, count) }
+
+enum telebot_stream_state {
+    STREAM_STATE_START,             /* Before the response object */
+    STREAM_STATE_VALUE,             /* After ':' or ',' in an array */
+    STREAM_STATE_VALUE_OR_END,      /* After '[' */
+    STREAM_STATE_KEY,               /* After ',' in an object */
+    STREAM_STATE_KEY_OR_END,        /* After '{' */
+    STREAM_STATE_COLON,
+    STREAM_STATE_COMMA_OR_END,
+    STREAM_STATE_DONE,
+};
+
+enum telebot_stream_status {
+    STREAM_STATUS_DONE,
+    STREAM_STATUS_MORE,     /* Token incomplete, wait for more data */
+    STREAM_STATUS_SKIP,     /* Value not stored anywhere */
+    STREAM_STATUS_ERROR,
+};
+
+struct telebot_stream_frame {
+    unsigned char kind;
+    bool array;
+    /* Object: field of the pending value. Array: field being filled. */
+    const struct telebot_stream_field *field;
+    char *target;
+};
+
+/* Elements of an open array, copied to the arena once it is closed */
+struct telebot_stream_vector {
+    char *data;
+    size_t count;
+    size_t capacity;
+};
+
+struct telebot_stream_parser {
+    const char *cur;
+    const char *end;
+    /* Bytes of input so far, for error reporting */
+    size_t received;
+    enum telebot_stream_status status;
+    /* Strings without escapes are terminated in place and not copied */
+    bool zero_copy;
+    telebot_linear_allocator_t *allocator;
+    enum telebot_stream_state state;
+    int depth;
+    struct telebot_stream_frame stack[TELEBOT_PARSER_DEPTH_MAX];
+    int arrays;
+    struct telebot_stream_vector vectors[TELEBOT_PARSER_ARRAYS_MAX];
+    /* Nesting of the value being skipped, 0 when not skipping */
+    int skip;
+
+    /* Fields of the response itself */
+    bool ok;
+    telebot_update_t *updates;
+    int count;
+};
+
+static const struct telebot_stream_field telebot_stream_response_fields[] = {
+    STREAM_FIELD(struct telebot_stream_parser, ok, BOOL),
+    { "result", 6, STREAM_TYPE_ARRAY, STREAM_KIND_UPDATE,
+        offsetof(struct telebot_stream_parser, updates),
+        offsetof(struct telebot_stream_parser, count) },
+};
+
+static const struct telebot_stream_field telebot_stream_update_fields[] = {
+    STREAM_FIELD(telebot_update_t, update_id, INT),
+    STREAM_OBJECT(telebot_update_t, message, OBJECT, MESSAGE),
+    STREAM_OBJECT(telebot_update_t, callback_query, OBJECT, CALLBACK_QUERY),
+};
+
+static const struct telebot_stream_field telebot_stream_message_fields[] = {
+    STREAM_FIELD(telebot_message_t, message_id, INT),
+    STREAM_OBJECT(telebot_message_t, from, POINTER, USER),
+    STREAM_FIELD(telebot_message_t, date, LONG),
+    STREAM_OBJECT(telebot_message_t, chat, OBJECT, CHAT),
+    STREAM_FIELD(telebot_message_t, text, STRING),
+    STREAM_OBJECT(telebot_message_t, forward_from, POINTER, USER),
+    STREAM_FIELD(telebot_message_t, forward_date, LONG),
+    STREAM_OBJECT(telebot_message_t, reply_to_message, POINTER, MESSAGE),
+    STREAM_OBJECT(telebot_message_t, audio, POINTER, AUDIO),
+    STREAM_OBJECT(telebot_message_t, document, POINTER, DOCUMENT),
+    STREAM_ARRAY(telebot_message_t, photo, photo_count, PHOTO),
+    STREAM_OBJECT(telebot_message_t, sticker, POINTER, STICKER),
+    STREAM_OBJECT(telebot_message_t, video, POINTER, VIDEO),
+    STREAM_OBJECT(telebot_message_t, voice, POINTER, VOICE),
+    STREAM_FIELD(telebot_message_t, caption, STRING),
+    STREAM_OBJECT(telebot_message_t, contact, POINTER, CONTACT),
+    STREAM_OBJECT(telebot_message_t, location, POINTER, LOCATION),
+    STREAM_OBJECT(telebot_message_t, new_chat_participant, POINTER, USER),
+    STREAM_OBJECT(telebot_message_t, left_chat_participant, POINTER, USER),
+    STREAM_FIELD(telebot_message_t, new_chat_title, STRING),
+    STREAM_ARRAY(telebot_message_t, new_chat_photo, new_chat_photo_count,
+            PHOTO),
+    STREAM_FIELD(telebot_message_t, delete_chat_photo, BOOL),
+    STREAM_FIELD(telebot_message_t, group_chat_created, BOOL),
+    STREAM_FIELD(telebot_message_t, supergroup_chat_created, BOOL),
+    STREAM_FIELD(telebot_message_t, channel_chat_created, BOOL),
+    STREAM_FIELD(telebot_message_t, migrate_to_chat_id, LLONG),
+    STREAM_FIELD(telebot_message_t, migrate_from_chat_id, LLONG),
+};
+
+static const struct telebot_stream_field telebot_stream_callback_query_fields[] = {
+    STREAM_FIELD(telebot_callback_query_t, id, STRING),
+    STREAM_OBJECT(telebot_callback_query_t, from, OBJECT, USER),
+    STREAM_OBJECT(telebot_callback_query_t, message, POINTER, MESSAGE),
+    STREAM_FIELD(telebot_callback_query_t, inline_message_id, STRING),
+    STREAM_FIELD(telebot_callback_query_t, chat_instance, STRING),
+    STREAM_FIELD(telebot_callback_query_t, data, STRING),
+    STREAM_FIELD(telebot_callback_query_t, game_short_name, STRING),
+};
+
+static const struct telebot_stream_field telebot_stream_user_fields[] = {
+    STREAM_FIELD(telebot_user_t, id, LLONG),
+    STREAM_FIELD(telebot_user_t, is_bot, BOOL),
+    STREAM_FIELD(telebot_user_t, first_name, STRING),
+    STREAM_FIELD(telebot_user_t, last_name, STRING),
+    STREAM_FIELD(telebot_user_t, username, STRING),
+    STREAM_FIELD(telebot_user_t, language_code, STRING),
+};
+
+static const struct telebot_stream_field telebot_stream_chat_fields[] = {
+    STREAM_FIELD(telebot_chat_t, id, LLONG),
+    STREAM_FIELD(telebot_chat_t, type, STRING),
+    STREAM_FIELD(telebot_chat_t, title, STRING),
+    STREAM_FIELD(telebot_chat_t, username, STRING),
+    STREAM_FIELD(telebot_chat_t, first_name, STRING),
+    STREAM_FIELD(telebot_chat_t, last_name, STRING),
+};
+
+static const struct telebot_stream_field telebot_stream_photo_fields[] = {
+    STREAM_FIELD(telebot_photo_t, file_id, STRING),
+    STREAM_FIELD(telebot_photo_t, width, INT),
+    STREAM_FIELD(telebot_photo_t, height, INT),
+    STREAM_FIELD(telebot_photo_t, file_size, INT),
+};
+
+static const struct telebot_stream_field telebot_stream_audio_fields[] = {
+    STREAM_FIELD(telebot_audio_t, file_id, STRING),
+    STREAM_FIELD(telebot_audio_t, duration, INT),
+    STREAM_FIELD(telebot_audio_t, performer, STRING),
+    STREAM_FIELD(telebot_audio_t, title, STRING),
+    STREAM_FIELD(telebot_audio_t, mime_type, STRING),
+    STREAM_FIELD(telebot_audio_t, file_size, INT),
+};
+
+static const struct telebot_stream_field telebot_stream_document_fields[] = {
+    STREAM_FIELD(telebot_document_t, file_id, STRING),
+    STREAM_OBJECT(telebot_document_t, thumb, POINTER, PHOTO),
+    STREAM_FIELD(telebot_document_t, file_name, STRING),
+    STREAM_FIELD(telebot_document_t, mime_type, STRING),
+    STREAM_FIELD(telebot_document_t, file_size, INT),
+};
+
+static const struct telebot_stream_field telebot_stream_sticker_fields[] = {
+    STREAM_FIELD(telebot_sticker_t, file_id, STRING),
+    STREAM_FIELD(telebot_sticker_t, width, INT),
+    STREAM_FIELD(telebot_sticker_t, height, INT),
+    STREAM_OBJECT(telebot_sticker_t, thumb, POINTER, PHOTO),
+    STREAM_FIELD(telebot_sticker_t, file_size, INT),
+};
+
+static const struct telebot_stream_field telebot_stream_video_fields[] = {
+    STREAM_FIELD(telebot_video_t, file_id, STRING),
+    STREAM_FIELD(telebot_video_t, width, INT),
+    STREAM_FIELD(telebot_video_t, height, INT),
+    STREAM_FIELD(telebot_video_t, duration, INT),
+    STREAM_OBJECT(telebot_video_t, thumb, POINTER, PHOTO),
+    STREAM_FIELD(telebot_video_t, mime_type, STRING),
+    STREAM_FIELD(telebot_video_t, file_size, INT),
+};
+
+static const struct telebot_stream_field telebot_stream_voice_fields[] = {
+    STREAM_FIELD(telebot_voice_t, file_id, STRING),
+    STREAM_FIELD(telebot_voice_t, duration, INT),
+    STREAM_FIELD(telebot_voice_t, mime_type, STRING),
+    STREAM_FIELD(telebot_voice_t, file_size, INT),
+};
+
+static const struct telebot_stream_field telebot_stream_contact_fields[] = {
+    STREAM_FIELD(telebot_contact_t, phone_number, STRING),
+    STREAM_FIELD(telebot_contact_t, first_name, STRING),
+    STREAM_FIELD(telebot_contact_t, last_name, STRING),
+    STREAM_FIELD(telebot_contact_t, user_id, LLONG),
+};
+
+static const struct telebot_stream_field telebot_stream_location_fields[] = {
+    STREAM_FIELD(telebot_location_t, longitude, FLOAT),
+    STREAM_FIELD(telebot_location_t, latitude, FLOAT),
+};
+
+#define STREAM_KIND(fields, size) \
+    { fields, sizeof(fields) / sizeof(fields[0]), size }
+
+static const struct telebot_stream_kind_info {
+    const struct telebot_stream_field *fields;
+    int count;
+    size_t size;
+} telebot_stream_kinds[] = {
+    [STREAM_KIND_RESPONSE] = STREAM_KIND(telebot_stream_response_fields,
+            sizeof(struct telebot_stream_parser)),
+    [STREAM_KIND_UPDATE] = STREAM_KIND(telebot_stream_update_fields,
+            sizeof(telebot_update_t)),
+    [STREAM_KIND_MESSAGE] = STREAM_KIND(telebot_stream_message_fields,
+            sizeof(telebot_message_t)),
+    [STREAM_KIND_CALLBACK_QUERY] = STREAM_KIND(
+            telebot_stream_callback_query_fields,
+            sizeof(telebot_callback_query_t)),
+    [STREAM_KIND_USER] = STREAM_KIND(telebot_stream_user_fields,
+            sizeof(telebot_user_t)),
+    [STREAM_KIND_CHAT] = STREAM_KIND(telebot_stream_chat_fields,
+            sizeof(telebot_chat_t)),
+    [STREAM_KIND_PHOTO] = STREAM_KIND(telebot_stream_photo_fields,
+            sizeof(telebot_photo_t)),
+    [STREAM_KIND_AUDIO] = STREAM_KIND(telebot_stream_audio_fields,
+            sizeof(telebot_audio_t)),
+    [STREAM_KIND_DOCUMENT] = STREAM_KIND(telebot_stream_document_fields,
+            sizeof(telebot_document_t)),
+    [STREAM_KIND_STICKER] = STREAM_KIND(telebot_stream_sticker_fields,
+            sizeof(telebot_sticker_t)),
+    [STREAM_KIND_VIDEO] = STREAM_KIND(telebot_stream_video_fields,
+            sizeof(telebot_video_t)),
+    [STREAM_KIND_VOICE] = STREAM_KIND(telebot_stream_voice_fields,
+            sizeof(telebot_voice_t)),
+    [STREAM_KIND_CONTACT] = STREAM_KIND(telebot_stream_contact_fields,
+            sizeof(telebot_contact_t)),
+    [STREAM_KIND_LOCATION] = STREAM_KIND(telebot_stream_location_fields,
+            sizeof(telebot_location_t)),
+};
+
+static const struct telebot_stream_field *telebot_stream_lookup(int kind,
+        const char *key, size_t len)
+{
+    const struct telebot_stream_kind_info *info = &telebot_stream_kinds[kind];
+    int index;
+    for (index = 0; index < info->count; index++) {
+        const struct telebot_stream_field *field = &(info->fields[index]);
+        if ((field->len == len) && (memcmp(field->name, key, len) == 0))
+            return field;
+    }
+
+    return NULL;
+}
+
+/*
+ * Scans the string token at parser->cur, which points to the opening quote.
+ * On success *start and *len describe the raw contents, escapes included, and
+ * parser->cur is moved past the closing quote.
+ */
+static enum telebot_stream_status telebot_stream_scan_string(
+        struct telebot_stream_parser *parser, const char **start, size_t *len,
+        bool *escaped)
+{
+    const char *p = parser->cur + 1;
+    *escaped = false;
+    while (true) {
+        const char *quote = memchr(p, '"', parser->end - p);
+        if (quote == NULL)
+            return STREAM_STATUS_MORE;
+
+        /* Most strings have no escapes, memchr skips them in bulk */
+        const char *backslash = memchr(p, '\\', quote - p);
+        if (backslash == NULL) {
+            *start = parser->cur + 1;
+            *len = quote - *start;
+            parser->cur = quote + 1;
+            return STREAM_STATUS_DONE;
+        }
+
+        *escaped = true;
+        p = backslash + 2;
+        if (p > parser->end)
+            return STREAM_STATUS_MORE;
+    }
+}
+
+static int telebot_stream_hex(const char *p)
+{
+    int value = 0, index;
+    for (index = 0; index < 4; index++) {
+        char c = p[index];
+        value <<= 4;
+        if ((c >= '0') && (c <= '9'))
+            value |= c - '0';
+        else if ((c >= 'a') && (c <= 'f'))
+            value |= c - 'a' + 10;
+        else if ((c >= 'A') && (c <= 'F'))
+            value |= c - 'A' + 10;
+        else
+            return -1;
+    }
+
+    return value;
+}
+
+/* Decoded strings are never longer than their escaped form */
+static bool telebot_stream_unescape(const char *src, size_t len, char *dst)
+{
+    const char *end = src + len;
+    while (src < end) {
+        if (*src != '\\') {
+            *dst++ = *src++;
+            continue;
+        }
+        if (++src == end)
+            return false;
+
+        switch (*src++) {
+        case '"': *dst++ = '"'; break;
+        case '\\': *dst++ = '\\'; break;
+        case '/': *dst++ = '/'; break;
+        case 'b': *dst++ = '\b'; break;
+        case 'f': *dst++ = '\f'; break;
+        case 'n': *dst++ = '\n'; break;
+        case 'r': *dst++ = '\r'; break;
+        case 't': *dst++ = '\t'; break;
+        case 'u': {
+            if (end - src < 4)
+                return false;
+            long cp = telebot_stream_hex(src);
+            if (cp < 0)
+                return false;
+            src += 4;
+
+            if ((cp >= 0xD800) && (cp <= 0xDBFF) && (end - src >= 6) &&
+                    (src[0] == '\\') && (src[1] == 'u')) {
+                long low = telebot_stream_hex(src + 2);
+                if ((low >= 0xDC00) && (low <= 0xDFFF)) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    src += 6;
+                }
+            }
+
+            if (cp < 0x80) {
+                *dst++ = cp;
+            }
+            else if (cp < 0x800) {
+                *dst++ = 0xC0 | (cp >> 6);
+                *dst++ = 0x80 | (cp & 0x3F);
+            }
+            else if (cp < 0x10000) {
+                *dst++ = 0xE0 | (cp >> 12);
+                *dst++ = 0x80 | ((cp >> 6) & 0x3F);
+                *dst++ = 0x80 | (cp & 0x3F);
+            }
+            else {
+                *dst++ = 0xF0 | (cp >> 18);
+                *dst++ = 0x80 | ((cp >> 12) & 0x3F);
+                *dst++ = 0x80 | ((cp >> 6) & 0x3F);
+                *dst++ = 0x80 | (cp & 0x3F);
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static char *telebot_stream_string(struct telebot_stream_parser *parser,
+        const char *start, size_t len, bool escaped)
+{
+    if (parser->zero_copy && !escaped) {
+        /* The closing quote is already consumed, it becomes the NUL */
+        char *str = (char *)start;
+        str[len] = '\0';
+        return str;
+    }
+
+    /* Arena memory is zeroed, so the copy is always NUL terminated */
+    char *str = telebot_linear_allocator_alloc_aligned(parser->allocator,
+            len + 1, 1);
+    if (str == NULL)
+        return NULL;
+
+    if (!escaped)
+        memcpy(str, start, len);
+    else if (!telebot_stream_unescape(start, len, str))
+        return NULL;
+
+    return str;
+}
+
+static bool telebot_stream_is_number(char c)
+{
+    return ((c >= '0') && (c <= '9')) || (c == '-') || (c == '+') ||
+        (c == '.') || (c == 'e') || (c == 'E');
+}
+
+static bool telebot_stream_starts_number(char c)
+{
+    return ((c >= '0') && (c <= '9')) || (c == '-');
+}
+
+static enum telebot_stream_status telebot_stream_scan_number(
+        struct telebot_stream_parser *parser, const char **start, size_t *len)
+{
+    const char *p = parser->cur;
+    while ((p < parser->end) && telebot_stream_is_number(*p))
+        p++;
+    /* The number could go on in data not received yet */
+    if (p == parser->end)
+        return STREAM_STATUS_MORE;
+
+    *start = parser->cur;
+    *len = p - parser->cur;
+    parser->cur = p;
+
+    return STREAM_STATUS_DONE;
+}
+
+static enum telebot_stream_status telebot_stream_scan_literal(
+        struct telebot_stream_parser *parser, const char *literal)
+{
+    size_t len = strlen(literal);
+    size_t available = parser->end - parser->cur;
+    if (memcmp(parser->cur, literal, (available < len) ? available : len))
+        return STREAM_STATUS_ERROR;
+    if (available < len)
+        return STREAM_STATUS_MORE;
+
+    parser->cur += len;
+
+    return STREAM_STATUS_DONE;
+}
+
+static void telebot_stream_store_number(const struct telebot_stream_field *field,
+        char *target, const char *start, size_t len)
+{
+    char buffer[64];
+    if (len >= sizeof(buffer))
+        return;
+    memcpy(buffer, start, len);
+    buffer[len] = '\0';
+
+    if (field->type == STREAM_TYPE_FLOAT) {
+        *(float *)(target + field->offset) = strtod(buffer, NULL);
+        return;
+    }
+
+    /* Out of range values saturate, the same as json_object_get_int() */
+    long long value;
+    if (strpbrk(buffer, ".eE") != NULL)
+        value = strtod(buffer, NULL);
+    else
+        value = strtoll(buffer, NULL, 10);
+    if (field->type == STREAM_TYPE_LONG) {
+        *(long *)(target + field->offset) = value;
+    }
+    else if (field->type == STREAM_TYPE_LLONG) {
+        *(long long *)(target + field->offset) = value;
+    }
+    else if (field->type == STREAM_TYPE_INT) {
+        if (value > INT_MAX)
+            value = INT_MAX;
+        else if (value < INT_MIN)
+            value = INT_MIN;
+        *(int *)(target + field->offset) = value;
+    }
+}
+
+static void *telebot_stream_vector_push(struct telebot_stream_vector *vector,
+        size_t size)
+{
+    if (vector->count == vector->capacity) {
+        size_t capacity = vector->capacity ? vector->capacity * 2 : 16;
+        char *data = realloc(vector->data, capacity * size);
+        if (data == NULL)
+            return NULL;
+        vector->data = data;
+        vector->capacity = capacity;
+    }
+
+    void *element = vector->data + vector->count * size;
+    memset(element, 0, size);
+    vector->count++;
+
+    return element;
+}
+
+static enum telebot_stream_status telebot_stream_push(
+        struct telebot_stream_parser *parser, int kind, bool array,
+        const struct telebot_stream_field *field, char *target)
+{
+    if (parser->depth == TELEBOT_PARSER_DEPTH_MAX) {
+        ERR("Update nested too deep");
+        return STREAM_STATUS_ERROR;
+    }
+
+    if (array) {
+        if (parser->arrays == TELEBOT_PARSER_ARRAYS_MAX) {
+            ERR("Update arrays nested too deep");
+            return STREAM_STATUS_ERROR;
+        }
+        parser->vectors[parser->arrays++].count = 0;
+    }
+
+    struct telebot_stream_frame *frame = &(parser->stack[parser->depth++]);
+    frame->kind = kind;
+    frame->array = array;
+    frame->field = field;
+    frame->target = target;
+
+    return STREAM_STATUS_DONE;
+}
+
+static enum telebot_stream_status telebot_stream_pop(
+        struct telebot_stream_parser *parser)
+{
+    struct telebot_stream_frame *frame = &(parser->stack[--parser->depth]);
+    if (!frame->array)
+        return STREAM_STATUS_DONE;
+
+    struct telebot_stream_vector *vector = &(parser->vectors[--parser->arrays]);
+    const struct telebot_stream_field *field = frame->field;
+    size_t size = telebot_stream_kinds[frame->kind].size;
+    void *elements = NULL;
+    if (vector->count > 0) {
+        elements = telebot_linear_allocator_alloc(parser->allocator,
+                vector->count * size);
+        if (elements == NULL)
+            return STREAM_STATUS_ERROR;
+        memcpy(elements, vector->data, vector->count * size);
+    }
+    *(void **)(frame->target + field->offset) = elements;
+    *(int *)(frame->target + field->count_offset) = vector->count;
+
+    return STREAM_STATUS_DONE;
+}
+
+/* Opens an object or array value for the pending field of the top frame */
+static enum telebot_stream_status telebot_stream_open(
+        struct telebot_stream_parser *parser, char token)
+{
+    struct telebot_stream_frame *frame = &(parser->stack[parser->depth - 1]);
+
+    if (frame->array) {
+        if (token != '{')
+            return STREAM_STATUS_SKIP;
+        struct telebot_stream_vector *vector =
+            &(parser->vectors[parser->arrays - 1]);
+        char *element = telebot_stream_vector_push(vector,
+                telebot_stream_kinds[frame->kind].size);
+        if (element == NULL)
+            return STREAM_STATUS_ERROR;
+        return telebot_stream_push(parser, frame->kind, false, NULL, element);
+    }
+
+    const struct telebot_stream_field *field = frame->field;
+    if (field == NULL)
+        return STREAM_STATUS_SKIP;
+
+    if ((token == '[') && (field->type == STREAM_TYPE_ARRAY))
+        return telebot_stream_push(parser, field->kind, true, field,
+                frame->target);
+
+    if (token != '{')
+        return STREAM_STATUS_SKIP;
+
+    char *target;
+    if (field->type == STREAM_TYPE_OBJECT) {
+        target = frame->target + field->offset;
+    }
+    else if (field->type == STREAM_TYPE_POINTER) {
+        target = telebot_linear_allocator_alloc(parser->allocator,
+                telebot_stream_kinds[field->kind].size);
+        if (target == NULL)
+            return STREAM_STATUS_ERROR;
+        *(char **)(frame->target + field->offset) = target;
+    }
+    else {
+        return STREAM_STATUS_SKIP;
+    }
+
+    if (frame->kind == STREAM_KIND_UPDATE) {
+        telebot_update_t *update = (telebot_update_t *)frame->target;
+        update->update_type = (field->kind == STREAM_KIND_MESSAGE) ?
+            UPDATE_TYPE_MESSAGE : UPDATE_TYPE_CALLBACK_QUERY;
+    }
+
+    return telebot_stream_push(parser, field->kind, false, NULL, target);
+}
+
+/* Consumes one token of a value nobody asked for */
+static enum telebot_stream_status telebot_stream_skip(
+        struct telebot_stream_parser *parser)
+{
+    const char *start;
+    size_t len;
+    bool escaped;
+
+    switch (*parser->cur) {
+    case '{':
+    case '[':
+        parser->skip++;
+        parser->cur++;
+        break;
+    case '}':
+    case ']':
+        parser->skip--;
+        parser->cur++;
+        break;
+    case '"':
+        return telebot_stream_scan_string(parser, &start, &len, &escaped);
+    case ',':
+    case ':':
+        parser->cur++;
+        break;
+    case 't':
+        return telebot_stream_scan_literal(parser, "true");
+    case 'f':
+        return telebot_stream_scan_literal(parser, "false");
+    case 'n':
+        return telebot_stream_scan_literal(parser, "null");
+    default:
+        if (!telebot_stream_starts_number(*parser->cur))
+            return STREAM_STATUS_ERROR;
+        return telebot_stream_scan_number(parser, &start, &len);
+    }
+
+    return STREAM_STATUS_DONE;
+}
+
+static enum telebot_stream_status telebot_stream_value(
+        struct telebot_stream_parser *parser)
+{
+    struct telebot_stream_frame *frame = &(parser->stack[parser->depth - 1]);
+    const struct telebot_stream_field *field = frame->array ? NULL :
+        frame->field;
+    enum telebot_stream_status status;
+    const char *start;
+    size_t len;
+    bool escaped;
+
+    switch (*parser->cur) {
+    case '{':
+    case '[': {
+        char token = *parser->cur;
+        status = telebot_stream_open(parser, token);
+        if (status == STREAM_STATUS_SKIP) {
+            /* Not a value we store, skip it whole */
+            parser->skip = 1;
+            status = STREAM_STATUS_DONE;
+        }
+        else if (status == STREAM_STATUS_DONE) {
+            parser->state = (token == '{') ? STREAM_STATE_KEY_OR_END :
+                STREAM_STATE_VALUE_OR_END;
+        }
+        parser->cur++;
+        return status;
+    }
+    case '"': {
+        status = telebot_stream_scan_string(parser, &start, &len, &escaped);
+        if (status != STREAM_STATUS_DONE)
+            return status;
+        if ((field != NULL) && (field->type == STREAM_TYPE_STRING)) {
+            char *str = telebot_stream_string(parser, start, len, escaped);
+            if (str == NULL)
+                return STREAM_STATUS_ERROR;
+            *(char **)(frame->target + field->offset) = str;
+        }
+        break;
+    }
+    case 't':
+    case 'f': {
+        bool value = (*parser->cur == 't');
+        status = telebot_stream_scan_literal(parser, value ? "true" : "false");
+        if (status != STREAM_STATUS_DONE)
+            return status;
+        if ((field != NULL) && (field->type == STREAM_TYPE_BOOL))
+            *(bool *)(frame->target + field->offset) = value;
+        break;
+    }
+    case 'n':
+        status = telebot_stream_scan_literal(parser, "null");
+        if (status != STREAM_STATUS_DONE)
+            return status;
+        break;
+    default:
+        if (!telebot_stream_starts_number(*parser->cur))
+            return STREAM_STATUS_ERROR;
+        status = telebot_stream_scan_number(parser, &start, &len);
+        if (status != STREAM_STATUS_DONE)
+            return status;
+        if ((field != NULL) && (field->type <= STREAM_TYPE_FLOAT) &&
+                (field->type != STREAM_TYPE_BOOL))
+            telebot_stream_store_number(field, frame->target, start, len);
+        break;
+    }
+
+    parser->state = STREAM_STATE_COMMA_OR_END;
+
+    return STREAM_STATUS_DONE;
+}
+
+static enum telebot_stream_status telebot_stream_run(
+        struct telebot_stream_parser *parser)
+{
+    enum telebot_stream_status status = STREAM_STATUS_DONE;
+
+    while (parser->state != STREAM_STATE_DONE) {
+        while ((parser->cur < parser->end) &&
+                ((*parser->cur == ' ') || (*parser->cur == '\n') ||
+                 (*parser->cur == '\r') || (*parser->cur == '\t')))
+            parser->cur++;
+        if (parser->cur == parser->end)
+            return STREAM_STATUS_MORE;
+
+        if (parser->skip > 0) {
+            status = telebot_stream_skip(parser);
+            if (status != STREAM_STATUS_DONE)
+                return status;
+            if (parser->skip == 0)
+                parser->state = STREAM_STATE_COMMA_OR_END;
+            continue;
+        }
+
+        char c = *parser->cur;
+        struct telebot_stream_frame *frame = &(parser->stack[parser->depth - 1]);
+
+        switch (parser->state) {
+        case STREAM_STATE_START:
+            if (c != '{')
+                return STREAM_STATUS_ERROR;
+            parser->cur++;
+            parser->state = STREAM_STATE_KEY_OR_END;
+            break;
+
+        case STREAM_STATE_VALUE_OR_END:
+            if (c == ']') {
+                parser->cur++;
+                status = telebot_stream_pop(parser);
+                parser->state = STREAM_STATE_COMMA_OR_END;
+                break;
+            }
+            /* Fall through */
+        case STREAM_STATE_VALUE:
+            status = telebot_stream_value(parser);
+            break;
+
+        case STREAM_STATE_KEY_OR_END:
+            if (c == '}') {
+                parser->cur++;
+                status = telebot_stream_pop(parser);
+                parser->state = (parser->depth == 0) ? STREAM_STATE_DONE :
+                    STREAM_STATE_COMMA_OR_END;
+                break;
+            }
+            /* Fall through */
+        case STREAM_STATE_KEY: {
+            const char *key;
+            size_t len;
+            bool escaped;
+            if (c != '"')
+                return STREAM_STATUS_ERROR;
+            status = telebot_stream_scan_string(parser, &key, &len, &escaped);
+            if (status != STREAM_STATUS_DONE)
+                return status;
+            frame->field = telebot_stream_lookup(frame->kind, key, len);
+            parser->state = STREAM_STATE_COLON;
+            break;
+        }
+
+        case STREAM_STATE_COLON:
+            if (c != ':')
+                return STREAM_STATUS_ERROR;
+            parser->cur++;
+            parser->state = STREAM_STATE_VALUE;
+            break;
+
+        case STREAM_STATE_COMMA_OR_END:
+            parser->cur++;
+            if (c == ',') {
+                parser->state = frame->array ? STREAM_STATE_VALUE :
+                    STREAM_STATE_KEY;
+            }
+            else if (c == (frame->array ? ']' : '}')) {
+                status = telebot_stream_pop(parser);
+                parser->state = (parser->depth == 0) ? STREAM_STATE_DONE :
+                    STREAM_STATE_COMMA_OR_END;
+            }
+            else {
+                return STREAM_STATUS_ERROR;
+            }
+            break;
+
+        default:
+            return STREAM_STATUS_ERROR;
+        }
+
+        if (status != STREAM_STATUS_DONE)
+            return status;
+    }
+
+    return STREAM_STATUS_DONE;
+}
+
+static struct telebot_stream_parser *telebot_stream_create(
+        telebot_linear_allocator_t *allocator, bool zero_copy)
+{
+    struct telebot_stream_parser *parser = calloc(1,
+            sizeof(struct telebot_stream_parser));
+    if (parser == NULL) {
+        ERR("Failed to allocate memory");
+        return NULL;
+    }
+
+    parser->zero_copy = zero_copy;
+    parser->allocator = allocator;
+    parser->status = STREAM_STATUS_MORE;
+    parser->state = STREAM_STATE_START;
+
+    /* The response object is the root, its fields land in the parser */
+    parser->stack[0].kind = STREAM_KIND_RESPONSE;
+    parser->stack[0].target = (char *)parser;
+    parser->depth = 1;
+
+    return parser;
+}
+
+static void telebot_stream_free(struct telebot_stream_parser *parser)
+{
+    int index;
+    for (index = 0; index < TELEBOT_PARSER_ARRAYS_MAX; index++)
+        free(parser->vectors[index].data);
+    free(parser);
+}
+
+static telebot_error_e telebot_stream_check(
+        struct telebot_stream_parser *parser)
+{
+    if (parser->status == STREAM_STATUS_MORE) {
+        ERR("Updates response ended after %lu bytes",
+                (unsigned long)parser->received);
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    }
+
+    if (parser->status != STREAM_STATUS_DONE) {
+        ERR("Failed to parse updates at offset %lu", (unsigned long)
+                (parser->received - (parser->end - parser->cur)));
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    }
+
+    return TELEBOT_ERROR_NONE;
+}
+
+static telebot_error_e telebot_stream_result(
+        struct telebot_stream_parser *parser, telebot_update_t **updates,
+        int *count)
+{
+    if (telebot_stream_check(parser) != TELEBOT_ERROR_NONE)
+        return TELEBOT_ERROR_OPERATION_FAILED;
+
+    if (!parser->ok)
+        return TELEBOT_ERROR_OPERATION_FAILED;
+
+    *updates = parser->updates;
+    *count = parser->count;
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_parser_parse_updates(char *data, size_t size,
+        bool zero_copy, telebot_update_t **updates, int *count,
+        telebot_linear_allocator_t *allocator)
+{
+    if ((data == NULL) || (updates == NULL) || (count == NULL))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    *updates = NULL;
+    *count = 0;
+
+    struct telebot_stream_parser *parser = telebot_stream_create(allocator,
+            zero_copy);
+    if (parser == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+
+    parser->cur = data;
+    parser->end = data + size;
+    parser->received = size;
+    parser->status = telebot_stream_run(parser);
+
+    telebot_error_e ret = telebot_stream_result(parser, updates, count);
+    telebot_stream_free(parser);
+
+    return ret;
+}
+
+telebot_error_e telebot_parser_parse_update(char *data, size_t size,
+        bool zero_copy, telebot_update_t *update,
+        telebot_linear_allocator_t *allocator)
+{
+    if ((data == NULL) || (update == NULL))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    memset(update, 0, sizeof(telebot_update_t));
+
+    struct telebot_stream_parser *parser = telebot_stream_create(allocator,
+            zero_copy);
+    if (parser == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+
+    /* The update is the root, there is no response around it */
+    parser->stack[0].kind = STREAM_KIND_UPDATE;
+    parser->stack[0].target = (char *)update;
+
+    parser->cur = data;
+    parser->end = data + size;
+    parser->received = size;
+    parser->status = telebot_stream_run(parser);
+
+    telebot_error_e ret = telebot_stream_check(parser);
+    telebot_stream_free(parser);
+
+    return ret;
+}
+
+telebot_stream_parser_t *telebot_parser_stream_create(
+        telebot_linear_allocator_t *allocator)
+{
+    if (allocator == NULL)
+        return NULL;
+
+    /* Chunks are copied to the allocator, strings can stay where they are */
+    return telebot_stream_create(allocator, true);
+}
+
+telebot_error_e telebot_parser_stream_feed(telebot_stream_parser_t *parser,
+        const char *data, size_t size)
+{
+    if ((parser == NULL) || ((data == NULL) && (size > 0)))
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    /* Anything after the response object is ignored */
+    if (parser->status == STREAM_STATUS_DONE)
+        return TELEBOT_ERROR_NONE;
+    if (parser->status != STREAM_STATUS_MORE)
+        return TELEBOT_ERROR_OPERATION_FAILED;
+    if (size == 0)
+        return TELEBOT_ERROR_NONE;
+
+    /*
+     * The unconsumed tail of the previous chunk is a token cut in two, it is
+     * copied in front of the new chunk so that every token ends up in one
+     * piece of memory. Tokens are short, the tail rarely is more than a few
+     * bytes.
+     */
+    size_t tail = parser->end - parser->cur;
+    char *buffer = telebot_linear_allocator_alloc_aligned(parser->allocator,
+            tail + size, 1);
+    if (buffer == NULL) {
+        parser->status = STREAM_STATUS_ERROR;
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+    }
+    if (tail > 0)
+        memcpy(buffer, parser->cur, tail);
+    memcpy(buffer + tail, data, size);
+
+    parser->cur = buffer;
+    parser->end = buffer + tail + size;
+    parser->received += size;
+    parser->status = telebot_stream_run(parser);
+
+    if (parser->status == STREAM_STATUS_ERROR)
+        return TELEBOT_ERROR_OPERATION_FAILED;
+
+    return TELEBOT_ERROR_NONE;
+}
+
+telebot_error_e telebot_parser_stream_finish(telebot_stream_parser_t *parser,
+        telebot_update_t **updates, int *count)
+{
+    if (parser == NULL)
+        return TELEBOT_ERROR_INVALID_PARAMETER;
+
+    telebot_error_e ret = TELEBOT_ERROR_INVALID_PARAMETER;
+    if ((updates != NULL) && (count != NULL)) {
+        *updates = NULL;
+        *count = 0;
+        ret = telebot_stream_result(parser, updates, count);
+    }
+    telebot_stream_free(parser);
+
+    return ret;
+}
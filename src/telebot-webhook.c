@@ -0,0 +1,634 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <telebot-private.h>
+#include <telebot-webhook.h>
+
+/*
+ * Connections are level triggered: input is read until the socket would
+ * block, complete requests are handed over, and their answers are written
+ * once the round callback returned, so that a request is only acknowledged
+ * after its update was handled.
+ */
+struct telebot_webhook_conn {
+    int fd;
+    char *in;
+    size_t in_size; /* Bytes received */
+    size_t in_used; /* Bytes of requests already answered */
+    size_t in_capacity;
+    char *out;
+    size_t out_size;
+    size_t out_sent;
+    size_t out_capacity;
+    bool continued; /* 100 Continue sent for the pending request */
+    bool eof; /* Peer is done sending */
+    bool closing; /* Close once the output is flushed */
+    uint32_t events; /* Registered with epoll */
+    bool in_round;
+    struct telebot_webhook_conn *round_next;
+    struct telebot_webhook_conn *prev;
+    struct telebot_webhook_conn *next;
+};
+
+struct telebot_webhook {
+    int listen_fd;
+    int event_fd;
+    int epoll_fd;
+    int port;
+    char *path;
+    pthread_t thread;
+    telebot_webhook_request_cb_f request_cb;
+    telebot_webhook_round_cb_f round_cb;
+    void *user_data;
+    /* Only used to tell the events of the two fds apart */
+    struct telebot_webhook_conn listener;
+    struct telebot_webhook_conn waker;
+    struct telebot_webhook_conn *conns;
+    int count;
+};
+
+struct telebot_webhook_request {
+    const char *method;
+    size_t method_len;
+    const char *target;
+    size_t target_len;
+    long content_length; /* -1 if absent */
+    bool chunked;
+    bool close;
+    bool expect_continue;
+};
+
+static bool telebot_webhook_reserve(char **data, size_t *capacity,
+        size_t size)
+{
+    if (size <= *capacity)
+        return true;
+
+    size_t new_capacity = (*capacity > 0) ? *capacity : 4096;
+    while (new_capacity < size)
+        new_capacity *= 2;
+
+    char *new_data = realloc(*data, new_capacity);
+    if (new_data == NULL) {
+        ERR("Failed to allocate memory");
+        return false;
+    }
+    *data = new_data;
+    *capacity = new_capacity;
+
+    return true;
+}
+
+static void telebot_webhook_close(telebot_webhook_t *webhook,
+        struct telebot_webhook_conn *conn)
+{
+    epoll_ctl(webhook->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        webhook->conns = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+    webhook->count--;
+
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+static void telebot_webhook_accept(telebot_webhook_t *webhook)
+{
+    while (true) {
+        int fd = accept4(webhook->listen_fd, NULL, NULL,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+                ERR("Failed to accept connection, error: %d", errno);
+            return;
+        }
+
+        if (webhook->count >= TELEBOT_WEBHOOK_CONNECTIONS_MAX) {
+            ERR("Too many webhook connections");
+            close(fd);
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct telebot_webhook_conn *conn = calloc(1,
+                sizeof(struct telebot_webhook_conn));
+        if (conn == NULL) {
+            ERR("Failed to allocate memory");
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(webhook->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            ERR("Failed to watch connection, error: %d", errno);
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        conn->next = webhook->conns;
+        if (webhook->conns != NULL)
+            webhook->conns->prev = conn;
+        webhook->conns = conn;
+        webhook->count++;
+    }
+}
+
+/* Reads until the socket would block, false if the connection failed */
+static bool telebot_webhook_read(struct telebot_webhook_conn *conn)
+{
+    /* Bodies of the previous round were handled, they can be moved over */
+    if (conn->in_used > 0) {
+        memmove(conn->in, conn->in + conn->in_used,
+                conn->in_size - conn->in_used);
+        conn->in_size -= conn->in_used;
+        conn->in_used = 0;
+    }
+
+    while (!conn->eof) {
+        if (conn->in_size == TELEBOT_WEBHOOK_REQUEST_SIZE_MAX)
+            return true;
+
+        size_t want = conn->in_size + 4096;
+        if (want > TELEBOT_WEBHOOK_REQUEST_SIZE_MAX)
+            want = TELEBOT_WEBHOOK_REQUEST_SIZE_MAX;
+        if (!telebot_webhook_reserve(&(conn->in), &(conn->in_capacity), want))
+            return false;
+
+        ssize_t n = recv(conn->fd, conn->in + conn->in_size,
+                conn->in_capacity - conn->in_size, 0);
+        if (n > 0) {
+            conn->in_size += n;
+        }
+        else if (n == 0) {
+            conn->eof = true;
+        }
+        else if (errno == EINTR) {
+            continue;
+        }
+        else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            return true;
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool telebot_webhook_write(struct telebot_webhook_conn *conn,
+        const char *data, size_t size)
+{
+    if (!telebot_webhook_reserve(&(conn->out), &(conn->out_capacity),
+                conn->out_size + size))
+        return false;
+
+    memcpy(conn->out + conn->out_size, data, size);
+    conn->out_size += size;
+
+    return true;
+}
+
+static const char *telebot_webhook_reason(int status)
+{
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    default: return "Internal Server Error";
+    }
+}
+
+static void telebot_webhook_respond(struct telebot_webhook_conn *conn,
+        int status, bool close)
+{
+    char response[128];
+    int size = snprintf(response, sizeof(response),
+            "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n%s\r\n", status,
+            telebot_webhook_reason(status),
+            close ? "Connection: close\r\n" : "");
+
+    if (!telebot_webhook_write(conn, response, size))
+        close = true;
+    if (close)
+        conn->closing = true;
+}
+
+static bool telebot_webhook_header_is(const char *name, size_t name_len,
+        const char *expected)
+{
+    return (strlen(expected) == name_len) &&
+        (strncasecmp(name, expected, name_len) == 0);
+}
+
+static bool telebot_webhook_value_has(const char *value, size_t value_len,
+        const char *token)
+{
+    size_t len = strlen(token);
+    size_t index;
+    for (index = 0; index + len <= value_len; index++) {
+        if (strncasecmp(value + index, token, len) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/* Splits the request line and picks the headers that matter to us */
+static bool telebot_webhook_parse_head(const char *head, size_t size,
+        struct telebot_webhook_request *request)
+{
+    const char *end = head + size;
+    const char *line_end = memmem(head, size, "\r\n", 2);
+    if (line_end == NULL)
+        return false;
+
+    memset(request, 0, sizeof(*request));
+    request->content_length = -1;
+
+    const char *p = head;
+    const char *space = memchr(p, ' ', line_end - p);
+    if (space == NULL)
+        return false;
+    request->method = p;
+    request->method_len = space - p;
+
+    p = space + 1;
+    space = memchr(p, ' ', line_end - p);
+    if (space == NULL)
+        return false;
+    request->target = p;
+    request->target_len = space - p;
+
+    p = space + 1;
+    if ((line_end - p == 8) && (strncmp(p, "HTTP/1.0", 8) == 0))
+        request->close = true;
+
+    for (p = line_end + 2; p < end; p = line_end + 2) {
+        line_end = memmem(p, end - p, "\r\n", 2);
+        if (line_end == NULL)
+            line_end = end;
+
+        const char *colon = memchr(p, ':', line_end - p);
+        if (colon == NULL)
+            continue;
+        size_t name_len = colon - p;
+        const char *value = colon + 1;
+        while ((value < line_end) && ((*value == ' ') || (*value == '\t')))
+            value++;
+        size_t value_len = line_end - value;
+
+        if (telebot_webhook_header_is(p, name_len, "Content-Length")) {
+            char *number_end;
+            request->content_length = strtol(value, &number_end, 10);
+            if ((number_end == value) || (request->content_length < 0))
+                return false;
+        }
+        else if (telebot_webhook_header_is(p, name_len, "Transfer-Encoding")) {
+            request->chunked = true;
+        }
+        else if (telebot_webhook_header_is(p, name_len, "Connection")) {
+            if (telebot_webhook_value_has(value, value_len, "close"))
+                request->close = true;
+            else if (telebot_webhook_value_has(value, value_len, "keep-alive"))
+                request->close = false;
+        }
+        else if (telebot_webhook_header_is(p, name_len, "Expect")) {
+            if (telebot_webhook_value_has(value, value_len, "100-continue"))
+                request->expect_continue = true;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Answers the next complete request in the input of conn. Returns false once
+ * more input is needed, or the connection is going to be closed.
+ */
+static bool telebot_webhook_handle(telebot_webhook_t *webhook,
+        struct telebot_webhook_conn *conn, int *handled)
+{
+    char *start = conn->in + conn->in_used;
+    size_t available = conn->in_size - conn->in_used;
+    struct telebot_webhook_request request;
+
+    char *head_end = memmem(start, available, "\r\n\r\n", 4);
+    if (head_end == NULL) {
+        if (available >= TELEBOT_WEBHOOK_REQUEST_SIZE_MAX)
+            telebot_webhook_respond(conn, 413, true);
+        return false;
+    }
+
+    size_t head_size = head_end + 4 - start;
+    if (!telebot_webhook_parse_head(start, head_size - 2, &request)) {
+        telebot_webhook_respond(conn, 400, true);
+        return false;
+    }
+
+    if (request.chunked) {
+        telebot_webhook_respond(conn, 411, true);
+        return false;
+    }
+
+    size_t body_size = (request.content_length > 0) ?
+        (size_t)request.content_length : 0;
+    if (body_size > TELEBOT_WEBHOOK_REQUEST_SIZE_MAX - head_size) {
+        telebot_webhook_respond(conn, 413, true);
+        return false;
+    }
+
+    if (available < head_size + body_size) {
+        if (request.expect_continue && !conn->continued) {
+            static const char continue_line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            if (!telebot_webhook_write(conn, continue_line,
+                        sizeof(continue_line) - 1))
+                conn->closing = true;
+            conn->continued = true;
+        }
+        return false;
+    }
+
+    int status;
+    if ((request.method_len != 4) || (strncmp(request.method, "POST", 4) != 0))
+        status = 405;
+    else if ((webhook->path != NULL) &&
+            ((strlen(webhook->path) != request.target_len) ||
+             (strncmp(request.target, webhook->path, request.target_len) != 0)))
+        status = 404;
+    else if (request.content_length < 0)
+        status = 411;
+    else {
+        status = webhook->request_cb(start + head_size, body_size,
+                webhook->user_data);
+        (*handled)++;
+    }
+
+    conn->in_used += head_size + body_size;
+    conn->continued = false;
+    telebot_webhook_respond(conn, status, request.close);
+
+    return !conn->closing;
+}
+
+/* Writes pending answers, false if the connection was closed */
+static bool telebot_webhook_flush(telebot_webhook_t *webhook,
+        struct telebot_webhook_conn *conn)
+{
+    while (conn->out_sent < conn->out_size) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_sent,
+                conn->out_size - conn->out_sent, MSG_NOSIGNAL);
+        if (n >= 0) {
+            conn->out_sent += n;
+        }
+        else if (errno == EINTR) {
+            continue;
+        }
+        else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            break;
+        }
+        else {
+            telebot_webhook_close(webhook, conn);
+            return false;
+        }
+    }
+
+    bool pending = conn->out_sent < conn->out_size;
+    if (!pending) {
+        conn->out_size = conn->out_sent = 0;
+        if (conn->closing || conn->eof) {
+            telebot_webhook_close(webhook, conn);
+            return false;
+        }
+    }
+
+    /* Input is not read anymore once the connection is going away */
+    uint32_t events = EPOLLIN;
+    if (pending)
+        events = (conn->closing || conn->eof) ? EPOLLOUT : EPOLLIN | EPOLLOUT;
+    if (events != conn->events) {
+        struct epoll_event event = { .events = events, .data.ptr = conn };
+        epoll_ctl(webhook->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->events = events;
+    }
+
+    return true;
+}
+
+static void *telebot_webhook_thread(void *data)
+{
+    telebot_webhook_t *webhook = data;
+    struct epoll_event events[TELEBOT_WEBHOOK_EVENTS];
+    bool running = true;
+
+    while (running) {
+        int count = epoll_wait(webhook->epoll_fd, events,
+                TELEBOT_WEBHOOK_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            ERR("Failed to wait for events, error: %d", errno);
+            break;
+        }
+
+        struct telebot_webhook_conn *round = NULL;
+        int index;
+        for (index = 0; index < count; index++) {
+            struct telebot_webhook_conn *conn = events[index].data.ptr;
+            if (conn == &(webhook->waker)) {
+                running = false;
+                continue;
+            }
+            if (conn == &(webhook->listener)) {
+                telebot_webhook_accept(webhook);
+                continue;
+            }
+
+            if ((events[index].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+                    !conn->closing && !telebot_webhook_read(conn)) {
+                conn->closing = true;
+                conn->out_size = conn->out_sent = 0;
+            }
+
+            if (!conn->in_round) {
+                conn->in_round = true;
+                conn->round_next = round;
+                round = conn;
+            }
+        }
+
+        int handled = 0;
+        struct telebot_webhook_conn *conn;
+        for (conn = round; conn != NULL; conn = conn->round_next) {
+            while (!conn->closing && telebot_webhook_handle(webhook, conn,
+                        &handled))
+                ;
+        }
+
+        if (handled > 0)
+            webhook->round_cb(webhook->user_data);
+
+        while (round != NULL) {
+            conn = round;
+            round = conn->round_next;
+            conn->in_round = false;
+            telebot_webhook_flush(webhook, conn);
+        }
+    }
+
+    return NULL;
+}
+
+telebot_webhook_t *telebot_webhook_start(int port, const char *path,
+        telebot_webhook_request_cb_f request_cb,
+        telebot_webhook_round_cb_f round_cb, void *user_data)
+{
+    telebot_webhook_t *webhook = calloc(1, sizeof(telebot_webhook_t));
+    if (webhook == NULL) {
+        ERR("Failed to allocate memory");
+        return NULL;
+    }
+
+    webhook->listen_fd = webhook->event_fd = webhook->epoll_fd = -1;
+    webhook->request_cb = request_cb;
+    webhook->round_cb = round_cb;
+    webhook->user_data = user_data;
+    if (path != NULL)
+        webhook->path = strdup(path);
+
+    webhook->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK |
+            SOCK_CLOEXEC, 0);
+    if (webhook->listen_fd < 0) {
+        ERR("Failed to create socket, error: %d", errno);
+        goto error;
+    }
+
+    int one = 1;
+    setsockopt(webhook->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if ((bind(webhook->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+            (listen(webhook->listen_fd, SOMAXCONN) != 0) ||
+            (getsockname(webhook->listen_fd, (struct sockaddr *)&addr,
+                         &addr_len) != 0)) {
+        ERR("Failed to listen on port %d, error: %d", port, errno);
+        goto error;
+    }
+    webhook->port = ntohs(addr.sin_port);
+
+    webhook->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    webhook->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if ((webhook->event_fd < 0) || (webhook->epoll_fd < 0)) {
+        ERR("Failed to create event loop, error: %d", errno);
+        goto error;
+    }
+
+    struct epoll_event event = { .events = EPOLLIN };
+    event.data.ptr = &(webhook->listener);
+    epoll_ctl(webhook->epoll_fd, EPOLL_CTL_ADD, webhook->listen_fd, &event);
+    event.data.ptr = &(webhook->waker);
+    epoll_ctl(webhook->epoll_fd, EPOLL_CTL_ADD, webhook->event_fd, &event);
+
+    if (pthread_create(&(webhook->thread), NULL, telebot_webhook_thread,
+                webhook) != 0) {
+        ERR("Failed to create thread, error: %d", errno);
+        goto error;
+    }
+
+    return webhook;
+
+error:
+    if (webhook->epoll_fd >= 0)
+        close(webhook->epoll_fd);
+    if (webhook->event_fd >= 0)
+        close(webhook->event_fd);
+    if (webhook->listen_fd >= 0)
+        close(webhook->listen_fd);
+    free(webhook->path);
+    free(webhook);
+
+    return NULL;
+}
+
+int telebot_webhook_port(telebot_webhook_t *webhook)
+{
+    return webhook->port;
+}
+
+void telebot_webhook_signal(telebot_webhook_t *webhook)
+{
+    uint64_t value = 1;
+    if (write(webhook->event_fd, &value, sizeof(value)) < 0)
+        ERR("Failed to wake up webhook thread, error: %d", errno);
+}
+
+bool telebot_webhook_is_thread(telebot_webhook_t *webhook)
+{
+    return pthread_equal(webhook->thread, pthread_self());
+}
+
+void telebot_webhook_stop(telebot_webhook_t *webhook)
+{
+    telebot_webhook_signal(webhook);
+    pthread_join(webhook->thread, NULL);
+
+    while (webhook->conns != NULL)
+        telebot_webhook_close(webhook, webhook->conns);
+
+    close(webhook->epoll_fd);
+    close(webhook->event_fd);
+    close(webhook->listen_fd);
+    free(webhook->path);
+    free(webhook);
+}
@@ -0,0 +1,164 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compares HTTP/1.1 keep-alive against HTTP/2 multiplexing of the core
+ * transport. A fixed number of sendMessage requests is kept in flight
+ * against a local stand-in server and throughput, latency and the number of
+ * connections the server had to accept are reported for both modes.
+ *
+ * Usage: bench-h2 [concurrency] [requests]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <telebot-common.h>
+#include <telebot-core-api.h>
+
+#include "bench-server.h"
+
+struct bench_run {
+    int total;
+    int issued;
+    int completed;
+    int failed;
+    double *latency;
+};
+
+struct bench_slot {
+    struct bench_run *run;
+    double start;
+};
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void issue(telebot_core_h *handler, struct bench_slot *slot);
+
+static void sent_cb(telebot_core_h *handler, telebot_error_e ret,
+        struct json_object *result, void *user_data)
+{
+    struct bench_slot *slot = user_data;
+    struct bench_run *run = slot->run;
+
+    /* Completions all run on the transport thread, no locking needed */
+    run->latency[run->completed++] = now_us() - slot->start;
+    if (ret != TELEBOT_ERROR_NONE)
+        run->failed++;
+
+    if (run->issued < run->total)
+        issue(handler, slot);
+}
+
+static void issue(telebot_core_h *handler, struct bench_slot *slot)
+{
+    slot->run->issued++;
+    slot->start = now_us();
+    if (telebot_core_send_message_async(handler, "1", "bench", "", false, 0,
+                "", sent_cb, slot) != TELEBOT_ERROR_NONE) {
+        slot->run->latency[slot->run->completed++] = 0;
+        slot->run->failed++;
+    }
+}
+
+static int bench(bench_server_t *server, bool http2, int concurrency,
+        int total)
+{
+    char url[64];
+    snprintf(url, sizeof(url), "https://127.0.0.1:%d",
+            bench_server_port(server));
+
+    telebot_core_options_t options = {
+        .http2 = http2,
+        .api_url = url,
+        .ca_file = bench_server_ca_file(server),
+    };
+    telebot_core_h handler;
+    if (telebot_core_create_ex(&handler, "bench", &options) !=
+            TELEBOT_ERROR_NONE) {
+        printf("Failed to create core handler\n");
+        return -1;
+    }
+
+    struct bench_run run = { .total = total };
+    run.latency = calloc(total, sizeof(double));
+    struct bench_slot *slots = calloc(concurrency, sizeof(struct bench_slot));
+    unsigned long connections = bench_server_connections(server);
+
+    double start = now_us();
+    for (int index = 0; (index < concurrency) && (run.issued < total); index++) {
+        slots[index].run = &run;
+        issue(&handler, &slots[index]);
+    }
+    telebot_core_async_wait(&handler);
+    double elapsed = now_us() - start;
+
+    connections = bench_server_connections(server) - connections;
+    qsort(run.latency, run.completed, sizeof(double), compare_double);
+
+    printf("%-9s %10.0f req/s  p50 %8.0f us  p99 %8.0f us  max %8.0f us  "
+            "connections %lu  failed %d\n", http2 ? "HTTP/2" : "HTTP/1.1",
+            run.completed / (elapsed / 1e6),
+            run.latency[run.completed / 2],
+            run.latency[(int)(run.completed * 0.99)],
+            run.latency[run.completed - 1], connections, run.failed);
+
+    telebot_core_destroy(&handler);
+    free(slots);
+    free(run.latency);
+
+    return run.failed == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int concurrency = (argc > 1) ? atoi(argv[1]) : 32;
+    int total = (argc > 2) ? atoi(argv[2]) : 20000;
+
+    if ((concurrency <= 0) || (total <= 0)) {
+        printf("Usage: %s [concurrency] [requests]\n", argv[0]);
+        return -1;
+    }
+
+    bench_server_t *server = bench_server_start(0);
+    if (server == NULL)
+        return -1;
+
+    printf("%d requests, %d in flight\n", total, concurrency);
+    int ret = bench(server, false, concurrency, total);
+    if (ret == 0)
+        ret = bench(server, true, concurrency, total);
+
+    bench_server_stop(server);
+
+    return ret;
+}
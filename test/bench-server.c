@@ -0,0 +1,556 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#include "bench-server.h"
+
+#define BENCH_EVENTS_MAX 64
+#define BENCH_READ_SIZE 16384
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEADER_LEN 9
+
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_SETTINGS 0x4
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_END_HEADERS 0x4
+
+static const char response_body[] = "{\"ok\":true,\"result\":{\"message_id\":1,"
+    "\"from\":{\"id\":1,\"is_bot\":true,\"first_name\":\"bench\"},"
+    "\"chat\":{\"id\":1,\"type\":\"private\"},\"date\":0,\"text\":\"bench\"}}";
+
+enum bench_proto {
+    BENCH_PROTO_UNKNOWN,
+    BENCH_PROTO_HTTP1,
+    BENCH_PROTO_HTTP2,
+};
+
+struct bench_buffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+struct bench_conn {
+    int fd;
+    SSL *ssl;
+    enum bench_proto proto;
+    long body_left; /* HTTP/1.1 request body still to skip, -1 if idle */
+    struct bench_buffer in;
+    struct bench_buffer out;
+    struct bench_conn *prev;
+    struct bench_conn *next;
+};
+
+struct bench_server {
+    SSL_CTX *ssl_ctx;
+    char ca_file[64];
+    int listen_fd;
+    int epoll_fd;
+    int stop_fd;
+    int port;
+    pthread_t thread;
+    struct bench_conn *conns;
+    atomic_ulong connections;
+    atomic_ulong requests;
+};
+
+static void buffer_append(struct bench_buffer *buf, const void *data,
+        size_t len)
+{
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len)
+            cap *= 2;
+        buf->data = realloc(buf->data, cap);
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static void buffer_consume(struct bench_buffer *buf, size_t len)
+{
+    memmove(buf->data, buf->data + len, buf->len - len);
+    buf->len -= len;
+}
+
+static void h2_frame(struct bench_buffer *out, int type, int flags,
+        unsigned int stream, const void *payload, size_t len)
+{
+    unsigned char hdr[H2_FRAME_HEADER_LEN];
+    hdr[0] = (len >> 16) & 0xff;
+    hdr[1] = (len >> 8) & 0xff;
+    hdr[2] = len & 0xff;
+    hdr[3] = type;
+    hdr[4] = flags;
+    hdr[5] = (stream >> 24) & 0x7f;
+    hdr[6] = (stream >> 16) & 0xff;
+    hdr[7] = (stream >> 8) & 0xff;
+    hdr[8] = stream & 0xff;
+    buffer_append(out, hdr, sizeof(hdr));
+    if (len > 0)
+        buffer_append(out, payload, len);
+}
+
+static void h2_respond(struct bench_server *server, struct bench_conn *conn,
+        unsigned int stream)
+{
+    /* HPACK static table index 8 is ":status: 200" */
+    static const unsigned char status_200 = 0x88;
+
+    h2_frame(&(conn->out), H2_HEADERS, H2_FLAG_END_HEADERS, stream,
+            &status_200, 1);
+    h2_frame(&(conn->out), H2_DATA, H2_FLAG_END_STREAM, stream,
+            response_body, sizeof(response_body) - 1);
+    atomic_fetch_add(&(server->requests), 1);
+}
+
+static bool h2_process(struct bench_server *server, struct bench_conn *conn)
+{
+    while (conn->in.len >= H2_FRAME_HEADER_LEN) {
+        unsigned char *hdr = (unsigned char *)conn->in.data;
+        size_t len = (hdr[0] << 16) | (hdr[1] << 8) | hdr[2];
+        int type = hdr[3];
+        int flags = hdr[4];
+        unsigned int stream = ((hdr[5] & 0x7f) << 24) | (hdr[6] << 16) |
+            (hdr[7] << 8) | hdr[8];
+
+        if (conn->in.len < H2_FRAME_HEADER_LEN + len)
+            break;
+
+        unsigned char *payload = hdr + H2_FRAME_HEADER_LEN;
+        switch (type) {
+        case H2_SETTINGS:
+            if (!(flags & H2_FLAG_ACK))
+                h2_frame(&(conn->out), H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+            break;
+        case H2_PING:
+            if (!(flags & H2_FLAG_ACK))
+                h2_frame(&(conn->out), H2_PING, H2_FLAG_ACK, 0, payload, len);
+            break;
+        case H2_HEADERS:
+            if (flags & H2_FLAG_END_STREAM)
+                h2_respond(server, conn, stream);
+            break;
+        case H2_DATA:
+            if (len > 0) {
+                /* Give the connection window back, streams are short */
+                unsigned char inc[4] = {
+                    (len >> 24) & 0x7f, (len >> 16) & 0xff,
+                    (len >> 8) & 0xff, len & 0xff
+                };
+                h2_frame(&(conn->out), H2_WINDOW_UPDATE, 0, 0, inc, 4);
+            }
+            if (flags & H2_FLAG_END_STREAM)
+                h2_respond(server, conn, stream);
+            break;
+        case H2_GOAWAY:
+            return false;
+        default:
+            break;
+        }
+
+        buffer_consume(&(conn->in), H2_FRAME_HEADER_LEN + len);
+    }
+
+    return true;
+}
+
+static void http1_respond(struct bench_server *server, struct bench_conn *conn)
+{
+    char head[128];
+    int len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/json\r\n"
+            "Content-Length: %zu\r\n\r\n", sizeof(response_body) - 1);
+    buffer_append(&(conn->out), head, len);
+    buffer_append(&(conn->out), response_body, sizeof(response_body) - 1);
+    atomic_fetch_add(&(server->requests), 1);
+}
+
+static bool http1_process(struct bench_server *server, struct bench_conn *conn)
+{
+    while (conn->in.len > 0) {
+        if (conn->body_left >= 0) {
+            size_t skip = conn->in.len;
+            if ((long)skip > conn->body_left)
+                skip = conn->body_left;
+            buffer_consume(&(conn->in), skip);
+            conn->body_left -= skip;
+            if (conn->body_left > 0)
+                break;
+            conn->body_left = -1;
+            http1_respond(server, conn);
+            continue;
+        }
+
+        buffer_append(&(conn->in), "", 1);
+        conn->in.len--;
+        char *end = strstr(conn->in.data, "\r\n\r\n");
+        if (end == NULL)
+            break;
+        *end = '\0';
+
+        long content_length = 0;
+        bool expect_continue = false;
+        char *line = strstr(conn->in.data, "\r\n");
+        while (line != NULL) {
+            line += 2;
+            if (strncasecmp(line, "Content-Length:", 15) == 0)
+                content_length = strtol(line + 15, NULL, 10);
+            else if (strncasecmp(line, "Expect:", 7) == 0)
+                expect_continue = true;
+            line = strstr(line, "\r\n");
+        }
+
+        buffer_consume(&(conn->in), end + 4 - conn->in.data);
+        conn->body_left = content_length;
+        if (expect_continue && content_length > 0)
+            buffer_append(&(conn->out), "HTTP/1.1 100 Continue\r\n\r\n", 25);
+    }
+
+    if (conn->body_left == 0) {
+        conn->body_left = -1;
+        http1_respond(server, conn);
+    }
+
+    return true;
+}
+
+static bool conn_process(struct bench_server *server, struct bench_conn *conn)
+{
+    if (conn->proto == BENCH_PROTO_UNKNOWN) {
+        if (conn->in.len < 3)
+            return true;
+        if (memcmp(conn->in.data, "PRI", 3) != 0) {
+            conn->proto = BENCH_PROTO_HTTP1;
+        }
+        else {
+            if (conn->in.len < H2_PREFACE_LEN)
+                return true;
+            if (memcmp(conn->in.data, H2_PREFACE, H2_PREFACE_LEN) != 0)
+                return false;
+            buffer_consume(&(conn->in), H2_PREFACE_LEN);
+            h2_frame(&(conn->out), H2_SETTINGS, 0, 0, NULL, 0);
+            conn->proto = BENCH_PROTO_HTTP2;
+        }
+    }
+
+    if (conn->proto == BENCH_PROTO_HTTP2)
+        return h2_process(server, conn);
+    return http1_process(server, conn);
+}
+
+static bool conn_flush(struct bench_conn *conn)
+{
+    size_t sent = 0;
+    while (sent < conn->out.len) {
+        int n = SSL_write(conn->ssl, conn->out.data + sent,
+                conn->out.len - sent);
+        if (n <= 0) {
+            int err = SSL_get_error(conn->ssl, n);
+            if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ)
+                break;
+            return false;
+        }
+        sent += n;
+    }
+    buffer_consume(&(conn->out), sent);
+    return true;
+}
+
+static void conn_close(struct bench_server *server, struct bench_conn *conn)
+{
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        server->conns = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+
+    SSL_free(conn->ssl);
+    close(conn->fd);
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn);
+}
+
+static void server_accept(struct bench_server *server)
+{
+    while (true) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0)
+            return;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct bench_conn *conn = calloc(1, sizeof(struct bench_conn));
+        conn->fd = fd;
+        conn->ssl = SSL_new(server->ssl_ctx);
+        SSL_set_fd(conn->ssl, fd);
+        SSL_set_accept_state(conn->ssl);
+        conn->body_left = -1;
+        conn->next = server->conns;
+        if (server->conns != NULL)
+            server->conns->prev = conn;
+        server->conns = conn;
+
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLOUT | EPOLLET,
+            .data.ptr = conn,
+        };
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        atomic_fetch_add(&(server->connections), 1);
+    }
+}
+
+static void server_handle(struct bench_server *server, struct bench_conn *conn)
+{
+    char buf[BENCH_READ_SIZE];
+    bool alive = true;
+
+    while (alive) {
+        int n = SSL_read(conn->ssl, buf, sizeof(buf));
+        if (n > 0) {
+            buffer_append(&(conn->in), buf, n);
+            continue;
+        }
+        int err = SSL_get_error(conn->ssl, n);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+            break;
+        alive = false;
+    }
+
+    if (alive)
+        alive = conn_process(server, conn);
+    if (alive)
+        alive = conn_flush(conn);
+    if (!alive)
+        conn_close(server, conn);
+}
+
+static void *server_thread(void *data)
+{
+    struct bench_server *server = data;
+    struct epoll_event events[BENCH_EVENTS_MAX];
+
+    while (true) {
+        int count = epoll_wait(server->epoll_fd, events, BENCH_EVENTS_MAX, -1);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            break;
+
+        for (int index = 0; index < count; index++) {
+            void *ptr = events[index].data.ptr;
+            if (ptr == &(server->stop_fd))
+                return NULL;
+            if (ptr == &(server->listen_fd))
+                server_accept(server);
+            else
+                server_handle(server, ptr);
+        }
+    }
+
+    return NULL;
+}
+
+static int alpn_select_cb(SSL *ssl, const unsigned char **out,
+        unsigned char *outlen, const unsigned char *in, unsigned int inlen,
+        void *arg)
+{
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+
+    if (SSL_select_next_proto((unsigned char **)out, outlen, protos,
+                sizeof(protos) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+/* Self-signed certificate for 127.0.0.1, written out for the client to trust */
+static SSL_CTX *ssl_ctx_create(char *ca_file)
+{
+    EVP_PKEY *pkey = EVP_EC_gen("P-256");
+    X509 *cert = X509_new();
+    X509V3_CTX v3;
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 86400);
+    X509_set_pubkey(cert, pkey);
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+            (const unsigned char *)"127.0.0.1", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509V3_set_ctx(&v3, cert, cert, NULL, NULL, 0);
+    X509_EXTENSION *ext = X509V3_EXT_conf_nid(NULL, &v3,
+            NID_subject_alt_name, "IP:127.0.0.1");
+    X509_add_ext(cert, ext, -1);
+    X509_EXTENSION_free(ext);
+    X509_sign(cert, pkey, EVP_sha256());
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate(ctx, cert);
+    SSL_CTX_use_PrivateKey(ctx, pkey);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+            SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_CTX_set_alpn_select_cb(ctx, alpn_select_cb, NULL);
+
+    strcpy(ca_file, "/tmp/telebot-bench-XXXXXX");
+    int fd = mkstemp(ca_file);
+    FILE *fp = (fd < 0) ? NULL : fdopen(fd, "w");
+    if (fp != NULL) {
+        PEM_write_X509(fp, cert);
+        fclose(fp);
+    }
+
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+
+    if (fp == NULL) {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+bench_server_t *bench_server_start(int port)
+{
+    struct bench_server *server = calloc(1, sizeof(struct bench_server));
+    if (server == NULL)
+        return NULL;
+
+    server->ssl_ctx = ssl_ctx_create(server->ca_file);
+    if (server->ssl_ctx == NULL) {
+        free(server);
+        return NULL;
+    }
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if ((bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+            (listen(server->listen_fd, 1024) < 0)) {
+        perror("bench server");
+        close(server->listen_fd);
+        unlink(server->ca_file);
+        SSL_CTX_free(server->ssl_ctx);
+        free(server);
+        return NULL;
+    }
+
+    socklen_t addr_len = sizeof(addr);
+    getsockname(server->listen_fd, (struct sockaddr *)&addr, &addr_len);
+    server->port = ntohs(addr.sin_port);
+
+    server->epoll_fd = epoll_create1(0);
+    server->stop_fd = eventfd(0, EFD_NONBLOCK);
+
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.ptr = &(server->listen_fd);
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &ev);
+    ev.data.ptr = &(server->stop_fd);
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->stop_fd, &ev);
+
+    if (pthread_create(&(server->thread), NULL, server_thread, server) != 0) {
+        close(server->stop_fd);
+        close(server->epoll_fd);
+        close(server->listen_fd);
+        unlink(server->ca_file);
+        SSL_CTX_free(server->ssl_ctx);
+        free(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+int bench_server_port(bench_server_t *server)
+{
+    return server->port;
+}
+
+const char *bench_server_ca_file(bench_server_t *server)
+{
+    return server->ca_file;
+}
+
+unsigned long bench_server_connections(bench_server_t *server)
+{
+    return atomic_load(&(server->connections));
+}
+
+unsigned long bench_server_requests(bench_server_t *server)
+{
+    return atomic_load(&(server->requests));
+}
+
+void bench_server_stop(bench_server_t *server)
+{
+    uint64_t one = 1;
+    if (write(server->stop_fd, &one, sizeof(one)) < 0)
+        perror("bench server");
+    pthread_join(server->thread, NULL);
+
+    while (server->conns != NULL)
+        conn_close(server, server->conns);
+
+    close(server->stop_fd);
+    close(server->epoll_fd);
+    close(server->listen_fd);
+    unlink(server->ca_file);
+    SSL_CTX_free(server->ssl_ctx);
+    free(server);
+}
@@ -0,0 +1,49 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BENCH_SERVER_H__
+#define __BENCH_SERVER_H__
+
+/*
+ * Minimal stand-in for the Bot API server used by the benchmarks. It listens
+ * on 127.0.0.1 behind TLS with a throwaway self-signed certificate, speaks
+ * HTTP/1.1 keep-alive or HTTP/2 depending on ALPN, and answers every request
+ * with the same canned sendMessage result. Request headers are never decoded.
+ */
+
+typedef struct bench_server bench_server_t;
+
+/** Start serving on a background thread, port 0 picks a free port. */
+bench_server_t *bench_server_start(int port);
+
+/** Port the server is listening on. */
+int bench_server_port(bench_server_t *server);
+
+/** PEM file with the server certificate, to be trusted by clients. */
+const char *bench_server_ca_file(bench_server_t *server);
+
+/** Number of TCP connections accepted so far. */
+unsigned long bench_server_connections(bench_server_t *server);
+
+/** Number of requests answered so far. */
+unsigned long bench_server_requests(bench_server_t *server);
+
+/** Stop the server thread and close every connection. */
+void bench_server_stop(bench_server_t *server);
+
+#endif /* __BENCH_SERVER_H__ */
@@ -10,21 +10,28 @@
 
 #define SIZE_OF_ARRAY(array) (sizeof(array)/sizeof(array[0]))
 
-static void update_cb(const telebot_message_t *message)
+static void update_cb(telebot_h *bot, const telebot_update_t *update,
+        void *user_data)
 {
     telebot_error_e ret;
     char str[TELEBOT_MESSAGE_TEXT_SIZE + 3];
-    char chat_id[32];
-    if (strstr(message->text, "/start")) {
+
+    if (update->update_type != UPDATE_TYPE_MESSAGE)
+        return;
+
+    const telebot_message_t *message = &(update->message);
+    if (message->text == NULL)
+        return;
+
+    if (strstr(message->text, "/start") && (message->from != NULL)) {
         snprintf(str, SIZE_OF_ARRAY(str), "Hello %s",
-                message->from.first_name);
+                message->from->first_name);
     }
     else {
         snprintf(str, SIZE_OF_ARRAY(str), "RE:%s", message->text);
     }
-    snprintf(chat_id, 32, "%d", message->chat.id);
 
-    ret = telebot_send_message(chat_id, str, "", false, 0, "");
+    ret = telebot_send_message(bot, message->chat.id, str, "", false, 0, "");
     if (ret != TELEBOT_ERROR_NONE) {
         printf("Failed to send message: %d \n", ret);
     }
@@ -49,33 +56,34 @@ int main(int argc, char *argv[])
     printf ("Token: %s\n", token);
     fclose(fp);
 
-    if (telebot_create(token) != TELEBOT_ERROR_NONE) {
+    telebot_h *bot;
+    if (telebot_create(&bot, token) != TELEBOT_ERROR_NONE) {
         printf("Telebot create failed\n");
         return -1;
     }
 
-    telebot_user_t *me;
-    if (telebot_get_me(&me) != TELEBOT_ERROR_NONE) {
+    telebot_user_t me;
+    if (telebot_get_me(bot, &me) != TELEBOT_ERROR_NONE) {
         printf("Failed to get bot information\n");
-        telebot_destroy();
+        telebot_destroy(bot);
         return -1;
     }
 
-    printf("ID: %d\n", me->id);
-    printf("First Name: %s\n", me->first_name);
-    printf("Last Name: %s\n", me->last_name);
-    printf("User Name: %s\n", me->username);
-    free(me);
+    printf("ID: %lld\n", me.id);
+    printf("First Name: %s\n", me.first_name);
+    printf("Last Name: %s\n", me.last_name);
+    printf("User Name: %s\n", me.username);
+    telebot_put_me(&me);
 
     pthread_t thread;
-    telebot_start(update_cb, false, &thread);
+    telebot_start(bot, update_cb, NULL, false, &thread);
 
     printf("t: %ld\n", thread);
     // wait for callbacks;
     pthread_join(thread, NULL);
 
-    telebot_stop();
-    telebot_destroy();
+    telebot_stop(bot);
+    telebot_destroy(bot);
 
     return 0;
 }
@@ -0,0 +1,108 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs the mock Bot API server until interrupted, for bots and benchmarks in
+ * other processes. Point them at the printed URL, e.g. through the api_url
+ * member of telebot_core_options_t.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "mock-server.h"
+
+static volatile sig_atomic_t stopped;
+
+static void stop_cb(int signum)
+{
+    stopped = 1;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+            "  -p port         port to listen on, default a free one\n"
+            "  -l ms           latency added to every answer\n"
+            "  -j ms           random extra latency, up to this\n"
+            "  -e rate         share of requests answered with 500\n"
+            "  -f rate         share of requests answered with 429\n"
+            "  -r seconds      retry_after sent with 429, default 1\n"
+            "  -d rate         share of requests whose connection is dropped\n"
+            "  -u count        synthetic updates in total\n"
+            "  -R rate         updates generated per second, default all at "
+            "once\n"
+            "  -c count        distinct chats, default 100\n"
+            "  -t size         message text length, default 32\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    mock_server_config_t config;
+    mock_server_config_init(&config);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:l:j:e:f:r:d:u:R:c:t:h")) != -1) {
+        switch (opt) {
+        case 'p': config.port = atoi(optarg); break;
+        case 'l': config.latency_us = atof(optarg) * 1000; break;
+        case 'j': config.jitter_us = atof(optarg) * 1000; break;
+        case 'e': config.error_rate = atof(optarg); break;
+        case 'f': config.flood_rate = atof(optarg); break;
+        case 'r': config.retry_after = atoi(optarg); break;
+        case 'd': config.drop_rate = atof(optarg); break;
+        case 'u': config.updates = strtoul(optarg, NULL, 10); break;
+        case 'R': config.update_rate = atoi(optarg); break;
+        case 'c': config.chats = atoi(optarg); break;
+        case 't': config.text_size = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : -1;
+        }
+    }
+
+    signal(SIGINT, stop_cb);
+    signal(SIGTERM, stop_cb);
+    signal(SIGPIPE, SIG_IGN);
+
+    mock_server_t *server = mock_server_start(&config);
+    if (server == NULL)
+        return -1;
+
+    printf("Serving the Bot API on http://127.0.0.1:%d\n",
+            mock_server_port(server));
+    fflush(stdout);
+
+    while (!stopped)
+        pause();
+
+    mock_server_stats_t stats;
+    mock_server_get_stats(server, &stats);
+    mock_server_stop(server);
+
+    printf("connections %lu  requests %lu  polls %lu  sent %lu\n"
+            "updates %lu  confirmed %lu  errors %lu  floods %lu  drops %lu\n",
+            stats.connections, stats.requests, stats.polls, stats.sent,
+            stats.updates, stats.confirmed, stats.errors, stats.floods,
+            stats.drops);
+
+    return 0;
+}
@@ -0,0 +1,778 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "mock-server.h"
+
+#define MOCK_READ_SIZE 16384
+#define MOCK_HEADER_SIZE_MAX (64 * 1024)
+#define MOCK_BODY_SIZE_MAX (64 * 1024 * 1024)
+#define MOCK_UPDATE_LIMIT_MAX 100
+#define MOCK_FILE_SIZE 1024
+#define MOCK_DATE_BASE 1508251000UL
+
+struct mock_buffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+struct mock_conn {
+    int fd;
+    pthread_t thread;
+    struct mock_server *server;
+    unsigned int seed;
+    bool done; /* Thread finished, under the server lock */
+    struct mock_buffer in;
+    struct mock_buffer out;
+    struct mock_conn *next;
+};
+
+struct mock_request {
+    char method[64];
+    bool file; /* Download below /file/bot<token>/ */
+    bool close; /* Connection: close */
+    const char *query;
+    const char *body;
+    size_t body_len;
+    size_t size; /* Headers and body, in the input buffer */
+};
+
+struct mock_server {
+    mock_server_config_t config;
+    int listen_fd;
+    int stop_fd;
+    int port;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* Signalled on stop, to end long polls */
+    bool running;
+    struct mock_conn *conns;
+    unsigned long start_us;
+    unsigned long confirmed; /* Highest update id confirmed, under lock */
+    char *text;
+    atomic_ulong connections;
+    atomic_ulong requests;
+    atomic_ulong polls;
+    atomic_ulong sent;
+    atomic_ulong updates;
+    atomic_ulong errors;
+    atomic_ulong floods;
+    atomic_ulong drops;
+};
+
+static __thread bool server_thread_flag;
+
+static unsigned long now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void sleep_us(unsigned long us)
+{
+    struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+    while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR));
+}
+
+static void buffer_reserve(struct mock_buffer *buf, size_t len)
+{
+    if (buf->len + len + 1 <= buf->cap)
+        return;
+
+    size_t cap = buf->cap ? buf->cap : 4096;
+    while (cap < buf->len + len + 1)
+        cap *= 2;
+    buf->data = realloc(buf->data, cap);
+    buf->cap = cap;
+}
+
+static void buffer_append(struct mock_buffer *buf, const void *data,
+        size_t len)
+{
+    buffer_reserve(buf, len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+static void buffer_printf(struct mock_buffer *buf, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    buffer_reserve(buf, len);
+    va_start(args, format);
+    vsnprintf(buf->data + buf->len, len + 1, format, args);
+    va_end(args);
+    buf->len += len;
+}
+
+static void buffer_consume(struct mock_buffer *buf, size_t len)
+{
+    memmove(buf->data, buf->data + len, buf->len - len);
+    buf->len -= len;
+    buf->data[buf->len] = '\0';
+}
+
+static bool send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+/* Reads more of the request, false once the connection is closed */
+static bool conn_read(struct mock_conn *conn)
+{
+    buffer_reserve(&(conn->in), MOCK_READ_SIZE);
+    ssize_t n;
+    do {
+        n = recv(conn->fd, conn->in.data + conn->in.len, MOCK_READ_SIZE, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return false;
+
+    conn->in.len += n;
+    conn->in.data[conn->in.len] = '\0';
+
+    return true;
+}
+
+static const char *header_value(const char *headers, const char *end,
+        const char *name)
+{
+    size_t name_len = strlen(name);
+    const char *line = strstr(headers, "\r\n");
+    while ((line != NULL) && (line < end)) {
+        line += 2;
+        if ((strncasecmp(line, name, name_len) == 0) &&
+                (line[name_len] == ':')) {
+            const char *value = line + name_len + 1;
+            while (*value == ' ')
+                value++;
+            return value;
+        }
+        line = strstr(line, "\r\n");
+    }
+
+    return NULL;
+}
+
+/*
+ * Field of a multipart/form-data body, as posted by the library, or of an
+ * urlencoded query string. Values are copied without decoding.
+ */
+static bool form_value(const struct mock_request *req, const char *name,
+        char *value, size_t size)
+{
+    char pattern[80];
+    const char *start = NULL, *end = NULL;
+
+    snprintf(pattern, sizeof(pattern), "name=\"%s\"", name);
+    if (req->body != NULL) {
+        start = memmem(req->body, req->body_len, pattern, strlen(pattern));
+        if (start != NULL)
+            start = strstr(start, "\r\n\r\n");
+        if (start != NULL) {
+            start += 4;
+            end = strstr(start, "\r\n");
+        }
+    }
+
+    if ((start == NULL) && (req->query != NULL)) {
+        snprintf(pattern, sizeof(pattern), "%s=", name);
+        const char *field = req->query;
+        while ((field != NULL) && (start == NULL)) {
+            if (strncmp(field, pattern, strlen(pattern)) == 0)
+                start = field + strlen(pattern);
+            field = strchr(field, '&');
+            if (field != NULL)
+                field++;
+        }
+        if (start != NULL)
+            end = start + strcspn(start, "& ");
+    }
+
+    if ((start == NULL) || (end == NULL))
+        return false;
+
+    size_t len = end - start;
+    if (len >= size)
+        len = size - 1;
+    memcpy(value, start, len);
+    value[len] = '\0';
+
+    return true;
+}
+
+static long form_long(const struct mock_request *req, const char *name,
+        long fallback)
+{
+    char value[32];
+    if (!form_value(req, name, value, sizeof(value)))
+        return fallback;
+
+    return strtol(value, NULL, 10);
+}
+
+static void respond(struct mock_conn *conn, int status, const char *reason,
+        const char *content_type, const struct mock_buffer *body, bool close)
+{
+    buffer_printf(&(conn->out), "HTTP/1.1 %d %s\r\n"
+            "Content-Type: %s\r\nContent-Length: %lu\r\n%s\r\n",
+            status, reason, content_type, (unsigned long)body->len,
+            close ? "Connection: close\r\n" : "");
+    buffer_append(&(conn->out), body->data, body->len);
+}
+
+/* Updates generated so far, ids start at 1 */
+static unsigned long updates_available(struct mock_server *server,
+        unsigned long now)
+{
+    const mock_server_config_t *config = &(server->config);
+    if (config->update_rate == 0)
+        return config->updates;
+
+    unsigned long generated = (now - server->start_us) / 1000000.0 *
+        config->update_rate;
+
+    return (generated < config->updates) ? generated : config->updates;
+}
+
+static void append_update(struct mock_server *server, struct mock_buffer *buf,
+        unsigned long id)
+{
+    unsigned long user = 1000 + id % server->config.chats;
+
+    buffer_printf(buf, "{\"update_id\":%lu,\"message\":{\"message_id\":%lu,"
+            "\"from\":{\"id\":%lu,\"is_bot\":false,\"first_name\":\"Mock\","
+            "\"username\":\"mock_user\",\"language_code\":\"en\"},"
+            "\"chat\":{\"id\":%lu,\"first_name\":\"Mock\","
+            "\"username\":\"mock_user\",\"type\":\"private\"},"
+            "\"date\":%lu,\"text\":\"%s\"}}",
+            id, id, user, user, MOCK_DATE_BASE + id, server->text);
+}
+
+/*
+ * Long polls like Telegram: updates below offset are confirmed and never sent
+ * again, the answer comes as soon as one more is available, or with an empty
+ * result after timeout seconds.
+ */
+static void get_updates(struct mock_server *server,
+        const struct mock_request *req, struct mock_buffer *body)
+{
+    long offset = form_long(req, "offset", 0);
+    long limit = form_long(req, "limit", MOCK_UPDATE_LIMIT_MAX);
+    long timeout = form_long(req, "timeout", 0);
+    if ((limit <= 0) || (limit > MOCK_UPDATE_LIMIT_MAX))
+        limit = MOCK_UPDATE_LIMIT_MAX;
+
+    unsigned long deadline = now_us() + timeout * 1000000UL;
+    unsigned long first, last;
+
+    pthread_mutex_lock(&(server->lock));
+    if ((offset > 0) && ((unsigned long)offset - 1 > server->confirmed))
+        server->confirmed = offset - 1;
+    first = server->confirmed + 1;
+
+    while (true) {
+        unsigned long now = now_us();
+        last = updates_available(server, now);
+        if ((last >= first) || (now >= deadline) || !server->running)
+            break;
+
+        /* Sleep until the next update is generated, or the poll times out */
+        unsigned long wake = deadline;
+        if ((server->config.update_rate > 0) &&
+                (first <= server->config.updates)) {
+            unsigned long due = mock_server_update_time(server, first);
+            if (due < wake)
+                wake = due;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        unsigned long wait = (wake > now) ? wake - now : 0;
+        ts.tv_sec += wait / 1000000;
+        ts.tv_nsec += (wait % 1000000) * 1000;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&(server->cond), &(server->lock), &ts);
+    }
+    pthread_mutex_unlock(&(server->lock));
+
+    if (last > first + limit - 1)
+        last = first + limit - 1;
+
+    buffer_append(body, "{\"ok\":true,\"result\":[", 21);
+    unsigned long id;
+    for (id = first; id <= last; id++) {
+        if (id > first)
+            buffer_append(body, ",", 1);
+        append_update(server, body, id);
+    }
+    buffer_append(body, "]}", 2);
+
+    if (last >= first)
+        server->updates += last - first + 1;
+}
+
+static void answer_method(struct mock_server *server, struct mock_conn *conn,
+        const struct mock_request *req, struct mock_buffer *body)
+{
+    const char *method = req->method;
+
+    if (strcmp(method, "getUpdates") == 0) {
+        server->polls++;
+        get_updates(server, req, body);
+    }
+    else if (strcmp(method, "getMe") == 0) {
+        buffer_printf(body, "{\"ok\":true,\"result\":{\"id\":1,"
+                "\"is_bot\":true,\"first_name\":\"Mock\","
+                "\"username\":\"mock_bot\"}}");
+    }
+    else if (((strncmp(method, "send", 4) == 0) &&
+                (strcmp(method, "sendChatAction") != 0)) ||
+            (strcmp(method, "forwardMessage") == 0)) {
+        server->sent++;
+        buffer_printf(body, "{\"ok\":true,\"result\":{\"message_id\":%lu,"
+                "\"from\":{\"id\":1,\"is_bot\":true,\"first_name\":\"Mock\"},"
+                "\"chat\":{\"id\":%ld,\"type\":\"private\"},\"date\":%lu,"
+                "\"text\":\"mock\"}}", (unsigned long)server->sent,
+                form_long(req, "chat_id", 1), MOCK_DATE_BASE);
+    }
+    else if ((strcmp(method, "sendChatAction") == 0) ||
+            (strcmp(method, "answerCallbackQuery") == 0) ||
+            (strcmp(method, "deleteMessage") == 0) ||
+            (strcmp(method, "setWebhook") == 0) ||
+            (strcmp(method, "deleteWebhook") == 0)) {
+        buffer_printf(body, "{\"ok\":true,\"result\":true}");
+    }
+    else if (strcmp(method, "getFile") == 0) {
+        char file_id[128] = "mock";
+        form_value(req, "file_id", file_id, sizeof(file_id));
+        buffer_printf(body, "{\"ok\":true,\"result\":{\"file_id\":\"%s\","
+                "\"file_size\":%d,\"file_path\":\"documents/mock.dat\"}}",
+                file_id, MOCK_FILE_SIZE);
+    }
+    else if (strcmp(method, "getUserProfilePhotos") == 0) {
+        buffer_printf(body, "{\"ok\":true,\"result\":{\"total_count\":0,"
+                "\"photos\":[]}}");
+    }
+    else {
+        buffer_printf(body, "{\"ok\":false,\"error_code\":404,"
+                "\"description\":\"Not Found\"}");
+        respond(conn, 404, "Not Found", "application/json", body, req->close);
+        return;
+    }
+
+    respond(conn, 200, "OK", "application/json", body, req->close);
+}
+
+/* Answers one request, false to close the connection without an answer */
+static bool conn_handle(struct mock_conn *conn, const struct mock_request *req)
+{
+    struct mock_server *server = conn->server;
+    const mock_server_config_t *config = &(server->config);
+    struct mock_buffer body = {0};
+
+    server->requests++;
+
+    unsigned long delay = config->latency_us;
+    if (config->jitter_us > 0)
+        delay += rand_r(&(conn->seed)) % (config->jitter_us + 1);
+    if (delay > 0)
+        sleep_us(delay);
+
+    double roll = rand_r(&(conn->seed)) / (RAND_MAX + 1.0);
+    if (roll < config->drop_rate) {
+        server->drops++;
+        return false;
+    }
+    roll -= config->drop_rate;
+
+    if (roll < config->error_rate) {
+        server->errors++;
+        buffer_printf(&body, "{\"ok\":false,\"error_code\":500,"
+                "\"description\":\"Internal Server Error\"}");
+        respond(conn, 500, "Internal Server Error", "application/json", &body,
+                req->close);
+    }
+    else if (roll - config->error_rate < config->flood_rate) {
+        server->floods++;
+        buffer_printf(&body, "{\"ok\":false,\"error_code\":429,"
+                "\"description\":\"Too Many Requests: retry after %d\","
+                "\"parameters\":{\"retry_after\":%d}}",
+                config->retry_after, config->retry_after);
+        respond(conn, 429, "Too Many Requests", "application/json", &body,
+                req->close);
+    }
+    else if (req->file) {
+        buffer_reserve(&body, MOCK_FILE_SIZE);
+        memset(body.data, 'm', MOCK_FILE_SIZE);
+        body.len = MOCK_FILE_SIZE;
+        respond(conn, 200, "OK", "application/octet-stream", &body,
+                req->close);
+    }
+    else {
+        answer_method(server, conn, req, &body);
+    }
+
+    free(body.data);
+
+    return send_all(conn->fd, conn->out.data, conn->out.len);
+}
+
+/*
+ * Parses the request line and headers, "POST /bot<token>/<method> HTTP/1.1",
+ * and reads the body. Returns false on a malformed request or a closed
+ * connection.
+ */
+static bool conn_request(struct mock_conn *conn, struct mock_request *req)
+{
+    char *end;
+    while ((conn->in.data == NULL) ||
+            ((end = strstr(conn->in.data, "\r\n\r\n")) == NULL)) {
+        if ((conn->in.len > MOCK_HEADER_SIZE_MAX) || !conn_read(conn))
+            return false;
+    }
+    size_t header_len = end + 4 - conn->in.data;
+
+    memset(req, 0, sizeof(*req));
+    const char *target = strchr(conn->in.data, ' ');
+    if (target == NULL)
+        return false;
+    target++;
+    size_t target_len = strcspn(target, " \r");
+    size_t target_offset = target - conn->in.data;
+
+    if (strncmp(target, "/file/bot", 9) == 0) {
+        req->file = true;
+    }
+    else if (strncmp(target, "/bot", 4) == 0) {
+        const char *method = memchr(target + 4, '/', target_len - 4);
+        if (method == NULL)
+            return false;
+        method++;
+        size_t len = strcspn(method, "? ");
+        if (len >= sizeof(req->method))
+            len = sizeof(req->method) - 1;
+        memcpy(req->method, method, len);
+    }
+
+    const char *value = header_value(conn->in.data, end, "Connection");
+    req->close = (value != NULL) && (strncasecmp(value, "close", 5) == 0);
+
+    long length = 0;
+    value = header_value(conn->in.data, end, "Content-Length");
+    if (value != NULL)
+        length = strtol(value, NULL, 10);
+    if ((length < 0) || (length > MOCK_BODY_SIZE_MAX))
+        return false;
+
+    /* curl waits for a go-ahead before posting larger forms */
+    value = header_value(conn->in.data, end, "Expect");
+    if ((value != NULL) && (strncasecmp(value, "100-continue", 12) == 0) &&
+            (conn->in.len < header_len + length) &&
+            !send_all(conn->fd, "HTTP/1.1 100 Continue\r\n\r\n", 25))
+        return false;
+
+    while (conn->in.len < header_len + length) {
+        if (!conn_read(conn))
+            return false;
+    }
+
+    /* The request stays in the input buffer until it was answered */
+    target = conn->in.data + target_offset;
+    const char *query = memchr(target, '?', target_len);
+    if (query != NULL)
+        req->query = query + 1;
+    req->body = (length > 0) ? conn->in.data + header_len : NULL;
+    req->body_len = length;
+    req->size = header_len + length;
+
+    return true;
+}
+
+static void *conn_thread(void *data)
+{
+    struct mock_conn *conn = data;
+    struct mock_server *server = conn->server;
+    struct mock_request req;
+
+    server_thread_flag = true;
+
+    while (conn_request(conn, &req)) {
+        conn->out.len = 0;
+        if (!conn_handle(conn, &req) || req.close)
+            break;
+        buffer_consume(&(conn->in), req.size);
+    }
+
+    shutdown(conn->fd, SHUT_RDWR);
+    pthread_mutex_lock(&(server->lock));
+    conn->done = true;
+    pthread_mutex_unlock(&(server->lock));
+
+    return NULL;
+}
+
+static void conn_free(struct mock_conn *conn)
+{
+    pthread_join(conn->thread, NULL);
+    close(conn->fd);
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn);
+}
+
+/* Joins the threads of connections that were closed in the meantime */
+static void server_reap(struct mock_server *server)
+{
+    pthread_mutex_lock(&(server->lock));
+    struct mock_conn **link = &(server->conns), *done = NULL;
+    while (*link != NULL) {
+        struct mock_conn *conn = *link;
+        if (conn->done) {
+            *link = conn->next;
+            conn->next = done;
+            done = conn;
+        }
+        else {
+            link = &(conn->next);
+        }
+    }
+    pthread_mutex_unlock(&(server->lock));
+
+    while (done != NULL) {
+        struct mock_conn *conn = done;
+        done = conn->next;
+        conn_free(conn);
+    }
+}
+
+static void server_accept(struct mock_server *server)
+{
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct mock_conn *conn = calloc(1, sizeof(struct mock_conn));
+    conn->fd = fd;
+    conn->server = server;
+    conn->seed = (unsigned int)(now_us() ^ (fd * 2654435761UL));
+
+    pthread_mutex_lock(&(server->lock));
+    if (pthread_create(&(conn->thread), NULL, conn_thread, conn) != 0) {
+        pthread_mutex_unlock(&(server->lock));
+        close(fd);
+        free(conn);
+        return;
+    }
+    conn->next = server->conns;
+    server->conns = conn;
+    pthread_mutex_unlock(&(server->lock));
+
+    server->connections++;
+}
+
+static void *server_thread(void *data)
+{
+    struct mock_server *server = data;
+    struct pollfd fds[2] = {
+        { .fd = server->listen_fd, .events = POLLIN },
+        { .fd = server->stop_fd, .events = POLLIN },
+    };
+
+    server_thread_flag = true;
+
+    while (true) {
+        if (poll(fds, 2, 1000) < 0 && errno != EINTR)
+            break;
+        if (fds[1].revents & POLLIN)
+            break;
+        if (fds[0].revents & POLLIN)
+            server_accept(server);
+        server_reap(server);
+    }
+
+    return NULL;
+}
+
+void mock_server_config_init(mock_server_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->retry_after = 1;
+    config->chats = 100;
+    config->text_size = 32;
+}
+
+mock_server_t *mock_server_start(const mock_server_config_t *config)
+{
+    struct mock_server *server = calloc(1, sizeof(struct mock_server));
+    if (server == NULL)
+        return NULL;
+
+    mock_server_config_init(&(server->config));
+    if (config != NULL)
+        server->config = *config;
+    if (server->config.chats == 0)
+        server->config.chats = 1;
+
+    /* Plain letters, so the text needs no escaping */
+    server->text = malloc(server->config.text_size + 1);
+    unsigned int index;
+    for (index = 0; index < server->config.text_size; index++)
+        server->text[index] = (index % 6 == 5) ? ' ' : 'a' + index % 26;
+    server->text[server->config.text_size] = '\0';
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(server->config.port);
+    socklen_t addr_len = sizeof(addr);
+    if ((bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+            (listen(server->listen_fd, 128) < 0) ||
+            (getsockname(server->listen_fd, (struct sockaddr *)&addr,
+                         &addr_len) < 0)) {
+        perror("mock server");
+        close(server->listen_fd);
+        free(server->text);
+        free(server);
+        return NULL;
+    }
+    server->port = ntohs(addr.sin_port);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(server->cond), &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&(server->lock), NULL);
+
+    server->stop_fd = eventfd(0, 0);
+    server->running = true;
+    server->start_us = now_us();
+    pthread_create(&(server->thread), NULL, server_thread, server);
+
+    return server;
+}
+
+int mock_server_port(mock_server_t *server)
+{
+    return server->port;
+}
+
+bool mock_server_thread(void)
+{
+    return server_thread_flag;
+}
+
+unsigned long mock_server_update_time(mock_server_t *server, unsigned long id)
+{
+    if (server->config.update_rate == 0)
+        return server->start_us;
+
+    return server->start_us + id * 1000000.0 / server->config.update_rate;
+}
+
+void mock_server_get_stats(mock_server_t *server, mock_server_stats_t *stats)
+{
+    stats->connections = server->connections;
+    stats->requests = server->requests;
+    stats->polls = server->polls;
+    stats->sent = server->sent;
+    stats->updates = server->updates;
+    stats->errors = server->errors;
+    stats->floods = server->floods;
+    stats->drops = server->drops;
+
+    pthread_mutex_lock(&(server->lock));
+    stats->confirmed = server->confirmed;
+    pthread_mutex_unlock(&(server->lock));
+}
+
+void mock_server_stop(mock_server_t *server)
+{
+    uint64_t one = 1;
+    if (write(server->stop_fd, &one, sizeof(one)) < 0)
+        perror("mock server");
+    pthread_join(server->thread, NULL);
+
+    /* End long polls and unblock every connection thread */
+    pthread_mutex_lock(&(server->lock));
+    server->running = false;
+    pthread_cond_broadcast(&(server->cond));
+    struct mock_conn *conn;
+    for (conn = server->conns; conn != NULL; conn = conn->next)
+        shutdown(conn->fd, SHUT_RDWR);
+    conn = server->conns;
+    server->conns = NULL;
+    pthread_mutex_unlock(&(server->lock));
+
+    while (conn != NULL) {
+        struct mock_conn *next = conn->next;
+        conn_free(conn);
+        conn = next;
+    }
+
+    close(server->listen_fd);
+    close(server->stop_fd);
+    pthread_mutex_destroy(&(server->lock));
+    pthread_cond_destroy(&(server->cond));
+    free(server->text);
+    free(server);
+}
@@ -0,0 +1,87 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __MOCK_SERVER_H__
+#define __MOCK_SERVER_H__
+
+/*
+ * Local stand-in for the Bot API server, to run the whole request path
+ * offline. It listens on 127.0.0.1 in plain HTTP/1.1 with keep-alive, one
+ * thread per connection, and answers every method the library uses with a
+ * canned result for any token. getUpdates long polls a synthetic stream of
+ * text messages, generated at a fixed rate and confirmed through offset like
+ * on Telegram. Each answer can be delayed, and a share of them replaced by
+ * 5xx errors, 429 flood waits or a dropped connection.
+ */
+
+typedef struct mock_server_config {
+    int port; /* 0 picks a free port */
+    unsigned int latency_us; /* Added before every answer */
+    unsigned int jitter_us; /* Random extra latency, up to this */
+    double error_rate; /* Share of requests answered with 500 */
+    double flood_rate; /* Share of requests answered with 429 */
+    int retry_after; /* Seconds, sent along with 429 */
+    double drop_rate; /* Share of requests whose connection is closed */
+    unsigned long updates; /* Synthetic updates in total, 0 for none */
+    unsigned int update_rate; /* Updates generated per second, 0 at once */
+    unsigned int chats; /* Distinct chats the updates come from */
+    unsigned int text_size; /* Length of the message texts */
+} mock_server_config_t;
+
+typedef struct mock_server_stats {
+    unsigned long connections; /* TCP connections accepted */
+    unsigned long requests; /* Requests received */
+    unsigned long polls; /* getUpdates requests */
+    unsigned long sent; /* Messages sent by the bot */
+    unsigned long updates; /* Updates delivered, redeliveries included */
+    unsigned long confirmed; /* Updates confirmed through offset */
+    unsigned long errors; /* Injected 500 answers */
+    unsigned long floods; /* Injected 429 answers */
+    unsigned long drops; /* Injected dropped connections */
+} mock_server_stats_t;
+
+typedef struct mock_server mock_server_t;
+
+/** Fill config with the defaults: no latency, no errors, no updates. */
+void mock_server_config_init(mock_server_config_t *config);
+
+/** Start serving on background threads. */
+mock_server_t *mock_server_start(const mock_server_config_t *config);
+
+/** Port the server is listening on. */
+int mock_server_port(mock_server_t *server);
+
+/**
+ * When update id is generated, in microseconds of CLOCK_MONOTONIC, to measure
+ * how long it took to reach the bot.
+ */
+unsigned long mock_server_update_time(mock_server_t *server, unsigned long id);
+
+/**
+ * True on the threads of the server, so that an in-process benchmark can
+ * leave the work of the server out of its measurements.
+ */
+bool mock_server_thread(void);
+
+/** Counters of the server so far. */
+void mock_server_get_stats(mock_server_t *server, mock_server_stats_t *stats);
+
+/** Stop the server threads and close every connection. */
+void mock_server_stop(mock_server_t *server);
+
+#endif /* __MOCK_SERVER_H__ */
@@ -0,0 +1,308 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Times the update parsers in isolation on a corpus of recorded getUpdates
+ * responses, one JSON body per file. Every file is parsed in a tight loop by
+ * each of the parsers:
+ *
+ *   json-c    telebot_parser_str_to_obj() and telebot_parser_get_updates()
+ *   copy      telebot_parser_parse_updates(), strings copied to the arena
+ *   in-place  telebot_parser_parse_updates() with zero copy, on a fresh copy
+ *             of the body each time, the copy included in the time
+ *   stream    telebot_parser_stream_feed() in 16 KB chunks
+ *
+ * and ns/update, MB/s of JSON, malloc calls and arena bytes per update are
+ * reported. The arena is cleared between iterations, as the polling thread
+ * does between batches.
+ *
+ * Usage: parser-bench [-t seconds] [corpus directory or files...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <json.h>
+
+#include <telebot-common.h>
+#include <telebot-api.h>
+#include <telebot-parser.h>
+
+#define BENCH_CHUNK_SIZE (16 * 1024)
+#define BENCH_ARENA_SIZE (16 * 1024 * 1024)
+#define BENCH_FILES_MAX 256
+
+struct corpus_file {
+    char name[64];
+    char *data;
+    size_t size;
+};
+
+typedef telebot_error_e (*parse_f)(const struct corpus_file *file,
+        char *scratch, telebot_linear_allocator_t *allocator, int *count);
+
+/*
+ * Allocation counter. The definitions below take precedence over the ones of
+ * the C library, for json-c as well.
+ */
+static atomic_ulong alloc_blocks;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    alloc_blocks++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    alloc_blocks++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    alloc_blocks++;
+    return __libc_realloc(ptr, size);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static telebot_error_e parse_json_c(const struct corpus_file *file,
+        char *scratch, telebot_linear_allocator_t *allocator, int *count)
+{
+    telebot_update_t *updates;
+    struct json_object *obj = telebot_parser_str_to_obj(file->data);
+    if (obj == NULL)
+        return TELEBOT_ERROR_OPERATION_FAILED;
+
+    struct json_object *result;
+    telebot_error_e ret = TELEBOT_ERROR_OPERATION_FAILED;
+    if (json_object_object_get_ex(obj, "result", &result))
+        ret = telebot_parser_get_updates(result, &updates, count, allocator);
+    json_object_put(obj);
+
+    return ret;
+}
+
+static telebot_error_e parse_copy(const struct corpus_file *file,
+        char *scratch, telebot_linear_allocator_t *allocator, int *count)
+{
+    telebot_update_t *updates;
+    return telebot_parser_parse_updates(file->data, file->size, false,
+            &updates, count, allocator);
+}
+
+static telebot_error_e parse_in_place(const struct corpus_file *file,
+        char *scratch, telebot_linear_allocator_t *allocator, int *count)
+{
+    telebot_update_t *updates;
+    memcpy(scratch, file->data, file->size + 1);
+    return telebot_parser_parse_updates(scratch, file->size, true, &updates,
+            count, allocator);
+}
+
+static telebot_error_e parse_stream(const struct corpus_file *file,
+        char *scratch, telebot_linear_allocator_t *allocator, int *count)
+{
+    telebot_update_t *updates;
+    telebot_stream_parser_t *parser = telebot_parser_stream_create(allocator);
+    if (parser == NULL)
+        return TELEBOT_ERROR_OUT_OF_MEMORY;
+
+    size_t offset;
+    for (offset = 0; offset < file->size; offset += BENCH_CHUNK_SIZE) {
+        size_t size = file->size - offset;
+        if (size > BENCH_CHUNK_SIZE)
+            size = BENCH_CHUNK_SIZE;
+        if (telebot_parser_stream_feed(parser, file->data + offset, size) !=
+                TELEBOT_ERROR_NONE)
+            break;
+    }
+
+    return telebot_parser_stream_finish(parser, &updates, count);
+}
+
+static const struct {
+    const char *name;
+    parse_f parse;
+} parsers[] = {
+    { "json-c", parse_json_c },
+    { "copy", parse_copy },
+    { "in-place", parse_in_place },
+    { "stream", parse_stream },
+};
+
+static int bench(const struct corpus_file *file, const char *name,
+        parse_f parse, double seconds)
+{
+    telebot_linear_allocator_t allocator =
+        telebot_linear_allocator_create(BENCH_ARENA_SIZE);
+    char *scratch = malloc(file->size + 1);
+    int count = 0;
+
+    /* One warm-up pass, which also checks the file parses at all */
+    if ((parse(file, scratch, &allocator, &count) != TELEBOT_ERROR_NONE) ||
+            (count == 0)) {
+        printf("%-16s %-9s failed to parse\n", file->name, name);
+        telebot_linear_allocator_destroy(&allocator);
+        free(scratch);
+        return -1;
+    }
+    size_t arena = allocator.used;
+    telebot_linear_allocator_zero_all(&allocator);
+
+    unsigned long iterations = 0;
+    unsigned long blocks = alloc_blocks;
+    double start = now_ns(), elapsed;
+    do {
+        parse(file, scratch, &allocator, &count);
+        telebot_linear_allocator_zero_all(&allocator);
+        iterations++;
+        elapsed = now_ns() - start;
+    } while (elapsed < seconds * 1e9);
+    blocks = alloc_blocks - blocks;
+
+    unsigned long updates = iterations * count;
+    printf("%-16s %-9s %5d updates %9.0f ns/update %8.1f MB/s "
+            "%7.1f allocs/update %7.0f arena B/update\n", file->name, name,
+            count, elapsed / updates,
+            iterations * file->size / (elapsed / 1e9) / 1e6,
+            (double)blocks / updates, (double)arena / count);
+
+    telebot_linear_allocator_destroy(&allocator);
+    free(scratch);
+
+    return 0;
+}
+
+static int load_file(const char *path, struct corpus_file *file)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    file->data = malloc(size + 1);
+    if ((file->data == NULL) ||
+            (fread(file->data, 1, size, fp) != (size_t)size)) {
+        printf("Failed to read %s\n", path);
+        fclose(fp);
+        free(file->data);
+        return -1;
+    }
+    fclose(fp);
+    file->data[size] = '\0';
+    file->size = size;
+
+    const char *name = strrchr(path, '/');
+    snprintf(file->name, sizeof(file->name), "%s", name ? name + 1 : path);
+    char *dot = strrchr(file->name, '.');
+    if (dot != NULL)
+        *dot = '\0';
+
+    return 0;
+}
+
+static int compare_files(const void *a, const void *b)
+{
+    return strcmp(((const struct corpus_file *)a)->name,
+            ((const struct corpus_file *)b)->name);
+}
+
+/* Loads every .json file of a directory, or the path itself if it is none */
+static int load_corpus(const char *path, struct corpus_file *files, int count)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return (load_file(path, &files[count]) == 0) ? count + 1 : -1;
+
+    struct dirent *entry;
+    while (((entry = readdir(dir)) != NULL) && (count < BENCH_FILES_MAX)) {
+        size_t len = strlen(entry->d_name);
+        if ((len < 5) || (strcmp(entry->d_name + len - 5, ".json") != 0))
+            continue;
+
+        char file_path[4096];
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, entry->d_name);
+        if (load_file(file_path, &files[count]) == 0)
+            count++;
+    }
+    closedir(dir);
+
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    double seconds = 0.5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:h")) != -1) {
+        switch (opt) {
+        case 't': seconds = atof(optarg); break;
+        default:
+            printf("Usage: %s [-t seconds] [corpus directory or files...]\n",
+                    argv[0]);
+            return (opt == 'h') ? 0 : -1;
+        }
+    }
+
+    static struct corpus_file files[BENCH_FILES_MAX];
+    int count = 0, arg;
+    if (optind >= argc)
+        count = load_corpus(PARSER_BENCH_CORPUS, files, 0);
+    for (arg = optind; (arg < argc) && (count >= 0); arg++)
+        count = load_corpus(argv[arg], files, count);
+    if (count <= 0) {
+        printf("No corpus files found\n");
+        return -1;
+    }
+    qsort(files, count, sizeof(struct corpus_file), compare_files);
+
+    int ret = 0, index, parser;
+    for (index = 0; index < count; index++) {
+        for (parser = 0; parser < sizeof(parsers) / sizeof(parsers[0]);
+                parser++) {
+            if (bench(&files[index], parsers[parser].name,
+                        parsers[parser].parse, seconds) != 0)
+                ret = -1;
+        }
+        free(files[index].data);
+    }
+
+    return ret;
+}
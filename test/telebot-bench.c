@@ -0,0 +1,417 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * End-to-end scenarios of the high-level API against the in-process mock Bot
+ * API server, so that they run offline and reproducibly:
+ *
+ *   parse      updates generated at a fixed rate are polled and parsed,
+ *              latency is from generation to the update callback
+ *   echo       every update is answered with sendMessage from its callback,
+ *              latency is from generation to the answer
+ *   broadcast  one message to each of many chats from several threads,
+ *              latency is per sendMessage
+ *   download   getFile and download of a small file from several threads,
+ *              latency is per file
+ *
+ * Besides throughput and latency percentiles, every scenario reports the
+ * bytes and blocks allocated through malloc, calloc and realloc while it ran,
+ * and the resident set size of the process at its end.
+ *
+ * Usage: telebot-bench [-n count] [-r rate] [-t threads] [-l ms] [scenario...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include <telebot-common.h>
+#include <telebot-core-api.h>
+#include <telebot-api.h>
+
+#include "mock-server.h"
+
+#define BENCH_TOKEN "1:bench"
+
+struct bench_options {
+    unsigned long count; /* 0 for the default of the scenario */
+    unsigned int rate;
+    int threads;
+    unsigned int latency_us;
+};
+
+struct bench_samples {
+    double *latency;
+    unsigned long capacity;
+    atomic_ulong count;
+    atomic_ulong failed;
+};
+
+struct bench_run {
+    mock_server_t *server;
+    telebot_h *bot;
+    struct bench_samples samples;
+    unsigned long total;
+    atomic_ulong next; /* Work items handed out to threads */
+    double last; /* Completion of the last update */
+};
+
+struct bench_scenario {
+    const char *name;
+    unsigned long count; /* Default number of operations */
+    int (*run)(struct bench_run *run, const struct bench_options *options);
+};
+
+/*
+ * Allocation counters. The definitions below take precedence over the ones
+ * of the C library for the whole process, the library and its dependencies
+ * included. Blocks allocated by the mock server threads are not counted.
+ */
+static atomic_ulong alloc_bytes;
+static atomic_ulong alloc_blocks;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static void count_alloc(size_t size)
+{
+    if (mock_server_thread())
+        return;
+
+    alloc_bytes += size;
+    alloc_blocks++;
+}
+
+void *malloc(size_t size)
+{
+    count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    count_alloc(nmemb * size);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count_alloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static long rss_kb(void)
+{
+    long pages = 0, resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == NULL)
+        return 0;
+    if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(file);
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Returns how many samples were recorded, this one included */
+static unsigned long record(struct bench_samples *samples, double latency,
+        bool failed)
+{
+    unsigned long index = samples->count++;
+    if (index < samples->capacity)
+        samples->latency[index] = latency;
+    if (failed)
+        samples->failed++;
+
+    return index + 1;
+}
+
+static double percentile(const double *latency, unsigned long count, double p)
+{
+    if (count == 0)
+        return 0;
+
+    unsigned long index = count * p;
+    return latency[(index < count) ? index : count - 1];
+}
+
+/* Runs fn on options->threads threads and waits for all of them */
+static void run_threads(struct bench_run *run,
+        const struct bench_options *options, void *(*fn)(void *))
+{
+    pthread_t *threads = calloc(options->threads, sizeof(pthread_t));
+    int index;
+    for (index = 0; index < options->threads; index++)
+        pthread_create(&threads[index], NULL, fn, run);
+    for (index = 0; index < options->threads; index++)
+        pthread_join(threads[index], NULL);
+    free(threads);
+}
+
+static void update_cb(telebot_h *bot, const telebot_update_t *update,
+        void *user_data)
+{
+    struct bench_run *run = user_data;
+    double generated = mock_server_update_time(run->server, update->update_id);
+    double now = now_us();
+
+    if (record(&(run->samples), now - generated,
+                update->update_type != UPDATE_TYPE_MESSAGE) == run->total)
+        run->last = now;
+}
+
+static void echo_cb(telebot_h *bot, const telebot_update_t *update,
+        void *user_data)
+{
+    struct bench_run *run = user_data;
+    double generated = mock_server_update_time(run->server, update->update_id);
+
+    telebot_error_e ret = telebot_send_message(bot,
+            update->message.chat.id, "echo", "", false,
+            update->message.message_id, "");
+
+    double now = now_us();
+    if (record(&(run->samples), now - generated,
+                ret != TELEBOT_ERROR_NONE) == run->total)
+        run->last = now;
+}
+
+/* Polls until total updates were handled */
+static int run_polling(struct bench_run *run, telebot_update_cb_f cb)
+{
+    pthread_t thread;
+    if (telebot_start(run->bot, cb, run, false, &thread) !=
+            TELEBOT_ERROR_NONE)
+        return -1;
+
+    while (run->samples.count < run->total)
+        usleep(1000);
+
+    telebot_stop(run->bot);
+    pthread_join(thread, NULL);
+
+    return 0;
+}
+
+static int bench_parse(struct bench_run *run,
+        const struct bench_options *options)
+{
+    return run_polling(run, update_cb);
+}
+
+static int bench_echo(struct bench_run *run,
+        const struct bench_options *options)
+{
+    return run_polling(run, echo_cb);
+}
+
+static void *broadcast_thread(void *data)
+{
+    struct bench_run *run = data;
+    unsigned long chat;
+
+    while ((chat = run->next++) < run->total) {
+        double start = now_us();
+        telebot_error_e ret = telebot_send_message(run->bot,
+                1000000 + (long long)chat, "broadcast", "", false, 0, "");
+        record(&(run->samples), now_us() - start, ret != TELEBOT_ERROR_NONE);
+    }
+
+    return NULL;
+}
+
+static int bench_broadcast(struct bench_run *run,
+        const struct bench_options *options)
+{
+    run_threads(run, options, broadcast_thread);
+    return 0;
+}
+
+static void *download_thread(void *data)
+{
+    struct bench_run *run = data;
+    char path[64];
+
+    snprintf(path, sizeof(path), "/tmp/telebot-bench-%d-%lu",
+            (int)getpid(), (unsigned long)pthread_self());
+    while (run->next++ < run->total) {
+        double start = now_us();
+        telebot_error_e ret = telebot_download_file(run->bot, "bench", path);
+        record(&(run->samples), now_us() - start, ret != TELEBOT_ERROR_NONE);
+    }
+    unlink(path);
+
+    return NULL;
+}
+
+static int bench_download(struct bench_run *run,
+        const struct bench_options *options)
+{
+    run_threads(run, options, download_thread);
+    return 0;
+}
+
+static const struct bench_scenario scenarios[] = {
+    { "parse", 100000, bench_parse },
+    { "echo", 20000, bench_echo },
+    { "broadcast", 10000, bench_broadcast },
+    { "download", 5000, bench_download },
+};
+
+static int bench(const struct bench_scenario *scenario,
+        const struct bench_options *options)
+{
+    struct bench_run run = {0};
+    run.total = (options->count > 0) ? options->count : scenario->count;
+    run.samples.capacity = run.total;
+    run.samples.latency = calloc(run.total, sizeof(double));
+
+    /* Updates only for the polling scenarios, chats for the broadcast */
+    mock_server_config_t config;
+    mock_server_config_init(&config);
+    config.latency_us = options->latency_us;
+    if ((scenario->run == bench_parse) || (scenario->run == bench_echo)) {
+        config.updates = run.total;
+        config.update_rate = options->rate;
+    }
+
+    unsigned long bytes = alloc_bytes, blocks = alloc_blocks;
+    double start = now_us();
+
+    run.server = mock_server_start(&config);
+    if (run.server == NULL)
+        return -1;
+
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d",
+            mock_server_port(run.server));
+    telebot_core_options_t core_options = { .api_url = url };
+    if (telebot_create_with_options(&(run.bot), BENCH_TOKEN, &core_options) !=
+            TELEBOT_ERROR_NONE) {
+        printf("Failed to create bot\n");
+        mock_server_stop(run.server);
+        return -1;
+    }
+    telebot_set_rate_limit(run.bot, 0, 0, 0, 0);
+    telebot_set_polling_timeout(run.bot, 1);
+
+    int ret = scenario->run(&run, options);
+    double elapsed = ((run.last > 0) ? run.last : now_us()) - start;
+
+    telebot_destroy(run.bot);
+    mock_server_stop(run.server);
+
+    bytes = alloc_bytes - bytes;
+    blocks = alloc_blocks - blocks;
+    unsigned long count = run.samples.count;
+    if (count > run.samples.capacity)
+        count = run.samples.capacity;
+    qsort(run.samples.latency, count, sizeof(double), compare_double);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%-10s %8lu ops %9.0f ops/s  p50 %8.0f us  p99 %8.0f us  "
+            "p999 %8.0f us  failed %lu\n"
+            "%-10s %8.1f MB allocated in %lu blocks (%.0f B/op)  "
+            "rss %ld KB  peak %ld KB\n", scenario->name, count,
+            count / (elapsed / 1e6),
+            percentile(run.samples.latency, count, 0.5),
+            percentile(run.samples.latency, count, 0.99),
+            percentile(run.samples.latency, count, 0.999),
+            (unsigned long)run.samples.failed, "",
+            bytes / 1e6, blocks, count ? (double)bytes / count : 0.0,
+            rss_kb(), usage.ru_maxrss);
+
+    free(run.samples.latency);
+
+    return ((ret == 0) && (run.samples.failed == 0)) ? 0 : -1;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-n count] [-r rate] [-t threads] [-l ms] "
+            "[scenario...]\n"
+            "  -n count    operations per scenario, default per scenario\n"
+            "  -r rate     updates generated per second, default 20000\n"
+            "  -t threads  sending threads, default 8\n"
+            "  -l ms       latency of the mock server, default 0\n"
+            "Scenarios: parse echo broadcast download, default all\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_options options = { .rate = 20000, .threads = 8 };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:t:l:h")) != -1) {
+        switch (opt) {
+        case 'n': options.count = strtoul(optarg, NULL, 10); break;
+        case 'r': options.rate = atoi(optarg); break;
+        case 't': options.threads = atoi(optarg); break;
+        case 'l': options.latency_us = atof(optarg) * 1000; break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : -1;
+        }
+    }
+
+    if (options.threads <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int count = sizeof(scenarios) / sizeof(scenarios[0]);
+    int ret = 0, index;
+    for (index = 0; index < count; index++) {
+        bool selected = (optind >= argc);
+        int arg;
+        for (arg = optind; arg < argc; arg++) {
+            if (strcmp(argv[arg], scenarios[index].name) == 0)
+                selected = true;
+        }
+
+        if (selected && (bench(&scenarios[index], &options) != 0))
+            ret = -1;
+    }
+
+    return ret;
+}
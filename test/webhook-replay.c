@@ -0,0 +1,217 @@
+/*
+ * telebot
+ *
+ * Copyright (c) 2015 Elmurod Talipov.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays recorded update payloads, one JSON update per line, against a
+ * webhook the way Telegram posts them: one POST per update over a keep-alive
+ * connection, the next one only after the previous was answered. Without a
+ * url, the payloads go to the embedded webhook server of a local bot, and the
+ * updates it handled are checked against the ones sent.
+ *
+ * Usage: webhook-replay <payloads> [rounds] [url]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <curl/curl.h>
+
+#include <telebot-common.h>
+#include <telebot-api.h>
+
+struct replay_check {
+    pthread_mutex_t lock;
+    unsigned long handled;
+    unsigned long messages;
+    unsigned long callback_queries;
+};
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static size_t discard_cb(void *contents, size_t size, size_t nmemb,
+        void *userp)
+{
+    return size * nmemb;
+}
+
+static void update_cb(telebot_h *bot, const telebot_update_t *update,
+        void *user_data)
+{
+    struct replay_check *check = user_data;
+
+    pthread_mutex_lock(&(check->lock));
+    check->handled++;
+    if ((update->update_type == UPDATE_TYPE_MESSAGE) &&
+            (update->message.message_id != 0))
+        check->messages++;
+    else if (update->update_type == UPDATE_TYPE_CALLBACK_QUERY)
+        check->callback_queries++;
+    pthread_mutex_unlock(&(check->lock));
+}
+
+/* Splits the file in place, one payload per non-empty line */
+static int load_payloads(const char *path, char **data, char ***payloads)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    *data = malloc(size + 1);
+    *payloads = calloc(size / 2 + 1, sizeof(char *));
+    if ((*data == NULL) || (*payloads == NULL) ||
+            (fread(*data, 1, size, file) != (size_t)size)) {
+        printf("Failed to read %s\n", path);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    (*data)[size] = '\0';
+
+    int count = 0;
+    char *line = strtok(*data, "\r\n");
+    while (line != NULL) {
+        (*payloads)[count++] = line;
+        line = strtok(NULL, "\r\n");
+    }
+
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        printf("Usage: %s <payloads> [rounds] [url]\n", argv[0]);
+        return -1;
+    }
+
+    int rounds = (argc > 2) ? atoi(argv[2]) : 100;
+    const char *target = (argc > 3) ? argv[3] : NULL;
+    if (rounds <= 0) {
+        printf("Usage: %s <payloads> [rounds] [url]\n", argv[0]);
+        return -1;
+    }
+
+    char *data;
+    char **payloads;
+    int count = load_payloads(argv[1], &data, &payloads);
+    if (count <= 0)
+        return -1;
+
+    struct replay_check check = {0};
+    pthread_mutex_init(&(check.lock), NULL);
+    telebot_h *bot = NULL;
+    char url[128];
+
+    if (target == NULL) {
+        int port;
+        if ((telebot_create(&bot, "replay") != TELEBOT_ERROR_NONE) ||
+                (telebot_start_webhook(bot, 0, "/replay", update_cb,
+                                       &check) != TELEBOT_ERROR_NONE) ||
+                (telebot_get_webhook_port(bot, &port) != TELEBOT_ERROR_NONE)) {
+            printf("Failed to start webhook\n");
+            return -1;
+        }
+        snprintf(url, sizeof(url), "http://127.0.0.1:%d/replay", port);
+        target = url;
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    CURL *curl_h = curl_easy_init();
+    struct curl_slist *headers = curl_slist_append(NULL,
+            "Content-Type: application/json");
+    curl_easy_setopt(curl_h, CURLOPT_URL, target);
+    curl_easy_setopt(curl_h, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl_h, CURLOPT_WRITEFUNCTION, discard_cb);
+    curl_easy_setopt(curl_h, CURLOPT_TCP_NODELAY, 1L);
+
+    unsigned long total = (unsigned long)count * rounds;
+    double *latency = calloc(total, sizeof(double));
+    unsigned long sent = 0, failed = 0;
+    size_t bytes = 0;
+
+    double start = now_us();
+    for (int round = 0; round < rounds; round++) {
+        for (int index = 0; index < count; index++) {
+            size_t size = strlen(payloads[index]);
+            curl_easy_setopt(curl_h, CURLOPT_POSTFIELDS, payloads[index]);
+            curl_easy_setopt(curl_h, CURLOPT_POSTFIELDSIZE, (long)size);
+
+            double begin = now_us();
+            CURLcode res = curl_easy_perform(curl_h);
+            long resp_code = 0;
+            curl_easy_getinfo(curl_h, CURLINFO_RESPONSE_CODE, &resp_code);
+            latency[sent++] = now_us() - begin;
+            bytes += size;
+            if ((res != CURLE_OK) || (resp_code != 200))
+                failed++;
+        }
+    }
+    double elapsed = now_us() - start;
+
+    long connections = 0;
+    curl_easy_getinfo(curl_h, CURLINFO_NUM_CONNECTS, &connections);
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl_h);
+    curl_global_cleanup();
+
+    qsort(latency, sent, sizeof(double), compare_double);
+    printf("%lu updates (%d payloads x %d), %.0f updates/s, %.1f MB/s\n",
+            sent, count, rounds, sent / (elapsed / 1e6),
+            bytes / elapsed);
+    printf("latency p50 %.0f us  p99 %.0f us  max %.0f us  failed %lu\n",
+            latency[sent / 2], latency[(unsigned long)(sent * 0.99)],
+            latency[sent - 1], failed);
+
+    int ret = (failed == 0) ? 0 : -1;
+    if (bot != NULL) {
+        telebot_stop(bot);
+        telebot_destroy(bot);
+
+        printf("handled %lu  messages %lu  callback queries %lu\n",
+                check.handled, check.messages, check.callback_queries);
+        if (check.handled != sent)
+            ret = -1;
+    }
+
+    pthread_mutex_destroy(&(check.lock));
+    free(latency);
+    free(payloads);
+    free(data);
+
+    return ret;
+}